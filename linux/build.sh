@@ -5,12 +5,18 @@ BUILD_DIR=$(dirname "$0")"/build"
 
 printUsage() {
 	echo "Builds GBEmu for Linux. By default, the 'release' build is built."
-	echo "Usage $0 [help | release | profile | debug | test]"
+	echo "Usage $0 [help | release | profile | debug | test | gbs | headless | batch | compare | libgbemu | bench]"
 	echo -e "\thelp -- Prints this help message."
 	echo -e "\trelease -- Builds release build."
 	echo -e "\tprofile -- Builds GBEmu where the profiler enabled and is accessible in the GBEmu debugger."
 	echo -e "\tdebug -- Builds debuggable build."
 	echo -e "\ttest -- Runs unit tests."
+	echo -e "\tgbs -- Builds the command line GBS music renderer."
+	echo -e "\theadless -- Builds the command line runner, which needs no display or audio device."
+	echo -e "\tbatch -- Builds the command line runner for a manifest of ROMs, run on every CPU core."
+	echo -e "\tcompare -- Builds the command line comparator, which checks a build of the core against another."
+	echo -e "\tlibgbemu -- Builds the emulator core as a static and a shared library with a C API."
+	echo -e "\tbench -- Builds and runs the core benchmarks, writing the results to bench_results.json next to this script."
         echo -e "\tclean -- Cleans the build directory."
 } 
 if [[ $1 == "help" ]]; then
@@ -24,7 +30,15 @@ else
            exit 1
        fi
     elif make $TARGET; then
-        echo "Success! App located at $BUILD_DIR/gbemu"
+        if [[ $TARGET == "gbs" || $TARGET == "headless" || $TARGET == "batch" || $TARGET == "compare" ]]; then
+            echo "Success! App located at $BUILD_DIR/$TARGET"
+        elif [[ $TARGET == "libgbemu" ]]; then
+            echo "Success! Libraries located at $BUILD_DIR/libgbemu.a and $BUILD_DIR/libgbemu.so"
+        elif [[ $TARGET == "bench" ]]; then
+            echo "Success! Results located at bench_results.json"
+        else
+            echo "Success! App located at $BUILD_DIR/gbemu"
+        fi
     else
         echo 'Build error!'
     fi
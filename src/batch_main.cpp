@@ -0,0 +1,694 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Batch runner.  Runs every job in a manifest, one Game Boy per thread, and writes what each one did to
+//a JSON report: its final state hash (and every frame's, if asked for), how long it took and whether it failed.
+//Jobs are timed in their thread's CPU time, so a job waiting for a core while others run isn't counted as slower.
+//
+//Manifest: one job per line, "rom frames [input]".  The input is a movie if it ends in .gbm, and an input
+//script (see headless.cpp) otherwise.  A frames of 0 plays a whole movie.  Lines starting with # are comments.
+//  roms/tetris.gb 600
+//  roms/zelda.gb 3000 scripts/zelda.txt
+//  roms/zelda.gb 0 movies/zelda.gbm
+//
+//With -T, the ROMs are test ROMs.  Each one stops as soon as it reports a result (see testROMResult()), and fails
+//if it reports a failure or runs out of frames first.
+//
+//With -G, each job is checked against its golden file, the job's input (or its ROM, if it has none) with .golden on
+//the end, and fails at the first hash that differs.  -U writes them instead.  A golden file has a line per
+//checkpoint, every -n frames and on the last frame run: the frame, its state hash and its screen's hash.
+//  59 1f0c3a9e27d6b4a1 8e2b77c1f0a3d5e9
+//
+//The exit code is 1 if any job failed, or with -c, if any job got slower than in an earlier report.
+
+#define CO_IMPL
+#include "common.h"
+#define GB_IMPL
+#include "gbemu.cpp"
+#include "headless.cpp"
+#include "testrom.cpp"
+
+#define DEFAULT_REPORT_PATH "batch_report.json"
+#define BATCH_GENERAL_MEMORY_SIZE MB(1)
+#define MAX_BATCH_ERROR_LEN 128
+#define GOLDEN_FILE_EXTENSION ".golden"
+#define DEFAULT_GOLDEN_INTERVAL 60
+#define DEFAULT_REGRESSION_PERCENT 10.
+
+enum class GoldenMode {
+    None, Check, Update
+};
+
+struct GoldenHash {
+    i64 frame;
+    u64 stateHash;
+    u64 screenHash;
+};
+
+struct BatchJob {
+    char romPath[MAX_PATH_LEN + 1];
+    char inputPath[MAX_PATH_LEN + 1]; //empty for none
+    i64 numFrames;
+
+    bool didSucceed;
+    char error[MAX_BATCH_ERROR_LEN];
+    i64 numFramesRun;
+    i64 numCycles;
+    TimeUS cpuTime;
+    u64 finalHash;
+    u64 *frameHashes; //buf_malloc, if asked for
+    TestROMResult testROMResult;
+    char *serialOutput; //buf_malloc, null terminated
+
+    char goldenPath[MAX_PATH_LEN + 1];
+    GoldenHash *goldenHashes; //buf_malloc.  Read from the golden file, or made for it
+    i64 nextGoldenHash;
+    double baselineFramesPerSecond; //0 if it's not in the baseline
+};
+
+struct BatchQueue {
+    bool shouldRecordFrameHashes;
+    bool areTestROMs;
+    GoldenMode goldenMode;
+    i64 goldenInterval;
+
+    BatchJob *jobs;
+    i64 numJobs;
+    i64 nextJob;
+    Mutex *mutex;
+    ROMCache romCache; //so jobs running the same ROM at once share one copy of it
+};
+
+struct BatchWorker {
+    BatchQueue *queue;
+    //carved out before the workers start, since making memory stacks is not thread safe
+    MemoryStack generalMemory;
+    MemoryStack fileMemory;
+};
+
+static bool isMoviePath(const char *path, i64 len) {
+    i64 extensionLen = stringLength("." MOVIE_FILE_EXTENSION);
+    return len > extensionLen && areStringsEqual(path + len - extensionLen, "." MOVIE_FILE_EXTENSION, extensionLen);
+}
+
+//returns a buf_malloc buffer of checkpoints in frame order, or nullptr and says why
+static GoldenHash *readGoldenFile(const char *path, MemoryStack *fileMemory, char *outError) {
+    auto fileResult = readEntireFile(path, fileMemory);
+    if (fileResult.resultCode != FileSystemResultCode::OK) {
+        copyString("Could not read its golden file.  -U makes it.", outError, MAX_BATCH_ERROR_LEN - 1);
+        return nullptr;
+    }
+    GoldenHash *ret = nullptr;
+    i64 lineNumber = 1;
+    const char *c = (const char*)fileResult.data, *end = c + fileResult.size;
+    while (c < end) {
+        const char *lineEnd = c;
+        while (lineEnd < end && *lineEnd != '\n') {
+            lineEnd++;
+        }
+        while (c < lineEnd && isspace(*c)) {
+            c++;
+        }
+        if (c < lineEnd && *c != '#') {
+            GoldenHash hash;
+            char *frameEnd, *stateHashEnd, *screenHashEnd;
+            hash.frame = strtoll(c, &frameEnd, 10);
+            hash.stateHash = strtoull(frameEnd, &stateHashEnd, 16);
+            hash.screenHash = strtoull(stateHashEnd, &screenHashEnd, 16);
+            bool isInOrder = buf_len(ret) == 0 || hash.frame > ret[buf_len(ret) - 1].frame;
+            if (frameEnd == c || stateHashEnd == frameEnd || screenHashEnd == stateHashEnd ||
+                screenHashEnd > lineEnd || !isInOrder) {
+                snprintf(outError, MAX_BATCH_ERROR_LEN, "Line %" PRId64 " of its golden file is not \"frame hash hash\".", lineNumber);
+                buf_malloc_free(ret);
+                ret = nullptr;
+                break;
+            }
+            buf_malloc_push(ret, hash);
+        }
+        c = lineEnd + 1;
+        lineNumber++;
+    }
+    freeFileBuffer(&fileResult, fileMemory);
+    if (!ret && !outError[0]) {
+        copyString("Its golden file is empty.", outError, MAX_BATCH_ERROR_LEN - 1);
+    }
+    return ret;
+}
+
+static FileSystemResultCode writeGoldenFile(const GoldenHash *hashes, const char *path) {
+    char *text = nullptr;
+    buf_malloc_printf(text, "# GBEmu golden hashes: frame, state hash, screen hash\n");
+    for (isize i = 0; i < (isize)buf_len(hashes); i++) {
+        buf_malloc_printf(text, "%" PRId64 " %016" PRIx64 " %016" PRIx64 "\n", hashes[i].frame, hashes[i].stateHash, hashes[i].screenHash);
+    }
+    auto ret = writeDataToFile(text, (isize)buf_len(text), path);
+    buf_malloc_free(text);
+    return ret;
+}
+
+static GoldenHash goldenHash(i64 frame, HeadlessGameBoy *gb) {
+    GoldenHash ret;
+    ret.frame = frame;
+    ret.stateHash = hashGameBoyState(gb->cpu, gb->mmu, &gb->stateHasher);
+    ret.screenHash = hashMemory(gb->mmu->lcd.screen, SCREEN_WIDTH * SCREEN_HEIGHT * (i64)sizeof(PaletteColor));
+    return ret;
+}
+
+//Called after every frame.  Returns false, and says why in job->error, at the first checkpoint that differs from the golden
+static bool checkpointGolden(i64 frame, HeadlessGameBoy *gb, BatchJob *job, const BatchQueue *queue) {
+    if (queue->goldenMode == GoldenMode::Update) {
+        if ((frame + 1) % queue->goldenInterval == 0) {
+            buf_malloc_push(job->goldenHashes, goldenHash(frame, gb));
+        }
+        return true;
+    }
+    if (job->nextGoldenHash == (i64)buf_len(job->goldenHashes) || job->goldenHashes[job->nextGoldenHash].frame != frame) {
+        return true;
+    }
+    const GoldenHash *golden = &job->goldenHashes[job->nextGoldenHash++];
+    GoldenHash hash = goldenHash(frame, gb);
+    if (hash.stateHash != golden->stateHash) {
+        snprintf(job->error, MAX_BATCH_ERROR_LEN, "Frame %" PRId64 "'s state hash is %016" PRIx64 ", not the golden %016" PRIx64 ".",
+                 frame, hash.stateHash, golden->stateHash);
+        return false;
+    }
+    if (hash.screenHash != golden->screenHash) {
+        snprintf(job->error, MAX_BATCH_ERROR_LEN, "Frame %" PRId64 "'s screen hash is %016" PRIx64 ", not the golden %016" PRIx64 ".",
+                 frame, hash.screenHash, golden->screenHash);
+        return false;
+    }
+    return true;
+}
+
+static void runBatchJob(BatchJob *job, BatchQueue *queue, MemoryStack fileMemory) {
+    TimeUS startTime = threadCPUTimeInMicroseconds();
+    InputScriptLine *script = nullptr;
+    HeadlessGameBoy gb;
+    const char *error = initHeadlessGameBoy(job->romPath, nullptr, 0, fileMemory, &queue->romCache, &gb);
+    if (error) {
+        copyString(error, job->error, MAX_BATCH_ERROR_LEN - 1);
+        return;
+    }
+
+    i64 numFrames = job->numFrames;
+    Movie *movie = &gb.programState->movie;
+    if (isMoviePath(job->inputPath, stringLength(job->inputPath))) {
+        if (!startMoviePlayback(job->inputPath, gb.cpu, gb.mmu, gb.gbDebug, gb.programState)) {
+            copyString("Could not play the movie.", job->error, MAX_BATCH_ERROR_LEN - 1);
+            freeHeadlessGameBoy(&gb);
+            return;
+        }
+        //stop before runFrame() finishes the movie, which puts back the state from before it
+        i64 movieLen = (i64)buf_len(movie->inputs);
+        if (numFrames == 0 || numFrames > movieLen) {
+            numFrames = movieLen;
+        }
+    }
+    else if (job->inputPath[0]) {
+        script = readInputScript(job->inputPath, &gb.programState->fileMemory);
+        if (!script) {
+            copyString("Could not read the input script.", job->error, MAX_BATCH_ERROR_LEN - 1);
+            freeHeadlessGameBoy(&gb);
+            return;
+        }
+        gb.script = script;
+    }
+
+    if (queue->goldenMode == GoldenMode::Check) {
+        job->goldenHashes = readGoldenFile(job->goldenPath, &gb.programState->fileMemory, job->error);
+        if (!job->goldenHashes) {
+            freeHeadlessGameBoy(&gb);
+            buf_malloc_free(script);
+            return;
+        }
+    }
+
+    char notification[MAX_NOTIFICATION_LEN + 1];
+    bool didHitIllegalOpcode = false;
+    bool didMatchGolden = true;
+    i64 frame = 0;
+    for (; frame < numFrames && !didHitIllegalOpcode && didMatchGolden; frame++) {
+        didHitIllegalOpcode = !runHeadlessFrame(frame, &gb);
+        while (popNotification(&gb.programState->notifications, notification))
+            ;
+        clear(&gb.mmu->host->soundFramesBuffer);
+        if (queue->shouldRecordFrameHashes) {
+            buf_malloc_push(job->frameHashes, hashGameBoyState(gb.cpu, gb.mmu, &gb.stateHasher));
+        }
+        if (queue->goldenMode != GoldenMode::None) {
+            didMatchGolden = checkpointGolden(frame, &gb, job, queue);
+        }
+        if (queue->areTestROMs) {
+            job->testROMResult = testROMResult(&gb);
+            if (job->testROMResult != TestROMResult::Running) {
+                frame++;
+                break;
+            }
+        }
+    }
+
+    //the last frame run is always a checkpoint, so a run that stops early or goes on too long is caught
+    i64 lastFrame = frame - 1;
+    i64 numGoldenHashes = (i64)buf_len(job->goldenHashes);
+    if (queue->goldenMode == GoldenMode::Update && lastFrame >= 0 &&
+        (numGoldenHashes == 0 || job->goldenHashes[numGoldenHashes - 1].frame != lastFrame)) {
+        buf_malloc_push(job->goldenHashes, goldenHash(lastFrame, &gb));
+    }
+    else if (queue->goldenMode == GoldenMode::Check && didMatchGolden) {
+        i64 lastGoldenFrame = job->goldenHashes[numGoldenHashes - 1].frame;
+        if (job->nextGoldenHash < numGoldenHashes) {
+            snprintf(job->error, MAX_BATCH_ERROR_LEN, "Stopped after frame %" PRId64 ", before the golden's frame %" PRId64 ".",
+                     lastFrame, job->goldenHashes[job->nextGoldenHash].frame);
+            didMatchGolden = false;
+        }
+        else if (lastGoldenFrame != lastFrame) {
+            snprintf(job->error, MAX_BATCH_ERROR_LEN, "Ran to frame %" PRId64 ", past the golden's last frame %" PRId64 ".",
+                     lastFrame, lastGoldenFrame);
+            didMatchGolden = false;
+        }
+    }
+
+    job->numFramesRun = frame;
+    job->numCycles = gb.cpu->totalCycles;
+    job->finalHash = hashGameBoyState(gb.cpu, gb.mmu, &gb.stateHasher);
+    const SerialOutput *serialOutput = &gb.mmu->host->serialOutput;
+    if (serialOutput->len > 0) {
+        buf_malloc_printf(job->serialOutput, "%.*s", (int)serialOutput->len, (const char*)serialOutput->data);
+    }
+    //a golden file mismatch has already said why
+    if (didMatchGolden) {
+        if (didHitIllegalOpcode) {
+            snprintf(job->error, MAX_BATCH_ERROR_LEN, "Hit an illegal opcode on frame %" PRId64 ".", frame - 1);
+        }
+        else if (movie->mode == MovieMode::Playing && movie->desyncFrame >= 0) {
+            snprintf(job->error, MAX_BATCH_ERROR_LEN, "Movie desynced at frame %" PRId64 ".", movie->desyncFrame);
+        }
+        else if (queue->areTestROMs && job->testROMResult == TestROMResult::Failed) {
+            copyString("Test ROM failed.", job->error, MAX_BATCH_ERROR_LEN - 1);
+        }
+        else if (queue->areTestROMs && job->testROMResult == TestROMResult::Running) {
+            copyString("Test ROM did not finish.", job->error, MAX_BATCH_ERROR_LEN - 1);
+        }
+        else if (queue->goldenMode == GoldenMode::Update &&
+                 writeGoldenFile(job->goldenHashes, job->goldenPath) != FileSystemResultCode::OK) {
+            copyString("Could not write its golden file.", job->error, MAX_BATCH_ERROR_LEN - 1);
+        }
+        else {
+            job->didSucceed = true;
+        }
+    }
+
+    freeHeadlessGameBoy(&gb);
+    buf_malloc_free(script);
+    job->cpuTime = threadCPUTimeInMicroseconds() - startTime;
+}
+
+static void batchWorker(void *arg) {
+    auto worker = (BatchWorker*)arg;
+    auto queue = worker->queue;
+    generalMemory = &worker->generalMemory;
+
+    for (;;) {
+        lockMutex(queue->mutex);
+        BatchJob *job = (queue->nextJob < queue->numJobs) ? &queue->jobs[queue->nextJob++] : nullptr;
+        unlockMutex(queue->mutex);
+        if (!job) {
+            break;
+        }
+        //each job starts with the worker's stacks empty
+        resetStack(&worker->generalMemory, false);
+        runBatchJob(job, queue, worker->fileMemory);
+    }
+}
+
+//returns a buf_malloc buffer of jobs, or nullptr and prints why
+static BatchJob *parseManifest(const char *text, i64 len, const char *path) {
+    BatchJob *ret = nullptr;
+    i64 lineNumber = 1;
+    const char *c = text, *end = text + len;
+    while (c < end) {
+        const char *lineEnd = c;
+        while (lineEnd < end && *lineEnd != '\n') {
+            lineEnd++;
+        }
+        const char *fields[3];
+        i64 fieldLens[3];
+        i64 numFields = 0;
+        while (c < lineEnd && isspace(*c)) {
+            c++;
+        }
+        if (c < lineEnd && *c != '#') {
+            while (c < lineEnd) {
+                const char *field = c;
+                while (c < lineEnd && !isspace(*c)) {
+                    c++;
+                }
+                if (numFields == ARRAY_LEN(fields) || c - field > MAX_PATH_LEN) {
+                    numFields = 0;
+                    break;
+                }
+                fields[numFields] = field;
+                fieldLens[numFields++] = c - field;
+                while (c < lineEnd && isspace(*c)) {
+                    c++;
+                }
+            }
+            char *numberEnd = nullptr;
+            i64 numFrames = (numFields >= 2) ? strtoll(fields[1], &numberEnd, 10) : -1;
+            bool isMovie = numFields == 3 && isMoviePath(fields[2], fieldLens[2]);
+            if (numFields < 2 || numberEnd != fields[1] + fieldLens[1] || numFrames < 0 || (numFrames == 0 && !isMovie)) {
+                PRINT_ERR("%s:%" PRId64 ": expected \"rom frames [input]\".", path, lineNumber);
+                buf_malloc_free(ret);
+                return nullptr;
+            }
+
+            buf_malloc_push(ret, BatchJob{});
+            BatchJob *job = &ret[buf_len(ret) - 1];
+            copyString(fields[0], job->romPath, fieldLens[0]);
+            if (numFields == 3) {
+                copyString(fields[2], job->inputPath, fieldLens[2]);
+            }
+            job->numFrames = numFrames;
+        }
+        c = lineEnd + 1;
+        lineNumber++;
+    }
+    return ret;
+}
+
+static void appendJSONString(char **json, const char *str) {
+    buf_malloc_printf(*json, "\"");
+    for (const char *c = str; *c; c++) {
+        switch (*c) {
+            case '"': buf_malloc_printf(*json, "\\\""); break;
+            case '\\': buf_malloc_printf(*json, "\\\\"); break;
+            default: {
+                if ((u8)*c < 0x20) {
+                    buf_malloc_printf(*json, "\\u%04x", (u8)*c);
+                }
+                else {
+                    buf_malloc_printf(*json, "%c", *c);
+                }
+            } break;
+        }
+    }
+    buf_malloc_printf(*json, "\"");
+}
+
+static double jobFramesPerSecond(const BatchJob *job) {
+    return (job->cpuTime > 0) ? (double)job->numFramesRun * 1000000. / (double)job->cpuTime : 0.;
+}
+
+//the start of a job's line in the report, which is how it's found in a baseline
+static void appendJobKey(char **json, const BatchJob *job) {
+    buf_malloc_printf(*json, "{\"rom\": ");
+    appendJSONString(json, job->romPath);
+    if (job->inputPath[0]) {
+        buf_malloc_printf(*json, ", \"input\": ");
+        appendJSONString(json, job->inputPath);
+    }
+    buf_malloc_printf(*json, ", \"succeeded\": ");
+}
+
+//a buf_malloc string
+static char *makeBatchReport(const BatchQueue *queue, i32 numWorkers, TimeUS elapsedTime, i64 numFailed) {
+    char *json = nullptr;
+    buf_malloc_printf(json, "{\n  \"threads\": %d,\n  \"seconds\": %.3f,\n", numWorkers, (double)elapsedTime / 1000000.);
+    buf_malloc_printf(json, "  \"numJobs\": %" PRId64 ",\n  \"numFailed\": %" PRId64 ",\n  \"jobs\": [", queue->numJobs, numFailed);
+    fori (queue->numJobs) {
+        const BatchJob *job = &queue->jobs[i];
+        buf_malloc_printf(json, "%s\n    ", (i > 0) ? "," : "");
+        appendJobKey(&json, job);
+        buf_malloc_printf(json, "%s", job->didSucceed ? "true" : "false");
+        if (!job->didSucceed) {
+            buf_malloc_printf(json, ", \"error\": ");
+            appendJSONString(&json, job->error);
+        }
+        buf_malloc_printf(json, ", \"frames\": %" PRId64 ", \"cycles\": %" PRId64 ", \"cpuSeconds\": %.3f, \"framesPerSecond\": %.1f, \"finalHash\": \"%016" PRIx64 "\"",
+                          job->numFramesRun, job->numCycles, (double)job->cpuTime / 1000000., jobFramesPerSecond(job), job->finalHash);
+        if (job->serialOutput) {
+            buf_malloc_printf(json, ", \"serialOutput\": ");
+            appendJSONString(&json, job->serialOutput);
+        }
+        if (queue->shouldRecordFrameHashes) {
+            buf_malloc_printf(json, ", \"frameHashes\": [");
+            for (isize j = 0; j < (isize)buf_len(job->frameHashes); j++) {
+                buf_malloc_printf(json, "%s\"%016" PRIx64 "\"", (j > 0) ? ", " : "", job->frameHashes[j]);
+            }
+            buf_malloc_printf(json, "]");
+        }
+        buf_malloc_printf(json, "}");
+    }
+    buf_malloc_printf(json, "\n  ]\n}\n");
+    return json;
+}
+
+//Only reads what makeBatchReport() writes, one job per line.  Jobs that aren't in it are left at 0
+static bool readBaselineReport(const char *path, BatchQueue *queue, MemoryStack *fileMemory) {
+    auto fileResult = readEntireFile(path, fileMemory);
+    if (fileResult.resultCode != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not read %s.", path);
+        return false;
+    }
+    const char framesPerSecondPrefix[] = "\"framesPerSecond\": ";
+    char *key = nullptr;
+    fori (queue->numJobs) {
+        BatchJob *job = &queue->jobs[i];
+        buf_clear(key);
+        appendJobKey(&key, job);
+        i64 keyLen = (i64)buf_len(key);
+        const char *c = (const char*)fileResult.data;
+        const char *end = c + fileResult.size;
+        while (c < end) {
+            const char *lineEnd = c;
+            while (lineEnd < end && *lineEnd != '\n') {
+                lineEnd++;
+            }
+            while (c < lineEnd && isspace(*c)) {
+                c++;
+            }
+            if (lineEnd - c > keyLen && areStringsEqual(c, key, keyLen)) {
+                char line[MAX_PATH_LEN * 4];
+                i64 lineLen = MIN(lineEnd - c, (i64)ARRAY_LEN(line) - 1);
+                copyMemory(c, line, lineLen);
+                line[lineLen] = '\0';
+                const char *field = strstr(line, framesPerSecondPrefix);
+                if (field) {
+                    job->baselineFramesPerSecond = atof(field + ARRAY_LEN(framesPerSecondPrefix) - 1);
+                }
+                break;
+            }
+            c = lineEnd + 1;
+        }
+    }
+    buf_malloc_free(key);
+    freeFileBuffer(&fileResult, fileMemory);
+    return true;
+}
+
+//How long each job took, and how that compares with the baseline if there was one.  Returns how many got more than
+//regressionPercent slower
+static i64 printTimingTable(const BatchQueue *queue, double regressionPercent) {
+    i64 numRegressions = 0;
+    PRINT("%8s %9s %10s %8s  %-6s  %s", "Frames", "CPU secs", "Frames/s", "Change", "Result", "Job");
+    fori (queue->numJobs) {
+        const BatchJob *job = &queue->jobs[i];
+        double framesPerSecond = jobFramesPerSecond(job);
+        char change[16] = "";
+        const char *result = job->didSucceed ? "ok" : "FAILED";
+        if (job->baselineFramesPerSecond > 0 && framesPerSecond > 0) {
+            //as time taken, so it reads the same way as bench's
+            double percent = 100. * (job->baselineFramesPerSecond / framesPerSecond - 1.);
+            snprintf(change, ARRAY_LEN(change), "%+.1f%%", percent);
+            if (percent > regressionPercent && job->didSucceed) {
+                result = "slower";
+                numRegressions++;
+            }
+        }
+        PRINT("%8" PRId64 " %9.3f %10.1f %8s  %-6s  %s%s%s", job->numFramesRun, (double)job->cpuTime / 1000000.,
+              framesPerSecond, change, result, job->romPath, job->inputPath[0] ? " " : "", job->inputPath);
+    }
+    return numRegressions;
+}
+
+static void printUsage() {
+    PRINT("Usage: batch [-j jobs] [-H] [-T] [-G | -U [-n frames]] [-c baseline] [-t percent] [-o report] manifest");
+    PRINT("\t-j -- Number of ROMs to run at the same time. Default is the number of CPU cores.");
+    PRINT("\t-H -- Put every frame's state hash in the report, not just the last one.");
+    PRINT("\t-T -- The ROMs are test ROMs. Each stops when it reports a result, and fails if it fails or never reports one.");
+    PRINT("\t-G -- Check each job against its golden file, its input's or ROM's path with " GOLDEN_FILE_EXTENSION " on the end.");
+    PRINT("\t-U -- Write each job's golden file instead.");
+    PRINT("\t-n -- Frames between the checkpoints written by -U. Default is %d.", DEFAULT_GOLDEN_INTERVAL);
+    PRINT("\t-c -- A report from an earlier run.  Any job that got more than -t percent slower fails the run.");
+    PRINT("\t-t -- How many percent slower counts as a regression. Default is %.0f.", DEFAULT_REGRESSION_PERCENT);
+    PRINT("\t-o -- File to write the JSON report to. Default is " DEFAULT_REPORT_PATH ".");
+}
+
+int main(int argc, char **argv) {
+    const char *manifestPath = nullptr;
+    const char *reportPath = DEFAULT_REPORT_PATH;
+    const char *baselinePath = nullptr;
+    i32 numWorkers = numberOfCPUCores();
+    bool shouldRecordFrameHashes = false;
+    bool areTestROMs = false;
+    GoldenMode goldenMode = GoldenMode::None;
+    i64 goldenInterval = DEFAULT_GOLDEN_INTERVAL;
+    double regressionPercent = DEFAULT_REGRESSION_PERCENT;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (areStringsEqual(argv[i], "-j", 3) && hasValue) {
+            numWorkers = atoi(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-H", 3)) {
+            shouldRecordFrameHashes = true;
+        }
+        else if (areStringsEqual(argv[i], "-T", 3)) {
+            areTestROMs = true;
+        }
+        else if (areStringsEqual(argv[i], "-G", 3) && goldenMode == GoldenMode::None) {
+            goldenMode = GoldenMode::Check;
+        }
+        else if (areStringsEqual(argv[i], "-U", 3) && goldenMode == GoldenMode::None) {
+            goldenMode = GoldenMode::Update;
+        }
+        else if (areStringsEqual(argv[i], "-n", 3) && hasValue) {
+            goldenInterval = atoll(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-c", 3) && hasValue) {
+            baselinePath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-t", 3) && hasValue) {
+            regressionPercent = atof(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-o", 3) && hasValue) {
+            reportPath = argv[++i];
+        }
+        else if (argv[i][0] != '-' && !manifestPath) {
+            manifestPath = argv[i];
+        }
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (!manifestPath || numWorkers <= 0 || goldenInterval <= 0) {
+        printUsage();
+        return 1;
+    }
+
+    //the manifest, then the stacks for each worker
+    if (!initMemory(FILE_MEMORY_SIZE + numWorkers * (BATCH_GENERAL_MEMORY_SIZE + FILE_MEMORY_SIZE), 0)) {
+        PRINT_ERR("Could not allocate memory.");
+        return 1;
+    }
+    MemoryStack fileMemory;
+    makeMemoryStack(FILE_MEMORY_SIZE, "fileMem", &fileMemory);
+
+    auto manifestResult = readEntireFile(manifestPath, &fileMemory);
+    if (manifestResult.resultCode != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not read %s.", manifestPath);
+        return 1;
+    }
+    BatchQueue queue = {};
+    queue.shouldRecordFrameHashes = shouldRecordFrameHashes;
+    queue.areTestROMs = areTestROMs;
+    queue.goldenMode = goldenMode;
+    queue.goldenInterval = goldenInterval;
+    queue.jobs = parseManifest((const char*)manifestResult.data, manifestResult.size, manifestPath);
+    queue.numJobs = (i64)buf_len(queue.jobs);
+    freeFileBuffer(&manifestResult, &fileMemory);
+    if (!queue.jobs) {
+        PRINT_ERR("%s has no jobs.", manifestPath);
+        return 1;
+    }
+    if (goldenMode != GoldenMode::None) {
+        fori (queue.numJobs) {
+            BatchJob *job = &queue.jobs[i];
+            const char *goldenBase = job->inputPath[0] ? job->inputPath : job->romPath;
+            if (stringLength(goldenBase) + stringLength(GOLDEN_FILE_EXTENSION) > MAX_PATH_LEN) {
+                PRINT_ERR("%s: the path is too long for a golden file.", goldenBase);
+                return 1;
+            }
+            i64 goldenBaseLen = stringLength(goldenBase);
+            copyMemory(goldenBase, job->goldenPath, goldenBaseLen);
+            copyMemory(GOLDEN_FILE_EXTENSION, job->goldenPath + goldenBaseLen, (i64)sizeof(GOLDEN_FILE_EXTENSION));
+            for (i64 j = 0; j < i; j++) {
+                if (areStringsEqual(job->goldenPath, queue.jobs[j].goldenPath, ARRAY_LEN(job->goldenPath))) {
+                    PRINT_ERR("Jobs %" PRId64 " and %" PRId64 " would share %s.  Give them different inputs.",
+                              j + 1, i + 1, job->goldenPath);
+                    return 1;
+                }
+            }
+        }
+    }
+    queue.mutex = createMutex();
+    if (!initROMCache(&queue.romCache)) {
+        PRINT_ERR("Could not allocate memory.");
+        return 1;
+    }
+    if (numWorkers > queue.numJobs) {
+        numWorkers = (i32)queue.numJobs;
+    }
+
+    BatchWorker *workers = CO_CALLOC(numWorkers, BatchWorker);
+    fori (numWorkers) {
+        workers[i].queue = &queue;
+        makeMemoryStack(BATCH_GENERAL_MEMORY_SIZE, "general", &workers[i].generalMemory);
+        makeMemoryStack(FILE_MEMORY_SIZE, "fileMem", &workers[i].fileMemory);
+    }
+
+    TimeUS startTime = nowInMicroseconds();
+    Thread **threads = CO_MALLOC(numWorkers, Thread*);
+    fori (numWorkers) {
+        threads[i] = startThread(batchWorker, &workers[i]);
+    }
+    fori (numWorkers) {
+        waitForAndFreeThread(threads[i]);
+    }
+    TimeUS elapsedTime = nowInMicroseconds() - startTime;
+
+    i64 numRegressions = 0;
+    bool didReadBaseline = !baselinePath || readBaselineReport(baselinePath, &queue, &fileMemory);
+    if (didReadBaseline) {
+        numRegressions = printTimingTable(&queue, regressionPercent);
+    }
+
+    i64 numFailed = 0;
+    i64 totalCycles = 0;
+    fori (queue.numJobs) {
+        const BatchJob *job = &queue.jobs[i];
+        if (!job->didSucceed) {
+            PRINT_ERR("%s: %s", job->romPath, job->error);
+            numFailed++;
+        }
+        totalCycles += job->numCycles;
+    }
+    char *report = makeBatchReport(&queue, numWorkers, elapsedTime, numFailed);
+    bool didWriteReport = writeDataToFile(report, (isize)buf_len(report), reportPath) == FileSystemResultCode::OK;
+    if (!didWriteReport) {
+        PRINT_ERR("Could not write %s.", reportPath);
+    }
+
+    double elapsedSeconds = (double)elapsedTime / 1000000.;
+    double emulatedSeconds = (double)totalCycles / CLOCK_SPEED_HZ;
+    PRINT("Ran %" PRId64 " jobs (%" PRId64 " failed) in %.2f seconds on %d threads. %.0fx real time.",
+          queue.numJobs, numFailed, elapsedSeconds, numWorkers,
+          (elapsedSeconds > 0) ? emulatedSeconds / elapsedSeconds : 0.);
+    if (baselinePath && didReadBaseline) {
+        PRINT("%" PRId64 " jobs got more than %.0f%% slower than in %s.", numRegressions, regressionPercent, baselinePath);
+    }
+
+    buf_malloc_free(report);
+    fori (queue.numJobs) {
+        buf_malloc_free(queue.jobs[i].frameHashes);
+        buf_malloc_free(queue.jobs[i].serialOutput);
+        buf_malloc_free(queue.jobs[i].goldenHashes);
+    }
+    CO_FREE(threads);
+    CO_FREE(workers);
+    freeROMCache(&queue.romCache);
+    destroyMutex(queue.mutex);
+    buf_malloc_free(queue.jobs);
+
+    return (numFailed == 0 && numRegressions == 0 && didReadBaseline && didWriteReport) ? 0 : 1;
+}
@@ -156,6 +156,8 @@ double nowInSeconds();
 
 TimeMS nowInMilliseconds();
 TimeUS nowInMicroseconds();
+//CPU time used by the calling thread.  Unlike the clock, it doesn't count time spent waiting on other threads
+TimeUS threadCPUTimeInMicroseconds();
 
 i64 unixWallClockTime();
 Timer *startAsyncTimer(TimerFn *tf, void *arg, i64 timeInMilliseconds);
@@ -179,6 +181,7 @@ void waitForCondition(WaitCondition *, Mutex *);
 void broadcastCondition(WaitCondition *);
 void waitForAndFreeThread(Thread *);
 u64 currentThreadID();
+i32 numberOfCPUCores();
 
 //clean up functions
 void destroyMutex(Mutex *);
@@ -314,7 +317,8 @@ bool initMemory(i64 totalMemoryLength, i64 generalMemoryLength);
 void makeMemoryStack(isize length, const char* name, MemoryStack *out);
 
 extern AlertDialogFn *alertDialog;
-extern MemoryStack *generalMemory;
+//per thread, so each thread running a Game Boy can be given its own.  initMemory() sets the calling thread's
+extern thread_local MemoryStack *generalMemory;
 
 MemoryContext *getMemoryContext();
 #ifdef CO_DEBUG
@@ -380,6 +384,47 @@ inline void zeroMemory(void* memory, i64 lenInBytes) {
 
 //used for hash tables
 u64 hashU64(u64 key);
+//fast non-cryptographic hash of a block of memory, for checksums and comparing states.
+//Hashes 4 independent lanes at a time so it isn't bound by multiply latency
+u64 hashMemory(const void *data, i64 lenInBytes, u64 seed = 0);
+
+//LEB128 style variable length integers
+inline u8 *writeVarInt(u64 value, u8 *out) {
+    while (value >= 0x80) {
+        *out++ = (u8)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (u8)value;
+    return out;
+}
+
+inline const u8 *readVarInt(const u8 *in, i64 *outValue) {
+    u64 value = 0;
+    int shift = 0;
+    for (;;) {
+        u8 b = *in++;
+        value |= (u64)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+        shift += 7;
+    }
+    *outValue = (i64)value;
+    return in;
+}
+//for untrusted data. Returns null if the integer runs past end
+inline const u8 *readVarInt(const u8 *in, const u8 *end, i64 *outValue) {
+    u64 value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        u8 b = *in++;
+        value |= (u64)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *outValue = (i64)value;
+            return in;
+        }
+    }
+    return nullptr;
+}
 
 //buf functions mostly gotten from https://github.com/pervognsen/bitwise/blob/768d59579a82944018ae4161b8f6d445be225edf/ion/common.c
 struct BufHdr {
@@ -473,7 +518,14 @@ i64 timestampFileName(const char *fileName, const char *extension, char *outStr)
 
 ReadFileResult readEntireFile(const char* fileName,  MemoryStack *memory);
 void freeFileBuffer(ReadFileResult* fileDataToFree, MemoryStack *memory);
-FileSystemResultCode writeDataToFile(const void* data, isize size, const char *fileName); 
+//shouldSync waits for the data to reach the disk before returning
+FileSystemResultCode writeDataToFile(const void* data, isize size, const char *fileName, bool shouldSync = false); 
+//replaces dest if it exists.  A missing src is returned as NotFound without logging, since callers often expect it
+FileSystemResultCode renameFile(const char *src, const char *dest);
+//a second name for src, which must be on the same volume.  dest must not exist.  Logs like renameFile()
+FileSystemResultCode linkFile(const char *src, const char *dest);
+//waits for renames and new files in the directory to reach the disk
+FileSystemResultCode syncDirectory(const char *path);
 FileSystemResultCode copyFile(const char *src, const char *dest,  MemoryStack *fileMemory);
 
 MemoryMappedFileHandle *mapFileToMemory(const char *fileName, u8 **outData, usize *outLen);
@@ -572,7 +624,8 @@ struct ProfileState {
     double programStartTime;
 };
 #ifdef CO_PROFILE
-static ProfileState *profileState;
+//per thread, since sections are a stack
+static thread_local ProfileState *profileState;
 #endif
 void profileInit(ProfileState *ps);
 void profileStart(const char *sectionName, ProfileState *ps);
@@ -596,6 +649,9 @@ union SoundFrame{
     i32 value;
 };
 typedef CircularBuffer<SoundFrame> SoundBuffer;
+
+//writes 16-bit stereo PCM
+FileSystemResultCode writeWAVFile(const SoundFrame *frames, i64 numFrames, i32 sampleRate, const char *fileName);
 #endif
 
 /***implementation start***/
@@ -624,7 +680,7 @@ struct _ThreadStartContext {
  *******************/
 //memory
 globalvar MemoryContext *memoryContext;
-MemoryStack *generalMemory;
+thread_local MemoryStack *generalMemory;
 AlertDialogFn *alertDialog;
 
 #ifdef CO_DEBUG
@@ -979,6 +1035,41 @@ u64 hashU64(u64 key)  {
 
     return key;
 }
+u64 hashMemory(const void *data, i64 lenInBytes, u64 seed) {
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH_ROTATE(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+    const u8 *bytes = (const u8*)data;
+    u64 lanes[4] = {seed + HASH_PRIME1 + HASH_PRIME2, seed + HASH_PRIME2, seed, seed - HASH_PRIME1};
+    i64 i = 0;
+    for (; i + 32 <= lenInBytes; i += 32) {
+        for (int lane = 0; lane < 4; lane++) {
+            u64 word;
+            memcpy(&word, bytes + i + lane*8, sizeof(word));
+            lanes[lane] += word * HASH_PRIME2;
+            lanes[lane] = HASH_ROTATE(lanes[lane], 31) * HASH_PRIME1;
+        }
+    }
+
+    u64 hash = (u64)lenInBytes;
+    for (int lane = 0; lane < 4; lane++) {
+        hash = (hash ^ hashU64(lanes[lane])) * HASH_PRIME1;
+    }
+    for (; i + 8 <= lenInBytes; i += 8) {
+        u64 word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash ^= HASH_ROTATE(word * HASH_PRIME2, 31) * HASH_PRIME1;
+        hash = HASH_ROTATE(hash, 27) * HASH_PRIME1;
+    }
+    for (; i < lenInBytes; i++) {
+        hash = HASH_ROTATE(hash ^ (bytes[i] * HASH_PRIME2), 11) * HASH_PRIME1;
+    }
+
+    return hashU64(hashU64(hash) ^ seed);
+#undef HASH_ROTATE
+#undef HASH_PRIME2
+#undef HASH_PRIME1
+}
 void *buf__grow(AllocatorFn *allocator, ReallocateFn *reallocator, const void *buf, size_t new_len, size_t elem_size) {
     CO_ASSERT(buf_cap(buf) <= (SIZE_MAX - 1)/2);
     size_t new_cap = MAX(16, MAX(1 + 2*buf_cap(buf), new_len));
@@ -1048,6 +1139,45 @@ FileSystemResultCode copyFile(const char *src, const char *dest, MemoryStack *fi
     return writeResult;
 }
 
+FileSystemResultCode writeWAVFile(const SoundFrame *frames, i64 numFrames, i32 sampleRate, const char *fileName) {
+#define WAV_HEADER_LEN 44
+    u32 dataLen = (u32)(numFrames * (i64)sizeof(SoundFrame));
+    u32 bytesPerSecond = (u32)sampleRate * (u32)sizeof(SoundFrame);
+    u8 *fileData = CO_MALLOC(WAV_HEADER_LEN + dataLen, u8);
+    u8 *header = fileData;
+    
+    auto writeU32 = [&header](u32 value) {
+        fori (4) {
+            *header++ = (u8)(value >> (i * 8));
+        }
+    };
+    auto writeU16 = [&header](u16 value) {
+        *header++ = (u8)value;
+        *header++ = (u8)(value >> 8);
+    };
+    
+    copyMemory("RIFF", header, 4); header += 4;
+    writeU32(WAV_HEADER_LEN - 8 + dataLen);
+    copyMemory("WAVEfmt ", header, 8); header += 8;
+    writeU32(16);  //fmt chunk length
+    writeU16(1);   //PCM
+    writeU16(2);   //channels
+    writeU32((u32)sampleRate);
+    writeU32(bytesPerSecond);
+    writeU16((u16)sizeof(SoundFrame)); //block align
+    writeU16(16);  //bits per sample
+    copyMemory("data", header, 4); header += 4;
+    writeU32(dataLen);
+    CO_ASSERT(header - fileData == WAV_HEADER_LEN);
+    
+    copyMemory(frames, fileData + WAV_HEADER_LEN, dataLen);
+    auto result = writeDataToFile(fileData, WAV_HEADER_LEN + dataLen, fileName);
+    CO_FREE(fileData);
+    
+    return result;
+#undef WAV_HEADER_LEN
+}
+
 void initPlatformFunctions(AlertDialogFn *alertDialogFn) {
     alertDialog = alertDialogFn;
 }
@@ -1191,6 +1321,11 @@ TimeUS nowInMicroseconds() {
     
     return ms;
 }
+TimeUS threadCPUTimeInMicroseconds() {
+	timespec tspec;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tspec);
+	return (tspec.tv_sec * 1000000) + (tspec.tv_nsec / 1000);
+}
 i64 unixWallClockTime() {
     return (i64)time(nullptr);
 }
@@ -1289,6 +1424,10 @@ void waitForAndFreeThread(Thread *thread) {
 u64 currentThreadID() {
     return (u64)pthread_self();
 }
+i32 numberOfCPUCores() {
+    long ret = sysconf(_SC_NPROCESSORS_ONLN);
+    return (ret > 0) ? (i32)ret : 1;
+}
 void destroyMutex(Mutex *mutex) {
     pthread_mutex_destroy(&mutex->value);
     CO_FREE(mutex);
@@ -1341,7 +1480,7 @@ struct MemoryMappedFileHandle {
 };
 
 
-FileSystemResultCode writeDataToFile(const void *data, isize size, const char *fileName) {
+FileSystemResultCode writeDataToFile(const void *data, isize size, const char *fileName, bool shouldSync) {
     FILE *f = fopen(fileName, "wb");
     if (!f) {
         CO_ERR("Error opening file %s", fileName);
@@ -1370,10 +1509,68 @@ FileSystemResultCode writeDataToFile(const void *data, isize size, const char *f
             return FileSystemResultCode::Unknown;
         }
     }
+    if (shouldSync && (fflush(f) != 0 || fsync(fileno(f)) != 0)) {
+        CO_ERR("Error syncing file %s", fileName);
+        fclose(f);
+        return (errno == ENOSPC) ? FileSystemResultCode::OutOfSpace : FileSystemResultCode::IOError;
+    }
     fclose(f);
     
     return FileSystemResultCode::OK;
 }
+static FileSystemResultCode fileSystemResultFromErrno(int error) {
+    switch (error) {
+    case EACCES:
+    case EPERM:
+        return FileSystemResultCode::PermissionDenied;
+    case ENOENT:
+        return FileSystemResultCode::NotFound;
+    case EEXIST:
+        return FileSystemResultCode::AlreadyExists;
+    case ENOSPC:
+        return FileSystemResultCode::OutOfSpace;
+    case EIO:
+        return FileSystemResultCode::IOError;
+    default:
+        return FileSystemResultCode::Unknown;
+    }
+}
+FileSystemResultCode renameFile(const char *src, const char *dest) {
+    if (rename(src, dest) != 0) {
+        int error = errno;
+        if (error != ENOENT) {
+            CO_ERR("Error renaming %s to %s", src, dest);
+        }
+        return fileSystemResultFromErrno(error);
+    }
+
+    return FileSystemResultCode::OK;
+}
+FileSystemResultCode linkFile(const char *src, const char *dest) {
+    if (link(src, dest) != 0) {
+        int error = errno;
+        if (error != ENOENT) {
+            CO_ERR("Error linking %s to %s", dest, src);
+        }
+        return fileSystemResultFromErrno(error);
+    }
+
+    return FileSystemResultCode::OK;
+}
+FileSystemResultCode syncDirectory(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        CO_ERR("Error opening directory %s", path);
+        return fileSystemResultFromErrno(errno);
+    }
+    FileSystemResultCode ret = FileSystemResultCode::OK;
+    if (fsync(fd) != 0) {
+        CO_ERR("Error syncing directory %s", path);
+        ret = fileSystemResultFromErrno(errno);
+    }
+    close(fd);
+    return ret;
+}
 ReadFileResult readEntireFile(const char *fileName, MemoryStack *fileMemory) {
     CO_ASSERT(fileMemory->isInited);
 
@@ -1663,6 +1860,15 @@ TimeUS nowInMicroseconds() {
     
     return us;
 }
+TimeUS threadCPUTimeInMicroseconds() {
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    bool result = GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime);
+    CO_ASSERT(result);
+    //in 100ns ticks
+    u64 kernel = ((u64)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+    u64 user = ((u64)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+    return (TimeUS)((kernel + user) / 10);
+}
 Timer *startAsyncTimer(TimerFn *tf, void *arg, TimeMS time) {
     
     Timer *timerState = CO_MALLOC(1, Timer); 
@@ -1746,6 +1952,11 @@ void waitForAndFreeThread(Thread *thread) {
 u64 currentThreadID() {
     return (u64)GetCurrentThreadId();
 }
+i32 numberOfCPUCores() {
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    return (systemInfo.dwNumberOfProcessors > 0) ? (i32)systemInfo.dwNumberOfProcessors : 1;
+}
 //memory
 bool initMemory(i64 totalMemoryLength, i64 generalMemoryLength) {
    {
@@ -1885,7 +2096,7 @@ error:
     return ret;
 
 }
-FileSystemResultCode writeDataToFile(const void *data, isize size, const char *fileName) {
+FileSystemResultCode writeDataToFile(const void *data, isize size, const char *fileName, bool shouldSync) {
 	wchar_t fileNameWide[MAX_PATH + 1];
 
 	if (!convertUTF8ToWChar(fileName, fileNameWide, MAX_PATH)) {
@@ -1920,10 +2131,69 @@ FileSystemResultCode writeDataToFile(const void *data, isize size, const char *f
             return FileSystemResultCode::Unknown;
         }
     }
+    if (shouldSync && (fflush(f) != 0 || !FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(f))))) {
+        CO_ERR("Error syncing file %s", fileName);
+        fclose(f);
+        return FileSystemResultCode::IOError;
+    }
     fclose(f);
     
     return FileSystemResultCode::OK;
 }
+static FileSystemResultCode fileSystemResultFromWin32Error(DWORD error) {
+    switch (error) {
+    case ERROR_ACCESS_DENIED:
+        return FileSystemResultCode::PermissionDenied;
+    case ERROR_FILE_NOT_FOUND:
+    case ERROR_PATH_NOT_FOUND:
+        return FileSystemResultCode::NotFound;
+    case ERROR_ALREADY_EXISTS:
+        return FileSystemResultCode::AlreadyExists;
+    case ERROR_DISK_FULL:
+        return FileSystemResultCode::OutOfSpace;
+    default:
+        return FileSystemResultCode::Unknown;
+    }
+}
+FileSystemResultCode renameFile(const char *src, const char *dest) {
+	wchar_t srcWide[MAX_PATH + 1];
+	wchar_t destWide[MAX_PATH + 1];
+
+	if (!convertUTF8ToWChar(src, srcWide, MAX_PATH) || !convertUTF8ToWChar(dest, destWide, MAX_PATH)) {
+		return FileSystemResultCode::Unknown;
+	}
+    if (!MoveFileExW(srcWide, destWide, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        DWORD error = GetLastError();
+        if (error != ERROR_FILE_NOT_FOUND) {
+            CO_ERR("Error renaming %s to %s", src, dest);
+        }
+        return fileSystemResultFromWin32Error(error);
+    }
+
+    return FileSystemResultCode::OK;
+}
+FileSystemResultCode linkFile(const char *src, const char *dest) {
+	wchar_t srcWide[MAX_PATH + 1];
+	wchar_t destWide[MAX_PATH + 1];
+
+	if (!convertUTF8ToWChar(src, srcWide, MAX_PATH) || !convertUTF8ToWChar(dest, destWide, MAX_PATH)) {
+		return FileSystemResultCode::Unknown;
+	}
+    if (!CreateHardLinkW(destWide, srcWide, nullptr)) {
+        DWORD error = GetLastError();
+        if (error != ERROR_FILE_NOT_FOUND) {
+            CO_ERR("Error linking %s to %s", dest, src);
+        }
+        return fileSystemResultFromWin32Error(error);
+    }
+
+    return FileSystemResultCode::OK;
+}
+//MoveFileExW() is already told to write through, and directories can't be flushed
+FileSystemResultCode syncDirectory(const char *path) {
+    UNUSED(path);
+    return FileSystemResultCode::OK;
+}
 bool getFilePathInHomeDir(const char *pathRelativeToHome, char *outFilePath) {
     char *homeDrive = getenv("HOMEDRIVE");
     if (!homeDrive) {
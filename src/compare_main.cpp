@@ -0,0 +1,972 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Lockstep comparator, for checking a changed core (a faster stepCPU(), say) against a build known to be right.
+//
+//The reference build records a trace of a run: every memory write, the registers every -g steps and the state hash
+//at the end of every frame.  A step is what step() runs: an instruction, an interrupt being dispatched or a halted
+//4 cycles.  The candidate build runs the same ROM and input script against the trace, and stops at the first step
+//that differs, showing the registers and the code around it.  Piped, the two run in lockstep and nothing is stored:
+//  git worktree add /tmp/reference <commit> && make -C /tmp/reference/linux compare
+//  /tmp/reference/linux/build/compare -r - game.gb | build/compare -c - game.gb
+//
+//With -j, runs SingleStepTests' sm83 test vectors instead: one JSON file of them per opcode, each vector a single
+//instruction run by stepCPU() against a flat 64KB of memory.
+
+#define CO_IMPL
+#include "common.h"
+#define GB_IMPL
+#include "gbemu.cpp"
+#include "headless.cpp"
+
+#define DEFAULT_NUM_FRAMES 600
+#define COMPARE_FILE_MEMORY_SIZE MB(32) //the sm83 files are a few MB each
+#define LOCKSTEP_TRACE_MAGIC 0x534C4247 //"GBLS"
+#define LOCKSTEP_TRACE_VERSION 2 //changes with hashGameBoyState() too
+#define LOCKSTEP_TRACE_BUFFER_SIZE KB(256)
+#define LOCKSTEP_HISTORY_LEN 8 //steps shown up to a divergence
+#define LOCKSTEP_LOOKAHEAD_LEN 4 //instructions shown after it
+#define MAX_DISASSEMBLY_LEN 32
+
+/*** Lockstep ***/
+
+struct LockstepTraceHeader {
+    u32 magic;
+    u32 version;
+    u64 romHash;
+    u64 scriptHash;
+    i64 numFrames;
+    i64 granularity;
+};
+
+enum class LockstepRecordType : u8 {
+    Write, Registers, FrameEnd, End
+};
+
+struct LockstepRegisters {
+    u16 PC, SP;
+    u8 A, F, B, C, D, E, H, L;
+    bool enableInterrupts, isHalted;
+    i64 totalCycles;
+};
+
+//Writes are only the head.  Registers and FrameEnd records are followed by their payload
+struct LockstepRecord {
+    LockstepRecordType type;
+    u8 value;
+    u16 address;
+    u32 unused;
+    u64 step; //counts from 1
+
+    union {
+        LockstepRegisters registers;
+        u64 stateHash;
+    };
+};
+#define LOCKSTEP_RECORD_HEAD_SIZE offsetof(LockstepRecord, registers)
+
+enum class LockstepStepKind : u8 {
+    Instruction, Interrupt, Halted
+};
+
+struct LockstepHistoryEntry {
+    u64 step;
+    u16 PC; //where the step started
+    LockstepStepKind kind;
+};
+
+struct Lockstep {
+    FILE *file;
+    bool isRecording;
+    LockstepTraceHeader header;
+
+    u64 step;
+    i64 frame;
+    bool didDiverge;
+    bool didFail; //couldn't read or write the trace.  Already printed
+
+    //checking only
+    LockstepRecord nextRecord; //from the reference, not yet matched
+    bool hasNextRecord;
+    LockstepHistoryEntry history[LOCKSTEP_HISTORY_LEN]; //indexed by step % LOCKSTEP_HISTORY_LEN
+    u16 nextPC;
+    bool wasHalted;
+};
+
+static u64 hashInputScript(const InputScriptLine *script) {
+    u64 hash = 0;
+    for (isize i = 0; i < (isize)buf_len(script); i++) {
+        hash = hashMemory(&script[i].frame, sizeof(script[i].frame), hash);
+        hash = hashMemory(script[i].actionsHit, sizeof(script[i].actionsHit), hash);
+    }
+    return hash;
+}
+
+static LockstepRegisters lockstepRegisters(const CPU *cpu) {
+    LockstepRegisters ret = {};
+    ret.PC = cpu->PC;
+    ret.SP = cpu->SP;
+    ret.A = cpu->A;
+    ret.F = cpu->F;
+    ret.B = cpu->B;
+    ret.C = cpu->C;
+    ret.D = cpu->D;
+    ret.E = cpu->E;
+    ret.H = cpu->H;
+    ret.L = cpu->L;
+    ret.enableInterrupts = cpu->enableInterrupts;
+    ret.isHalted = cpu->isHalted;
+    ret.totalCycles = cpu->totalCycles;
+    return ret;
+}
+
+static size_t lockstepRecordSize(LockstepRecordType type) {
+    switch (type) {
+        case LockstepRecordType::Registers: return LOCKSTEP_RECORD_HEAD_SIZE + sizeof(LockstepRegisters);
+        case LockstepRecordType::FrameEnd: return LOCKSTEP_RECORD_HEAD_SIZE + sizeof(u64);
+        case LockstepRecordType::Write:
+        case LockstepRecordType::End: return LOCKSTEP_RECORD_HEAD_SIZE;
+    }
+    return LOCKSTEP_RECORD_HEAD_SIZE;
+}
+
+static void writeLockstepRecord(const LockstepRecord *record, Lockstep *lockstep) {
+    if (!lockstep->didFail && fwrite(record, lockstepRecordSize(record->type), 1, lockstep->file) != 1) {
+        PRINT_ERR("Could not write the trace.");
+        lockstep->didFail = true;
+    }
+}
+
+//the reference's next record, or nullptr at the end of the trace
+static const LockstepRecord *peekLockstepRecord(Lockstep *lockstep) {
+    if (lockstep->hasNextRecord) {
+        return &lockstep->nextRecord;
+    }
+    LockstepRecord *record = &lockstep->nextRecord;
+    if (lockstep->didFail || fread(record, LOCKSTEP_RECORD_HEAD_SIZE, 1, lockstep->file) != 1) {
+        return nullptr;
+    }
+    size_t payloadSize = lockstepRecordSize(record->type) - LOCKSTEP_RECORD_HEAD_SIZE;
+    if (record->type > LockstepRecordType::End ||
+        (payloadSize > 0 && fread(&record->registers, payloadSize, 1, lockstep->file) != 1)) {
+        PRINT_ERR("The trace is cut short or corrupt.");
+        lockstep->didFail = true;
+        return nullptr;
+    }
+    lockstep->hasNextRecord = true;
+    return record;
+}
+
+static void disassemble(u16 address, MMU *mmu, char *out, i32 *outLen) {
+    *outLen = disassembleInstructionAtAddress(address, mmu, out, MAX_DISASSEMBLY_LEN);
+    if (*outLen <= 0) {
+        *outLen = 1;
+    }
+}
+
+static void printLockstepRegisters(const char *label, const LockstepRegisters *r) {
+    PRINT("  %-10s %04X %04X %02X %02X %02X %02X %02X %02X %02X %02X %-3d %-4d %" PRId64,
+          label, r->PC, r->SP, r->A, r->F, r->B, r->C, r->D, r->E, r->H, r->L,
+          r->enableInterrupts, r->isHalted, r->totalCycles);
+}
+
+//Prints what differs, then the code the candidate ran up to it and what comes after, from the candidate's memory.
+//Called from the step it's found in, before anything else runs
+static void reportDivergence(const char *what, const LockstepRegisters *reference, CPU *cpu, MMU *mmu, Lockstep *lockstep) {
+    lockstep->didDiverge = true;
+    PRINT("Diverged at step %" PRIu64 " (frame %" PRId64 ", cycle %" PRId64 "): %s",
+          lockstep->step, lockstep->frame, cpu->totalCycles, what);
+
+    LockstepRegisters candidate = lockstepRegisters(cpu);
+    PRINT("  %-10s PC   SP   A  F  B  C  D  E  H  L  IME HALT cycles", "");
+    if (reference) {
+        printLockstepRegisters("reference", reference);
+    }
+    printLockstepRegisters("candidate", &candidate);
+
+    char instruction[MAX_DISASSEMBLY_LEN];
+    i32 len;
+    u64 firstStep = (lockstep->step > LOCKSTEP_HISTORY_LEN) ? lockstep->step - LOCKSTEP_HISTORY_LEN + 1 : 1;
+    for (u64 step = firstStep; step <= lockstep->step; step++) {
+        const LockstepHistoryEntry *entry = &lockstep->history[step % LOCKSTEP_HISTORY_LEN];
+        const char *marker = (step == lockstep->step) ? ">" : " ";
+        switch (entry->kind) {
+            case LockstepStepKind::Instruction: {
+                disassemble(entry->PC, mmu, instruction, &len);
+                PRINT("%s %10" PRIu64 "  %04X: %s", marker, step, entry->PC, instruction);
+            } break;
+            case LockstepStepKind::Interrupt: {
+                PRINT("%s %10" PRIu64 "  %04X: (interrupt)", marker, step, entry->PC);
+            } break;
+            case LockstepStepKind::Halted: {
+                PRINT("%s %10" PRIu64 "  %04X: (halted)", marker, step, entry->PC);
+            } break;
+        }
+    }
+    u16 address = cpu->PC;
+    fori (LOCKSTEP_LOOKAHEAD_LEN) {
+        disassemble(address, mmu, instruction, &len);
+        PRINT("  %10s  %04X: %s", "", address, instruction);
+        address = (u16)(address + len);
+    }
+}
+
+static void recordLockstepStep(CPU *cpu, MMU *mmu, StepTrace *trace) {
+    UNUSED(mmu);
+    auto lockstep = (Lockstep*)trace->context;
+    lockstep->step++;
+    LockstepRecord record = {};
+    record.step = lockstep->step;
+    if (trace->numWrites > MAX_STEP_TRACE_WRITES) {
+        PRINT_ERR("Step %" PRIu64 " made %" PRId64 " writes, more than can be traced.", lockstep->step, trace->numWrites);
+        lockstep->didFail = true;
+    }
+    for (i64 i = 0; i < trace->numWrites && i < MAX_STEP_TRACE_WRITES; i++) {
+        record.type = LockstepRecordType::Write;
+        record.address = trace->writes[i].address;
+        record.value = trace->writes[i].value;
+        writeLockstepRecord(&record, lockstep);
+    }
+    trace->numWrites = 0;
+    if (lockstep->step % (u64)lockstep->header.granularity == 0) {
+        record.type = LockstepRecordType::Registers;
+        record.address = 0;
+        record.value = 0;
+        record.registers = lockstepRegisters(cpu);
+        writeLockstepRecord(&record, lockstep);
+    }
+}
+
+static void checkLockstepStep(CPU *cpu, MMU *mmu, StepTrace *trace) {
+    auto lockstep = (Lockstep*)trace->context;
+    i64 numWrites = trace->numWrites;
+    trace->numWrites = 0;
+    //the rest of the frame still runs after a divergence, but it's already been reported
+    if (lockstep->didDiverge || lockstep->didFail) {
+        return;
+    }
+    lockstep->step++;
+    u64 step = lockstep->step;
+
+    LockstepHistoryEntry *entry = &lockstep->history[step % LOCKSTEP_HISTORY_LEN];
+    entry->step = step;
+    entry->PC = lockstep->nextPC;
+    entry->kind = LockstepStepKind::Instruction;
+    if (lockstep->wasHalted) {
+        entry->kind = LockstepStepKind::Halted;
+    }
+    //a dispatch is the only 20 cycle step that lands on an interrupt routine
+    foriarr (interruptRoutineAddresses) {
+        if (cpu->PC == interruptRoutineAddresses[i] && cpu->instructionCycles == 20) {
+            entry->kind = LockstepStepKind::Interrupt;
+        }
+    }
+    lockstep->nextPC = cpu->PC;
+    lockstep->wasHalted = cpu->isHalted;
+
+    char what[128];
+    if (numWrites > MAX_STEP_TRACE_WRITES) {
+        snprintf(what, ARRAY_LEN(what), "the candidate made %" PRId64 " writes, more than can be traced", numWrites);
+        reportDivergence(what, nullptr, cpu, mmu, lockstep);
+        return;
+    }
+    for (i64 i = 0; i < numWrites; i++) {
+        const TracedWrite *write = &trace->writes[i];
+        const LockstepRecord *record = peekLockstepRecord(lockstep);
+        if (!record) {
+            if (!lockstep->didFail) {
+                reportDivergence("the reference's trace ends here", nullptr, cpu, mmu, lockstep);
+            }
+            return;
+        }
+        if (record->type != LockstepRecordType::Write || record->step != step) {
+            snprintf(what, ARRAY_LEN(what), "the candidate wrote $%02X to $%04X, the reference didn't write",
+                     write->value, write->address);
+            reportDivergence(what, nullptr, cpu, mmu, lockstep);
+            return;
+        }
+        if (record->address != write->address || record->value != write->value) {
+            snprintf(what, ARRAY_LEN(what), "the reference wrote $%02X to $%04X, the candidate wrote $%02X to $%04X",
+                     record->value, record->address, write->value, write->address);
+            reportDivergence(what, nullptr, cpu, mmu, lockstep);
+            return;
+        }
+        lockstep->hasNextRecord = false;
+    }
+
+    const LockstepRecord *record = peekLockstepRecord(lockstep);
+    if (!record) {
+        if (!lockstep->didFail) {
+            reportDivergence("the reference's trace ends here", nullptr, cpu, mmu, lockstep);
+        }
+        return;
+    }
+    if (record->type == LockstepRecordType::Write && record->step == step) {
+        snprintf(what, ARRAY_LEN(what), "the reference wrote $%02X to $%04X, the candidate didn't write",
+                 record->value, record->address);
+        reportDivergence(what, nullptr, cpu, mmu, lockstep);
+        return;
+    }
+    if (step % (u64)lockstep->header.granularity != 0) {
+        return;
+    }
+    if (record->type != LockstepRecordType::Registers || record->step != step) {
+        reportDivergence("the reference's trace is out of step", nullptr, cpu, mmu, lockstep);
+        return;
+    }
+    LockstepRegisters reference = record->registers;
+    LockstepRegisters candidate = lockstepRegisters(cpu);
+    lockstep->hasNextRecord = false;
+    if (!isMemoryEqual(&reference, &candidate, sizeof(reference))) {
+        const char *names[] = {"PC", "SP", "A", "F", "B", "C", "D", "E", "H", "L", "IME", "HALT", "cycles"};
+        const i64 referenceValues[] = {reference.PC, reference.SP, reference.A, reference.F, reference.B,
+            reference.C, reference.D, reference.E, reference.H, reference.L,
+            reference.enableInterrupts, reference.isHalted, reference.totalCycles};
+        const i64 candidateValues[] = {candidate.PC, candidate.SP, candidate.A, candidate.F, candidate.B,
+            candidate.C, candidate.D, candidate.E, candidate.H, candidate.L,
+            candidate.enableInterrupts, candidate.isHalted, candidate.totalCycles};
+        i64 len = snprintf(what, ARRAY_LEN(what), "registers differ:");
+        foriarr (names) {
+            if (referenceValues[i] != candidateValues[i] && len < (i64)ARRAY_LEN(what)) {
+                len += snprintf(what + len, ARRAY_LEN(what) - (size_t)len, " %s", names[i]);
+            }
+        }
+        reportDivergence(what, &reference, cpu, mmu, lockstep);
+    }
+}
+
+static void printUsage() {
+    PRINT("Usage: compare -r trace [-g steps] [-f frames] [-i script] file.gb");
+    PRINT("       compare -c trace [-i script] file.gb");
+    PRINT("       compare -j test.json...");
+    PRINT("\t-r -- Records the reference's trace, to stdout if it's -.");
+    PRINT("\t-c -- Checks this build against a reference's trace, from stdin if it's -.");
+    PRINT("\t-g -- Steps between register checks.  Every write is always checked. Default is 1.");
+    PRINT("\t-f -- Number of frames to run. Default is %d.", DEFAULT_NUM_FRAMES);
+    PRINT("\t-i -- Input script to play, the same for both.  No buttons are pressed by default.");
+    PRINT("\t-j -- Runs SingleStepTests' sm83 JSON test vectors, one file per opcode.");
+}
+
+static int runLockstep(const char *romPath, const char *scriptPath, const char *tracePath, bool isRecording,
+                       i64 numFrames, i64 granularity, MemoryStack fileMemory) {
+    InputScriptLine *script = nullptr;
+    if (scriptPath) {
+        script = readInputScript(scriptPath, &fileMemory);
+        if (!script) {
+            return 1;
+        }
+    }
+    HeadlessGameBoy gb;
+    const char *error = initHeadlessGameBoy(romPath, nullptr, 0, fileMemory, nullptr, &gb);
+    if (error) {
+        PRINT_ERR("%s: %s", romPath, error);
+        buf_malloc_free(script);
+        return 1;
+    }
+    gb.script = script;
+
+    bool isStdio = areStringsEqual(tracePath, "-", 2);
+    Lockstep lockstep = {};
+    lockstep.isRecording = isRecording;
+    lockstep.file = isStdio ? (isRecording ? stdout : stdin) : fopen(tracePath, isRecording ? "wb" : "rb");
+    if (!lockstep.file) {
+        PRINT_ERR("Could not open %s.", tracePath);
+        freeHeadlessGameBoy(&gb);
+        buf_malloc_free(script);
+        return 1;
+    }
+    setvbuf(lockstep.file, nullptr, _IOFBF, LOCKSTEP_TRACE_BUFFER_SIZE);
+
+    LockstepTraceHeader *header = &lockstep.header;
+    bool didSucceed = true;
+    if (isRecording) {
+        header->magic = LOCKSTEP_TRACE_MAGIC;
+        header->version = LOCKSTEP_TRACE_VERSION;
+        header->romHash = hashMemory(gb.rom->data, gb.rom->size);
+        header->scriptHash = hashInputScript(script);
+        header->numFrames = numFrames;
+        header->granularity = granularity;
+        if (fwrite(header, sizeof(*header), 1, lockstep.file) != 1) {
+            PRINT_ERR("Could not write the trace.");
+            didSucceed = false;
+        }
+    }
+    else {
+        if (fread(header, sizeof(*header), 1, lockstep.file) != 1 || header->magic != LOCKSTEP_TRACE_MAGIC ||
+            header->granularity <= 0) {
+            PRINT_ERR("%s is not a trace.", tracePath);
+            didSucceed = false;
+        }
+        else if (header->version != LOCKSTEP_TRACE_VERSION) {
+            PRINT_ERR("%s is from a different version of compare.", tracePath);
+            didSucceed = false;
+        }
+        else if (header->romHash != hashMemory(gb.rom->data, gb.rom->size)) {
+            PRINT_ERR("%s was recorded with a different ROM.", tracePath);
+            didSucceed = false;
+        }
+        else if (header->scriptHash != hashInputScript(script)) {
+            PRINT_ERR("%s was recorded with a different input script.", tracePath);
+            didSucceed = false;
+        }
+        numFrames = header->numFrames;
+    }
+
+    StepTrace trace = {};
+    trace.onStep = isRecording ? recordLockstepStep : checkLockstepStep;
+    trace.context = &lockstep;
+    gb.gbDebug->stepTrace = &trace;
+    lockstep.nextPC = gb.cpu->PC;
+    lockstep.wasHalted = gb.cpu->isHalted;
+
+    char notification[MAX_NOTIFICATION_LEN + 1];
+    bool didHitIllegalOpcode = false;
+    TimeUS startTime = nowInMicroseconds();
+    for (; didSucceed && lockstep.frame < numFrames && !didHitIllegalOpcode; lockstep.frame++) {
+        didHitIllegalOpcode = !runHeadlessFrame(lockstep.frame, &gb);
+        while (popNotification(&gb.programState->notifications, notification))
+            ;
+        clear(&gb.mmu->host->soundFramesBuffer);
+        if (lockstep.didDiverge || lockstep.didFail) {
+            break;
+        }
+
+        LockstepRecord record = {};
+        record.type = LockstepRecordType::FrameEnd;
+        record.step = lockstep.step;
+        record.stateHash = hashGameBoyState(gb.cpu, gb.mmu, &gb.stateHasher);
+        if (isRecording) {
+            writeLockstepRecord(&record, &lockstep);
+            continue;
+        }
+        const LockstepRecord *reference = peekLockstepRecord(&lockstep);
+        if (!reference) {
+            if (!lockstep.didFail) {
+                reportDivergence("the reference's trace ends here", nullptr, gb.cpu, gb.mmu, &lockstep);
+            }
+        }
+        else if (reference->type != LockstepRecordType::FrameEnd || reference->step != record.step) {
+            reportDivergence("the reference's frame ends somewhere else", nullptr, gb.cpu, gb.mmu, &lockstep);
+        }
+        else if (reference->stateHash != record.stateHash) {
+            reportDivergence("the state hash at the end of the frame differs, with every step the same. "
+                             "Something outside the CPU (LCD, sound, timers...) ran differently",
+                             nullptr, gb.cpu, gb.mmu, &lockstep);
+        }
+        lockstep.hasNextRecord = false;
+    }
+    TimeUS elapsedTime = nowInMicroseconds() - startTime;
+
+    if (isRecording) {
+        LockstepRecord end = {};
+        end.type = LockstepRecordType::End;
+        end.step = lockstep.step;
+        writeLockstepRecord(&end, &lockstep);
+        if (fflush(lockstep.file) != 0) {
+            PRINT_ERR("Could not write the trace.");
+            lockstep.didFail = true;
+        }
+    }
+    else if (didSucceed && !lockstep.didDiverge && !lockstep.didFail) {
+        const LockstepRecord *end = peekLockstepRecord(&lockstep);
+        if (!end || end->type != LockstepRecordType::End || end->step != lockstep.step) {
+            reportDivergence("the reference ran further", nullptr, gb.cpu, gb.mmu, &lockstep);
+        }
+    }
+    didSucceed = didSucceed && !lockstep.didDiverge && !lockstep.didFail;
+
+    //the trace can be on stdout, so this goes to stderr
+    if (didSucceed) {
+        PRINT_ERR("%s %" PRId64 " frames (%" PRIu64 " steps) in %.2f seconds%s.", isRecording ? "Recorded" : "Matched",
+                  lockstep.frame, lockstep.step, (double)elapsedTime / 1000000.,
+                  didHitIllegalOpcode ? ", stopping at an illegal opcode" : "");
+    }
+
+    if (!isStdio) {
+        fclose(lockstep.file);
+    }
+    freeHeadlessGameBoy(&gb);
+    buf_malloc_free(script);
+    return didSucceed ? 0 : 1;
+}
+
+/*** SingleStepTests ***/
+
+//At most 3 bytes of instruction and 2 written.  Room to spare for any other tests in this format
+#define SM83_MAX_RAM_BYTES 32
+#define SM83_MAX_NAME_LEN 31
+
+struct SM83RAMByte {
+    u16 address;
+    u8 value;
+};
+
+struct SM83State {
+    u16 PC, SP;
+    u8 A, B, C, D, E, F, H, L;
+    u8 ime, ie;
+    SM83RAMByte ram[SM83_MAX_RAM_BYTES];
+    i32 numRAMBytes;
+};
+
+struct SM83Test {
+    char name[SM83_MAX_NAME_LEN + 1];
+    SM83State initial, final;
+    i64 numMCycles;
+};
+
+//Just enough JSON for the test files.  Values it doesn't know are skipped
+struct JSONScanner {
+    const char *c, *end;
+    bool didFail;
+};
+
+static void skipJSONSpace(JSONScanner *s) {
+    while (s->c < s->end && isspace(*s->c)) {
+        s->c++;
+    }
+}
+
+static bool acceptJSONChar(char ch, JSONScanner *s) {
+    skipJSONSpace(s);
+    if (s->c < s->end && *s->c == ch) {
+        s->c++;
+        return true;
+    }
+    return false;
+}
+
+static void expectJSONChar(char ch, JSONScanner *s) {
+    if (!acceptJSONChar(ch, s)) {
+        s->didFail = true;
+    }
+}
+
+static i64 parseJSONInt(JSONScanner *s) {
+    skipJSONSpace(s);
+    char *numberEnd;
+    i64 ret = strtoll(s->c, &numberEnd, 10);
+    if (numberEnd == s->c || numberEnd > s->end) {
+        s->didFail = true;
+    }
+    s->c = numberEnd;
+    return ret;
+}
+
+//cut to maxLen
+static void parseJSONString(char *out, i64 maxLen, JSONScanner *s) {
+    i64 len = 0;
+    if (!acceptJSONChar('"', s)) {
+        s->didFail = true;
+        out[0] = '\0';
+        return;
+    }
+    while (s->c < s->end && *s->c != '"') {
+        if (*s->c == '\\') {
+            s->c++;
+        }
+        if (len < maxLen && s->c < s->end) {
+            out[len++] = *s->c;
+        }
+        s->c++;
+    }
+    out[len] = '\0';
+    expectJSONChar('"', s);
+}
+
+static void skipJSONValue(JSONScanner *s) {
+    char unused[1];
+    skipJSONSpace(s);
+    if (s->c == s->end) {
+        s->didFail = true;
+    }
+    else if (*s->c == '"') {
+        parseJSONString(unused, 0, s);
+    }
+    else if (*s->c == '[' || *s->c == '{') {
+        char close = (*s->c == '[') ? ']' : '}';
+        s->c++;
+        if (!acceptJSONChar(close, s)) {
+            do {
+                if (close == '}') {
+                    parseJSONString(unused, 0, s);
+                    expectJSONChar(':', s);
+                }
+                skipJSONValue(s);
+            } while (!s->didFail && acceptJSONChar(',', s));
+            expectJSONChar(close, s);
+        }
+    }
+    else {
+        //numbers, true, false and null
+        while (s->c < s->end && *s->c != ',' && *s->c != ']' && *s->c != '}' && !isspace(*s->c)) {
+            s->c++;
+        }
+    }
+}
+
+static void parseSM83State(SM83State *state, JSONScanner *s) {
+    *state = {};
+    struct {
+        const char *name;
+        u8 *byte;
+        u16 *word;
+    } fields[] = {
+        {"pc", nullptr, &state->PC}, {"sp", nullptr, &state->SP},
+        {"a", &state->A, nullptr}, {"b", &state->B, nullptr}, {"c", &state->C, nullptr}, {"d", &state->D, nullptr},
+        {"e", &state->E, nullptr}, {"f", &state->F, nullptr}, {"h", &state->H, nullptr}, {"l", &state->L, nullptr},
+        {"ime", &state->ime, nullptr}, {"ie", &state->ie, nullptr},
+    };
+    expectJSONChar('{', s);
+    if (acceptJSONChar('}', s)) {
+        return;
+    }
+    do {
+        char key[8];
+        parseJSONString(key, ARRAY_LEN(key) - 1, s);
+        expectJSONChar(':', s);
+        if (areStringsEqual(key, "ram", 4)) {
+            expectJSONChar('[', s);
+            if (acceptJSONChar(']', s)) {
+                continue;
+            }
+            do {
+                expectJSONChar('[', s);
+                i64 address = parseJSONInt(s);
+                expectJSONChar(',', s);
+                i64 value = parseJSONInt(s);
+                expectJSONChar(']', s);
+                if (state->numRAMBytes == SM83_MAX_RAM_BYTES) {
+                    s->didFail = true;
+                }
+                else {
+                    state->ram[state->numRAMBytes++] = {(u16)address, (u8)value};
+                }
+            } while (!s->didFail && acceptJSONChar(',', s));
+            expectJSONChar(']', s);
+            continue;
+        }
+        bool isKnown = false;
+        foriarr (fields) {
+            if (areStringsEqual(key, fields[i].name, ARRAY_LEN(key))) {
+                i64 value = parseJSONInt(s);
+                if (fields[i].byte) {
+                    *fields[i].byte = (u8)value;
+                }
+                else {
+                    *fields[i].word = (u16)value;
+                }
+                isKnown = true;
+                break;
+            }
+        }
+        if (!isKnown) {
+            skipJSONValue(s);
+        }
+    } while (!s->didFail && acceptJSONChar(',', s));
+    expectJSONChar('}', s);
+}
+
+static void parseSM83Test(SM83Test *test, JSONScanner *s) {
+    *test = {};
+    expectJSONChar('{', s);
+    if (acceptJSONChar('}', s)) {
+        return;
+    }
+    do {
+        char key[16];
+        parseJSONString(key, ARRAY_LEN(key) - 1, s);
+        expectJSONChar(':', s);
+        if (areStringsEqual(key, "name", 5)) {
+            parseJSONString(test->name, SM83_MAX_NAME_LEN, s);
+        }
+        else if (areStringsEqual(key, "initial", 8)) {
+            parseSM83State(&test->initial, s);
+        }
+        else if (areStringsEqual(key, "final", 6)) {
+            parseSM83State(&test->final, s);
+        }
+        else if (areStringsEqual(key, "cycles", 7)) {
+            expectJSONChar('[', s);
+            if (!acceptJSONChar(']', s)) {
+                do {
+                    skipJSONValue(s);
+                    test->numMCycles++;
+                } while (!s->didFail && acceptJSONChar(',', s));
+                expectJSONChar(']', s);
+            }
+        }
+        else {
+            skipJSONValue(s);
+        }
+    } while (!s->didFail && acceptJSONChar(',', s));
+    expectJSONChar('}', s);
+}
+
+static const SM83RAMByte *findSM83RAMByte(const SM83State *state, u16 address) {
+    fori (state->numRAMBytes) {
+        if (state->ram[i].address == address) {
+            return &state->ram[i];
+        }
+    }
+    return nullptr;
+}
+
+//Some test sets start with the opcode already fetched, so PC is one past it and ends one past the next.  Found by
+//where the opcode named by the test is.  Returns how far PC is past the opcode, or -1
+static i32 sm83PCOffset(const SM83Test *test) {
+    u16 opcodes[2];
+    i32 numOpcodes = 0;
+    for (const char *c = test->name; numOpcodes < 2; ) {
+        char *numberEnd;
+        long opcode = strtol(c, &numberEnd, 16);
+        if (numberEnd == c || opcode > 0xFF || (*numberEnd != ' ' && *numberEnd != '\0')) {
+            break;
+        }
+        opcodes[numOpcodes++] = (u16)opcode;
+        c = numberEnd;
+        if (opcode != 0xCB) {
+            break;
+        }
+    }
+    for (i32 offset = 0; offset <= 1 && numOpcodes > 0; offset++) {
+        u16 address = (u16)(test->initial.PC - offset);
+        bool isAt = true;
+        fori (numOpcodes) {
+            const SM83RAMByte *byte = findSM83RAMByte(&test->initial, (u16)(address + i));
+            isAt = isAt && byte && byte->value == opcodes[i];
+        }
+        if (isAt) {
+            return offset;
+        }
+    }
+    return -1;
+}
+
+//Runs one instruction from the test's initial state.  Memory is left as it was found.  Returns false and says why
+//if it doesn't end in the test's final state
+static bool runSM83Test(const SM83Test *test, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, char *outWhy, i64 maxWhyLen) {
+    const SM83State *initial = &test->initial;
+    const SM83State *final = &test->final;
+    u8 *memory = mmu->flatTestMemory;
+    i32 pcOffset = sm83PCOffset(test);
+    if (pcOffset < 0) {
+        snprintf(outWhy, (size_t)maxWhyLen, "its opcode isn't at PC");
+        return false;
+    }
+    fori (initial->numRAMBytes) {
+        memory[initial->ram[i].address] = initial->ram[i].value;
+    }
+    *cpu = {};
+    cpu->PC = (u16)(initial->PC - pcOffset);
+    cpu->SP = initial->SP;
+    cpu->A = initial->A;
+    cpu->B = initial->B;
+    cpu->C = initial->C;
+    cpu->D = initial->D;
+    cpu->E = initial->E;
+    cpu->F = initial->F;
+    cpu->H = initial->H;
+    cpu->L = initial->L;
+    cpu->enableInterrupts = initial->ime != 0;
+    mmu->enabledInterrupts = initial->ie;
+    mmu->requestedInterrupts = 0;
+    mmu->didInterruptsChange = false;
+    gbDebug->stepTrace->numWrites = 0;
+
+    char instruction[MAX_DISASSEMBLY_LEN];
+    i32 len;
+    disassemble(cpu->PC, mmu, instruction, &len);
+    stepCPU(cpu, mmu, gbDebug);
+
+    i64 whyLen = 0;
+#define SM83_MISMATCH(format, ...) do {\
+    if (whyLen < maxWhyLen) {\
+        whyLen += snprintf(outWhy + whyLen, (size_t)(maxWhyLen - whyLen), (whyLen > 0) ? ", " format : format, ##__VA_ARGS__);\
+    }} while (0)
+
+    const struct {
+        const char *name;
+        i64 got, expected;
+    } registers[] = {
+        {"PC", cpu->PC, (u16)(final->PC - pcOffset)}, {"SP", cpu->SP, final->SP},
+        {"A", cpu->A, final->A}, {"F", cpu->F, final->F}, {"B", cpu->B, final->B}, {"C", cpu->C, final->C},
+        {"D", cpu->D, final->D}, {"E", cpu->E, final->E}, {"H", cpu->H, final->H}, {"L", cpu->L, final->L},
+        {"IME", cpu->enableInterrupts, final->ime},
+    };
+    foriarr (registers) {
+        if (registers[i].got != registers[i].expected) {
+            SM83_MISMATCH("%s is $%" PRIX64 ", expected $%" PRIX64, registers[i].name, registers[i].got, registers[i].expected);
+        }
+    }
+    if (test->numMCycles > 0 && cpu->instructionCycles != test->numMCycles * 4) {
+        SM83_MISMATCH("took %d cycles, expected %" PRId64, cpu->instructionCycles, test->numMCycles * 4);
+    }
+    fori (final->numRAMBytes) {
+        const SM83RAMByte *expected = &final->ram[i];
+        if (memory[expected->address] != expected->value) {
+            SM83_MISMATCH("$%04X is $%02X, expected $%02X", expected->address, memory[expected->address], expected->value);
+        }
+    }
+    for (i64 i = 0; i < gbDebug->stepTrace->numWrites && i < MAX_STEP_TRACE_WRITES; i++) {
+        const TracedWrite *write = &gbDebug->stepTrace->writes[i];
+        if (!findSM83RAMByte(final, write->address)) {
+            SM83_MISMATCH("wrote $%02X to $%04X, which it shouldn't have", write->value, write->address);
+        }
+    }
+#undef SM83_MISMATCH
+    if (whyLen > 0 && whyLen < maxWhyLen) {
+        snprintf(outWhy + whyLen, (size_t)(maxWhyLen - whyLen), " (%s)", instruction);
+    }
+
+    fori (initial->numRAMBytes) {
+        memory[initial->ram[i].address] = 0;
+    }
+    fori (final->numRAMBytes) {
+        memory[final->ram[i].address] = 0;
+    }
+    for (i64 i = 0; i < gbDebug->stepTrace->numWrites && i < MAX_STEP_TRACE_WRITES; i++) {
+        memory[gbDebug->stepTrace->writes[i].address] = 0;
+    }
+    return whyLen == 0;
+}
+
+//Vectors are run as they're read, so nothing is kept but the file.  Prints the first failure
+static bool runSM83TestFile(const char *path, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, MemoryStack *fileMemory,
+                            i64 *outNumPassed, i64 *outNumRun) {
+    auto fileResult = readEntireFile(path, fileMemory);
+    if (fileResult.resultCode != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not read %s.", path);
+        return false;
+    }
+    JSONScanner s = {(const char*)fileResult.data, (const char*)fileResult.data + fileResult.size, false};
+    i64 numRun = 0, numPassed = 0;
+    char firstFailure[256] = {};
+    SM83Test test;
+    expectJSONChar('[', &s);
+    if (!acceptJSONChar(']', &s)) {
+        do {
+            parseSM83Test(&test, &s);
+            if (s.didFail) {
+                break;
+            }
+            char why[192];
+            numRun++;
+            if (runSM83Test(&test, cpu, mmu, gbDebug, why, ARRAY_LEN(why))) {
+                numPassed++;
+            }
+            else if (!firstFailure[0]) {
+                snprintf(firstFailure, ARRAY_LEN(firstFailure), "\"%s\": %s", test.name, why);
+            }
+        } while (acceptJSONChar(',', &s));
+        expectJSONChar(']', &s);
+    }
+    freeFileBuffer(&fileResult, fileMemory);
+    if (s.didFail) {
+        PRINT_ERR("%s is not an sm83 test file.", path);
+        return false;
+    }
+
+    if (numPassed == numRun) {
+        PRINT("%s: passed all %" PRId64 ".", path, numRun);
+    }
+    else {
+        PRINT("%s: passed %" PRId64 " of %" PRId64 ". First failure %s", path, numPassed, numRun, firstFailure);
+    }
+    *outNumPassed += numPassed;
+    *outNumRun += numRun;
+    return numPassed == numRun;
+}
+
+static int runSM83Tests(const char **paths, i64 numPaths, MemoryStack *fileMemory) {
+    CPU *cpu = CO_CALLOC(1, CPU);
+    MMU *mmu = CO_CALLOC(1, MMU);
+    GameBoyDebug *gbDebug = CO_CALLOC(1, GameBoyDebug);
+    u8 *memory = CO_CALLOC(0x10000, u8);
+    if (!cpu || !mmu || !gbDebug || !memory) {
+        PRINT_ERR("Could not allocate memory.");
+        return 1;
+    }
+    //only the writes are wanted, as stepCPU() doesn't call onStep()
+    StepTrace trace = {};
+    gbDebug->stepTrace = &trace;
+    mmu->flatTestMemory = memory;
+
+    i64 numFilesPassed = 0, numPassed = 0, numRun = 0;
+    fori (numPaths) {
+        if (runSM83TestFile(paths[i], cpu, mmu, gbDebug, fileMemory, &numPassed, &numRun)) {
+            numFilesPassed++;
+        }
+    }
+    PRINT("Passed %" PRId64 " of %" PRId64 " files (%" PRId64 " of %" PRId64 " tests).",
+          numFilesPassed, numPaths, numPassed, numRun);
+
+    CO_FREE(memory);
+    CO_FREE(gbDebug);
+    CO_FREE(mmu);
+    CO_FREE(cpu);
+    return (numFilesPassed == numPaths) ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    const char *romPath = nullptr;
+    const char *scriptPath = nullptr;
+    const char *tracePath = nullptr;
+    bool isRecording = false;
+    bool isRunningSM83Tests = false;
+    const char **testPaths = nullptr;
+    i64 numFrames = DEFAULT_NUM_FRAMES;
+    i64 granularity = 1;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if ((areStringsEqual(argv[i], "-r", 3) || areStringsEqual(argv[i], "-c", 3)) && hasValue && !tracePath) {
+            isRecording = argv[i][1] == 'r';
+            tracePath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-g", 3) && hasValue) {
+            granularity = atoll(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-f", 3) && hasValue) {
+            numFrames = atoll(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-i", 3) && hasValue) {
+            scriptPath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-j", 3)) {
+            isRunningSM83Tests = true;
+        }
+        else if (argv[i][0] != '-' && isRunningSM83Tests) {
+            buf_malloc_push(testPaths, (const char*)argv[i]);
+        }
+        else if (argv[i][0] != '-' && !romPath) {
+            romPath = argv[i];
+        }
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+    bool isLockstepValid = tracePath && romPath && numFrames > 0 && granularity > 0;
+    bool isSM83Valid = buf_len(testPaths) > 0 && !tracePath && !romPath;
+    if (isRunningSM83Tests ? !isSM83Valid : !isLockstepValid) {
+        printUsage();
+        return 1;
+    }
+
+    if (!initMemory(COMPARE_FILE_MEMORY_SIZE, 0)) {
+        PRINT_ERR("Could not allocate memory.");
+        return 1;
+    }
+    MemoryStack fileMemory;
+    makeMemoryStack(COMPARE_FILE_MEMORY_SIZE, "fileMem", &fileMemory);
+
+    int ret;
+    if (isRunningSM83Tests) {
+        ret = runSM83Tests(testPaths, (i64)buf_len(testPaths), &fileMemory);
+    }
+    else {
+        ret = runLockstep(romPath, scriptPath, tracePath, isRecording, numFrames, granularity, fileMemory);
+    }
+    buf_malloc_free(testPaths);
+    return ret;
+}
@@ -1,7 +1,7 @@
 //Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
 
 #include "config.h"
-#define CMP_STR(stringLiteral) areStringsEqualCaseInsenstive(currentToken.stringValue.data, stringLiteral, currentToken.stringValue.len, sizeof(stringLiteral) - 1) 
+#define CMP_STR(stringLiteral) areStringsEqualCaseInsenstive(parser->currentToken.stringValue.data, stringLiteral, parser->currentToken.stringValue.len, sizeof(stringLiteral) - 1) 
 
 enum class ConfigTokenType {
     Begin, Identifier, Integer,
@@ -22,12 +22,15 @@ struct ConfigToken {
     };
 };
 
-globalvar ConfigToken currentToken;
-globalvar char *stream;
-globalvar int currentLineNumber = 1;
-globalvar int currentPosInLine = 1;
-globalvar char *currentLine;
-globalvar char *previousLine;
+//one per parse, so configs can be parsed on more than one thread
+struct ConfigParser {
+    ConfigToken currentToken;
+    char *stream;
+    int currentLineNumber;
+    int currentPosInLine;
+    char *currentLine;
+    char *previousLine;
+};
 
 static inline bool isIdentifierChar(char c) {
     return isalpha(c) || c == '_';
@@ -56,137 +59,137 @@ static bool areStringsEqualCaseInsenstive(const char *l, const char *r, i64 ln,
 }
 
 
-static void nextToken() {
+static void nextToken(ConfigParser *parser) {
 repeat:
-    currentToken.line = currentLineNumber;
-    currentToken.posInLine = currentPosInLine;
+    parser->currentToken.line = parser->currentLineNumber;
+    parser->currentToken.posInLine = parser->currentPosInLine;
     
-    if (*stream == '\0') {
-        currentToken.type = ConfigTokenType::End; 
+    if (*parser->stream == '\0') {
+        parser->currentToken.type = ConfigTokenType::End; 
     }
-    else if (isblank(*stream)) {
-        while (*stream != '\0' && isblank(*stream)) {
-            stream++;
-            currentPosInLine++;
+    else if (isblank(*parser->stream)) {
+        while (*parser->stream != '\0' && isblank(*parser->stream)) {
+            parser->stream++;
+            parser->currentPosInLine++;
         }
         goto repeat;
     }
-    else if (isNewLineChar(*stream)) {
-        currentToken.type = ConfigTokenType::NewLine;
-        currentToken.stringValue.data = stream;
-        currentToken.stringValue.len = 1;
-        while (*stream != '\0' && isspace(*stream))  {
-            switch (*stream) {
+    else if (isNewLineChar(*parser->stream)) {
+        parser->currentToken.type = ConfigTokenType::NewLine;
+        parser->currentToken.stringValue.data = parser->stream;
+        parser->currentToken.stringValue.len = 1;
+        while (*parser->stream != '\0' && isspace(*parser->stream))  {
+            switch (*parser->stream) {
             case '\n':
-                stream++; 
-                currentPosInLine = 1;
-                currentLineNumber++;
-                previousLine = currentLine;
-                currentLine = stream;
+                parser->stream++; 
+                parser->currentPosInLine = 1;
+                parser->currentLineNumber++;
+                parser->previousLine = parser->currentLine;
+                parser->currentLine = parser->stream;
                 break;
             case '\r':
-                stream++;
-                if (*stream == '\n') {
-                    stream++;
+                parser->stream++;
+                if (*parser->stream == '\n') {
+                    parser->stream++;
                 }
-                currentPosInLine = 1;
-                currentLineNumber++;
-                previousLine = currentLine;
-                currentLine = stream;
+                parser->currentPosInLine = 1;
+                parser->currentLineNumber++;
+                parser->previousLine = parser->currentLine;
+                parser->currentLine = parser->stream;
                 break;
             default:
-                stream++;
-                currentPosInLine++;
+                parser->stream++;
+                parser->currentPosInLine++;
             }
         }
     }
-    else if (stream[0] == '/' && stream[1] == '/') { //comment
-        while (*stream != '\0' && !isNewLineChar(*stream)) {
-            stream++;
-            currentPosInLine++;
+    else if (parser->stream[0] == '/' && parser->stream[1] == '/') { //comment
+        while (*parser->stream != '\0' && !isNewLineChar(*parser->stream)) {
+            parser->stream++;
+            parser->currentPosInLine++;
         }
         goto repeat;
     }
-    else if (isdigit(*stream)) {
-        currentToken.type = ConfigTokenType::Integer;
-        currentToken.stringValue.data = stream;
-        while (*stream != '\0' &&
-               isdigit(*stream)) {
-            stream++;
-            currentPosInLine++;
-        }
-        currentToken.stringValue.len = stream - currentToken.stringValue.data ;
+    else if (isdigit(*parser->stream)) {
+        parser->currentToken.type = ConfigTokenType::Integer;
+        parser->currentToken.stringValue.data = parser->stream;
+        while (*parser->stream != '\0' &&
+               isdigit(*parser->stream)) {
+            parser->stream++;
+            parser->currentPosInLine++;
+        }
+        parser->currentToken.stringValue.len = parser->stream - parser->currentToken.stringValue.data ;
         {
-            char tmp = *stream;
-            *stream = '\0';
-            currentToken.intValue = atoi(currentToken.stringValue.data);
-            *stream = tmp;
+            char tmp = *parser->stream;
+            *parser->stream = '\0';
+            parser->currentToken.intValue = atoi(parser->currentToken.stringValue.data);
+            *parser->stream = tmp;
         }
     }
-    else if (tolower(stream[0]) == 'k' && tolower(stream[1]) == 'e' && stream[2] == 'y') {
-       currentToken.type = ConfigTokenType::KeyKW;
-       currentToken.stringValue.data = stream;
-       currentToken.stringValue.len = 3;
-       stream += 3;
-       currentPosInLine += 3;
+    else if (tolower(parser->stream[0]) == 'k' && tolower(parser->stream[1]) == 'e' && parser->stream[2] == 'y') {
+       parser->currentToken.type = ConfigTokenType::KeyKW;
+       parser->currentToken.stringValue.data = parser->stream;
+       parser->currentToken.stringValue.len = 3;
+       parser->stream += 3;
+       parser->currentPosInLine += 3;
     }
-    else if (tolower(stream[0]) == 'g' && tolower(stream[1]) == 'a' && tolower(stream[2]) == 'm' && 
-             tolower(stream[3]) == 'e' && tolower(stream[4]) == 'p' && tolower(stream[5]) == 'a' &&
-             tolower(stream[6]) == 'd') {
-       currentToken.type = ConfigTokenType::GamepadKW;
-       currentToken.stringValue.data = stream;
-       currentToken.stringValue.len = 7;
-       stream += 7 ;
-       currentPosInLine += 7;
+    else if (tolower(parser->stream[0]) == 'g' && tolower(parser->stream[1]) == 'a' && tolower(parser->stream[2]) == 'm' && 
+             tolower(parser->stream[3]) == 'e' && tolower(parser->stream[4]) == 'p' && tolower(parser->stream[5]) == 'a' &&
+             tolower(parser->stream[6]) == 'd') {
+       parser->currentToken.type = ConfigTokenType::GamepadKW;
+       parser->currentToken.stringValue.data = parser->stream;
+       parser->currentToken.stringValue.len = 7;
+       parser->stream += 7 ;
+       parser->currentPosInLine += 7;
     }
-    else if (tolower(stream[0]) == 'c' && tolower(stream[1]) == 'o' && tolower(stream[2]) == 'm' && 
-             tolower(stream[3]) == 'm' && tolower(stream[4]) == 'a' && tolower(stream[5]) == 'n' &&
-             tolower(stream[6]) == 'd' && tolower(stream[7]) == '-' ) {
-       currentToken.type = ConfigTokenType::CtrlKW;
-       currentToken.stringValue.data = stream;
-       currentToken.stringValue.len = 8;
-       stream += 8 ;
-       currentPosInLine += 8;
+    else if (tolower(parser->stream[0]) == 'c' && tolower(parser->stream[1]) == 'o' && tolower(parser->stream[2]) == 'm' && 
+             tolower(parser->stream[3]) == 'm' && tolower(parser->stream[4]) == 'a' && tolower(parser->stream[5]) == 'n' &&
+             tolower(parser->stream[6]) == 'd' && tolower(parser->stream[7]) == '-' ) {
+       parser->currentToken.type = ConfigTokenType::CtrlKW;
+       parser->currentToken.stringValue.data = parser->stream;
+       parser->currentToken.stringValue.len = 8;
+       parser->stream += 8 ;
+       parser->currentPosInLine += 8;
                 
     }
-    else if (tolower(stream[0]) == 'c' && tolower(stream[1]) == 't' && tolower(stream[2]) == 'r' && 
-             tolower(stream[3]) == 'l' && tolower(stream[4]) == '-') {
-       currentToken.type = ConfigTokenType::CtrlKW;
-       currentToken.stringValue.data = stream;
-       currentToken.stringValue.len = 5;
-       stream += 5;
-       currentPosInLine += 5;
+    else if (tolower(parser->stream[0]) == 'c' && tolower(parser->stream[1]) == 't' && tolower(parser->stream[2]) == 'r' && 
+             tolower(parser->stream[3]) == 'l' && tolower(parser->stream[4]) == '-') {
+       parser->currentToken.type = ConfigTokenType::CtrlKW;
+       parser->currentToken.stringValue.data = parser->stream;
+       parser->currentToken.stringValue.len = 5;
+       parser->stream += 5;
+       parser->currentPosInLine += 5;
     }
-    else if (isIdentifierChar(*stream)) {
-        currentToken.type = ConfigTokenType::Identifier;
-        currentToken.stringValue.data = stream;
-        while (*stream != '\0' &&
-               (isIdentifierChar(*stream) ||
-                isdigit(*stream))) {
-            stream++;
-            currentPosInLine++;
-        }
-        currentToken.stringValue.len = stream - currentToken.stringValue.data ;
+    else if (isIdentifierChar(*parser->stream)) {
+        parser->currentToken.type = ConfigTokenType::Identifier;
+        parser->currentToken.stringValue.data = parser->stream;
+        while (*parser->stream != '\0' &&
+               (isIdentifierChar(*parser->stream) ||
+                isdigit(*parser->stream))) {
+            parser->stream++;
+            parser->currentPosInLine++;
+        }
+        parser->currentToken.stringValue.len = parser->stream - parser->currentToken.stringValue.data ;
     }
-    else if (*stream == '=') {
-        currentToken.type = ConfigTokenType::Equals; 
-        currentToken.charValue.data = '=';
-        currentToken.stringValue.data = stream;
-        currentToken.stringValue.len = 1;
-        stream++;
-        currentPosInLine++;
+    else if (*parser->stream == '=') {
+        parser->currentToken.type = ConfigTokenType::Equals; 
+        parser->currentToken.charValue.data = '=';
+        parser->currentToken.stringValue.data = parser->stream;
+        parser->currentToken.stringValue.len = 1;
+        parser->stream++;
+        parser->currentPosInLine++;
     }
-    else if (*stream == ',') {
-        currentToken.type = ConfigTokenType::Comma;
-        currentToken.charValue.data = ',';
-        currentToken.stringValue.data = stream;
-        currentToken.stringValue.len = 1;
-        stream++;
-        currentPosInLine++;
+    else if (*parser->stream == ',') {
+        parser->currentToken.type = ConfigTokenType::Comma;
+        parser->currentToken.charValue.data = ',';
+        parser->currentToken.stringValue.data = parser->stream;
+        parser->currentToken.stringValue.len = 1;
+        parser->stream++;
+        parser->currentPosInLine++;
     }
     else {
-        u8 leadByte = (u8)*stream;
-        currentToken.stringValue.data = stream;
+        u8 leadByte = (u8)*parser->stream;
+        parser->currentToken.stringValue.data = parser->stream;
         int expectedNumBytes;
         switch (leadByte & 0xF0) {
         case 0xC0: 
@@ -204,39 +207,39 @@ repeat:
         int byteLen = 0;
         int i;
         for (i = 0; i < expectedNumBytes; i++) {
-            currentToken.charValue.string[i] = *stream++;
+            parser->currentToken.charValue.string[i] = *parser->stream++;
             //TODO: handle failure case with 0b11xxxxxx
             byteLen++;
-            if (!isBitSet(7,(u8)*stream)) {
+            if (!isBitSet(7,(u8)*parser->stream)) {
                 break;
             }
         }
-        currentToken.charValue.string[i+1] = '\0';
+        parser->currentToken.charValue.string[i+1] = '\0';
         //TODO: invalid byte TokenType for bad bytes
         
-        currentToken.stringValue.len = byteLen;
-        currentToken.type = ConfigTokenType::Character;
-        currentPosInLine++;
+        parser->currentToken.stringValue.len = byteLen;
+        parser->currentToken.type = ConfigTokenType::Character;
+        parser->currentPosInLine++;
     }
     
     
 }
 
-static bool accept(ConfigTokenType tt) {
-    if (currentToken.type == tt) {
-        nextToken();
+static bool accept(ConfigParser *parser, ConfigTokenType tt) {
+    if (parser->currentToken.type == tt) {
+        nextToken(parser);
         return true;
     }
     return false;
 }
-static inline bool isToken(ConfigTokenType tokenType) {
-    return currentToken.type == tokenType;
+static inline bool isToken(ConfigParser *parser, ConfigTokenType tokenType) {
+    return parser->currentToken.type == tokenType;
 }
 
-static ParserStatus gamepadMapping(GamepadMapping *outGamepadMapping) {
-    outGamepadMapping->posInLine = currentPosInLine;
-    outGamepadMapping->line = currentLineNumber;
-    switch (currentToken.type) {
+static ParserStatus gamepadMapping(ConfigParser *parser, GamepadMapping *outGamepadMapping) {
+    outGamepadMapping->posInLine = parser->currentPosInLine;
+    outGamepadMapping->line = parser->currentLineNumber;
+    switch (parser->currentToken.type) {
     case ConfigTokenType::Identifier:  {
         if (CMP_STR("a")) {
             outGamepadMapping->value = GamepadMappingValue::A;
@@ -294,35 +297,35 @@ static ParserStatus gamepadMapping(GamepadMapping *outGamepadMapping) {
     
     return ParserStatus::OK;
 }
-static ParserStatus keyMapping(KeyMapping *outKeyMapping) {
-    outKeyMapping->posInLine = currentPosInLine;
-    outKeyMapping->line = currentLineNumber;
-    outKeyMapping->textFromFile = currentToken.stringValue;  
-    NonNullTerminatedString startToken = currentToken.stringValue;
+static ParserStatus keyMapping(ConfigParser *parser, KeyMapping *outKeyMapping) {
+    outKeyMapping->posInLine = parser->currentPosInLine;
+    outKeyMapping->line = parser->currentLineNumber;
+    outKeyMapping->textFromFile = parser->currentToken.stringValue;  
+    NonNullTerminatedString startToken = parser->currentToken.stringValue;
 
-    if (currentToken.type == ConfigTokenType::CtrlKW) {
+    if (parser->currentToken.type == ConfigTokenType::CtrlKW) {
        outKeyMapping->isCtrlHeld = true; 
-       nextToken();
-       isize spaceInBetween = currentToken.stringValue.data - 
+       nextToken(parser);
+       isize spaceInBetween = parser->currentToken.stringValue.data - 
                                 (startToken.data + startToken.len);
-       outKeyMapping->textFromFile.len += spaceInBetween + currentToken.stringValue.len;  
+       outKeyMapping->textFromFile.len += spaceInBetween + parser->currentToken.stringValue.len;  
     }
     else {
        outKeyMapping->isCtrlHeld = false; 
     }
 
-    switch (currentToken.type) {
+    switch (parser->currentToken.type) {
     case ConfigTokenType::Equals:
     case ConfigTokenType::Comma:
     case ConfigTokenType::Character:  {
         outKeyMapping->type = KeyMappingType::Character;
-        outKeyMapping->characterValue = currentToken.charValue;
+        outKeyMapping->characterValue = parser->currentToken.charValue;
     } break;
     case ConfigTokenType::Identifier:  {
         outKeyMapping->type = KeyMappingType::MovementKey;
-        if (currentToken.stringValue.len == 1) {
+        if (parser->currentToken.stringValue.len == 1) {
            outKeyMapping->type = KeyMappingType::Character;
-           outKeyMapping->characterValue.data = (u64)tolower(*currentToken.stringValue.data);
+           outKeyMapping->characterValue.data = (u64)tolower(*parser->currentToken.stringValue.data);
         }
         else if (CMP_STR("enter")) {
             outKeyMapping->movementKeyValue = MovementKeyMappingValue::Enter;
@@ -363,15 +366,15 @@ static ParserStatus keyMapping(KeyMapping *outKeyMapping) {
     return ParserStatus::OK;
 }
 
-static ParserStatus configValue(ConfigValue *outConfigValue) {
-    outConfigValue->line = currentToken.line;
-    outConfigValue->posInLine = currentToken.posInLine;
+static ParserStatus configValue(ConfigParser *parser, ConfigValue *outConfigValue) {
+    outConfigValue->line = parser->currentToken.line;
+    outConfigValue->posInLine = parser->currentToken.posInLine;
 
-    if (isToken(ConfigTokenType::KeyKW))  {
+    if (isToken(parser, ConfigTokenType::KeyKW))  {
         outConfigValue->type = ConfigValueType::KeyMapping;
-        outConfigValue->textFromFile = currentToken.stringValue;
-        nextToken();
-        auto res = keyMapping(&outConfigValue->keyMapping);
+        outConfigValue->textFromFile = parser->currentToken.stringValue;
+        nextToken(parser);
+        auto res = keyMapping(parser, &outConfigValue->keyMapping);
         if (res != ParserStatus::OK) {
             return res;
         }
@@ -379,34 +382,34 @@ static ParserStatus configValue(ConfigValue *outConfigValue) {
                 (outConfigValue->keyMapping.textFromFile.data - (outConfigValue->textFromFile.data + outConfigValue->textFromFile.len)) + 
                 outConfigValue->keyMapping.textFromFile.len;
     }
-    else if (isToken(ConfigTokenType::GamepadKW)) {
+    else if (isToken(parser, ConfigTokenType::GamepadKW)) {
         outConfigValue->type = ConfigValueType::GamepadMapping;
-        outConfigValue->textFromFile = currentToken.stringValue;
-        nextToken();
-        outConfigValue->textFromFile.len += (currentToken.stringValue.data - outConfigValue->textFromFile.data - 
-                                             outConfigValue->textFromFile.len) + currentToken.stringValue.len;
-        auto res = gamepadMapping(&outConfigValue->gamepadMapping);
+        outConfigValue->textFromFile = parser->currentToken.stringValue;
+        nextToken(parser);
+        outConfigValue->textFromFile.len += (parser->currentToken.stringValue.data - outConfigValue->textFromFile.data - 
+                                             outConfigValue->textFromFile.len) + parser->currentToken.stringValue.len;
+        auto res = gamepadMapping(parser, &outConfigValue->gamepadMapping);
         if (res != ParserStatus::OK) {
             return res;
         }
     }
-    else if (isToken(ConfigTokenType::Integer)) {
+    else if (isToken(parser, ConfigTokenType::Integer)) {
         outConfigValue->type = ConfigValueType::Integer;
-        outConfigValue->intValue = currentToken.intValue;
-        outConfigValue->textFromFile = currentToken.stringValue;
+        outConfigValue->intValue = parser->currentToken.intValue;
+        outConfigValue->textFromFile = parser->currentToken.stringValue;
     }
     else {
         return ParserStatus::UnknownConfigValue;
     }
     
-    nextToken();
+    nextToken(parser);
     return ParserStatus::OK;
 }
 
-static ParserStatus configKey(ConfigKey *outConfigKey) {
-    outConfigKey->line = currentToken.line;
-    outConfigKey->posInLine = currentToken.posInLine;
-    if (isToken(ConfigTokenType::Identifier)) {
+static ParserStatus configKey(ConfigParser *parser, ConfigKey *outConfigKey) {
+    outConfigKey->line = parser->currentToken.line;
+    outConfigKey->posInLine = parser->currentToken.posInLine;
+    if (isToken(parser, ConfigTokenType::Identifier)) {
         if (CMP_STR("up")) {
             outConfigKey->type = ConfigKeyType::Up;
         }
@@ -464,12 +467,33 @@ static ParserStatus configKey(ConfigKey *outConfigKey) {
         else if (CMP_STR("showcontrols")) {
             outConfigKey->type = ConfigKeyType::ShowControls;
         }
+        else if (CMP_STR("rewindbuffersize")) {
+            outConfigKey->type = ConfigKeyType::RewindBufferSize;
+        }
+        else if (CMP_STR("runahead")) {
+            outConfigKey->type = ConfigKeyType::RunAhead;
+        }
+        else if (CMP_STR("runaheadonsecondcore")) {
+            outConfigKey->type = ConfigKeyType::RunAheadOnSecondCore;
+        }
+        else if (CMP_STR("turbo")) {
+            outConfigKey->type = ConfigKeyType::Turbo;
+        }
+        else if (CMP_STR("toggleturbo")) {
+            outConfigKey->type = ConfigKeyType::ToggleTurbo;
+        }
+        else if (CMP_STR("turbospeed")) {
+            outConfigKey->type = ConfigKeyType::TurboSpeed;
+        }
+        else if (CMP_STR("turbosound")) {
+            outConfigKey->type = ConfigKeyType::TurboSound;
+        }
         else {
             return ParserStatus::UnknownConfigKey;
         }
         
-        outConfigKey->textFromFile = currentToken.stringValue;
-        nextToken();
+        outConfigKey->textFromFile = parser->currentToken.stringValue;
+        nextToken(parser);
     }
     else {
         return ParserStatus::BadTokenStartOfLine;
@@ -479,30 +503,30 @@ static ParserStatus configKey(ConfigKey *outConfigKey) {
     return ParserStatus::OK;
 }
 
-static ParserStatus pair(ConfigPair **outputPairs) {
+static ParserStatus pair(ConfigParser *parser, ConfigPair **outputPairs) {
     ConfigPair configPair;
     ConfigValue tmpRHS;
     configPair.values = nullptr;
     
-    auto res = configKey(&configPair.key);
+    auto res = configKey(parser, &configPair.key);
     if (res != ParserStatus::OK) {
         return res;
     }
     
-    if (!accept(ConfigTokenType::Equals)) {
+    if (!accept(parser, ConfigTokenType::Equals)) {
         return ParserStatus::MissingEquals; 
     }
     
     for (;;) {
-        res = configValue(&tmpRHS);
+        res = configValue(parser, &tmpRHS);
         if (res != ParserStatus::OK) {
             return res;
         }
         
-        if (accept(ConfigTokenType::Comma)) {
+        if (accept(parser, ConfigTokenType::Comma)) {
             buf_malloc_push(configPair.values, tmpRHS); 
         }
-        else if(accept(ConfigTokenType::NewLine) || accept(ConfigTokenType::End)) {
+        else if(accept(parser, ConfigTokenType::NewLine) || accept(parser, ConfigTokenType::End)) {
             buf_malloc_push(configPair.values, tmpRHS); 
             break;
         }
@@ -529,31 +553,35 @@ ParserResult parseConfigFile(const char *fileName) {
         return ret;
     }
     
-    currentToken.type = ConfigTokenType::Begin;
-    stream = currentLine = (char*)fileResult.data;
+    ConfigParser configParser = {};
+    ConfigParser *parser = &configParser;
+    parser->currentLineNumber = 1;
+    parser->currentPosInLine = 1;
+    parser->currentToken.type = ConfigTokenType::Begin;
+    parser->stream = parser->currentLine = (char*)fileResult.data;
     
-    RESIZEM(stream, fileResult.size + 1, char);
-    stream[fileResult.size] = '\0';
-    nextToken();
+    RESIZEM(parser->stream, fileResult.size + 1, char);
+    parser->stream[fileResult.size] = '\0';
+    nextToken(parser);
     
-    while (currentToken.type != ConfigTokenType::End) {
-        while (accept(ConfigTokenType::NewLine)) 
+    while (parser->currentToken.type != ConfigTokenType::End) {
+        while (accept(parser, ConfigTokenType::NewLine)) 
             ;
-        auto res = !isToken(ConfigTokenType::End) ?
-             pair(&ret.configPairs) :
+        auto res = !isToken(parser, ConfigTokenType::End) ?
+             pair(parser, &ret.configPairs) :
                     ParserStatus::OK;
         switch (res) {
         case ParserStatus::OK:
             break;
         default: {
-            ret.errorLineNumber = currentToken.line;
-            ret.errorColumn = currentToken.posInLine;
-            if (currentToken.type != ConfigTokenType::NewLine) {
-                ret.errorToken = currentToken.stringValue.data;
-                ret.errorLine = currentLine;
-                ret.stringAfterErrorToken = ret.errorToken + currentToken.stringValue.len;
+            ret.errorLineNumber = parser->currentToken.line;
+            ret.errorColumn = parser->currentToken.posInLine;
+            if (parser->currentToken.type != ConfigTokenType::NewLine) {
+                ret.errorToken = parser->currentToken.stringValue.data;
+                ret.errorLine = parser->currentLine;
+                ret.stringAfterErrorToken = ret.errorToken + parser->currentToken.stringValue.len;
                 {
-                    char *tmp = currentLine;
+                    char *tmp = parser->currentLine;
                     while (!isNewLineChar(*tmp) && *tmp != '\0') {
                         tmp++;
                     }
@@ -561,14 +589,14 @@ ParserResult parseConfigFile(const char *fileName) {
                         *tmp++ = ' ';
                     }
                     *tmp = '\0';
-                    ret.errorLineLen = tmp - currentLine;
+                    ret.errorLineLen = tmp - parser->currentLine;
                     ret.errorLineLen--; //minus out '\0'
                 }
                 ret.status = res;
             }
             else {
-                *currentToken.stringValue.data = '\0';
-                ret.errorLine = previousLine;
+                *parser->currentToken.stringValue.data = '\0';
+                ret.errorLine = parser->previousLine;
                 ret.status = ParserStatus::UnexpectedNewLine;
             }
             return ret;
@@ -578,7 +606,7 @@ ParserResult parseConfigFile(const char *fileName) {
 
     ret.numConfigPairs = (i64)buf_len(ret.configPairs);
     ret.status = ParserStatus::OK;
-    ret.stream = stream;
+    ret.stream = parser->stream;
     return ret;
 }
 
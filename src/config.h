@@ -22,6 +22,8 @@ enum class ConfigKeyType{
     DebuggerStep, DebuggerContinue, Mute,
     ScreenScale, Pause, ShowDebugger,
     Reset, ShowHomePath, FullScreen, ShowControls,
+    RewindBufferSize, RunAhead, RunAheadOnSecondCore,
+    Turbo, ToggleTurbo, TurboSpeed, TurboSound,
 };
 
 struct NonNullTerminatedString {
@@ -6,6 +6,247 @@
 #define IS_FLAG_CLEAR(flag) ((cpu->F & (int)Flag::flag) == 0)
 #define IS_DOWN(button) (input->newState.button)
 
+/***************************
+ * Reverse stepping journal
+ ***************************/
+//The whole MMU is diffed every step.  VRAM, WRAM and cart RAM are allocated apart from it and are
+//journaled byte by byte in writeByte().  Returns false if the MMU has more pages than the journal has room for
+static bool findJournaledPages(DebugJournal *journal) {
+    static_assert(sizeof(MMU) % 8 == 0 && alignof(MMU) >= 8, "Journaled pages are compared 8 bytes at a time");
+    journal->numPages = 0;
+    for (usize pageStart = 0; pageStart < sizeof(MMU); pageStart += DEBUG_JOURNAL_PAGE_SIZE) {
+        if (journal->numPages == DEBUG_JOURNAL_MAX_PAGES) {
+            CO_ERR("The MMU has more than %d journaled pages. Increase DEBUG_JOURNAL_MAX_PAGES", DEBUG_JOURNAL_MAX_PAGES);
+            journal->numPages = 0;
+            return false;
+        }
+        journal->pages[journal->numPages++] = (u16)(pageStart / DEBUG_JOURNAL_PAGE_SIZE);
+    }
+    return true;
+}
+
+static inline i64 journaledPageLen(u16 page) {
+    i64 start = page * DEBUG_JOURNAL_PAGE_SIZE;
+    return ((i64)sizeof(MMU) - start < DEBUG_JOURNAL_PAGE_SIZE) ? (i64)sizeof(MMU) - start : DEBUG_JOURNAL_PAGE_SIZE;
+}
+
+//pages start on 8 byte boundaries of the MMU and are a multiple of 8 bytes long, so compare 8 bytes at a time
+static inline bool isJournaledPageEqual(const u8 *lhs, const u8 *rhs, i64 len) {
+    const u64 *lhs64 = (const u64*)lhs;
+    const u64 *rhs64 = (const u64*)rhs;
+    u64 difference = 0;
+    for (i64 i = 0; i < len / 8; i++) {
+        difference |= lhs64[i] ^ rhs64[i];
+    }
+    return difference == 0;
+}
+
+static void syncJournalShadow(const MMU *mmu, DebugJournal *journal) {
+    fori (journal->numPages) {
+        i64 start = journal->pages[i] * DEBUG_JOURNAL_PAGE_SIZE;
+        copyMemory((const u8*)mmu + start, journal->shadowMMU + start, journaledPageLen(journal->pages[i]));
+    }
+    journal->isShadowValid = true;
+}
+
+static inline JournalStep *journalStepAt(i64 age, DebugJournal *journal) {
+    return &journal->steps[(journal->oldestStep + age) % DEBUG_JOURNAL_MAX_STEPS];
+}
+
+static void dropOldestJournalStep(DebugJournal *journal) {
+    journal->oldestStep = (journal->oldestStep + 1) % DEBUG_JOURNAL_MAX_STEPS;
+    journal->numSteps--;
+}
+
+//journal can be null, when recording is off
+void clearDebugJournal(DebugJournal *journal) {
+    if (!journal) {
+        return;
+    }
+    journal->oldestStep = 0;
+    journal->numSteps = 0;
+    journal->isStepOpen = false;
+    journal->nextWriteRecord = 0;
+    journal->nextPageRecord = 0;
+    journal->isShadowValid = false;
+}
+
+//The journal is about 24MB, so it only exists while recording for reverse stepping is on.
+//Returns whether recording is on, which it can't be if the journal couldn't be allocated
+bool setDebugJournalEnabled(bool isEnabled, GameBoyDebug *gbDebug) {
+    if (isEnabled && !gbDebug->journal) {
+        DebugJournal *journal = (DebugJournal*)calloc(1, sizeof(DebugJournal));
+        if (!journal) {
+            CO_ERR("Could not allocate %zu bytes for the reverse stepping journal", sizeof(DebugJournal));
+            isEnabled = false;
+        }
+        else if (!findJournaledPages(journal)) {
+            CO_FREE(journal);
+            isEnabled = false;
+        }
+        else {
+            gbDebug->journal = journal;
+        }
+    }
+    else if (!isEnabled && gbDebug->journal) {
+        CO_FREE(gbDebug->journal);
+        gbDebug->journal = nullptr;
+    }
+    gbDebug->isRecordDebugStateEnabled = isEnabled;
+    return isEnabled;
+}
+
+static void journalBeginStep(const CPU *cpu, const MMU *mmu, DebugJournal *journal) {
+    if (!journal->isShadowValid) {
+        syncJournalShadow(mmu, journal);
+    }
+    if (journal->numSteps == DEBUG_JOURNAL_MAX_STEPS) {
+        dropOldestJournalStep(journal);
+    }
+    JournalStep *step = journalStepAt(journal->numSteps++, journal);
+    step->cpu = *cpu;
+    step->firstWriteRecord = journal->nextWriteRecord;
+    step->firstPageRecord = journal->nextPageRecord;
+    journal->isStepOpen = true;
+}
+
+//Called from writeByte() before the write happens
+static void journalMemoryWrite(u16 address, const MMU *mmu, DebugJournal *journal) {
+    JournalWriteRecord record;
+    switch (address) {
+        case 0x8000 ... 0x9FFF: {
+            record.memory = JournaledMemory::VideoRAM;
+            record.offset = (u32)(address - 0x8000);
+            record.oldValue = mmu->lcd.videoRAM[record.offset];
+        } break;
+        case 0xA000 ... 0xBFFF: {
+            if (!mmu->hasRAM || !mmu->isCartRAMEnabled) {
+                return;
+            }
+            i64 offset = address - 0xA000;
+            if (mmu->mbcType != MBCType::MBC0) {
+                if (mmu->currentRAMBank > 3) {
+                    return; //RTC registers, which are paged
+                }
+                offset += 0x2000 * mmu->currentRAMBank;
+            }
+            if (offset >= mmu->cartRAMSize) {
+                return;
+            }
+            record.memory = JournaledMemory::CartRAM;
+            record.offset = (u32)offset;
+            record.oldValue = mmu->cartRAM[offset];
+        } break;
+        case 0xC000 ... 0xFDFF: {
+            record.memory = JournaledMemory::WorkingRAM;
+            record.offset = (u32)((address - 0xC000) & 0x1FFF);
+            record.oldValue = mmu->workingRAM[record.offset];
+        } break;
+        default: return; //paged
+    }
+
+    while (journal->numSteps > 1 &&
+           journal->nextWriteRecord - journalStepAt(0, journal)->firstWriteRecord >= DEBUG_JOURNAL_MAX_WRITE_RECORDS) {
+        dropOldestJournalStep(journal);
+    }
+    journal->writeRecords[journal->nextWriteRecord++ % DEBUG_JOURNAL_MAX_WRITE_RECORDS] = record;
+}
+
+static void journalEndStep(const MMU *mmu, DebugJournal *journal) {
+    fori (journal->numPages) {
+        u16 page = journal->pages[i];
+        i64 start = page * DEBUG_JOURNAL_PAGE_SIZE;
+        i64 len = journaledPageLen(page);
+        const u8 *current = (const u8*)mmu + start;
+        u8 *shadow = journal->shadowMMU + start;
+        if (isJournaledPageEqual(current, shadow, len)) {
+            continue;
+        }
+
+        while (journal->numSteps > 1 &&
+               journal->nextPageRecord - journalStepAt(0, journal)->firstPageRecord >= DEBUG_JOURNAL_MAX_PAGE_RECORDS) {
+            dropOldestJournalStep(journal);
+        }
+        JournalPageRecord *record = &journal->pageRecords[journal->nextPageRecord++ % DEBUG_JOURNAL_MAX_PAGE_RECORDS];
+        record->page = page;
+        copyMemory(shadow, record->oldValue, len);
+        copyMemory(current, shadow, len);
+    }
+    journal->isStepOpen = false;
+}
+
+//Undoes the most recent step.  Returns false if there is nothing to undo
+static bool journalUndoStep(CPU *cpu, MMU *mmu, DebugJournal *journal) {
+    if (journal->numSteps == 0) {
+        return false;
+    }
+    CO_ASSERT(!journal->isStepOpen);
+    JournalStep *step = journalStepAt(journal->numSteps - 1, journal);
+
+    for (i64 r = journal->nextWriteRecord - 1; r >= step->firstWriteRecord; r--) {
+        JournalWriteRecord *record = &journal->writeRecords[r % DEBUG_JOURNAL_MAX_WRITE_RECORDS];
+        switch (record->memory) {
+            case JournaledMemory::VideoRAM: mmu->lcd.videoRAM[record->offset] = record->oldValue; break;
+            case JournaledMemory::WorkingRAM: mmu->workingRAM[record->offset] = record->oldValue; break;
+            case JournaledMemory::CartRAM: {
+                mmu->cartRAM[record->offset] = record->oldValue;
+                if (mmu->hasBattery) {
+                    mmu->host->cartRAMPlatformState.cartRAMFileMap[record->offset] = record->oldValue;
+                }
+            } break;
+        }
+    }
+    journal->nextWriteRecord = step->firstWriteRecord;
+
+    for (i64 r = journal->nextPageRecord - 1; r >= step->firstPageRecord; r--) {
+        JournalPageRecord *record = &journal->pageRecords[r % DEBUG_JOURNAL_MAX_PAGE_RECORDS];
+        copyMemory(record->oldValue, (u8*)mmu + record->page * DEBUG_JOURNAL_PAGE_SIZE, journaledPageLen(record->page));
+    }
+    journal->nextPageRecord = step->firstPageRecord;
+
+    bool isPaused = cpu->isPaused;
+    *cpu = step->cpu;
+    cpu->isPaused = isPaused;
+
+    journal->numSteps--;
+    syncJournalShadow(mmu, journal);
+    return true;
+}
+
+//Returns the number of instructions undone
+i64 stepBackwards(ReverseStepAmount amount, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
+    DebugJournal *journal = gbDebug->journal;
+    if (!journal) {
+        return 0;
+    }
+    u8 startLY = mmu->lcd.ly;
+    i64 numUndone = 0;
+    for (;;) {
+        u8 lyBefore = mmu->lcd.ly;
+        if (!journalUndoStep(cpu, mmu, journal)) {
+            break;
+        }
+        numUndone++;
+        if (amount == ReverseStepAmount::Instruction ||
+            (amount == ReverseStepAmount::Scanline && mmu->lcd.ly != startLY) ||
+            (amount == ReverseStepAmount::Frame && mmu->lcd.ly > lyBefore)) {
+            break;
+        }
+    }
+
+    if (numUndone > 0) {
+#ifndef GB_NO_DEBUGGER_UI
+        foriarr (gbDebug->tiles) {
+            gbDebug->tiles[i].needsUpdate = true;
+        }
+#endif
+        gbDebug->hitBreakpoint = nullptr;
+        gbDebug->shouldRefreshDisassembler = true;
+    }
+    return numUndone;
+}
+
+#ifndef GB_NO_DEBUGGER_UI
 static i32 disassembleInstructionAtAddress(u16 startAddress, MMU *mmu, char *outDisassembledInstruction, size_t maxLen) {
 #define OP(nBPI, str, ...) snprintf(outDisassembledInstruction, maxLen, str, ##__VA_ARGS__);\
     numBytesPerInstruction = nBPI
@@ -331,6 +572,7 @@ static i32 disassembleInstructionAtAddress(u16 startAddress, MMU *mmu, char *out
         }
         gbDebug->numDisassembledInstructions = i;
     }
+#endif
 Breakpoint *hardwareBreakpointForAddress(u16 address, BreakpointExpectedValueType expectedValueType, GameBoyDebug *gbDebug) {
     foriarr (gbDebug->breakpoints) {
         Breakpoint *bp = &gbDebug->breakpoints[i];
@@ -350,6 +592,7 @@ Breakpoint *hardwareBreakpointForAddress(u16 address, BreakpointExpectedValueTyp
     return nullptr;
 }
 
+#ifndef GB_NO_DEBUGGER_UI
 static Breakpoint
 *regularBreakpointForAddress(u16 address, GameBoyDebug *gbDebug) {
     foriarr (gbDebug->breakpoints) {
@@ -929,7 +1172,7 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
         ImGui::SetWindowPos(ImVec2(0, 0), ImGuiCond_Once);
 
         ImGui::Text("Frame time %.2f", gbDebug->frameTimeMS);
-        ImGui::Text("Number of states saved: %zd", gbDebug->numGBStates);
+        ImGui::Text("Rewind frames saved: %" PRId64, gbDebug->rewindBuffer.numFrames);
         ImGui::Text("Mouse X: %d, Y: %d", input->newState.mouseX / DEFAULT_SCREEN_SCALE, input->newState.mouseY/ DEFAULT_SCREEN_SCALE);
         if (ImGui::CollapsingHeader("CPU")) {
             ImGui::Text("A: %X B: %X C: %X D: %X", cpu->A, cpu->B, cpu->C, cpu->D);
@@ -958,13 +1201,20 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
             //ImGui::Text("In BIOS: %s", BOOL_TO_STR(mmu->inBios));
             ImGui::Text("Clock speed: %f cyles", cpu->cylesExecutedThisFrame / (dt/ 1000000.));
             ImGui::Text("Total Cycles: %" PRId64, cpu->totalCycles);
+            ImGui::Text("State Hash: %016" PRIx64, hashGameBoyState(cpu, mmu, &gbDebug->stateHasher));
         }
 
         if (ImGui::CollapsingHeader("Timer/Divider")) {
-            ImGui::Text("Divider: %d", mmu->divider);
-            ImGui::Text("Timer: %d, Timer Enabled: %s", mmu->timer,
+            ImGui::Text("Divider: %d, Divider Counter: %d", readDividerCounter(mmu) >> 8, readDividerCounter(mmu));
+            ImGui::Text("Timer: %d, Timer Enabled: %s", readTimer(mmu),
                         mmu->isTimerEnabled ? "true" : "false");
-            ImGui::Text("Cycles since last incr %d, Timer increment rate: %d", mmu->cyclesSinceTimerIncrement, mmu->timerIncrementRate);
+            if (mmu->isTimerEnabled) {
+                ImGui::Text("Timer increment rate: %d, Cycles until overflow: %" PRId64, (int)mmu->timerIncrementRate,
+                            mmu->eventCycles[(int)ScheduledEvent::TimerOverflow] - mmu->currentCycle);
+            }
+            else {
+                ImGui::Text("Timer increment rate: %d", (int)mmu->timerIncrementRate);
+            }
             ImGui::Text("Timer Modulo: %d", mmu->timerModulo);
             if (mmu->hasRTC) {
                 ImGui::Text("RTC -- Days High: %d, Days: %d, Hours: %d, Minutes %d, Seconds: %d",
@@ -1022,7 +1272,8 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
                         BOOL_TO_STR(isBitSet((int)LCDCBit::VBlankInterrupt,mmu->lcd.stat)),
                         BOOL_TO_STR(isBitSet((int)LCDCBit::HBlankInterrupt,mmu->lcd.stat)));
             if (mmu->isDMAOccurring) {
-                ImGui::Text("DMA src: %X, DMA dest: %X", mmu->currentDMAAddress, 0xFE00 + (mmu->currentDMAAddress & 0xFF));
+                ImGui::Text("DMA src: %X, Cycles left: %" PRId64, mmu->dmaSourceAddress,
+                            mmu->eventCycles[(int)ScheduledEvent::DMAEnd] - mmu->currentCycle);
             }
 
         }
@@ -1107,6 +1358,15 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
                     gbDebug->isSoundViewOpen = true;
                 }
             }
+
+            if (ImGui::Button("Save Slots")) {
+                if (gbDebug->isSaveSlotsViewOpen) {
+                    ImGui::SetWindowFocus("Save Slots"); 
+                }
+                else {
+                    gbDebug->isSaveSlotsViewOpen = true;
+                }
+            }
 #ifdef CO_PROFILE 
             if (ImGui::Button("Profiler")) {
                 if (gbDebug->isProfilerOpen) {
@@ -1121,34 +1381,25 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
 
         if (ImGui::CollapsingHeader("Debug Controls", ImGuiTreeNodeFlags_DefaultOpen)) {
             if (gbDebug->isRecordDebugStateEnabled && cpu->isPaused) {
-                ImGui::Text("Number of instructions recorded: %d", gbDebug->numDebugStates);
+                ImGui::Text("Number of instructions recorded: %" PRId64, gbDebug->journal->numSteps);
             }
             if (cpu->isPaused) {
                 if (ImGui::Button("Step")) {
                     step(cpu, mmu, gbDebug, programState->soundState.volume);
                     gbDebug->shouldRefreshDisassembler = true;
                 }
-                if (gbDebug->numDebugStates > 0) {
+                if (gbDebug->journal && gbDebug->journal->numSteps > 0) {
                     ImGui::SameLine();
                     if (ImGui::Button("Back")) {
-
-                        if (gbDebug->currentDebugState - 1 < 0) {
-                            gbDebug->currentDebugState = ARRAY_LEN(gbDebug->prevGBDebugStates) - 1;
-                        }
-                        else {
-                            gbDebug->currentDebugState--;
-                        }
-                        gbDebug->numDebugStates--;
-
-
-                        auto prevDebugState = &gbDebug->prevGBDebugStates[gbDebug->currentDebugState];
-                        *cpu = prevDebugState->cpu;
-
-                        if (mmu->hasRAM) {
-                            copyMemory(prevDebugState->mmu.cartRAM, mmu->cartRAM, mmu->cartRAMSize);
-                        }
-                        *mmu = prevDebugState->mmu;
-                        setPausedState(true, programState, cpu);
+                        stepBackwards(ReverseStepAmount::Instruction, cpu, mmu, gbDebug);
+                    }
+                    ImGui::SameLine();
+                    if (ImGui::Button("Back Scanline")) {
+                        stepBackwards(ReverseStepAmount::Scanline, cpu, mmu, gbDebug);
+                    }
+                    ImGui::SameLine();
+                    if (ImGui::Button("Back Frame")) {
+                        stepBackwards(ReverseStepAmount::Frame, cpu, mmu, gbDebug);
                     }
                 }
                 ImGui::SameLine();
@@ -1167,17 +1418,16 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
             }
             ImGui::SameLine();
             if (ImGui::Button("Reset")) {
+                stopMovie(cpu, mmu, gbDebug, programState);
                 reset(cpu, mmu, gbDebug, programState);
                 gbDebug->shouldRefreshDisassembler = true;
             }
             //ImGui::SameLine();
             //ImGui::Checkbox("Skip Boot Screen", &gbDebug->shouldSkipBootScreen);
 
-            ImGui::Checkbox("Debug Recording (Slow)", &gbDebug->isRecordDebugStateEnabled);
-
-            if (!gbDebug->isRecordDebugStateEnabled && !cpu->isPaused) {
-                gbDebug->numDebugStates = 0;
-
+            bool isRecordDebugStateEnabled = gbDebug->isRecordDebugStateEnabled;
+            if (ImGui::Checkbox("Record for Reverse Stepping", &isRecordDebugStateEnabled)) {
+                setDebugJournalEnabled(isRecordDebugStateEnabled, gbDebug);
             }
         }
 
@@ -1191,6 +1441,30 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
             }
         }
 
+        Movie *movie = &programState->movie;
+        if (movie->mode != MovieMode::None && ImGui::CollapsingHeader("Movie", ImGuiTreeNodeFlags_DefaultOpen)) {
+            ImGui::Text("%s", movie->path);
+            if (movie->mode == MovieMode::Recording) {
+                ImGui::Text("Recording frame %" PRId64, movie->currentFrame);
+                if (ImGui::Button("Stop Recording")) {
+                    stopMovie(cpu, mmu, gbDebug, programState);
+                }
+            }
+            else {
+                if (movie->desyncFrame >= 0) {
+                    ImGui::TextColored(ImVec4(255, 0, 0, 255), "Desynced at frame %" PRId64, movie->desyncFrame);
+                }
+                int frame = (int)movie->currentFrame;
+                if (ImGui::SliderInt("Frame", &frame, 0, (int)buf_len(movie->inputs))) {
+                    seekMovie(frame, cpu, mmu, gbDebug, movie);
+                    gbDebug->shouldRefreshDisassembler = true;
+                }
+                if (ImGui::Button("Stop Playing")) {
+                    stopMovie(cpu, mmu, gbDebug, programState);
+                }
+            }
+        }
+
 #ifdef CO_DEBUG
         if (ImGui::CollapsingHeader("Program Memory")) {
             auto mss = memorySnapShot();
@@ -1378,6 +1652,46 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
         }
         ImGui::End();
     }
+    if (gbDebug->isSaveSlotsViewOpen) {
+        if (ImGui::Begin("Save Slots", &gbDebug->isSaveSlotsViewOpen, ImGuiWindowFlags_AlwaysAutoResize)) {
+            if (ImGui::GetWindowPos().x == 0 && ImGui::GetWindowPos().y == 0) {
+                ImGui::SetWindowPos(ImVec2(debugDataSize.x, 0), ImGuiCond_Once);
+            }
+            const ImU32 shades[] = {
+                IM_COL32(0xFF, 0xFF, 0xFF, 0xFF), IM_COL32(0xAA, 0xAA, 0xAA, 0xFF),
+                IM_COL32(0x55, 0x55, 0x55, 0xFF), IM_COL32(0x00, 0x00, 0x00, 0xFF)
+            };
+            const float pixelSize = 2;
+            i64 now = unixWallClockTime();
+            fori (NUM_SAVE_SLOTS) {
+                SaveSlotIndexEntry entry;
+                if (!getSaveSlotIndexEntry((int)i, &programState->saveStateWriter, &entry)) {
+                    ImGui::Text("Slot %d: Empty", (int)i);
+                    continue;
+                }
+
+                ImVec2 topLeft = ImGui::GetCursorScreenPos();
+                ImDrawList *drawList = ImGui::GetWindowDrawList();
+                for (int y = 0; y < SAVE_SLOT_THUMBNAIL_HEIGHT; y++) {
+                    for (int x = 0; x < SAVE_SLOT_THUMBNAIL_WIDTH; x++) {
+                        int pixel = y * SAVE_SLOT_THUMBNAIL_WIDTH + x;
+                        int shade = (entry.thumbnail[pixel / 4] >> ((pixel % 4) * 2)) & 0x3;
+                        ImVec2 a(topLeft.x + (float)x * pixelSize, topLeft.y + (float)y * pixelSize);
+                        drawList->AddRectFilled(a, ImVec2(a.x + pixelSize, a.y + pixelSize), shades[shade]);
+                    }
+                }
+                ImGui::Dummy(ImVec2(SAVE_SLOT_THUMBNAIL_WIDTH * pixelSize, SAVE_SLOT_THUMBNAIL_HEIGHT * pixelSize));
+                ImGui::SameLine();
+
+                i64 secondsPlayed = (entry.frameCount * CYCLES_PER_FRAME) / CLOCK_SPEED_HZ;
+                i64 minutesAgo = (now - entry.timestamp) / 60;
+                ImGui::Text("Slot %d\nPlayed: %" PRId64 ":%02d:%02d\nSaved %" PRId64 " minutes ago", (int)i,
+                            secondsPlayed / 3600, (int)((secondsPlayed / 60) % 60), (int)(secondsPlayed % 60),
+                            minutesAgo);
+            }
+        }
+        ImGui::End();
+    }
     if (gbDebug->isDisassemblerOpen)  {
         if (gbDebug->shouldRefreshDisassembler) {
             refreshDisassemblerIfOpen(gbDebug, mmu);
@@ -1551,7 +1865,7 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
         if (ImGui::Begin("Sound Debug", &gbDebug->isSoundViewOpen, ImGuiWindowFlags_AlwaysAutoResize)) {
             ImGui::Text("Is muted: %s", soundState->isMuted ? "true" : "false");
 
-            ImGui::Text("Samples backed up %zd", (isize)mmu->soundFramesBuffer.numItemsQueued);
+            ImGui::Text("Samples backed up %zd", (isize)mmu->host->soundFramesBuffer.numItemsQueued);
             ImGui::Text("Cycles since last frame seq tick: %d", mmu->cyclesSinceLastFrameSequencer);
             ImGui::Text("Master Left Volume: %d  Master Right Volume %d", mmu->masterLeftVolume, mmu->masterRightVolume); 
 
@@ -1782,3 +2096,12 @@ void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *progr
     //            CO_ASSERT(soundState->buffer.data[i].value == 0);
     //        }
 }
+#else
+void drawDebugger(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *programState, TimeUS dt) {
+    UNUSED(gbDebug);
+    UNUSED(mmu);
+    UNUSED(cpu);
+    UNUSED(programState);
+    UNUSED(dt);
+}
+#endif
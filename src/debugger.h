@@ -51,6 +51,74 @@ struct Breakpoint {
     u16 expectedValue;
 };
 
+//Reverse stepping journal.  Rather than copying the whole CPU and MMU before every instruction,
+//each step logs the CPU, the old value of every VRAM, WRAM and cart RAM byte it wrote, and the
+//old contents of the small pages of the rest of the MMU that it changed.  The screen buffers
+//are not journaled.
+#define DEBUG_JOURNAL_PAGE_SIZE 64
+#define DEBUG_JOURNAL_MAX_PAGES 64 //pages of MMU state
+#define DEBUG_JOURNAL_MAX_STEPS 0x10000
+#define DEBUG_JOURNAL_MAX_WRITE_RECORDS 0x40000
+#define DEBUG_JOURNAL_MAX_PAGE_RECORDS 0x40000
+
+enum class JournaledMemory : u8 {
+    VideoRAM, WorkingRAM, CartRAM
+};
+struct JournalWriteRecord {
+    u32 offset;
+    JournaledMemory memory;
+    u8 oldValue;
+};
+struct JournalPageRecord {
+    u16 page;
+    u8 oldValue[DEBUG_JOURNAL_PAGE_SIZE];
+};
+struct JournalStep {
+    CPU cpu;
+    //records for this step go up to the next step's.  These never wrap, index with % max
+    i64 firstWriteRecord;
+    i64 firstPageRecord;
+};
+struct DebugJournal {
+    JournalStep steps[DEBUG_JOURNAL_MAX_STEPS];
+    i64 oldestStep;
+    i64 numSteps;
+    bool isStepOpen; //between journalBeginStep() and journalEndStep()
+    
+    JournalWriteRecord writeRecords[DEBUG_JOURNAL_MAX_WRITE_RECORDS];
+    i64 nextWriteRecord;
+    JournalPageRecord pageRecords[DEBUG_JOURNAL_MAX_PAGE_RECORDS];
+    i64 nextPageRecord;
+    
+    //MMU as of the end of the last step.  Only the journaled pages are kept up to date
+    u8 shadowMMU[sizeof(MMU)];
+    bool isShadowValid;
+    u16 pages[DEBUG_JOURNAL_MAX_PAGES];
+    i64 numPages;
+};
+
+//Lockstep tracing, for tools that check one build of the core against another (see compare_main.cpp).
+//While GameBoyDebug::stepTrace is set, every memory write is logged to it, and onStep() is called at the
+//end of every step(), which should take the writes.  DMA copies straight into OAM, so a step writes 2 at most.
+//Only built with GB_STEP_TRACE, so other builds don't check for it on every write
+#ifdef GB_STEP_TRACE
+#define MAX_STEP_TRACE_WRITES 16
+struct TracedWrite {
+    u16 address;
+    u8 value;
+};
+struct StepTrace {
+    void (*onStep)(CPU *cpu, MMU *mmu, StepTrace *trace);
+    void *context;
+    TracedWrite writes[MAX_STEP_TRACE_WRITES];
+    i64 numWrites; //keeps counting past MAX_STEP_TRACE_WRITES
+};
+#endif
+
+enum class ReverseStepAmount {
+    Instruction, Scanline, Frame
+};
+
 struct GameBoyDebug {
     Breakpoint breakpoints[16];
     Breakpoint *hitBreakpoint;
@@ -63,6 +131,7 @@ struct GameBoyDebug {
     bool isOAMViewOpen;
     bool isBreakpointsViewOpen;
     bool isBackgroundTileMapOpen;
+    bool isSaveSlotsViewOpen;
 #ifdef CO_PROFILE
     bool isProfilerOpen;
     char lastFileNameWritten[MAX_PATH_LEN];
@@ -76,8 +145,11 @@ struct GameBoyDebug {
     i64 numBreakpoints;
     i64 debugNumPreviousSoundSamples;
 
+#ifndef GB_NO_DEBUGGER_UI
+    //over 2MB, and only the disassembler window uses it
     u16 disassembledInstructionAddresses[MAX_INSTRUCTIONS];
     char disassembledInstructions[MAX_INSTRUCTIONS][MAX_INSTRUCTION_LEN];
+#endif
     char disassemblerSearchString[MAX_INSTRUCTION_LEN];
     bool shouldHighlightSearch;
     bool didSearchFail;
@@ -85,24 +157,25 @@ struct GameBoyDebug {
     i64 numDisassembledInstructions;
     bool shouldRefreshDisassembler;
     bool wasCPUPaused;
+    GameBoyStateHasher stateHasher; //allocated the first time the state hash is shown
     
-    i64 nextFreeGBStateIndex;
-    isize numGBStates;
-    TimeUS elapsedTimeSinceLastRecord;
     double frameTimeMS;
-    GameBoyState recordedGBStates[60];
+    RewindBuffer rewindBuffer;
     
-    GameBoyState prevGBDebugStates[60]; //used for debugging
-    int numDebugStates;
-    i64 currentDebugState;
+    DebugJournal *journal; //only allocated while isRecordDebugStateEnabled is set.  See setDebugJournalEnabled()
     bool isRecordDebugStateEnabled;
+#ifdef GB_STEP_TRACE
+    StepTrace *stepTrace;
+#endif
     
+#ifndef GB_NO_DEBUGGER_UI
     struct Tile {
         bool needsUpdate;
         ColorID pixels[64];
         void *textureID;
     }; 
     Tile tiles[0x200]; 
+#endif
     
     //Input
     char inputText[32]; //32 is based on SDL
@@ -8,9 +8,12 @@
 #include "gbemu.h"
 #include "debugger.cpp"
 #include "serialize.cpp"
+#include "rewind.cpp"
+#include "savewriter.cpp"
+#include "movie.cpp"
+#include "runahead.cpp"
+#include "romcache.cpp"
 
-#define MAX_LY 153
-#define TOTAL_SCANLINE_DURATION 456
 #define HBLANK_DURATION 204
 #define VBLANK_DURATION 456
 #define SCAN_OAM_DURATION 80
@@ -83,135 +86,262 @@ updateColorPaletteFromU8(PaletteColor *palette, u8 val) {
     }
 }
 
+static inline void requestInterrupt(InterruptRequestedBit interrupt, MMU *mmu) {
+    setBit((int)interrupt, &mmu->requestedInterrupts);
+    mmu->didInterruptsChange = true;
+}
 
-u8 readByte(u16 address, MMU *mmu) {
-    LCD *lcd = &mmu->lcd;
+static void scheduleEvent(ScheduledEvent event, i64 cycle, MMU *mmu) {
+    mmu->eventCycles[(int)event] = cycle;
+    mmu->nextEventCycle = EVENT_NOT_SCHEDULED;
+    foriarr (mmu->eventCycles) {
+        if (mmu->eventCycles[i] < mmu->nextEventCycle) {
+            mmu->nextEventCycle = mmu->eventCycles[i];
+        }
+    }
+}
+
+void clearScheduledEvents(MMU *mmu) {
+    foriarr (mmu->eventCycles) {
+        mmu->eventCycles[i] = EVENT_NOT_SCHEDULED;
+    }
+    mmu->nextEventCycle = EVENT_NOT_SCHEDULED;
+}
+
+static inline i64 dividerCounterAtCycle(i64 cycle, MMU *mmu) {
+    CO_ASSERT(cycle >= mmu->dividerBaseCycle);
+    return cycle - mmu->dividerBaseCycle;
+}
+
+u16 readDividerCounter(MMU *mmu) {
+    return (u16)dividerCounterAtCycle(mmu->currentCycle, mmu);
+}
+
+u8 readTimer(MMU *mmu) {
+    if (!mmu->isTimerEnabled) {
+        return mmu->timerBaseValue;
+    }
+    //a tick happens every time the counter passes a multiple of the increment rate
+    i64 rate = (i64)mmu->timerIncrementRate;
+    i64 ticks = dividerCounterAtCycle(mmu->currentCycle, mmu) / rate -
+        dividerCounterAtCycle(mmu->timerBaseCycle, mmu) / rate;
+    i64 ret = mmu->timerBaseValue + ticks;
+    if (ret > 0xFF) {
+        //overflowed, but the overflow event hasn't fired yet
+        ret = mmu->timerModulo + (ret - 0x100) % (0x100 - mmu->timerModulo);
+    }
+    
+    return (u8)ret;
+}
+
+static void scheduleTimerOverflow(MMU *mmu) {
+    if (!mmu->isTimerEnabled) {
+        scheduleEvent(ScheduledEvent::TimerOverflow, EVENT_NOT_SCHEDULED, mmu);
+        return;
+    }
+    i64 rate = (i64)mmu->timerIncrementRate;
+    i64 ticksUntilOverflow = 0x100 - mmu->timerBaseValue;
+    i64 overflowCounter = (dividerCounterAtCycle(mmu->timerBaseCycle, mmu) / rate + ticksUntilOverflow) * rate;
+    scheduleEvent(ScheduledEvent::TimerOverflow, mmu->dividerBaseCycle + overflowCounter, mmu);
+}
+
+//folds the ticks so far into timerBaseValue, so the divider or TAC can be changed
+static void rebaseTimer(MMU *mmu) {
+    mmu->timerBaseValue = readTimer(mmu);
+    mmu->timerBaseCycle = mmu->currentCycle;
+}
+
+static void incrementTimer(MMU *mmu) {
+    if (mmu->timerBaseValue == 0xFF) {
+        mmu->timerBaseValue = mmu->timerModulo;
+        requestInterrupt(InterruptRequestedBit::TimerRequested, mmu);
+    }
+    else {
+        mmu->timerBaseValue++;
+    }
+}
+
+//the signal TIMA counts the falling edges of
+static inline bool isTimerSignalHigh(MMU *mmu) {
+    i64 bitToCheck = (i64)mmu->timerIncrementRate / 2;
+    return mmu->isTimerEnabled && (dividerCounterAtCycle(mmu->currentCycle, mmu) & bitToCheck);
+}
+
+void restoreTimers(u16 dividerCounter, u8 timer, MMU *mmu) {
+    mmu->dividerBaseCycle = mmu->currentCycle - dividerCounter;
+    mmu->timerBaseCycle = mmu->currentCycle;
+    mmu->timerBaseValue = timer;
+    scheduleTimerOverflow(mmu);
+}
+
+static void handleTimerOverflow(i64 overflowCycle, MMU *mmu) {
+    mmu->timerBaseValue = mmu->timerModulo;
+    mmu->timerBaseCycle = overflowCycle;
+    requestInterrupt(InterruptRequestedBit::TimerRequested, mmu);
+    scheduleTimerOverflow(mmu);
+}
+
+//the byte goes out to the host, and since nothing is connected, 1s come in
+static void finishSerialTransfer(MMU *mmu) {
+    SerialOutput *output = &mmu->host->serialOutput;
+    if (output->len < output->capacity) {
+        output->data[output->len++] = mmu->serialData;
+    }
+    mmu->serialData = 0xFF;
+    mmu->isSerialTransferring = false;
+    requestInterrupt(InterruptRequestedBit::SerialRequested, mmu);
+}
+
+enum class MemoryBus {
+    External, //ROM, cart RAM and working RAM
+    VideoRAM,
+    OAM,
+    Internal //I/O registers and HRAM
+};
+
+static inline MemoryBus memoryBusForAddress(u16 address) {
     switch (address) {
-        case 0 ... 0xFF: {
-            //        if (mmu->inBios) {
-            //            return BIOS[address];
-            //        }
-            //        else {
-            //            return mmu->romData[address];
-            //        }
-            return mmu->romData[address];
-        }break;
-        
-        case 0x100 ... 0x3FFF: return mmu->romData[address];
+        case 0x8000 ... 0x9FFF: return MemoryBus::VideoRAM;
+        case 0xFE00 ... 0xFE9F: return MemoryBus::OAM;
+        case 0xFEA0 ... 0xFFFF: return MemoryBus::Internal;
+        default: return MemoryBus::External;
+    }
+}
+
+//while DMA runs, the CPU can't use OAM or the bus DMA is reading from
+static inline bool isBlockedByDMA(u16 address, MMU *mmu) {
+    if (!mmu->isDMAOccurring) {
+        return false;
+    }
+    MemoryBus bus = memoryBusForAddress(address);
+    return bus == MemoryBus::OAM || bus == memoryBusForAddress(mmu->dmaSourceAddress);
+}
+
+//what the CPU reads from a bus DMA is using
+static inline u8 readByteBlockedByDMA(u16 address, MMU *mmu) {
+    if (memoryBusForAddress(address) == MemoryBus::OAM) {
+        return 0xFF;
+    }
+    //the byte DMA is transferring at this moment.  OAM already holds it
+    i64 index = (mmu->currentCycle - mmu->dmaStartCycle) / DMA_CYCLES_PER_BYTE;
+    if (index >= (i64)ARRAY_LEN(mmu->lcd.oam)) {
+        index = ARRAY_LEN(mmu->lcd.oam) - 1;
+    }
+    return mmu->lcd.oam[index];
+}
+
+//memory DMA copies from, or null if it has to go through readByte()
+static const u8 *dmaSourceMemory(u16 address, MMU *mmu) {
+    switch (address) {
+        case 0 ... 0x3FFF: return mmu->romData + address;
         case 0x4000 ... 0x7FFF: {
-            switch (mmu->mbcType) {
-                case MBCType::MBC0: 
-                return mmu->romData[address];
-                case MBCType::MBC1: 
-                case MBCType::MBC3: 
-                case MBCType::MBC5:
-                return mmu->romData[address + (0x4000 * (mmu->currentROMBank - 1))];
-            }
-        } break;
-        case 0x8000 ... 0x9FFF: {
-            //vram can only be properly accessed when not being drawn from
-            //         return (lcd->mode != LCDMode::ScanVRAMAndOAM) ? lcd->videoRAM[address - 0x8000] : 0xFF;
-            return lcd->videoRAM[address - 0x8000];
-        } break;
-        case 0xA000 ... 0xBFFF: {
-            if (mmu->hasRAM && mmu->isCartRAMEnabled) {
-                switch (mmu->mbcType) {
-                    case MBCType::MBC0: 
-                    return mmu->cartRAM[address - 0xA000];
-                    case MBCType::MBC1: 
-                    case MBCType::MBC5:
-                    return mmu->cartRAM[(address - 0xA000) +  (0x2000 * mmu->currentRAMBank)];
-                    case MBCType::MBC3: {
-                        if (mmu->currentRAMBank <= 3) {
-                            return mmu->cartRAM[(address - 0xA000) +  (0x2000 * mmu->currentRAMBank)];
-                        }
-                        else if (mmu->currentRAMBank >= 0x8 &&
-                                 mmu->currentRAMBank <= 0xC) {
-                            switch (mmu->currentRAMBank) {
-                                case 0x8: return mmu->rtc.latchedSeconds;
-                                case 0x9: return mmu->rtc.latchedMinutes;
-                                case 0xA: return mmu->rtc.latchedHours;
-                                case 0xB: return mmu->rtc.latchedDays;
-                                case 0xC: return mmu->rtc.latchedMisc;
-                                default: return 0xFF;
-                            }
-                        }
-                        else {
-                            return 0xFF;
-                        }
-                    } break;
-                }
+            if (mmu->mbcType == MBCType::MBC0) {
+                return mmu->romData + address;
             }
-            else {
-                return 0xFF;
+            return mmu->romData + address + (0x4000 * (mmu->currentROMBank - 1));
+        }
+        case 0x8000 ... 0x9FFF: return mmu->lcd.videoRAM + (address - 0x8000);
+        case 0xC000 ... 0xDFFF: return mmu->workingRAM + (address - 0xC000);
+        case 0xE000 ... 0xFDFF: return mmu->workingRAM + (address - 0xE000);
+        default: return nullptr; //cart RAM and RTC registers
+    }
+}
+
+//fires every event that is due by mmu->currentCycle, in order
+static void processScheduledEvents(MMU *mmu) {
+    while (mmu->nextEventCycle <= mmu->currentCycle) {
+        i64 eventCycle = mmu->nextEventCycle;
+        ScheduledEvent event = ScheduledEvent::NumEvents;
+        foriarr (mmu->eventCycles) {
+            if (mmu->eventCycles[i] == eventCycle) {
+                event = (ScheduledEvent)i;
+                break;
             }
-        } break;
-        case 0xC000 ... 0xDFFF: return mmu->workingRAM[address - 0xC000];
-        case 0xE000 ... 0xFDFF: return mmu->workingRAM[address - 0xE000];
-        case 0xFE00 ... 0xFE9F: {
-            //            switch (lcd->mode) {
-            //            case LCDMode::ScanVRAMAndOAM:
-            //            case LCDMode::ScanOAM:
-            //                return 0xFF;
+        }
+        scheduleEvent(event, EVENT_NOT_SCHEDULED, mmu);
+        
+        switch (event) {
+            case ScheduledEvent::TimerOverflow: handleTimerOverflow(eventCycle, mmu); break;
+            case ScheduledEvent::DMAEnd: mmu->isDMAOccurring = false; break;
+            case ScheduledEvent::SerialTransferEnd: finishSerialTransfer(mmu); break;
+            case ScheduledEvent::NumEvents: CO_ASSERT(!"Invalid event"); break;
+        }
+    }
+}
+
+
+static u8 readJoyPadRegister(u16 address, MMU *mmu) {
+    UNUSED(address);
+    u8 joyPadReg = 0xCF;
+    
+    switch (mmu->joyPad.selectedButtonGroup) {
+        case JPButtonGroup::DPad: {
+            joyPadReg = 0xE0;
+            
+            joyPadReg |= (int)mmu->joyPad.down << 3;
+            joyPadReg |= (int)mmu->joyPad.up << 2;
+            joyPadReg |= (int)mmu->joyPad.left << 1;
+            joyPadReg |= (int)mmu->joyPad.right << 0;
             
-            //            default: return lcd->oam[address - 0xFE00];
-            //            }
-            return lcd->oam[address - 0xFE00];
         } break;
-        case 0xFF00: {
-            u8 joyPadReg = 0xCF;
+        
+        case JPButtonGroup::FaceButtons: {
+            joyPadReg = 0xD0;
             
-            switch (mmu->joyPad.selectedButtonGroup) {
-                case JPButtonGroup::DPad: {
-                    joyPadReg = 0xE0;
-                    
-                    joyPadReg |= (int)mmu->joyPad.down << 3;
-                    joyPadReg |= (int)mmu->joyPad.up << 2;
-                    joyPadReg |= (int)mmu->joyPad.left << 1;
-                    joyPadReg |= (int)mmu->joyPad.right << 0;
-                    
-                } break;
-                
-                case JPButtonGroup::FaceButtons: {
-                    joyPadReg = 0xD0;
-                    
-                    joyPadReg |= (int)mmu->joyPad.start << 3;
-                    joyPadReg |= (int)mmu->joyPad.select << 2;
-                    joyPadReg |= (int)mmu->joyPad.b << 1;
-                    joyPadReg |= (int)mmu->joyPad.a << 0;
-                    
-                } break;
-                
-                case JPButtonGroup::Nothing: break;
-                
-            }
+            joyPadReg |= (int)mmu->joyPad.start << 3;
+            joyPadReg |= (int)mmu->joyPad.select << 2;
+            joyPadReg |= (int)mmu->joyPad.b << 1;
+            joyPadReg |= (int)mmu->joyPad.a << 0;
             
-            return joyPadReg;
         } break;
         
-        case 0xFF04: return mmu->divider;
-        case 0xFF05: return mmu->timer;
+        case JPButtonGroup::Nothing: break;
+        
+    }
+    
+    return joyPadReg;
+}
+
+static u8 readTimerRegister(u16 address, MMU *mmu) {
+    switch (address) {
+        case 0xFF04: return (u8)(readDividerCounter(mmu) >> 8);
+        case 0xFF05: return readTimer(mmu);
         case 0xFF06: return mmu->timerModulo;
         case 0xFF07: {
             u8 ret = 0;
             if (mmu->isTimerEnabled) {
                 setBit(2, &ret);
             }
-            
+        
             switch (mmu->timerIncrementRate) {
                 case TimerIncrementRate::TIR_0: break;
                 case TimerIncrementRate::TIR_1: ret |= 1; break;
                 case TimerIncrementRate::TIR_2: ret |= 2; break;
                 case TimerIncrementRate::TIR_3: ret |= 3; break;
             }
-            
+        
             return ret;
         } break;
-        
-        
-        //TODO
-        case 0xFF0F: return mmu->requestedInterrupts;
-        
+        default: return 0;
+    }
+}
+
+static u8 readSerialRegister(u16 address, MMU *mmu) {
+    switch (address) {
+        case 0xFF01: return mmu->serialData;
+        case 0xFF02: return (u8)(0x7E | (mmu->isSerialTransferring ? 0x80 : 0) | (mmu->isSerialClockInternal ? 1 : 0));
+        default: return 0;
+    }
+}
+
+static u8 readInterruptFlagRegister(u16 address, MMU *mmu) {
+    UNUSED(address);
+    //TODO
+    return mmu->requestedInterrupts;
+}
+
+static u8 readSoundRegister(u16 address, MMU *mmu) {
+    switch (address) {
         case 0xFF10: return mmu->NR10 | 0x80;
         case 0xFF11: return mmu->NR11 | 0x3F;
         case 0xFF12: return mmu->NR12;
@@ -233,7 +363,7 @@ u8 readByte(u16 address, MMU *mmu) {
         case 0xFF22: return mmu->NR43;
         case 0xFF23: return mmu->NR44 | 0xBF;
         case 0xFF24: return mmu->NR50;
-        
+    
         case 0xFF25: return mmu->NR51;
         case 0xFF26: {
             u8 lengthEnableStatus = 0;
@@ -247,8 +377,14 @@ u8 readByte(u16 address, MMU *mmu) {
         case 0xFF30 ... 0xFF3F:  {
             return mmu->waveChannel.waveTable[address & 0xF];
         } break;
+        default: return 0;
+    }
+}
+
+static u8 readLCDRegister(u16 address, MMU *mmu) {
+    LCD *lcd = &mmu->lcd;
+    switch (address) {
         case 0xFF40: { //LCD Control
-            profileStart("Read LCD Status", profileState);
             //Bit 7 - LCD Enabled
             u8 control = (lcd->isEnabled) ? (1 << 7) : 0;
             //Bit 6 - Window Tile Map Display Select (0=9800-9BFF, 1=9C00-9FFF)
@@ -266,331 +402,228 @@ u8 readByte(u16 address, MMU *mmu) {
             };
             //Bit 1 - OAM Enable
             if (lcd->isOAMEnabled) control |= (1 << 1);
-            
+        
             //Bit 0 - Background enabled
             if (lcd->isBackgroundEnabled) control |= 1;
-            profileEnd(profileState);
-            
+        
             return control;
         } break;
-        
+    
         case 0xFF41: return lcd->stat; //LCD Status
-        
+    
         case 0xFF42: return lcd->scy;
         case 0xFF43: return lcd->scx;
         case 0xFF44: return lcd->ly;
         case 0xFF45: return lcd->lyc;
-        case 0xFF46: return (mmu->currentDMAAddress >> 8) & 0xFF;
+        case 0xFF46: return (mmu->dmaSourceAddress >> 8) & 0xFF;
         case 0xFF47: return byteForColorPallette(lcd->backgroundPalette);
         case 0xFF48: return byteForColorPallette(lcd->spritePalette0);
         case 0xFF49: return byteForColorPallette(lcd->spritePalette1);
         case 0xFF4A: return lcd->wy;
         case 0xFF4B: return lcd->wx;
-        case 0xFF50: return 1;//(mmu->inBios) ? 1 : 0;
-        case 0xFF80 ... 0xFFFE: return mmu->zeroPageRAM[address - 0xFF80];
-        case 0xFFFF: return mmu->enabledInterrupts;
-        
         default: return 0;
     }
 }
 
-static inline void changeRAMBank(MMU *mmu, u8 newBank) {
-    mmu->currentRAMBank = newBank & mmu->maxCartRAMBank; 
+static u8 readBootROMRegister(u16 address, MMU *mmu) {
+    UNUSED(address);
+    UNUSED(mmu);
+    return 1;//(mmu->inBios) ? 1 : 0;
 }
-static inline void changeROMBank(MMU *mmu, u16 newBank) {
-    mmu->currentROMBank = newBank & mmu->maxROMBank; 
+
+static u8 readUnmappedIORegister(u16 address, MMU *mmu) {
+    UNUSED(address);
+    UNUSED(mmu);
+    return 0;
 }
 
-void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
-    LCD *lcd = &mmu->lcd;
-    //        if (address >= 0xFF10 && address <= 0xFF26) {
-    //            CO_LOG("Addr: %X, Old Val %X, New Val %X", address, readByte(address, mmu), byte);
-    //        }
-    //        if (address >= 0xFF10 && address <= 0xFF14) {
-    //            CO_LOG("Addr: %X, New Val %X", address, byte);
-    //        }
-    
-    if (gbDebug->numBreakpoints > 0 && gbDebug->isEnabled) {
-        fori ((i64)BreakpointExpectedValueType::OnePastLast) {
-            Breakpoint *bp = hardwareBreakpointForAddress(address, (BreakpointExpectedValueType)i, gbDebug);
-            if (bp && !bp->isDisabled) {
-                auto breakpointHit = [&byte, &address, &mmu, &bp, &gbDebug]() {
-                    gbDebug->hitBreakpoint = bp;
-                    bp->valueBefore = readByte(address, mmu);
-                    bp->valueAfter = byte;
-                };
-                switch (bp->expectedValueType) {
-                    case BreakpointExpectedValueType::Custom: {
-                        if (bp->expectedValue == byte) {
-                            breakpointHit();
-                        }
-                    } break;
-                    case BreakpointExpectedValueType::Any: {
+static void checkHardwareBreakpoints(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
+    fori ((i64)BreakpointExpectedValueType::OnePastLast) {
+        Breakpoint *bp = hardwareBreakpointForAddress(address, (BreakpointExpectedValueType)i, gbDebug);
+        if (bp && !bp->isDisabled) {
+            auto breakpointHit = [&byte, &address, &mmu, &bp, &gbDebug]() {
+                gbDebug->hitBreakpoint = bp;
+                bp->valueBefore = readByte(address, mmu);
+                bp->valueAfter = byte;
+            };
+            switch (bp->expectedValueType) {
+                case BreakpointExpectedValueType::Custom: {
+                    if (bp->expectedValue == byte) {
                         breakpointHit();
-                    } break;    
-                    case BreakpointExpectedValueType::BitClear: {
-                        if ((bp->expectedValue & byte) == 0) {
-                            breakpointHit();
-                        }
-                    } break;
-                    case BreakpointExpectedValueType::BitSet: {
-                        if ((bp->expectedValue & byte) == bp->expectedValue) {
-                            breakpointHit();
-                        }
-                    } break;
-                    case BreakpointExpectedValueType::OnePastLast:
-                    case BreakpointExpectedValueType::None:
-                    //do nothing
-                    break;
-                }
+                    }
+                } break;
+                case BreakpointExpectedValueType::Any: {
+                    breakpointHit();
+                } break;    
+                case BreakpointExpectedValueType::BitClear: {
+                    if ((bp->expectedValue & byte) == 0) {
+                        breakpointHit();
+                    }
+                } break;
+                case BreakpointExpectedValueType::BitSet: {
+                    if ((bp->expectedValue & byte) == bp->expectedValue) {
+                        breakpointHit();
+                    }
+                } break;
+                case BreakpointExpectedValueType::OnePastLast:
+                case BreakpointExpectedValueType::None:
+                //do nothing
+                break;
             }
-            
         }
+        
     }
+}
+
+//Copies all of OAM at once.  The 640 cycles the transfer really takes are modeled by
+//blocking the buses it uses until the DMAEnd event
+static void startDMA(u16 sourceAddress, MMU *mmu, GameBoyDebug *gbDebug) {
+    LCD *lcd = &mmu->lcd;
+    //in case a DMA is already running, so the source and old OAM can be read
+    mmu->isDMAOccurring = false;
     
-    //        if ((address == 0xFF13 || address == 0xFF14) && mmu->squareWave1.toneFrequency == 0x6EB){
-    //            Breakpoint *bp = &gbDebug->breakpoints[0];
-    //            gbDebug->hitBreakpoint =bp; 
-    //            bp->valueBefore = 0xEB;
-    //            bp->valueAfter = byte;
-    
-    //        }
+    const u8 *source = dmaSourceMemory(sourceAddress, mmu);
+    if (gbDebug->numBreakpoints > 0 && gbDebug->isEnabled) {
+        foriarr (lcd->oam) {
+            u8 byte = source ? source[i] : readByte((u16)(sourceAddress + i), mmu);
+            checkHardwareBreakpoints(byte, (u16)(0xFE00 + i), mmu, gbDebug);
+        }
+    }
+    if (source) {
+        copyMemory(source, lcd->oam, ARRAY_LEN(lcd->oam));
+    }
+    else {
+        foriarr (lcd->oam) {
+            lcd->oam[i] = readByte((u16)(sourceAddress + i), mmu);
+        }
+    }
     
+    mmu->isDMAOccurring = true;
+    mmu->dmaSourceAddress = sourceAddress;
+    mmu->dmaStartCycle = mmu->currentCycle;
+    scheduleEvent(ScheduledEvent::DMAEnd, mmu->dmaStartCycle + DMA_DURATION, mmu);
+}
+
+void restoreDMA(u16 currentDMAAddress, int cyclesSinceLastDMACopy, MMU *mmu) {
+    mmu->dmaSourceAddress = currentDMAAddress & 0xFF00;
+    i64 bytesCopied = currentDMAAddress & 0xFF;
+    if (!mmu->isDMAOccurring || bytesCopied >= (i64)ARRAY_LEN(mmu->lcd.oam)) {
+        mmu->isDMAOccurring = false;
+        return;
+    }
     
-    switch (address) {
-        case 0 ... 0x1FFF: {
-            if (mmu->hasRAM) {
-                if (byte == 0xA) {
-                    mmu->isCartRAMEnabled = true;
-                }
-                else {
-                    mmu->isCartRAMEnabled = false;
-                }
-            }
-        } break;
-        
-        case 0x2000 ... 0x3FFF: {
-            switch (mmu->mbcType){
-                case MBCType::MBC0:
-                break;
-                case MBCType::MBC1: {
-                    u16 bank = (mmu->currentROMBank & 0x60) | (byte & 0x1F);
-                    switch (bank) {
-                        case 0x20:
-                        case 0x40:
-                        case 0x60:
-                        bank += 1;
-                    }
-                    changeROMBank(mmu, bank);
-                } break;
-                case MBCType::MBC3:  {
-                    u16 bank = byte & 0x7F; 
-                    if (bank == 0) bank = 1;
-                    changeROMBank(mmu, bank);
-                } break; 
-                case MBCType::MBC5: {
-                    if (address < 0x3000) {
-                        changeROMBank(mmu, (mmu->currentROMBank & 0x100) | byte);
-                    }
-                    else {
-                        changeROMBank(mmu, (mmu->currentROMBank & 0xFF) | (u16)((byte & 1) << 9));
-                    }
-                } break;
-            }
-        } break;
-        
-        case 0x4000 ... 0x5FFF: {
-            switch (mmu->mbcType){
-                case MBCType::MBC0:
-                break;
-                case MBCType::MBC1: {
-                    if (!mmu->hasRAM || mmu->bankingMode == BankingMode::Mode0) {
-                        changeROMBank(mmu, (mmu->currentROMBank & 0x1F) | (byte & 0x60));
-                    }
-                    else if (mmu->bankingMode == BankingMode::Mode1) {
-                        changeRAMBank(mmu, byte & 0x3);
-                    }
-                } break;
-                case MBCType::MBC3:  
-                case MBCType::MBC5: {
-                    //TODO: support rumble.  Rumble is bit 3
-                    if (mmu->hasRTC && byte >= 0x8) {
-                        mmu->currentRAMBank = byte & 0xF;
-                    }
-                    else {
-                        changeRAMBank(mmu, byte & 0x3);
-                    }
-                } break;
-            }
-        } break;
-        case 0x6000 ... 0x7FFF: {
-            if (mmu->hasRAM && mmu->mbcType == MBCType::MBC1) {
-                mmu->bankingMode = (BankingMode)(byte & 1);
-            }
-            else if (mmu->hasRTC && mmu->mbcType == MBCType::MBC3){
-                if (byte == 1 && mmu->rtc.latchState == 0) {
-                    mmu->rtc.latchState = 1;
-                    mmu->rtc.latchedSeconds = mmu->rtc.seconds;
-                    mmu->rtc.latchedMinutes = mmu->rtc.minutes;
-                    mmu->rtc.latchedHours = mmu->rtc.hours;
-                    mmu->rtc.latchedDays = mmu->rtc.days;
-                    
-                    //Upper 1 bit of Day Counter, Carry Bit, Halt Flag
-                    mmu->rtc.latchedMisc = 0;
-                    mmu->rtc.latchedMisc |= mmu->rtc.daysHigh;
-                    mmu->rtc.latchedMisc |= mmu->rtc.isStopped ? 0x40 : 0;
-                    mmu->rtc.latchedMisc |= (mmu->rtc.didOverflow) ? 0x80 : 0;
-                    
-                    //persist to file
-                    {
-                        RTCFileState *rtcFS = mmu->cartRAMPlatformState.rtcFileMap;  
-                        rtcFS->latchedSeconds = mmu->rtc.seconds;
-                        rtcFS->latchedMinutes = mmu->rtc.minutes;
-                        rtcFS->latchedHours = mmu->rtc.hours;
-                        rtcFS->latchedDays = mmu->rtc.days;
-                        rtcFS->latchedDaysHigh = mmu->rtc.daysHigh;
-                    }
-                }
-                else {
-                    mmu->rtc.latchState = byte;
-                }
-            }
-        } break;
-        case 0x8000 ... 0x9FFF:
-        //vram can only be properly accessed when not being drawn from
-        //TODO: Proper emulation
-        /*if (lcd->mode != LCDMode::ScanVRAMAndOAM)*/ {
-            lcd->videoRAM[address - 0x8000] = byte;
-            if (gbDebug->isEnabled) {
-                gbDebug->tiles[(address-0x8000)/16].needsUpdate = true;
-            }
-            
-        } break;
-        case 0xA000 ... 0xBFFF: {
-            //TODO move code around for rtc
-            if (mmu->hasRAM && mmu->isCartRAMEnabled) {
-                switch (mmu->mbcType) {
-                    case MBCType::MBC0: 
-                    mmu->cartRAM[address - 0xA000] = byte; 
-                    break;
-                    case MBCType::MBC1: 
-                    case MBCType::MBC5: 
-                    mmu->cartRAM[(address - 0xA000) + (0x2000 * mmu->currentRAMBank)] = byte; 
-                    break;
-                    case MBCType::MBC3: {
-                        if (mmu->currentRAMBank <= 3) {
-                            mmu->cartRAM[(address - 0xA000) + (0x2000 * mmu->currentRAMBank)] = byte; 
-                            if (mmu->hasBattery) {
-                                mmu->cartRAMPlatformState.cartRAMFileMap[(address - 0xA000) + (0x2000 * mmu->currentRAMBank)] = byte; 
-                            }
-                        }
-                        else if (mmu->hasRTC) {
-                            switch (mmu->currentRAMBank) {
-                                case 0x8: {
-                                    //seconds
-                                    mmu->rtc.seconds = byte;
-                                    mmu->cartRAMPlatformState.rtcFileMap->seconds = byte;
-                                } break;
-                                case 0x9: {
-                                    //minutes
-                                    mmu->rtc.minutes = byte;
-                                    mmu->cartRAMPlatformState.rtcFileMap->minutes = byte;
-                                } break;
-                                case 0xA: {
-                                    //hours
-                                    mmu->rtc.hours = byte;
-                                    mmu->cartRAMPlatformState.rtcFileMap->hours = byte;
-                                } break;
-                                case 0xB: {
-                                    //days
-                                    mmu->rtc.days = byte;
-                                    mmu->cartRAMPlatformState.rtcFileMap->days = byte;
-                                } break;
-                                case 0xC: {
-                                    //misc
-                                    mmu->rtc.daysHigh = byte & 0x1;
-                                    mmu->cartRAMPlatformState.rtcFileMap->daysHigh = byte & 0x1;
-                                    mmu->rtc.isStopped = isBitSet(6, byte);
-                                    mmu->rtc.didOverflow = isBitSet(7, byte);
-                                } break;
-                            }
-                        }
-                        
-                    } break; 
-                }
-                
-                if (mmu->hasBattery) {
-                    switch (mmu->mbcType) {
-                        case MBCType::MBC0: 
-                        mmu->cartRAMPlatformState.cartRAMFileMap[address - 0xA000] = byte; 
-                        break;
-                        case MBCType::MBC1: 
-                        case MBCType::MBC5:
-                        mmu->cartRAMPlatformState.cartRAMFileMap[(address - 0xA000) + (0x2000 * mmu->currentRAMBank)] = byte; 
-                        break;
-                        default: break;
-                    }
-                }
-            }
+    //states from before bulk DMA can be partway through a transfer. Finish it now
+    mmu->isDMAOccurring = false;
+    for (i64 i = bytesCopied; i < (i64)ARRAY_LEN(mmu->lcd.oam); i++) {
+        mmu->lcd.oam[i] = readByte((u16)(mmu->dmaSourceAddress + i), mmu);
+    }
+    mmu->isDMAOccurring = true;
+    mmu->dmaStartCycle = mmu->currentCycle - (bytesCopied * DMA_CYCLES_PER_BYTE) - cyclesSinceLastDMACopy;
+    scheduleEvent(ScheduledEvent::DMAEnd, mmu->dmaStartCycle + DMA_DURATION, mmu);
+}
+
+void restoreSerialTransfer(i64 cyclesUntilTransferEnds, MMU *mmu) {
+    i64 endCycle = EVENT_NOT_SCHEDULED;
+    if (mmu->isSerialTransferring && mmu->isSerialClockInternal) {
+        endCycle = mmu->currentCycle + cyclesUntilTransferEnds;
+    }
+    scheduleEvent(ScheduledEvent::SerialTransferEnd, endCycle, mmu);
+}
+
+static inline void changeRAMBank(MMU *mmu, u8 newBank) {
+    mmu->currentRAMBank = newBank & mmu->maxCartRAMBank; 
+}
+static inline void changeROMBank(MMU *mmu, u16 newBank) {
+    mmu->currentROMBank = newBank & mmu->maxROMBank; 
+}
+
+static void writeJoyPadRegister(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
+    UNUSED(address);
+    UNUSED(gbDebug);
+    switch (byte & 0x30) {
+        case 0x10: {
+            mmu->joyPad.selectedButtonGroup = JPButtonGroup::FaceButtons;
         } break;
-        case 0xC000 ... 0xDFFF: mmu->workingRAM[address - 0xC000] = byte; break;
-        case 0xE000 ... 0xFDFF: mmu->workingRAM[address - 0xE000] = byte; break;
         
-        case 0xFE00 ... 0xFE9F: {
-            lcd->oam[address - 0xFE00] = byte;
-            //TODO: Shouldn't be able to write to OAM memory during these modes.
-            //      Enabling commented out code breaks sprites.  Figure out why...
-            //            if (lcd->mode != ScanVRAMAndOAM && lcd->mode != ScanOAM) {
-            //                lcd->oam[address - 0xFE00] = byte;
-            //            }
+        case 0x20: {
+            mmu->joyPad.selectedButtonGroup = JPButtonGroup::DPad;
         } break;
         
-        case 0xFF00: {
-            switch (byte & 0x30) {
-                case 0x10: {
-                    mmu->joyPad.selectedButtonGroup = JPButtonGroup::FaceButtons;
-                } break;
-                
-                case 0x20: {
-                    mmu->joyPad.selectedButtonGroup = JPButtonGroup::DPad;
-                } break;
-                
-                case 0x00:
-                case 0x30: {
-                    mmu->joyPad.selectedButtonGroup = JPButtonGroup::Nothing;
-                } break;
-            }
+        case 0x00:
+        case 0x30: {
+            mmu->joyPad.selectedButtonGroup = JPButtonGroup::Nothing;
         } break;
+    }
+}
+
+static void writeTimerRegister(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
+    UNUSED(gbDebug);
+    switch (address) {
         case 0xFF04: {
-            mmu->divider = 0;
-            //TODO: not too sure about this...
-            mmu->cyclesSinceDividerIncrement = 0;
+            rebaseTimer(mmu);
+            //resetting the counter is a falling edge if the timer's bit was set
+            if (isTimerSignalHigh(mmu)) {
+                incrementTimer(mmu);
+            }
+            mmu->dividerBaseCycle = mmu->currentCycle;
+            scheduleTimerOverflow(mmu);
         } break;
         case 0xFF05: {
-            mmu->timer = byte;
-            //TODO: not too sure about this...
-            //mmu->cyclesSinceTimerIncrement = 0;
+            rebaseTimer(mmu);
+            mmu->timerBaseValue = byte;
+            scheduleTimerOverflow(mmu);
         } break;
         case 0xFF06: mmu->timerModulo = byte; break;
         case 0xFF07:  {
-            if (!mmu->isTimerEnabled && isBitSet(2, byte)) {
-                mmu->timer = mmu->timerModulo;
-                mmu->cyclesSinceTimerIncrement = 0;
-            }
-            
+            rebaseTimer(mmu);
+            bool wasTimerSignalHigh = isTimerSignalHigh(mmu);
+        
             mmu->isTimerEnabled = isBitSet(2, byte);
-            
+        
             switch (byte & 3) {
                 case 0: mmu->timerIncrementRate = TimerIncrementRate::TIR_0; break;
                 case 1: mmu->timerIncrementRate = TimerIncrementRate::TIR_1; break;
                 case 2: mmu->timerIncrementRate = TimerIncrementRate::TIR_2; break;
                 case 3: mmu->timerIncrementRate = TimerIncrementRate::TIR_3; break;
             }
-            
-            
+        
+            //disabling the timer or switching to a bit that is low is also a falling edge (DMG)
+            if (wasTimerSignalHigh && !isTimerSignalHigh(mmu)) {
+                incrementTimer(mmu);
+            }
+            scheduleTimerOverflow(mmu);
+        } break;
+    }
+}
+
+static void writeSerialRegister(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
+    UNUSED(gbDebug);
+    switch (address) {
+        case 0xFF01: mmu->serialData = byte; break;
+        case 0xFF02: {
+            mmu->isSerialTransferring = isBitSet(7, byte);
+            mmu->isSerialClockInternal = isBitSet(0, byte);
+            i64 endCycle = EVENT_NOT_SCHEDULED;
+            if (mmu->isSerialTransferring && mmu->isSerialClockInternal) {
+                //the clock runs off the divider, so the first bit goes out when the counter next passes a multiple
+                i64 bitPeriods = dividerCounterAtCycle(mmu->currentCycle, mmu) / SERIAL_CYCLES_PER_BIT + 8;
+                endCycle = mmu->dividerBaseCycle + bitPeriods * SERIAL_CYCLES_PER_BIT;
+            }
+            scheduleEvent(ScheduledEvent::SerialTransferEnd, endCycle, mmu);
         } break;
-        //TODO
-        case 0xFF0F: mmu->requestedInterrupts = byte; break;
+    }
+}
+
+static void writeInterruptFlagRegister(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
+    UNUSED(address);
+    UNUSED(gbDebug);
+    //TODO
+    mmu->requestedInterrupts = byte;
+    mmu->didInterruptsChange = true;
+}
+
+static void writeSoundRegister(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
+    switch (address) {
         case 0xFF10:  { //NR10 FF10 -PPP NSSS Sweep period, negate, shift
             if (mmu->isSoundEnabled) {
                 mmu->NR10 = byte;
@@ -598,7 +631,7 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                 mmu->squareWave1Channel.isSweepNegated = isBitSet(3, byte);
                 mmu->squareWave1Channel.sweepPeriod = ((byte >> 4) & 0x7);
             }
-            
+        
         } break;
         case 0xFF11: {//NR11 FF11 DDLL LLLL Duty, Length load (64-L)
             if (mmu->isSoundEnabled) {
@@ -628,7 +661,7 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     sq1->isDACEnabled = true;
                 }
             }
-            
+        
         } break;
         case 0xFF13: { //NR13 FF13 FFFF FFFF Frequency LSB
             if (mmu->isSoundEnabled) {
@@ -638,14 +671,14 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
         } break;  
         case 0xFF14: {//NR14 FF14 TL-- -FFF Trigger, Length enable, Frequency MSB
             MMU::SquareWave1 *sq1 = &mmu->squareWave1Channel;
-            
+        
             //sound enabled does not affect length counter
             sq1->isLengthCounterEnabled = isBitSet(6, byte);
             if (mmu->isSoundEnabled) {
                 mmu->NR14 = byte;
                 sq1->toneFrequency &= 0xFF;
                 setToneFrequencyForSquareWave(sq1->toneFrequency | (u16)((byte & 0x7) << 8), &mmu->squareWave1Channel.toneFrequency, &mmu->squareWave1Channel.tonePeriod);
-                
+            
                 if (isBitSet(7, byte)) {
                     //1) Channel is enabled (see length counter).
                     //2) If length counter is zero, it is set to 64 (256 for wave channel).
@@ -656,16 +689,16 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     //7) Wave channel's position is set to 0 but sample buffer is NOT refilled.
                     //8) Square 1's sweep does several things (see frequency sweep).
                     sq1->isEnabled = sq1->isDACEnabled;
-                    
+                
                     if (sq1->lengthCounter == 0) {
                         sq1->lengthCounter = 64;
                         mmu->ticksSinceLastLengthCounter = 0;
                     }
-                    
+                
                     sq1->frequencyClock = 0;
                     sq1->volumeEnvelopeClock = 0;
                     sq1->currentVolume = sq1->startingVolume;
-                    
+                
                     //During a trigger event, several things occur:
                     //1) Square 1's frequency is copied to the shadow register.
                     //2) The sweep timer is reloaded.
@@ -674,14 +707,14 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     sq1->sweepShadowReg = sq1->toneFrequency;
                     sq1->sweepClock = 0;
                     sq1->isSweepEnabled = (sq1->sweepPeriod != 0 || sq1->sweepShift != 0) ? true : false;
-                    
+                
                     if (sq1->isSweepEnabled && sq1->sweepShift != 0) {
                         sq1->sweepShadowReg >>= sq1->sweepShift;
-                        
+                    
                         sq1->sweepShadowReg = (sq1->isSweepNegated) ?
                             sq1->toneFrequency - sq1->sweepShadowReg :
                         sq1->toneFrequency + sq1->sweepShadowReg;
-                        
+                    
                         if (sq1->toneFrequency <= 2047) {
                             setToneFrequencyForSquareWave(sq1->sweepShadowReg, &sq1->toneFrequency, &sq1->tonePeriod);
                         }
@@ -692,7 +725,7 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                 }
             }
         } break;
-        
+    
         //FF15 is unused
         case 0xFF16: {//NR21 FF16 DDLL LLLL Duty, Length load (64-L)
             if (mmu->isSoundEnabled) {
@@ -704,11 +737,11 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     case 3: mmu->squareWave2Channel.waveForm = WaveForm::WF_75Pct; break;
                 }
             }
-            
+        
             //sound enabled does not affect length counter
             mmu->squareWave2Channel.lengthCounter = 64 - (byte & 0x3F);
         } break;
-        
+    
         case 0xFF17: { //NR22 FF17 VVVV APPP Starting volume, Envelope add mode, envelope period
             if (mmu->isSoundEnabled) {
                 mmu->NR22 = byte;
@@ -724,26 +757,26 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     sq2->isDACEnabled = true;
                 }
             }
-            
-        } break;
         
+        } break;
+    
         case 0xFF18: { //NR23 FF18 FFFF FFFF Frequency LSB
             if (mmu->isSoundEnabled) {
                 mmu->squareWave2Channel.toneFrequency &= 0x700;
                 setToneFrequencyForSquareWave(mmu->squareWave2Channel.toneFrequency | byte, &mmu->squareWave2Channel.toneFrequency, &mmu->squareWave2Channel.tonePeriod);
             }
         } break;  
-        
+    
         case 0xFF19: {//NR24 FF19 TL-- -FFF Trigger, Length enable, Frequency MSB
             MMU::SquareWave2 *sq2 = &mmu->squareWave2Channel;
-            
+        
             //sound enabled does not affect length counter
             sq2->isLengthCounterEnabled = isBitSet(6, byte);
             if (mmu->isSoundEnabled) {
                 mmu->NR24 = byte;
                 mmu->squareWave2Channel.toneFrequency &= 0xFF;
                 setToneFrequencyForSquareWave(sq2->toneFrequency | (u16)((byte & 0x7) << 8), &sq2->toneFrequency, &sq2->tonePeriod);
-                
+            
                 if (isBitSet(7, byte)) {
                     // trigger event
                     //1) Channel is enabled (see length counter).
@@ -754,23 +787,23 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     //6) Noise channel's LFSR bits are all set to 1.
                     //7) Wave channel's position is set to 0 but sample buffer is NOT refilled.
                     sq2->isEnabled = sq2->isDACEnabled;
-                    
+                
                     if (sq2->lengthCounter == 0) {
                         sq2->lengthCounter = 64;
                         mmu->ticksSinceLastLengthCounter = 0;
                     }
-                    
+                
                     sq2->frequencyClock = 0;
                     sq2->volumeEnvelopeClock = 0;
                     sq2->currentVolume = sq2->startingVolume;
                 }
             }
         } break;
-        
+    
         case 0xFF1A: { //NR30 FF1A E--- ---- DAC power
             if (mmu->isSoundEnabled) {
                 mmu->NR30 = byte;
-                
+            
                 if (isBitSet(7, byte)) {
                     mmu->waveChannel.isDACEnabled = true; 
                     //TODO: do we enable the channel?
@@ -780,13 +813,13 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     mmu->waveChannel.isEnabled = false; 
                 }
             }
-            
-        } break;
         
-        case 0xFF1B: { //NR31 FF1B LLLL LLLL Length load (256-L)
+        } break;
+    
+        case 0xFF1B: { //NR31 FF1B LLLL LLLL Length load (256-L)
             //sound enabled does not affect length counter
             mmu->waveChannel.lengthCounter = 256 - byte;
-            
+        
         } break;
         case 0xFF1C: { //NR32 FF1C -VV- ---- Volume code (00=0%, 01=100%, 10=50%, 11=25%)
             if (mmu->isSoundEnabled) {
@@ -813,7 +846,7 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                 mmu->NR34 = byte;
                 mmu->waveChannel.toneFrequency &= 0xFF;
                 setToneFrequencyForWave(wave->toneFrequency | (u16)((byte & 0x7) << 8), wave);
-                
+            
                 if (isBitSet(7, byte)) {
                     // trigger event
                     //1) Channel is enabled (see length counter).
@@ -824,28 +857,28 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     //6) Noise channel's LFSR bits are all set to 1.
                     //7) Wave channel's position is set to 0 but sample buffer is NOT refilled.
                     wave->isEnabled = wave->isDACEnabled;
-                    
+                
                     if (wave->lengthCounter == 0) {
                         wave->lengthCounter = 256;
                         mmu->ticksSinceLastLengthCounter = 0;
                     }
-                    
+                
                     wave->frequencyClock = 0;
                     wave->currentSampleIndex = 0;
                 }
             }
-            
-            
-        } break;
-        
         
         
+        } break;
+    
+    
+    
         //FF1F is unused
         case 0xFF20: {//NR41 FF20 --LL LLLL Length load (64-L)
             //sound enabled does not affect length counter
             mmu->noiseChannel.lengthCounter = 64 - (byte & 0x3F);
         } break;
-        
+    
         case 0xFF21: { //NR42 FF21 VVVV APPP Starting volume, Envelope add mode, envelope period
             if (mmu->isSoundEnabled) {
                 mmu->NR42 = byte;
@@ -861,29 +894,29 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     noise->isDACEnabled = true;
                 }
             }
-            
-        } break;
         
+        } break;
+    
         case 0xFF22: { //NR43 FF22 SSSS WDDD Clock shift, Width mode of LFSR, Divisor code
             if (mmu->isSoundEnabled) {
                 mmu->NR43 = byte;
                 MMU::Noise *noise = &mmu->noiseChannel;
                 noise->divisorCode = byte & 0x7;
                 noise->tonePeriod = (((noise->divisorCode == 0) ? 8 : noise->divisorCode * 16) << (byte >> 4));
-                
+            
                 noise->is7BitMode = isBitSet(3, byte);
-                
+            
             }
         } break;  
-        
+    
         case 0xFF23: {//NR44 FF23 TL-- ---- Trigger, Length enable
             MMU::Noise *noise = &mmu->noiseChannel;
-            
+        
             //sound enabled does not affect length counter
             noise->isLengthCounterEnabled = isBitSet(6, byte);
             if (mmu->isSoundEnabled) {
                 mmu->NR44 = byte;
-                
+            
                 if (isBitSet(7, byte)) {
                     // trigger event
                     //1) Channel is enabled (see length counter).
@@ -894,21 +927,21 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                     //6) Noise channel's LFSR bits are all set to 1.
                     //7) Wave channel's position is set to 0 but sample buffer is NOT refilled.
                     noise->isEnabled = noise->isDACEnabled;
-                    
+                
                     if (noise->lengthCounter == 0) {
                         noise->lengthCounter = 64;
                         mmu->ticksSinceLastLengthCounter = 0;
                     }
-                    
+                
                     noise->shiftValue = 0xFFFF;
-                    
+                
                     noise->frequencyClock = 0;
                     noise->volumeEnvelopeClock = 0;
                     noise->currentVolume = noise->startingVolume;
                 }
             }
         } break;
-        
+    
         case 0xFF24:  {
             //TODO: VIN and Volume control
             if (mmu->isSoundEnabled) {
@@ -917,8 +950,8 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                 mmu->masterRightVolume = (byte & 0x7) + 1;
             }
         } break;
-        
-        
+    
+    
         case 0xFF25: {//NR51
             if (mmu->isSoundEnabled) {
                 mmu->NR51 = byte;
@@ -926,90 +959,591 @@ void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
                 channelState |= (u8)(isBitSet(0, byte) ? ChannelEnabledState::Right : ChannelEnabledState::None);
                 channelState |= (u8)(isBitSet(4, byte) ? ChannelEnabledState::Left : ChannelEnabledState::None);
                 mmu->squareWave1Channel.channelEnabledState = (ChannelEnabledState)channelState;
-                
+            
                 channelState = 0;
                 channelState |= (u8)(isBitSet(1, byte) ? ChannelEnabledState::Right : ChannelEnabledState::None);
                 channelState |= (u8)(isBitSet(5, byte) ? ChannelEnabledState::Left : ChannelEnabledState::None);
                 mmu->squareWave2Channel.channelEnabledState = (ChannelEnabledState)channelState;
-                
+            
                 channelState = 0;
                 channelState |= (u8)(isBitSet(2, byte) ? ChannelEnabledState::Right : ChannelEnabledState::None);
                 channelState |= (u8)(isBitSet(6, byte) ? ChannelEnabledState::Left : ChannelEnabledState::None);
                 mmu->waveChannel.channelEnabledState = (ChannelEnabledState)channelState;
+            
+                channelState = 0;
+                channelState |= (u8)(isBitSet(3, byte) ? ChannelEnabledState::Right : ChannelEnabledState::None);
+                channelState |= (u8)(isBitSet(7, byte) ? ChannelEnabledState::Left : ChannelEnabledState::None);
+                mmu->noiseChannel.channelEnabledState = (ChannelEnabledState)channelState;
+            }
+        
+        } break;
+    
+        case 0xFF26: {//NR52
+            mmu->NR52 = (byte & 0x80) | 0x70;
+            if (isBitSet(7, byte)) {
+                mmu->isSoundEnabled = true;
+            }
+            else {
+                forirange (0xFF10, 0xFF26) {
+                    writeByte(0, (u16)i, mmu, gbDebug);
+                }
+                mmu->isSoundEnabled = false;
+            }
+        } break;
+    
+        case 0xFF30 ... 0xFF3F:  {
+            mmu->waveChannel.waveTable[address & 0xF] = byte;
+        } break;
+    }
+}
+
+static void writeLCDRegister(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
+    LCD *lcd = &mmu->lcd;
+    switch (address) {
+        case 0xFF40: { //LCD Control
+            lcd->isEnabled = isBitSet(7, byte);
+            if (lcd->isEnabled) {
+                lcd->stat = (lcd->stat & 0xF8) | (u8)lcd->mode;
+            }
+            else {
+                lcd->stat &= 0xF8 ;  //reset to HBlank if disabled. TODO: Not sure if this correct
+                lcd->modeClock = 0;
+                lcd->mode = LCDMode::HBlank;
+                lcd->ly = 0;
+            }
+        
+            //Bit 6 - Window Tile Map Display Select (0=9800-9BFF, 1=9C00-9FFF)
+            lcd->windowTileMap = isBitSet(6, byte) ? 1 : 0;
+            //Bit 5 - Window Display Enable
+            lcd->isWindowEnabled = isBitSet(5, byte);
+            //Bit 4 - Background Tile Set Select
+            lcd->backgroundTileSet = isBitSet(4, byte) ? 1 : 0;
+            //Bit 3 - Background Tile Map Select
+            lcd->backgroundTileMap = isBitSet(3, byte) ? 1 : 0;
+            //Bit 2 - Sprite size
+            lcd->spriteHeight = isBitSet(2, byte) ? SpriteHeight::Tall : SpriteHeight::Short;
+            //Bit 1 - OAM enabled
+            lcd->isOAMEnabled = isBitSet(1, byte);
+            //Bit 0 - Background enabled
+            lcd->isBackgroundEnabled = isBitSet(0, byte);
+        
+        } break;
+        case 0xFF41: lcd->stat = (lcd->stat & 7) | byte; break; //STAT interrupt (last 3 bytes read-only)
+        case 0xFF42: lcd->scy = byte; break;
+        case 0xFF43: lcd->scx = byte; break;
+        case 0xFF44: lcd->ly = 0; break; //reset ly
+        case 0xFF45: lcd->lyc = byte; break;
+        case 0xFF46: {
+            if (byte < 0xF1) {
+                startDMA((u16)(byte << 8), mmu, gbDebug);
+            }
+        } break;
+        case 0xFF47: updateColorPaletteFromU8(lcd->backgroundPalette, byte); break;
+        case 0xFF48: updateColorPaletteFromU8(lcd->spritePalette0, byte); break;
+        case 0xFF49: updateColorPaletteFromU8(lcd->spritePalette1, byte); break;
+        case 0xFF4A: lcd->wy = byte; break;
+        case 0xFF4B: lcd->wx = byte; break;
+    }
+}
+
+static void writeUnmappedIORegister(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
+    UNUSED(byte);
+    UNUSED(address);
+    UNUSED(mmu);
+    UNUSED(gbDebug);
+    //TODO: FF50 unmaps the boot ROM
+}
+
+typedef u8 (*IORegisterReader)(u16 address, MMU *mmu);
+typedef void (*IORegisterWriter)(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug);
+struct IORegisterHandlers {
+    IORegisterReader read;
+    IORegisterWriter write;
+    //reads have no side effects and the value only changes on writes, so reads come from mmu->ioRegisters
+    bool isCached;
+};
+static const IORegisterHandlers ioRegisterHandlers[0x80] = {
+    /*FF00*/ {readJoyPadRegister, writeJoyPadRegister, true},
+    /*FF01*/ {readSerialRegister, writeSerialRegister, false},
+    /*FF02*/ {readSerialRegister, writeSerialRegister, false},
+    /*FF03*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF04*/ {readTimerRegister, writeTimerRegister, false},
+    /*FF05*/ {readTimerRegister, writeTimerRegister, false},
+    /*FF06*/ {readTimerRegister, writeTimerRegister, true},
+    /*FF07*/ {readTimerRegister, writeTimerRegister, true},
+    /*FF08*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF09*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF0A*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF0B*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF0C*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF0D*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF0E*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF0F*/ {readInterruptFlagRegister, writeInterruptFlagRegister, false},
+    /*FF10*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF11*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF12*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF13*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF14*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF15*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF16*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF17*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF18*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF19*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF1A*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF1B*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF1C*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF1D*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF1E*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF1F*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF20*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF21*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF22*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF23*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF24*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF25*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF26*/ {readSoundRegister, writeSoundRegister, false},
+    /*FF27*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF28*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF29*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF2A*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF2B*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF2C*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF2D*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF2E*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF2F*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF30*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF31*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF32*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF33*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF34*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF35*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF36*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF37*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF38*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF39*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF3A*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF3B*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF3C*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF3D*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF3E*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF3F*/ {readSoundRegister, writeSoundRegister, true},
+    /*FF40*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF41*/ {readLCDRegister, writeLCDRegister, false},
+    /*FF42*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF43*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF44*/ {readLCDRegister, writeLCDRegister, false},
+    /*FF45*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF46*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF47*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF48*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF49*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF4A*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF4B*/ {readLCDRegister, writeLCDRegister, true},
+    /*FF4C*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF4D*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF4E*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF4F*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF50*/ {readBootROMRegister, writeUnmappedIORegister, true},
+    /*FF51*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF52*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF53*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF54*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF55*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF56*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF57*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF58*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF59*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF5A*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF5B*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF5C*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF5D*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF5E*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF5F*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF60*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF61*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF62*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF63*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF64*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF65*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF66*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF67*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF68*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF69*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF6A*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF6B*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF6C*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF6D*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF6E*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF6F*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF70*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF71*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF72*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF73*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF74*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF75*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF76*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF77*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF78*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF79*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF7A*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF7B*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF7C*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF7D*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF7E*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+    /*FF7F*/ {readUnmappedIORegister, writeUnmappedIORegister, true},
+};
+
+void updateJoyPadRegister(MMU *mmu) {
+    mmu->ioRegisters[0x00] = readJoyPadRegister(0xFF00, mmu);
+}
+
+void rebuildIORegisterCache(MMU *mmu) {
+    foriarr (ioRegisterHandlers) {
+        if (ioRegisterHandlers[i].isCached) {
+            mmu->ioRegisters[i] = ioRegisterHandlers[i].read((u16)(0xFF00 + i), mmu);
+        }
+    }
+}
+
+u8 readByte(u16 address, MMU *mmu) {
+    LCD *lcd = &mmu->lcd;
+#ifdef GB_FLAT_TEST_MEMORY
+    if (mmu->flatTestMemory) {
+        return mmu->flatTestMemory[address];
+    }
+#endif
+    if (isBlockedByDMA(address, mmu)) {
+        return readByteBlockedByDMA(address, mmu);
+    }
+    switch (address) {
+        case 0 ... 0xFF: {
+            //        if (mmu->inBios) {
+            //            return BIOS[address];
+            //        }
+            //        else {
+            //            return mmu->romData[address];
+            //        }
+            return mmu->romData[address];
+        }break;
+        
+        case 0x100 ... 0x3FFF: return mmu->romData[address];
+        case 0x4000 ... 0x7FFF: {
+            switch (mmu->mbcType) {
+                case MBCType::MBC0: 
+                return mmu->romData[address];
+                case MBCType::MBC1: 
+                case MBCType::MBC3: 
+                case MBCType::MBC5:
+                return mmu->romData[address + (0x4000 * (mmu->currentROMBank - 1))];
+            }
+        } break;
+        case 0x8000 ... 0x9FFF: {
+            //vram can only be properly accessed when not being drawn from
+            //         return (lcd->mode != LCDMode::ScanVRAMAndOAM) ? lcd->videoRAM[address - 0x8000] : 0xFF;
+            return lcd->videoRAM[address - 0x8000];
+        } break;
+        case 0xA000 ... 0xBFFF: {
+            if (mmu->hasRAM && mmu->isCartRAMEnabled) {
+                switch (mmu->mbcType) {
+                    case MBCType::MBC0: 
+                    return mmu->cartRAM[address - 0xA000];
+                    case MBCType::MBC1: 
+                    case MBCType::MBC5:
+                    return mmu->cartRAM[(address - 0xA000) +  (0x2000 * mmu->currentRAMBank)];
+                    case MBCType::MBC3: {
+                        if (mmu->currentRAMBank <= 3) {
+                            return mmu->cartRAM[(address - 0xA000) +  (0x2000 * mmu->currentRAMBank)];
+                        }
+                        else if (mmu->currentRAMBank >= 0x8 &&
+                                 mmu->currentRAMBank <= 0xC) {
+                            switch (mmu->currentRAMBank) {
+                                case 0x8: return mmu->rtc.latchedSeconds;
+                                case 0x9: return mmu->rtc.latchedMinutes;
+                                case 0xA: return mmu->rtc.latchedHours;
+                                case 0xB: return mmu->rtc.latchedDays;
+                                case 0xC: return mmu->rtc.latchedMisc;
+                                default: return 0xFF;
+                            }
+                        }
+                        else {
+                            return 0xFF;
+                        }
+                    } break;
+                }
+            }
+            else {
+                return 0xFF;
+            }
+        } break;
+        case 0xC000 ... 0xDFFF: return mmu->workingRAM[address - 0xC000];
+        case 0xE000 ... 0xFDFF: return mmu->workingRAM[address - 0xE000];
+        case 0xFE00 ... 0xFE9F: {
+            //            switch (lcd->mode) {
+            //            case LCDMode::ScanVRAMAndOAM:
+            //            case LCDMode::ScanOAM:
+            //                return 0xFF;
+            
+            //            default: return lcd->oam[address - 0xFE00];
+            //            }
+            return lcd->oam[address - 0xFE00];
+        } break;
+        case 0xFF00 ... 0xFF7F: {
+            const IORegisterHandlers *handlers = &ioRegisterHandlers[address - 0xFF00];
+            return handlers->isCached ? mmu->ioRegisters[address - 0xFF00] : handlers->read(address, mmu);
+        } break;
+        case 0xFF80 ... 0xFFFE: return mmu->zeroPageRAM[address - 0xFF80];
+        case 0xFFFF: return mmu->enabledInterrupts;
+        
+        default: return 0;
+    }
+}
+
+void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug) {
+    LCD *lcd = &mmu->lcd;
+    //        if (address >= 0xFF10 && address <= 0xFF26) {
+    //            CO_LOG("Addr: %X, Old Val %X, New Val %X", address, readByte(address, mmu), byte);
+    //        }
+    //        if (address >= 0xFF10 && address <= 0xFF14) {
+    //            CO_LOG("Addr: %X, New Val %X", address, byte);
+    //        }
+    
+    if (isBlockedByDMA(address, mmu)) {
+        return;
+    }
+    
+    if (gbDebug->numBreakpoints > 0 && gbDebug->isEnabled) {
+        checkHardwareBreakpoints(byte, address, mmu, gbDebug);
+    }
+    if (gbDebug->journal && gbDebug->journal->isStepOpen) {
+        journalMemoryWrite(address, mmu, gbDebug->journal);
+    }
+#ifdef GB_STEP_TRACE
+    if (gbDebug->stepTrace) {
+        StepTrace *trace = gbDebug->stepTrace;
+        if (trace->numWrites < MAX_STEP_TRACE_WRITES) {
+            trace->writes[trace->numWrites] = {address, byte};
+        }
+        trace->numWrites++;
+    }
+#endif
+#ifdef GB_FLAT_TEST_MEMORY
+    if (mmu->flatTestMemory) {
+        mmu->flatTestMemory[address] = byte;
+        return;
+    }
+#endif
+    
+    //        if ((address == 0xFF13 || address == 0xFF14) && mmu->squareWave1.toneFrequency == 0x6EB){
+    //            Breakpoint *bp = &gbDebug->breakpoints[0];
+    //            gbDebug->hitBreakpoint =bp; 
+    //            bp->valueBefore = 0xEB;
+    //            bp->valueAfter = byte;
+    
+    //        }
+    
+    
+    switch (address) {
+        case 0 ... 0x1FFF: {
+            if (mmu->hasRAM) {
+                if (byte == 0xA) {
+                    mmu->isCartRAMEnabled = true;
+                }
+                else {
+                    mmu->isCartRAMEnabled = false;
+                }
+            }
+        } break;
+        
+        case 0x2000 ... 0x3FFF: {
+            switch (mmu->mbcType){
+                case MBCType::MBC0:
+                break;
+                case MBCType::MBC1: {
+                    u16 bank = (mmu->currentROMBank & 0x60) | (byte & 0x1F);
+                    switch (bank) {
+                        case 0x20:
+                        case 0x40:
+                        case 0x60:
+                        bank += 1;
+                    }
+                    changeROMBank(mmu, bank);
+                } break;
+                case MBCType::MBC3:  {
+                    u16 bank = byte & 0x7F; 
+                    if (bank == 0) bank = 1;
+                    changeROMBank(mmu, bank);
+                } break; 
+                case MBCType::MBC5: {
+                    if (address < 0x3000) {
+                        changeROMBank(mmu, (mmu->currentROMBank & 0x100) | byte);
+                    }
+                    else {
+                        changeROMBank(mmu, (mmu->currentROMBank & 0xFF) | (u16)((byte & 1) << 9));
+                    }
+                } break;
+            }
+        } break;
+        
+        case 0x4000 ... 0x5FFF: {
+            switch (mmu->mbcType){
+                case MBCType::MBC0:
+                break;
+                case MBCType::MBC1: {
+                    if (!mmu->hasRAM || mmu->bankingMode == BankingMode::Mode0) {
+                        changeROMBank(mmu, (mmu->currentROMBank & 0x1F) | (byte & 0x60));
+                    }
+                    else if (mmu->bankingMode == BankingMode::Mode1) {
+                        changeRAMBank(mmu, byte & 0x3);
+                    }
+                } break;
+                case MBCType::MBC3:  
+                case MBCType::MBC5: {
+                    //TODO: support rumble.  Rumble is bit 3
+                    if (mmu->hasRTC && byte >= 0x8) {
+                        mmu->currentRAMBank = byte & 0xF;
+                    }
+                    else {
+                        changeRAMBank(mmu, byte & 0x3);
+                    }
+                } break;
+            }
+        } break;
+        case 0x6000 ... 0x7FFF: {
+            if (mmu->hasRAM && mmu->mbcType == MBCType::MBC1) {
+                mmu->bankingMode = (BankingMode)(byte & 1);
+            }
+            else if (mmu->hasRTC && mmu->mbcType == MBCType::MBC3){
+                if (byte == 1 && mmu->rtc.latchState == 0) {
+                    mmu->rtc.latchState = 1;
+                    mmu->rtc.latchedSeconds = mmu->rtc.seconds;
+                    mmu->rtc.latchedMinutes = mmu->rtc.minutes;
+                    mmu->rtc.latchedHours = mmu->rtc.hours;
+                    mmu->rtc.latchedDays = mmu->rtc.days;
+                    
+                    //Upper 1 bit of Day Counter, Carry Bit, Halt Flag
+                    mmu->rtc.latchedMisc = 0;
+                    mmu->rtc.latchedMisc |= mmu->rtc.daysHigh;
+                    mmu->rtc.latchedMisc |= mmu->rtc.isStopped ? 0x40 : 0;
+                    mmu->rtc.latchedMisc |= (mmu->rtc.didOverflow) ? 0x80 : 0;
+                    
+                    //persist to file
+                    {
+                        RTCFileState *rtcFS = mmu->host->cartRAMPlatformState.rtcFileMap;  
+                        rtcFS->latchedSeconds = mmu->rtc.seconds;
+                        rtcFS->latchedMinutes = mmu->rtc.minutes;
+                        rtcFS->latchedHours = mmu->rtc.hours;
+                        rtcFS->latchedDays = mmu->rtc.days;
+                        rtcFS->latchedDaysHigh = mmu->rtc.daysHigh;
+                    }
+                }
+                else {
+                    mmu->rtc.latchState = byte;
+                }
+            }
+        } break;
+        case 0x8000 ... 0x9FFF:
+        //vram can only be properly accessed when not being drawn from
+        //TODO: Proper emulation
+        /*if (lcd->mode != LCDMode::ScanVRAMAndOAM)*/ {
+            lcd->videoRAM[address - 0x8000] = byte;
+#ifndef GB_NO_DEBUGGER_UI
+            if (gbDebug->isEnabled) {
+                gbDebug->tiles[(address-0x8000)/16].needsUpdate = true;
+            }
+#endif
+            
+        } break;
+        case 0xA000 ... 0xBFFF: {
+            //TODO move code around for rtc
+            if (mmu->hasRAM && mmu->isCartRAMEnabled) {
+                switch (mmu->mbcType) {
+                    case MBCType::MBC0: 
+                    mmu->cartRAM[address - 0xA000] = byte; 
+                    break;
+                    case MBCType::MBC1: 
+                    case MBCType::MBC5: 
+                    mmu->cartRAM[(address - 0xA000) + (0x2000 * mmu->currentRAMBank)] = byte; 
+                    break;
+                    case MBCType::MBC3: {
+                        if (mmu->currentRAMBank <= 3) {
+                            mmu->cartRAM[(address - 0xA000) + (0x2000 * mmu->currentRAMBank)] = byte; 
+                            if (mmu->hasBattery) {
+                                mmu->host->cartRAMPlatformState.cartRAMFileMap[(address - 0xA000) + (0x2000 * mmu->currentRAMBank)] = byte; 
+                            }
+                        }
+                        else if (mmu->hasRTC) {
+                            switch (mmu->currentRAMBank) {
+                                case 0x8: {
+                                    //seconds
+                                    mmu->rtc.seconds = byte;
+                                    mmu->host->cartRAMPlatformState.rtcFileMap->seconds = byte;
+                                } break;
+                                case 0x9: {
+                                    //minutes
+                                    mmu->rtc.minutes = byte;
+                                    mmu->host->cartRAMPlatformState.rtcFileMap->minutes = byte;
+                                } break;
+                                case 0xA: {
+                                    //hours
+                                    mmu->rtc.hours = byte;
+                                    mmu->host->cartRAMPlatformState.rtcFileMap->hours = byte;
+                                } break;
+                                case 0xB: {
+                                    //days
+                                    mmu->rtc.days = byte;
+                                    mmu->host->cartRAMPlatformState.rtcFileMap->days = byte;
+                                } break;
+                                case 0xC: {
+                                    //misc
+                                    mmu->rtc.daysHigh = byte & 0x1;
+                                    mmu->host->cartRAMPlatformState.rtcFileMap->daysHigh = byte & 0x1;
+                                    mmu->rtc.isStopped = isBitSet(6, byte);
+                                    mmu->rtc.didOverflow = isBitSet(7, byte);
+                                } break;
+                            }
+                        }
+                        
+                    } break; 
+                }
                 
-                channelState = 0;
-                channelState |= (u8)(isBitSet(3, byte) ? ChannelEnabledState::Right : ChannelEnabledState::None);
-                channelState |= (u8)(isBitSet(7, byte) ? ChannelEnabledState::Left : ChannelEnabledState::None);
-                mmu->noiseChannel.channelEnabledState = (ChannelEnabledState)channelState;
-            }
-            
-        } break;
-        
-        case 0xFF26: {//NR52
-            mmu->NR52 = (byte & 0x80) | 0x70;
-            if (isBitSet(7, byte)) {
-                mmu->isSoundEnabled = true;
-            }
-            else {
-                forirange (0xFF10, 0xFF26) {
-                    writeByte(0, (u16)i, mmu, gbDebug);
+                if (mmu->hasBattery) {
+                    switch (mmu->mbcType) {
+                        case MBCType::MBC0: 
+                        mmu->host->cartRAMPlatformState.cartRAMFileMap[address - 0xA000] = byte; 
+                        break;
+                        case MBCType::MBC1: 
+                        case MBCType::MBC5:
+                        mmu->host->cartRAMPlatformState.cartRAMFileMap[(address - 0xA000) + (0x2000 * mmu->currentRAMBank)] = byte; 
+                        break;
+                        default: break;
+                    }
                 }
-                mmu->isSoundEnabled = false;
             }
         } break;
+        case 0xC000 ... 0xDFFF: mmu->workingRAM[address - 0xC000] = byte; break;
+        case 0xE000 ... 0xFDFF: mmu->workingRAM[address - 0xE000] = byte; break;
         
-        case 0xFF30 ... 0xFF3F:  {
-            mmu->waveChannel.waveTable[address & 0xF] = byte;
+        case 0xFE00 ... 0xFE9F: {
+            lcd->oam[address - 0xFE00] = byte;
+            //TODO: Shouldn't be able to write to OAM memory during these modes.
+            //      Enabling commented out code breaks sprites.  Figure out why...
+            //            if (lcd->mode != ScanVRAMAndOAM && lcd->mode != ScanOAM) {
+            //                lcd->oam[address - 0xFE00] = byte;
+            //            }
         } break;
         
-        case 0xFF40: { //LCD Control
-            lcd->isEnabled = isBitSet(7, byte);
-            if (lcd->isEnabled) {
-                lcd->stat = (lcd->stat & 0xF8) | (u8)lcd->mode;
-            }
-            else {
-                lcd->stat &= 0xF8 ;  //reset to HBlank if disabled. TODO: Not sure if this correct
-                lcd->modeClock = 0;
-                lcd->mode = LCDMode::HBlank;
-                lcd->ly = 0;
-            }
-            
-            //Bit 6 - Window Tile Map Display Select (0=9800-9BFF, 1=9C00-9FFF)
-            lcd->windowTileMap = isBitSet(6, byte) ? 1 : 0;
-            //Bit 5 - Window Display Enable
-            lcd->isWindowEnabled = isBitSet(5, byte);
-            //Bit 4 - Background Tile Set Select
-            lcd->backgroundTileSet = isBitSet(4, byte) ? 1 : 0;
-            //Bit 3 - Background Tile Map Select
-            lcd->backgroundTileMap = isBitSet(3, byte) ? 1 : 0;
-            //Bit 2 - Sprite size
-            lcd->spriteHeight = isBitSet(2, byte) ? SpriteHeight::Tall : SpriteHeight::Short;
-            //Bit 1 - OAM enabled
-            lcd->isOAMEnabled = isBitSet(1, byte);
-            //Bit 0 - Background enabled
-            lcd->isBackgroundEnabled = isBitSet(0, byte);
-            
-        } break;
-        case 0xFF41: lcd->stat = (lcd->stat & 7) | byte; break; //STAT interrupt (last 3 bytes read-only)
-        case 0xFF42: lcd->scy = byte; break;
-        case 0xFF43: lcd->scx = byte; break;
-        case 0xFF44: lcd->ly = 0; break; //reset ly
-        case 0xFF45: lcd->lyc = byte; break;
-        case 0xFF46: {
-            if (byte < 0xF1) {
-                mmu->currentDMAAddress = ((u16)(byte << 8)) & 0xFF00;
-                mmu->isDMAOccurring = true;
+        case 0xFF00 ... 0xFF7F: {
+            const IORegisterHandlers *handlers = &ioRegisterHandlers[address - 0xFF00];
+            handlers->write(byte, address, mmu, gbDebug);
+            if (handlers->isCached) {
+                mmu->ioRegisters[address - 0xFF00] = handlers->read(address, mmu);
             }
         } break;
-        case 0xFF47: updateColorPaletteFromU8(lcd->backgroundPalette, byte); break;
-        case 0xFF48: updateColorPaletteFromU8(lcd->spritePalette0, byte); break;
-        case 0xFF49: updateColorPaletteFromU8(lcd->spritePalette1, byte); break;
-        case 0xFF4A: lcd->wy = byte; break;
-        case 0xFF4B: lcd->wx = byte; break;
-        //TODO: Implement writing to LCD status
-        case 0xFF50: break;//mmu->inBios = (byte != 0) ? false : true; break;
         case 0xFF80 ... 0xFFFE: mmu->zeroPageRAM[address - 0xFF80] = byte; break;
-        case 0xFFFF: mmu->enabledInterrupts = byte; break;
+        case 0xFFFF: {
+            mmu->enabledInterrupts = byte;
+            mmu->didInterruptsChange = true;
+        } break;
         
         
     }
@@ -1244,38 +1778,65 @@ static u16 popOffStack(u16 *SP, MMU *mmu) {
 //addresses of interrupt service routines in order of priority
 const u16 interruptRoutineAddresses[] = {0x40, 0x48, 0x50, 0x58, 0x60};
 
+static inline void updateIsInterruptPending(CPU *cpu, MMU *mmu) {
+    cpu->isInterruptPending = cpu->enableInterrupts && (mmu->enabledInterrupts & mmu->requestedInterrupts);
+}
+
+//Servicing an interrupt is its own 20 cycle step
+static void dispatchInterrupt(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
+    u8 interruptsToHandle = mmu->enabledInterrupts & mmu->requestedInterrupts;
+    u16 returnAddress = cpu->PC;
+    if (cpu->isHaltBugTriggered) {
+        //EI then HALT with an interrupt pending.  The interrupt comes before the byte after HALT is read, and
+        //returns to the HALT
+        returnAddress--;
+        cpu->isHaltBugTriggered = false;
+    }
+    foriarr (interruptRoutineAddresses) {
+        if (isBitSet((int)i, interruptsToHandle)) {
+            pushOnToStack(returnAddress, &cpu->SP, mmu, gbDebug);
+            cpu->PC = interruptRoutineAddresses[i];
+            clearBit((int)i, &mmu->requestedInterrupts);
+            break;
+        }
+    }
+    cpu->enableInterrupts = false;
+    cpu->isInterruptPending = false;
+    cpu->isHalted = false;
+    cpu->instructionCycles = 20;
+}
+
 static void stepCPU(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
     cpu->instructionCycles = 4;
     
-    bool isHandlingInterrupts = false;
-    u8 interruptsToHandle = mmu->enabledInterrupts & mmu->requestedInterrupts;
-    if (interruptsToHandle > 0) {
-        if (cpu->isHalted) {
-            cpu->isHalted = false;
-        }
-        if (cpu->enableInterrupts) {
-            //TODO: change names to be more distinct
-            isHandlingInterrupts = true;
-            foriarr (interruptRoutineAddresses) {
-                if (isBitSet((int)i, interruptsToHandle)) {
-                    pushOnToStack(cpu->PC, &cpu->SP, mmu, gbDebug);
-                    cpu->PC = interruptRoutineAddresses[i];
-                    
-                    clearBit((int)i, &mmu->requestedInterrupts);
-                    cpu->enableInterrupts = false;
-                    Breakpoint *bp;
-                    if (shouldBreakOnPC(cpu->PC, gbDebug, &bp)) {
-                        gbDebug->hitBreakpoint = bp;
-                        return;
-                    }
-                    break;
-                }
-            }
-        }
+    if (mmu->didInterruptsChange) {
+        mmu->didInterruptsChange = false;
+        updateIsInterruptPending(cpu, mmu);
+    }
+    
+    if (cpu->isInterruptPending) {
+        dispatchInterrupt(cpu, mmu, gbDebug);
+        cpu->totalCycles += cpu->instructionCycles;
+        mmu->currentCycle = cpu->totalCycles;
+        return;
+    }
+    
+    if (cpu->isHalted && (mmu->enabledInterrupts & mmu->requestedInterrupts)) {
+        //with IME off, HALT just ends when an interrupt is requested
+        cpu->isHalted = false;
     }
     
+    //EI takes effect after the instruction following it
+    bool shouldEnableInterruptsAfterThisInstruction = cpu->shouldEnableInterrupts;
+    
     if (!cpu->isHalted) {
         u8 instructionToExecute = readByte(cpu->PC, mmu);
+        if (cpu->isHaltBugTriggered) {
+            //PC failed to increment past the opcode, so the instruction reads its own opcode as its first operand
+            //and the byte after the opcode runs again
+            cpu->isHaltBugTriggered = false;
+            cpu->PC--;
+        }
         
         switch (instructionToExecute) {
             case 0x0: { //NOP
@@ -1714,8 +2275,13 @@ static void stepCPU(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
             } break;
             
             case 0x76: { //HALT
-                //TODO: finish implementing
-                cpu->isHalted = true;
+                if (!cpu->enableInterrupts && (mmu->enabledInterrupts & mmu->requestedInterrupts)) {
+                    //HALT bug. Doesn't halt and the next byte is read twice
+                    cpu->isHaltBugTriggered = true;
+                }
+                else {
+                    cpu->isHalted = true;
+                }
                 cpu->instructionCycles = 4;
                 cpu->PC += 1;
             } break;
@@ -2023,6 +2589,7 @@ static void stepCPU(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
             
             case 0xD9: {                                             //RETI
                 cpu->enableInterrupts = true;
+                updateIsInterruptPending(cpu, mmu);
                 RET_FROM_PROC(true);
             } break;
             
@@ -2092,6 +2659,8 @@ static void stepCPU(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
             
             case 0xF3: {                                              //DI
                 cpu->enableInterrupts = false;
+                cpu->shouldEnableInterrupts = false;
+                cpu->isInterruptPending = false;
                 cpu->PC += 1;
                 cpu->instructionCycles = 4;
             } break;
@@ -2122,7 +2691,7 @@ static void stepCPU(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
             } break;
             
             case 0xFB: {                                              //EI
-                cpu->enableInterrupts = true;
+                cpu->shouldEnableInterrupts = true;
                 cpu->PC += 1;
                 cpu->instructionCycles = 4;
             } break;
@@ -2144,117 +2713,30 @@ static void stepCPU(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
     
     cpu->F &= 0xF0;
     
-    if (isHandlingInterrupts) {
-        cpu->instructionCycles += 20;
+    if (shouldEnableInterruptsAfterThisInstruction && cpu->shouldEnableInterrupts) {
+        cpu->shouldEnableInterrupts = false;
+        cpu->enableInterrupts = true;
+        updateIsInterruptPending(cpu, mmu);
     }
     
     cpu->totalCycles += cpu->instructionCycles;
+    mmu->currentCycle = cpu->totalCycles;
     
     
     
-}
-static void recordDebugState(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
-    if (gbDebug->numDebugStates < ARRAY_LEN(gbDebug->prevGBDebugStates)) {
-        gbDebug->numDebugStates++;
-    }
-    
-    auto prevState = &gbDebug->prevGBDebugStates[gbDebug->currentDebugState];
-    prevState->cpu = *cpu;
-    
-    if (mmu->hasRAM) {
-        copyMemory(mmu->cartRAM, prevState->mmu.cartRAM, prevState->mmu.cartRAMSize);
-    }
-    prevState->mmu = *mmu;
-    
-    if (gbDebug->currentDebugState < ARRAY_LEN(gbDebug->prevGBDebugStates) - 1){
-        gbDebug->currentDebugState++;
-    }
-    else {
-        gbDebug->currentDebugState = 0;
-    }
 }
 
-static bool rewindState(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
-    if (gbDebug->numGBStates == 0) {
-        return false;
-    }
-    
-    if (gbDebug->nextFreeGBStateIndex - 1 < 0) {
-        gbDebug->nextFreeGBStateIndex = ARRAY_LEN(gbDebug->recordedGBStates) - 1;
-    }
-    else {
-        gbDebug->nextFreeGBStateIndex--;
-    }
-    gbDebug->numGBStates--;
-    
-    auto prevState = &gbDebug->recordedGBStates[gbDebug->nextFreeGBStateIndex];
-    *cpu = prevState->cpu;
-    
-    auto cartRAM = mmu->cartRAM;
-    copyMemory(prevState->mmu.cartRAM, cartRAM, mmu->cartRAMSize);
-    //Since there is only one copy of the MMAPed RAM file, the cartRAMFileMap address 
-    //will be the same upon *mmu = prevState->mmu
-    copyMemory(prevState->mmu.cartRAM, mmu->cartRAMPlatformState.cartRAMFileMap, mmu->cartRAMSize);
-    
-    auto soundFrameBufferData = prevState->mmu.soundFramesBuffer.data;
-    copyMemory(soundFrameBufferData, mmu->soundFramesBuffer.data,
-               mmu->soundFramesBuffer.len);
-    
-    
-    *mmu = prevState->mmu;
-    mmu->cartRAM = cartRAM;
-    mmu->soundFramesBuffer.data = soundFrameBufferData;
-    
-    if (mmu->hasRTC) {
-        syncRTCTime(&mmu->rtc, mmu->cartRAMPlatformState.rtcFileMap);
-    }
-    gbDebug->elapsedTimeSinceLastRecord = 0;
-    
-    return true;
-}
 void continueFromBreakPoint(GameBoyDebug *gbDebug, MMU *mmu, CPU *cpu, ProgramState *programState) {
     gbDebug->hitBreakpoint = nullptr;
-    rewindState(cpu, mmu, gbDebug);
+    if (rewindOneFrame(cpu, mmu, &gbDebug->rewindBuffer)) {
+        clearDebugJournal(gbDebug->journal);
+    }
     setPausedState(false, programState, cpu);
     if (mmu->hasRTC) {
-        syncRTCTime(&mmu->rtc, mmu->cartRAMPlatformState.rtcFileMap);
+        syncRTCTime(mmu);
     }
 }
 
-static void recordState(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
-    profileStart("record state", profileState); 
-    if (gbDebug->numGBStates < ARRAY_LEN(gbDebug->recordedGBStates)) {
-        gbDebug->numGBStates++;
-    }
-    
-    auto prevState = &gbDebug->recordedGBStates[gbDebug->nextFreeGBStateIndex];
-    prevState->cpu = *cpu;
-    
-    auto cartRAM = prevState->mmu.cartRAM; 
-    if (mmu->hasRAM) {
-        copyMemory(mmu->cartRAM, cartRAM, mmu->cartRAMSize);
-    }
-    
-    auto soundFrameBufferData = prevState->mmu.soundFramesBuffer.data;
-    copyMemory(mmu->soundFramesBuffer.data, soundFrameBufferData, 
-               mmu->soundFramesBuffer.len);
-    
-    prevState->mmu = *mmu;
-    if (mmu->hasRAM) {
-        prevState->mmu.cartRAM = cartRAM;
-    }
-    
-    prevState->mmu.soundFramesBuffer.data = soundFrameBufferData;
-    
-    
-    if (gbDebug->nextFreeGBStateIndex < ARRAY_LEN(gbDebug->recordedGBStates) - 1){
-        gbDebug->nextFreeGBStateIndex++;
-    }
-    else {
-        gbDebug->nextFreeGBStateIndex = 0;
-    }
-    profileEnd(profileState);
-}
 
 static void nextScanLine(LCD *lcd, u8 *outRequestedInterrupts) {
     lcd->ly = (lcd->ly == MAX_LY) ? 0 : (lcd->ly + 1);
@@ -2671,127 +3153,35 @@ static void stepLCD(LCD *lcd, u8 *outRequestedInterrupts, i32 cyclesTakeOfLastIn
                 if (lcd->modeClock >= SCAN_OAM_DURATION) {
                     lcd->modeClock -= SCAN_OAM_DURATION;
                     changeToNewLCDMode(LCDMode::ScanVRAMAndOAM, lcd, outRequestedInterrupts);
-                }
-                
-            } break;
-            
-            case LCDMode::ScanVRAMAndOAM: {
-                if (lcd->modeClock >= SCAN_VRAM_AND_OAM_DURATION) {
-                    lcd->modeClock -= SCAN_VRAM_AND_OAM_DURATION;
-                    if (lcd->numScreensToSkip <= 0) {
-                        drawScanLine(lcd);
-                    }
-                    changeToNewLCDMode(LCDMode::HBlank, lcd, outRequestedInterrupts);
-                }
-            } break;
-            
-        }
-    }
-    
-    profileEnd(profileState);
-    
-}
-
-void step(CPU *cpu, MMU* mmu, GameBoyDebug *gbDebug, int volume) {
-    
-    u8 tmpRequestedInterrupts = 0;
-    
-    if (gbDebug->numBreakpoints > 0 && gbDebug->isEnabled ) {
-        
-        
-        if (gbDebug->isRecordDebugStateEnabled && gbDebug->numBreakpoints > 0) {
-            recordDebugState(cpu, mmu, gbDebug);
-        }           
-        CPU tmpCPU = *cpu;
-        stepCPU(cpu, mmu, gbDebug);
-        
-        //get changed registers 
-        foriarr (gbDebug->breakpoints) {
-            auto *bp = &gbDebug->breakpoints[i];
-            if (!bp->isUsed || bp->isDisabled || bp->type != BreakpointType::Register) {
-                continue;
-            }
-            
-            u16 before = 0, after = 0;
-            
-            if (areStringsEqual(bp->reg, "A", ARRAY_LEN(bp->reg))) {
-                before = tmpCPU.A;
-                after = cpu->A;
-            }
-            else if (areStringsEqual(bp->reg, "B", ARRAY_LEN(bp->reg))) {
-                before = tmpCPU.B;
-                after = cpu->B;
-            }
-            else if (areStringsEqual(bp->reg, "C", ARRAY_LEN(bp->reg))) {
-                before = tmpCPU.C;
-                after = cpu->C;
-            }
-            else if (areStringsEqual(bp->reg, "D", ARRAY_LEN(bp->reg))) {
-                before = tmpCPU.D;
-                after = cpu->D;
-            }
-            else if (areStringsEqual(bp->reg, "E", ARRAY_LEN(bp->reg))) {
-                before = tmpCPU.E;
-                after = cpu->E;
-            }
-            else if (areStringsEqual(bp->reg, "H", ARRAY_LEN(bp->reg))) {
-                before = tmpCPU.H;
-                after = cpu->H;
-            }
-            else if (areStringsEqual(bp->reg, "L", ARRAY_LEN(bp->reg))) {
-                before = tmpCPU.L;
-                after = cpu->L;
-            }
-            else if (areStringsEqual(bp->reg, "AF", ARRAY_LEN(bp->reg))) {
-                before = word(tmpCPU.A, tmpCPU.F);
-                after = word(cpu->A, cpu->F);
-            }
-            else if (areStringsEqual(bp->reg, "BC", ARRAY_LEN(bp->reg))) {
-                before = word(tmpCPU.B, tmpCPU.C);
-                after = word(cpu->B, cpu->C);
-            }
-            else if (areStringsEqual(bp->reg, "DE", ARRAY_LEN(bp->reg))) {
-                before = word(tmpCPU.D, tmpCPU.E);
-                after = word(cpu->D, cpu->E);
-            }
-            else if (areStringsEqual(bp->reg, "HL", ARRAY_LEN(bp->reg))) {
-                before = word(tmpCPU.H, tmpCPU.L);
-                after = word(cpu->H, cpu->L);
-            }
-            else if (areStringsEqual(bp->reg, "SP", ARRAY_LEN(bp->reg))) {
-                before = tmpCPU.SP;
-                after = cpu->SP; 
-            }
-            else if (areStringsEqual(bp->reg, "PC", ARRAY_LEN(bp->reg))) {
-                before = tmpCPU.PC;
-                after = cpu->PC; 
-            }
-            
-            if (((bp->op == BreakpointOP::Equal && after == bp->expectedValue) ||
-                 (bp->op == BreakpointOP::LessThan && after < bp->expectedValue) ||
-                 (bp->op == BreakpointOP::GreaterThan && after > bp->expectedValue)) &&
-                before != after) {
+                }
                 
-                gbDebug->hitBreakpoint = bp;
-                bp->valueBefore = before;
-                bp->valueAfter = after;
-                break;
-            }
+            } break;
+            
+            case LCDMode::ScanVRAMAndOAM: {
+                if (lcd->modeClock >= SCAN_VRAM_AND_OAM_DURATION) {
+                    lcd->modeClock -= SCAN_VRAM_AND_OAM_DURATION;
+                    if (lcd->numScreensToSkip <= 0) {
+                        drawScanLine(lcd);
+                    }
+                    changeToNewLCDMode(LCDMode::HBlank, lcd, outRequestedInterrupts);
+                }
+            } break;
             
         }
-        
-    }
-    else {
-        stepCPU(cpu, mmu, gbDebug);
     }
     
+    profileEnd(profileState);
+    
+}
+
+static void stepSound(MMU *mmu, GameBoyDebug *gbDebug, i32 cycles, int volume) {
     profileStart("Step sound", profileState);
     MMU::SquareWave1 *sq1 = &mmu->squareWave1Channel;
     MMU::SquareWave2 *sq2 = &mmu->squareWave2Channel;
     MMU::Wave *wave = &mmu->waveChannel;
     MMU::Noise *noise = &mmu->noiseChannel;
     
-    mmu->cyclesSinceLastFrameSequencer += cpu->instructionCycles;
+    mmu->cyclesSinceLastFrameSequencer += cycles;
     int tmpCyclesSinceLastFrameSeq = mmu->cyclesSinceLastFrameSequencer;
     
     //sweep
@@ -2830,7 +3220,7 @@ void step(CPU *cpu, MMU* mmu, GameBoyDebug *gbDebug, int volume) {
     }
     
     //duty
-    sq1->frequencyClock += cpu->instructionCycles;
+    sq1->frequencyClock += cycles;
     while (sq1->tonePeriod > 0 && sq1->frequencyClock >= sq1->tonePeriod) {
         sq1->positionInWaveForm++;
         if (sq1->positionInWaveForm >= 8) {
@@ -2839,7 +3229,7 @@ void step(CPU *cpu, MMU* mmu, GameBoyDebug *gbDebug, int volume) {
         
         sq1->frequencyClock -= sq1->tonePeriod;
     }
-    sq2->frequencyClock += cpu->instructionCycles;
+    sq2->frequencyClock += cycles;
     while (sq2->tonePeriod > 0 && sq2->frequencyClock >= sq2->tonePeriod) {
         sq2->positionInWaveForm++;
         if (sq2->positionInWaveForm >= 8) {
@@ -2848,7 +3238,7 @@ void step(CPU *cpu, MMU* mmu, GameBoyDebug *gbDebug, int volume) {
         
         sq2->frequencyClock -= sq2->tonePeriod;
     }
-    wave->frequencyClock += cpu->instructionCycles;
+    wave->frequencyClock += cycles;
     while (wave->tonePeriod > 0 && wave->frequencyClock >= wave->tonePeriod) {
         wave->currentSampleIndex++;
         if (wave->currentSampleIndex >= ARRAY_LEN(wave->waveTable) * 2) {
@@ -2862,7 +3252,7 @@ void step(CPU *cpu, MMU* mmu, GameBoyDebug *gbDebug, int volume) {
         
         wave->frequencyClock -= wave->tonePeriod;
     }
-    noise->frequencyClock += cpu->instructionCycles;
+    noise->frequencyClock += cycles;
     while (noise->tonePeriod > 0 && noise->frequencyClock >= noise->tonePeriod) {
         noise->shiftValue >>= 1;
         u8 bit = (noise->shiftValue & 1) ^ ((noise->shiftValue >> 1) & 1);
@@ -2963,6 +3353,13 @@ void step(CPU *cpu, MMU* mmu, GameBoyDebug *gbDebug, int volume) {
         mmu->cyclesSinceLastFrameSequencer -= FRAME_SEQUENCER_PERIOD;
     }
     
+    if (mmu->isSoundOutputSkipped) {
+        //keeps the sample clock where it would be, so the sound heard after is the same
+        mmu->cyclesSinceLastSoundSample = (mmu->cyclesSinceLastSoundSample + cycles) % (CLOCK_SPEED_HZ/44100);
+        profileEnd(profileState);
+        return;
+    }
+    
     SoundFrame frame;
     
     
@@ -3077,68 +3474,126 @@ void step(CPU *cpu, MMU* mmu, GameBoyDebug *gbDebug, int volume) {
     }
     
     //TODO: would like to move to platform layer, but not sure if i can
-    mmu->cyclesSinceLastSoundSample += cpu->instructionCycles;
+    mmu->cyclesSinceLastSoundSample += cycles;
     while (mmu->cyclesSinceLastSoundSample >= CLOCK_SPEED_HZ/44100) {
         
-        push(frame, &mmu->soundFramesBuffer);
+        push(frame, &mmu->host->soundFramesBuffer);
         
         mmu->cyclesSinceLastSoundSample -= CLOCK_SPEED_HZ/44100;
     }
     profileEnd(profileState);
-    stepLCD(&mmu->lcd, &tmpRequestedInterrupts, cpu->instructionCycles);
+}
+
+void step(CPU *cpu, MMU* mmu, GameBoyDebug *gbDebug, int volume) {
     
-    //DMA
-    if (mmu->isDMAOccurring) {
-#define DMA_CYCLES_PER_BYTE 4
-        mmu->cyclesSinceLastDMACopy += cpu->instructionCycles;
-        
-        while (mmu->cyclesSinceLastDMACopy >= DMA_CYCLES_PER_BYTE) {
-            if ((mmu->currentDMAAddress & 0xFF) < 0xA0) {
-                u16 destAddr = 0xFE00 + (mmu->currentDMAAddress & 0xFF);
-                u8 srcByte = readByte(mmu->currentDMAAddress, mmu);
-                
-                writeByte(srcByte, destAddr, mmu, gbDebug);
-                
-                mmu->cyclesSinceLastDMACopy -= DMA_CYCLES_PER_BYTE;
-                mmu->currentDMAAddress++;
-            }
-            else {
-                mmu->isDMAOccurring = false;
-                mmu->cyclesSinceLastDMACopy = 0;
-                mmu->currentDMAAddress = 0;
-            }
-        }
-#undef DMA_CYCLES_PER_BYTE 
+    u8 tmpRequestedInterrupts = 0;
+    //the journal only exists while recording is on
+    bool isJournaling = gbDebug->isEnabled && gbDebug->journal;
+    if (isJournaling) {
+        journalBeginStep(cpu, mmu, gbDebug->journal);
     }
     
-    //divider and timer
-    {
-#define DIVIDER_CYCLES_PER_INCREMENT 256
-        mmu->cyclesSinceDividerIncrement += cpu->instructionCycles;
-        
-        while (mmu->cyclesSinceDividerIncrement >= DIVIDER_CYCLES_PER_INCREMENT) {
-            mmu->divider++;
-            mmu->cyclesSinceDividerIncrement -= DIVIDER_CYCLES_PER_INCREMENT;
-        }
+    if (gbDebug->numBreakpoints > 0 && gbDebug->isEnabled ) {
+        CPU tmpCPU = *cpu;
+        stepCPU(cpu, mmu, gbDebug);
         
-        if (mmu->isTimerEnabled) {
-            mmu->cyclesSinceTimerIncrement += cpu->instructionCycles;
-            while (mmu->cyclesSinceTimerIncrement >= (int)mmu->timerIncrementRate) {
-                mmu->timer++;
-                
-                if (mmu->timer == 0) { //timer overFlowed
-                    mmu->timer = mmu->timerModulo;
-                    setBit((int)InterruptRequestedBit::TimerRequested, &mmu->requestedInterrupts);
-                }
+        //get changed registers 
+        foriarr (gbDebug->breakpoints) {
+            auto *bp = &gbDebug->breakpoints[i];
+            if (!bp->isUsed || bp->isDisabled || bp->type != BreakpointType::Register) {
+                continue;
+            }
+            
+            u16 before = 0, after = 0;
+            
+            if (areStringsEqual(bp->reg, "A", ARRAY_LEN(bp->reg))) {
+                before = tmpCPU.A;
+                after = cpu->A;
+            }
+            else if (areStringsEqual(bp->reg, "B", ARRAY_LEN(bp->reg))) {
+                before = tmpCPU.B;
+                after = cpu->B;
+            }
+            else if (areStringsEqual(bp->reg, "C", ARRAY_LEN(bp->reg))) {
+                before = tmpCPU.C;
+                after = cpu->C;
+            }
+            else if (areStringsEqual(bp->reg, "D", ARRAY_LEN(bp->reg))) {
+                before = tmpCPU.D;
+                after = cpu->D;
+            }
+            else if (areStringsEqual(bp->reg, "E", ARRAY_LEN(bp->reg))) {
+                before = tmpCPU.E;
+                after = cpu->E;
+            }
+            else if (areStringsEqual(bp->reg, "H", ARRAY_LEN(bp->reg))) {
+                before = tmpCPU.H;
+                after = cpu->H;
+            }
+            else if (areStringsEqual(bp->reg, "L", ARRAY_LEN(bp->reg))) {
+                before = tmpCPU.L;
+                after = cpu->L;
+            }
+            else if (areStringsEqual(bp->reg, "AF", ARRAY_LEN(bp->reg))) {
+                before = word(tmpCPU.A, tmpCPU.F);
+                after = word(cpu->A, cpu->F);
+            }
+            else if (areStringsEqual(bp->reg, "BC", ARRAY_LEN(bp->reg))) {
+                before = word(tmpCPU.B, tmpCPU.C);
+                after = word(cpu->B, cpu->C);
+            }
+            else if (areStringsEqual(bp->reg, "DE", ARRAY_LEN(bp->reg))) {
+                before = word(tmpCPU.D, tmpCPU.E);
+                after = word(cpu->D, cpu->E);
+            }
+            else if (areStringsEqual(bp->reg, "HL", ARRAY_LEN(bp->reg))) {
+                before = word(tmpCPU.H, tmpCPU.L);
+                after = word(cpu->H, cpu->L);
+            }
+            else if (areStringsEqual(bp->reg, "SP", ARRAY_LEN(bp->reg))) {
+                before = tmpCPU.SP;
+                after = cpu->SP; 
+            }
+            else if (areStringsEqual(bp->reg, "PC", ARRAY_LEN(bp->reg))) {
+                before = tmpCPU.PC;
+                after = cpu->PC; 
+            }
+            
+            if (((bp->op == BreakpointOP::Equal && after == bp->expectedValue) ||
+                 (bp->op == BreakpointOP::LessThan && after < bp->expectedValue) ||
+                 (bp->op == BreakpointOP::GreaterThan && after > bp->expectedValue)) &&
+                before != after) {
                 
-                mmu->cyclesSinceTimerIncrement -= (int)mmu->timerIncrementRate;
+                gbDebug->hitBreakpoint = bp;
+                bp->valueBefore = before;
+                bp->valueAfter = after;
+                break;
             }
+            
         }
         
-#undef DIVIDER_CYCLES_PER_INCREMENT
+    }
+    else {
+        stepCPU(cpu, mmu, gbDebug);
+    }
+    
+    stepSound(mmu, gbDebug, cpu->instructionCycles, volume);
+    stepLCD(&mmu->lcd, &tmpRequestedInterrupts, cpu->instructionCycles);
+    processScheduledEvents(mmu);
+    
+    if (tmpRequestedInterrupts) {
+        mmu->requestedInterrupts |= tmpRequestedInterrupts;
+        mmu->didInterruptsChange = true;
     }
     
-    mmu->requestedInterrupts |= tmpRequestedInterrupts;
+    if (isJournaling) {
+        journalEndStep(mmu, gbDebug->journal);
+    }
+#ifdef GB_STEP_TRACE
+    if (gbDebug->stepTrace) {
+        gbDebug->stepTrace->onStep(cpu, mmu, gbDebug->stepTrace);
+    }
+#endif
     
     if (cpu->didHitIllegalOpcode || gbDebug->hitBreakpoint) {
         return;
@@ -3167,8 +3622,9 @@ void reset(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState
     
     u8 *tmpROM = mmu->romData;
     u8 *tmpRAM = mmu->cartRAM;
-    char *tmpROMName = mmu->romName;
-    i64 tmpROMNameLen = mmu->romNameLen;
+    u8 *tmpVideoRAM = mmu->lcd.videoRAM;
+    u8 *tmpWorkingRAM = mmu->workingRAM;
+    MMUHost *host = mmu->host;
     MBCType tmpMBC = mmu->mbcType;
     bool tmpHasRAM = mmu->hasRAM;
     bool tmpHasBattery = mmu->hasBattery;
@@ -3178,23 +3634,26 @@ void reset(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState
     i64 tmpROMSize = mmu->romSize;
     PaletteColor *tmpScreen = mmu->lcd.screen;
     PaletteColor *tmpBackBuffer = mmu->lcd.backBuffer;
-    SoundFrame *tmpSq1 = mmu->soundFramesBuffer.data;
-    i64 tmpSq1Len = mmu->soundFramesBuffer.len;
     i64 cartRAMSize = mmu->cartRAMSize;
     
-    CartRAMPlatformState tmpRAMPlatformState = mmu->cartRAMPlatformState;
     if (!tmpHasBattery) {
         zeroMemory(tmpRAM, mmu->cartRAMSize);
+        host->cartRAMPlatformState = {};
     }
     
     zeroMemory(tmpBackBuffer, SCREEN_WIDTH * SCREEN_HEIGHT);
     zeroMemory(tmpScreen, SCREEN_WIDTH * SCREEN_HEIGHT);
-    zeroMemory(tmpSq1, mmu->soundFramesBuffer.len);
+    zeroMemory(host->soundFramesBuffer.data, host->soundFramesBuffer.len);
+    zeroMemory(tmpVideoRAM, VIDEO_RAM_SIZE);
+    zeroMemory(tmpWorkingRAM, WORKING_RAM_SIZE);
     
     *mmu = {};
+    clearScheduledEvents(mmu);
+    mmu->didInterruptsChange = true;
+    mmu->lcd.videoRAM = tmpVideoRAM;
+    mmu->workingRAM = tmpWorkingRAM;
+    mmu->host = host;
     mmu->cartRAM = tmpRAM;
-    mmu->romName = tmpROMName;
-    mmu->romNameLen = tmpROMNameLen;
     mmu->mbcType = tmpMBC;
     mmu->hasRAM = tmpHasRAM;
     mmu->hasBattery = tmpHasBattery;
@@ -3209,10 +3668,6 @@ void reset(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState
     mmu->lcd.screen = tmpScreen;
     mmu->lcd.backBuffer = tmpBackBuffer;
     
-    if (tmpHasBattery) {
-        mmu->cartRAMPlatformState = tmpRAMPlatformState;
-    }
-    
     mmu->joyPad.selectedButtonGroup = JPButtonGroup::Nothing;
     
     mmu->joyPad.a = JPButtonState::Up;
@@ -3227,15 +3682,13 @@ void reset(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState
     
     mmu->timerIncrementRate = TimerIncrementRate::TIR_0;
     
-    mmu->soundFramesBuffer.data = tmpSq1;
-    mmu->soundFramesBuffer.len = tmpSq1Len;
-    
     mmu->noiseChannel.shiftValue = 1;
     
     mmu->lcd.stat = 0x82;
     mmu->lcd.mode = LCDMode::ScanOAM;
     
-    gbDebug->nextFreeGBStateIndex = 0;
+    clearRewindBuffer(&gbDebug->rewindBuffer);
+    clearDebugJournal(gbDebug->journal);
     
     //            while (mmu->inBios) {
     //                step(cpu, mmu, gbDebug, programState->soundState.volume);
@@ -3251,7 +3704,7 @@ void reset(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState
     cpu->L = 0x4D;
     cpu->PC = 0x100;
     cpu->SP = 0xFFFE;
-    mmu->divider = 207;
+    mmu->dividerBaseCycle = -(207 << 8); //DIV starts at 207
     mmu->lcd.isEnabled = true;
     mmu->lcd.modeClock = 116;
     mmu->lcd.mode = LCDMode::VBlank;
@@ -3262,13 +3715,247 @@ void reset(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState
     mmu->lcd.backgroundPalette[3] = PaletteColor::White;
     mmu->lcd.backgroundTileSet = 1;
     mmu->lcd.spriteHeight = SpriteHeight::Short;
-    clear(&mmu->soundFramesBuffer);
+    clear(&mmu->host->soundFramesBuffer);
+    rebuildIORegisterCache(mmu);
     
-    recordState(cpu, mmu, gbDebug);
+    recordRewindFrame(cpu, mmu, &gbDebug->rewindBuffer);
     
 }
 
 
+//the movie can't continue from a state it didn't reach by itself
+static void stopMovieForInterruption(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState) {
+    NotificationState *notifications = &programState->notifications;
+    switch (programState->movie.mode) {
+        case MovieMode::None: break;
+        case MovieMode::Recording: {
+            if (stopMovie(cpu, mmu, gbDebug, programState) != FileSystemResultCode::OK) {
+                NOTIFY(notifications, "Could not save movie!");
+            }
+            else {
+                NOTIFY(notifications, "Stopped recording movie");
+            }
+        } break;
+        case MovieMode::Playing: {
+            stopMovie(cpu, mmu, gbDebug, programState);
+            NOTIFY(notifications, "Stopped playing movie");
+        } break;
+    }
+}
+
+//Runs numFrames frames without sound, only drawing the last one
+static void lookAhead(i32 numFrames, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
+    LCD *lcd = &mmu->lcd;
+    lcd->numScreensToSkip = numFrames - 1;
+    //the LCD might be off, so give up after that many frames of cycles
+    i64 cyclesLeft = (i64)(numFrames + 1) * CYCLES_PER_FRAME;
+    while (numFrames > 0 && cyclesLeft > 0) {
+        LCDMode oldMode = lcd->mode;
+        step(cpu, mmu, gbDebug, 0);
+        cyclesLeft -= cpu->instructionCycles;
+        if (cpu->didHitIllegalOpcode || gbDebug->hitBreakpoint) {
+            break;
+        }
+        if (oldMode != LCDMode::VBlank && lcd->mode == LCDMode::VBlank) {
+            numFrames--;
+        }
+    }
+}
+
+//Run by the run-ahead worker, or by runAheadOfFrame() if there isn't one
+static void lookAheadOnSecondInstance(RunAhead *runAhead) {
+#ifdef CO_PROFILE
+    profileState = runAhead->profileState;
+#endif
+    restoreSnapshot(&runAhead->snapshot, runAhead->cpu, runAhead->mmu, runAhead->gbDebug);
+    lookAhead(runAhead->numFrames, runAhead->cpu, runAhead->mmu, runAhead->gbDebug);
+}
+
+static void runAheadOfFrame(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, RunAhead *runAhead) {
+    if (!runAhead->snapshot.data && !initSnapshot(mmu, &runAhead->snapshot)) {
+        runAhead->numFrames = 0;
+        return;
+    }
+    snapshotGameBoy(cpu, mmu, &runAhead->snapshot);
+    const CartRAMPlatformState *crps = &mmu->host->cartRAMPlatformState;
+
+    if (runAhead->mode == RunAheadMode::SecondInstance && runAhead->cpu) {
+        CartRAMPlatformState *copyCRPS = &runAhead->mmu->host->cartRAMPlatformState;
+        copyCRPS->isRTCOnEmulatedTime = crps->isRTCOnEmulatedTime;
+        copyCRPS->rtcEmulatedTimeBase = crps->rtcEmulatedTimeBase;
+        copyCRPS->rtcEmulatedCycleBase = crps->rtcEmulatedCycleBase;
+        runAhead->lookAhead = lookAheadOnSecondInstance;
+        runAhead->hasScreen = true;
+        if (runAhead->worker) {
+            lockMutex(runAhead->mutex);
+            runAhead->isWorkQueued = true;
+            broadcastCondition(runAhead->workAvailable);
+            unlockMutex(runAhead->mutex);
+        }
+        else {
+            lookAheadOnSecondInstance(runAhead);
+        }
+        return;
+    }
+
+    //the look-ahead's samples and serial bytes are dropped by putting the write side of their buffers
+    //back.  Only the main thread reads them, after this frame
+    SoundBuffer *soundFramesBuffer = &mmu->host->soundFramesBuffer;
+    i64 soundWriteIndex = soundFramesBuffer->writeIndex;
+    i64 numSoundFramesQueued = soundFramesBuffer->numItemsQueued;
+    i64 serialOutputLen = mmu->host->serialOutput.len;
+
+    lookAhead(runAhead->numFrames, cpu, mmu, gbDebug);
+
+    //the screens aren't part of the snapshot, so the look-ahead's stays up
+    restoreSnapshot(&runAhead->snapshot, cpu, mmu, gbDebug);
+    soundFramesBuffer->writeIndex = soundWriteIndex;
+    mmu->host->serialOutput.len = serialOutputLen;
+    soundFramesBuffer->numItemsQueued = numSoundFramesQueued;
+    runAhead->hasScreen = false;
+}
+
+//Returns false if the movie isn't running after this frame's input
+static bool advanceMovie(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState) {
+    NotificationState *notifications = &programState->notifications;
+    Movie *movie = &programState->movie;
+    if (movie->mode == MovieMode::None) {
+        return false;
+    }
+    i64 desyncFrame = movie->desyncFrame;
+    if (!updateMovieFrame(cpu, mmu, gbDebug, movie)) {
+        stopMovie(cpu, mmu, gbDebug, programState);
+        NOTIFY(notifications, "Movie finished");
+        return false;
+    }
+    if (movie->desyncFrame != desyncFrame) {
+        NOTIFY(notifications, "Movie desynced at frame %" PRId64 "!", movie->desyncFrame);
+    }
+    return true;
+}
+
+//Only the screen finished last in the next cyclesToExecute cycles gets drawn
+static void skipAllButLastScreen(i64 cyclesToExecute, LCD *lcd) {
+    i32 cyclesLeftForThisScanLine;
+    switch (lcd->mode) {
+        case LCDMode::VBlank: cyclesLeftForThisScanLine = VBLANK_DURATION - lcd->modeClock; break;
+        case LCDMode::HBlank: cyclesLeftForThisScanLine = (HBLANK_DURATION - lcd->modeClock) + SCAN_OAM_DURATION + SCAN_VRAM_AND_OAM_DURATION; break;
+        case LCDMode::ScanOAM: cyclesLeftForThisScanLine = (SCAN_OAM_DURATION - lcd->modeClock) + SCAN_VRAM_AND_OAM_DURATION; break;
+        case LCDMode::ScanVRAMAndOAM: cyclesLeftForThisScanLine = SCAN_VRAM_AND_OAM_DURATION - lcd->modeClock; break;
+    }
+    i32 cyclesLeftForThisFrame = cyclesLeftForThisScanLine + (MAX_LY - lcd->ly) * TOTAL_SCANLINE_DURATION; 
+    lcd->numScreensToSkip = (i32)((cyclesToExecute - cyclesLeftForThisFrame) / (TOTAL_SCANLINE_DURATION * (MAX_LY+1)));
+}
+
+//Returns false if emulation was paused by an illegal opcode or a breakpoint
+static bool runCycles(i32 cyclesToExecute, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState) {
+    NotificationState *notifications = &programState->notifications;
+    while (cyclesToExecute > 0) {
+        step(cpu, mmu, gbDebug, programState->soundState.volume);
+        cpu->cylesExecutedThisFrame += cpu->instructionCycles;
+        cyclesToExecute -= cpu->instructionCycles;
+        
+        
+        if (cpu->didHitIllegalOpcode || gbDebug->hitBreakpoint) {
+            if (gbDebug->hitBreakpoint) {
+                recordRewindFrame(cpu, mmu, &gbDebug->rewindBuffer);
+            }
+            setPausedState(true, programState, cpu);
+            if (cpu->didHitIllegalOpcode) {
+                NOTIFY(notifications, "Illegal opcode hit. Emulation paused.");
+            }
+            return false;
+        }
+        
+    }
+    return true;
+}
+
+//Fades the held back end of the last sound heard into the start of numSamples samples just queued,
+//then holds back the end of those for the next time
+static void crossfadeTurboSound(i64 startIndex, i64 numSamples, Turbo *turbo, SoundBuffer *sound) {
+    i64 numFaded = MIN((i64)turbo->numCrossfadeSamples, numSamples);
+    fori (numFaded) {
+        SoundFrame *frame = &sound->data[(startIndex + i) % sound->len];
+        const SoundFrame *fadingOut = &turbo->crossfade[i];
+        i32 weight = (i32)i + 1;
+        i32 totalWeight = (i32)numFaded + 1;
+        frame->leftChannel = (i16)((fadingOut->leftChannel * (totalWeight - weight) + frame->leftChannel * weight) / totalWeight);
+        frame->rightChannel = (i16)((fadingOut->rightChannel * (totalWeight - weight) + frame->rightChannel * weight) / totalWeight);
+    }
+    //the overlap is only heard once, so that much more sound is owed
+    turbo->leftOverSoundCycles += numFaded * (CLOCK_SPEED_HZ/44100);
+
+    //only the main thread reads the buffer, after this frame, so the end can be taken back off
+    i64 numHeldBack = MIN((i64)TURBO_CROSSFADE_SAMPLES, numSamples);
+    i64 heldBackIndex = (startIndex + numSamples - numHeldBack) % sound->len;
+    fori (numHeldBack) {
+        turbo->crossfade[i] = sound->data[(heldBackIndex + i) % sound->len];
+    }
+    turbo->numCrossfadeSamples = (i32)numHeldBack;
+    sound->writeIndex = heldBackIndex;
+    sound->numItemsQueued -= numHeldBack;
+}
+
+//Runs whole frames for this host frame, each with the input applied so movies record and play back
+//the same as at normal speed.  Only the last screen is drawn
+static void runTurboFrames(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState, TimeUS dt) {
+    Turbo *turbo = &programState->turbo;
+    i64 hostFrameCycles = (CLOCK_SPEED_HZ * dt) / 1000000;
+    i32 numFrames;
+    if (turbo->speed > 0) {
+        //a slow host falls behind instead of trying to catch up
+        turbo->leftOverCycles += turbo->speed * hostFrameCycles;
+        numFrames = (i32)MIN(turbo->leftOverCycles / CYCLES_PER_FRAME, (i64)turbo->speed * 2);
+        turbo->leftOverCycles = MIN(turbo->leftOverCycles - (i64)numFrames * CYCLES_PER_FRAME, (i64)CYCLES_PER_FRAME);
+    }
+    else if (turbo->frameTime > 0) {
+        numFrames = (i32)MAX(TURBO_UNCAPPED_TIME_US / turbo->frameTime, (TimeUS)1);
+    }
+    else {
+        numFrames = 1;
+    }
+
+    //the last frames are heard, as many as the host's frame time covers
+    i32 numHeardFrames = 0;
+    if (turbo->sound == TurboSound::Compressed) {
+        turbo->leftOverSoundCycles += hostFrameCycles;
+        numHeardFrames = (i32)MIN(turbo->leftOverSoundCycles / CYCLES_PER_FRAME, (i64)numFrames);
+        turbo->leftOverSoundCycles = MIN(turbo->leftOverSoundCycles - (i64)numHeardFrames * CYCLES_PER_FRAME, (i64)CYCLES_PER_FRAME);
+    }
+
+    SoundBuffer *sound = &mmu->host->soundFramesBuffer;
+    i64 soundStartIndex = 0;
+    i64 numSoundFramesQueued = 0;
+    skipAllButLastScreen((i64)numFrames * CYCLES_PER_FRAME, &mmu->lcd);
+    TimeUS startTime = nowInMicroseconds();
+    i32 numFramesRun = 0;
+    while (numFramesRun < numFrames) {
+        Movie *movie = &programState->movie;
+        if (movie->mode != MovieMode::None && !advanceMovie(cpu, mmu, gbDebug, programState)) {
+            break;
+        }
+        if (numFramesRun == numFrames - numHeardFrames) {
+            soundStartIndex = sound->writeIndex;
+            numSoundFramesQueued = sound->numItemsQueued;
+        }
+        mmu->isSoundOutputSkipped = numFramesRun < numFrames - numHeardFrames;
+        bool isRunning = runCycles(CYCLES_PER_FRAME, cpu, mmu, gbDebug, programState);
+        numFramesRun++;
+        if (!isRunning) {
+            break;
+        }
+    }
+    mmu->isSoundOutputSkipped = false;
+
+    if (numFramesRun > 0) {
+        turbo->frameTime = (nowInMicroseconds() - startTime) / numFramesRun;
+    }
+    if (numHeardFrames > 0 && numFramesRun > numFrames - numHeardFrames) {
+        crossfadeTurboSound(soundStartIndex, sound->numItemsQueued - numSoundFramesQueued, turbo, sound);
+    }
+}
+
 #ifdef CO_DEBUG
 extern "C"
 #endif
@@ -3283,6 +3970,8 @@ void runFrame(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programSt
     
     
     
+    bool isRewinding = false;
+    
     /************************
      * Process input
      ************************/
@@ -3296,6 +3985,7 @@ void runFrame(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programSt
         }
         
         if (isActionPressed(Input::Action::Reset, input)) {
+            stopMovieForInterruption(cpu, mmu, gbDebug, programState);
             reset(cpu, mmu, gbDebug, programState);
         }
         if (isActionPressed(Input::Action::ShowHomePath, input)) {
@@ -3308,45 +3998,74 @@ void runFrame(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programSt
         if (isActionPressed(Input::Action::Pause, input)) {
             setPausedState(!cpu->isPaused, programState, cpu);
             if (!cpu->isPaused && mmu->hasRTC) {
-                syncRTCTime(&mmu->rtc, mmu->cartRAMPlatformState.rtcFileMap);
+                syncRTCTime(mmu);
             }
         }
         if (isActionPressed(Input::Action::DebuggerContinue, input)) {
             continueFromBreakPoint(gbDebug, mmu, cpu, programState); 
         }
-        if (isActionPressed(Input::Action::Rewind, input)) {
-            if (!rewindState(cpu, mmu, gbDebug)) {
-                NOTIFY(notifications, "Nothing left to rewind!");
+        if (isActionPressed(Input::Action::ToggleTurbo, input)) {
+            programState->turbo.isToggledOn = !programState->turbo.isToggledOn;
+            if (programState->turbo.isToggledOn) {
+                NOTIFY(notifications, "Turbo on");
             }
             else {
-                NOTIFY(notifications, "Rewind");
+                NOTIFY(notifications, "Turbo off");
+            }
+        }
+        if (isActionDown(Input::Action::Rewind, input)) {
+            //plays backwards one recorded frame per frame for as long as it's held
+            isRewinding = true;
+            stopMovieForInterruption(cpu, mmu, gbDebug, programState);
+            bool didRewind = rewindOneFrame(cpu, mmu, &gbDebug->rewindBuffer);
+            if (didRewind) {
+                clearDebugJournal(gbDebug->journal);
+            }
+            if (isActionPressed(Input::Action::Rewind, input)) {
+                if (!didRewind) {
+                    NOTIFY(notifications, "Nothing left to rewind!");
+                }
+                else {
+                    NOTIFY(notifications, "Rewind");
+                }
             }
         }
         if (WAS_PRESSED(saveState)) {
             int slot = input->newState.slotToRestoreOrSave;
-            switch (saveSaveStateToFile(cpu, mmu, programState, slot)) {
-                case FileSystemResultCode::OK: {
-                    NOTIFY(notifications, "Saved state to slot %d!", slot);  
-                } break;
-                case FileSystemResultCode::OutOfSpace: {
-                    NOTIFY(notifications, "Could not save state to slot %d. Disk full!", slot);  
-                } break;
-                case FileSystemResultCode::PermissionDenied: {
-                    NOTIFY(notifications, "Could not save state to slot %d. Permission denied!", slot);  
-                } break;
-                case FileSystemResultCode::IOError: {
-                    NOTIFY(notifications, "Could not save state to slot %d. IO error!", slot);  
-                } break;
-                default: {
-                    NOTIFY(notifications, "Could not save state to slot %d.", slot);  
-                } break;
+            if (saveSaveStateToFile(cpu, mmu, programState, slot) != FileSystemResultCode::OK) {
+                NOTIFY(notifications, "Could not save state to slot %d.", slot);  
+            }
+        }
+        {
+            SaveStateWriteResult result;
+            while (popSaveStateWriteResult(&programState->saveStateWriter, &result)) {
+                int slot = result.slot;
+                switch (result.resultCode) {
+                    case FileSystemResultCode::OK: {
+                        NOTIFY(notifications, "Saved state to slot %d!", slot);  
+                    } break;
+                    case FileSystemResultCode::OutOfSpace: {
+                        NOTIFY(notifications, "Could not save state to slot %d. Disk full!", slot);  
+                    } break;
+                    case FileSystemResultCode::PermissionDenied: {
+                        NOTIFY(notifications, "Could not save state to slot %d. Permission denied!", slot);  
+                    } break;
+                    case FileSystemResultCode::IOError: {
+                        NOTIFY(notifications, "Could not save state to slot %d. IO error!", slot);  
+                    } break;
+                    default: {
+                        NOTIFY(notifications, "Could not save state to slot %d.", slot);  
+                    } break;
+                }
             }
         }
         if (WAS_PRESSED(restoreState)) {
             int slot = input->newState.slotToRestoreOrSave;
-            auto result = restoreSaveStateFromFile(cpu, mmu, programState->loadedROMName, slot);
+            stopMovieForInterruption(cpu, mmu, gbDebug, programState);
+            auto result = restoreSaveStateFromFile(cpu, mmu, programState, slot);
             switch (result) {
                 case RestoreSaveResult::Success: {
+                    clearDebugJournal(gbDebug->journal);
                     NOTIFY(notifications, "Restored save state from slot %d!", slot);  
                 } break;
                 case RestoreSaveResult::NothingInSlot:  {
@@ -3367,7 +4086,7 @@ void runFrame(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programSt
         mmu->joyPad.down = isActionDown(Input::Action::Down, input) ? JPButtonState::Down : JPButtonState::Up;
         mmu->joyPad.left = isActionDown(Input::Action::Left, input) ? JPButtonState::Down : JPButtonState::Up;
         mmu->joyPad.right = isActionDown(Input::Action::Right, input) ? JPButtonState::Down : JPButtonState::Up;
-        
+        mmu->ioRegisters[0x00] = readJoyPadRegister(0xFF00, mmu);
     }
     
     /************************
@@ -3375,45 +4094,43 @@ void runFrame(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programSt
      ************************/
     profileStart("Step loop", profileState);
     cpu->cylesExecutedThisFrame = 0;
-    if (!cpu->isPaused){
+    Turbo *turbo = &programState->turbo;
+    bool wasTurboActive = turbo->isActive;
+    turbo->isActive = !cpu->isPaused && !isRewinding &&
+        (turbo->isToggledOn || (!gbDebug->isTypingInTextBox && isActionDown(Input::Action::Turbo, input)));
+    if (turbo->isActive != wasTurboActive) {
+        programState->shouldUpdateTitleBar = true;
+        turbo->leftOverCycles = 0;
+        turbo->leftOverSoundCycles = 0;
+        turbo->numCrossfadeSamples = 0;
+    }
+    if (turbo->isActive) {
+        runTurboFrames(cpu, mmu, gbDebug, programState, dt);
+        if (mmu->hasRTC) {
+            profileStart("RTC tick", profileState);
+            syncRTCTime(mmu);
+            profileEnd(profileState);
+        }
+    }
+    else if (!cpu->isPaused && !isRewinding){
         i32 cyclesToExecute = ((i32)((CLOCK_SPEED_HZ * dt) / 1000000) + cpu->leftOverCyclesFromPreviousFrame);
         
         //cycles are in multiples of 4
         cpu->leftOverCyclesFromPreviousFrame = cyclesToExecute - (cyclesToExecute & ~3);
         cyclesToExecute &= ~3;
         
-        LCD *lcd = &mmu->lcd; 
-        i32 cyclesLeftForThisScanLine;
-        switch (lcd->mode) {
-            case LCDMode::VBlank: cyclesLeftForThisScanLine = VBLANK_DURATION - lcd->modeClock; break;
-            case LCDMode::HBlank: cyclesLeftForThisScanLine = (HBLANK_DURATION - lcd->modeClock) + SCAN_OAM_DURATION + SCAN_VRAM_AND_OAM_DURATION; break;
-            case LCDMode::ScanOAM: cyclesLeftForThisScanLine = (SCAN_OAM_DURATION - lcd->modeClock) + SCAN_VRAM_AND_OAM_DURATION; break;
-            case LCDMode::ScanVRAMAndOAM: cyclesLeftForThisScanLine = SCAN_VRAM_AND_OAM_DURATION - lcd->modeClock; break;
+        //the host's frame time isn't part of the movie
+        bool isMovieFrame = advanceMovie(cpu, mmu, gbDebug, programState);
+        if (isMovieFrame || programState->hasFixedFrameLength) {
+            cyclesToExecute = CYCLES_PER_FRAME;
+            cpu->leftOverCyclesFromPreviousFrame = 0;
         }
-        i32 cyclesLeftForThisFrame = cyclesLeftForThisScanLine + (MAX_LY - lcd->ly) * TOTAL_SCANLINE_DURATION; 
-        lcd->numScreensToSkip = (cyclesToExecute - cyclesLeftForThisFrame) / (TOTAL_SCANLINE_DURATION * (MAX_LY+1));
         
-        while (cyclesToExecute > 0) {
-            step(cpu, mmu, gbDebug, programState->soundState.volume);
-            cpu->cylesExecutedThisFrame += cpu->instructionCycles;
-            cyclesToExecute -= cpu->instructionCycles;
-            
-            
-            if (cpu->didHitIllegalOpcode || gbDebug->hitBreakpoint) {
-                if (gbDebug->hitBreakpoint) {
-                    recordState(cpu, mmu, gbDebug);
-                }
-                setPausedState(true, programState, cpu);
-                if (cpu->didHitIllegalOpcode) {
-                    NOTIFY(notifications, "Illegal opcode hit. Emulation paused.");
-                }
-                break;
-            }
-            
-        }
+        skipAllButLastScreen(cyclesToExecute, &mmu->lcd);
+        runCycles(cyclesToExecute, cpu, mmu, gbDebug, programState);
         if (mmu->hasRTC) {
             profileStart("RTC tick", profileState);
-            syncRTCTime(&mmu->rtc, mmu->cartRAMPlatformState.rtcFileMap);
+            syncRTCTime(mmu);
             profileEnd(profileState);
         }
     }
@@ -3424,13 +4141,26 @@ void runFrame(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programSt
     /**********
      * Record
      **********/
-    if (!cpu->isPaused) {
-        gbDebug->elapsedTimeSinceLastRecord += dt;
-        if (gbDebug->elapsedTimeSinceLastRecord >= NUM_US_BETWEEN_RECORDS) {
-            recordState(cpu, mmu, gbDebug);
-            gbDebug->elapsedTimeSinceLastRecord = 0;
-        }
+    if (!cpu->isPaused && !isRewinding) {
+        profileStart("Record rewind frame", profileState);
+        recordRewindFrame(cpu, mmu, &gbDebug->rewindBuffer);
+        profileEnd(profileState);
     }        
+    
+    /**********
+     * Run-ahead
+     **********/
+    RunAhead *runAhead = &programState->runAhead;
+    //breakpoints and the journal would see the look-ahead, so it's off while debugging.  Turbo's lag
+    //doesn't matter and it would be slowed down, so it's off then too
+    if (!cpu->isPaused && !isRewinding && runAhead->numFrames > 0 && !gbDebug->isEnabled && !turbo->isActive) {
+        profileStart("Run-ahead", profileState);
+        runAheadOfFrame(cpu, mmu, gbDebug, runAhead);
+        profileEnd(profileState);
+    }
+    else {
+        runAhead->hasScreen = false;
+    }
     if (gbDebug->isEnabled) {
         profileStart("Draw Debug window", profileState);
         drawDebugger(gbDebug, mmu, cpu, programState, dt);
@@ -9,8 +9,11 @@
 # define MT_RENDER //OpenGL mutli-threaded render is broken on macOS Mojave
 #endif
 
+//GB_NO_DEBUGGER_UI leaves out the debugger's windows, and with them ImGui, for builds that embed the core
+#ifndef GB_NO_DEBUGGER_UI
 #define IMGUI_DISABLE_OBSOLETE_FUNCTIONS
 #include "3rdparty/imgui.h"
+#endif
 
 #define RTC_TICKS_PER_SECOND 32768
 #define CYCLES_PER_RTC_TICK (CLOCK_SPEED_HZ / RTC_TICKS_PER_SECOND)
@@ -24,9 +27,15 @@
 
 #define PALETTE_LEN 4
 #define CLOCK_SPEED_HZ 4194304
+#define MAX_LY 153
+#define TOTAL_SCANLINE_DURATION 456
+#define CYCLES_PER_FRAME (TOTAL_SCANLINE_DURATION * (MAX_LY + 1))
 
 #define MAX_ROM_NAME_LEN 16
 
+#define VIDEO_RAM_SIZE 0x2000
+#define WORKING_RAM_SIZE 0x2000
+
 #define BYTES_PER_TILE_ROW  2
 #define BYTES_PER_TILE  16
 
@@ -48,7 +57,11 @@
 #define SWEEP_TIMER_PERIOD (512/128)
 #define VOLUME_ENVELOPE_TIMER_PERIOD (512/64)
 
-#define NUM_US_BETWEEN_RECORDS 5000000
+//rewind
+#define DEFAULT_REWIND_BUFFER_SIZE_MB 64
+#define REWIND_FRAMES_PER_KEY_FRAME 60
+#define REWIND_MAX_FRAMES (60*60*30) //30 minutes of frames at 60 FPS
+#define REWIND_MAX_PENDING_FRAMES 4
 
 #define MAX_NOTIFICATION_LEN 127
 #define MAX_NOTIFICATIONS 10
@@ -66,11 +79,40 @@ struct PlatformState {
 struct RTC;
 struct RTCFileState;
 
+//Bytes the game sends over the serial port, for test ROMs that report their results there.
+//Owned by the platform layer.  Bytes past the capacity are dropped, so a capacity of 0 drops every one
+struct SerialOutput {
+    u8 *data;
+    i64 len;
+    i64 capacity;
+};
+
 struct CartRAMPlatformState {
     u8 *cartRAMFileMap;
     usize ramLen;
     MemoryMappedFileHandle *cartRAMFileHandle;
     RTCFileState *rtcFileMap;
+    
+    //movies run the RTC off emulated time instead of the wall clock, so they play back the same
+    bool isRTCOnEmulatedTime;
+    i64 rtcEmulatedTimeBase; //unix time as of rtcEmulatedCycleBase
+    i64 rtcEmulatedCycleBase;
+};
+
+//Where an MMU's output goes and what backs its battery.  Owned by the platform layer and set with
+//attachMMU().  None of it is emulated state, so snapshots, rewind and the journal leave it alone
+struct MMUHost {
+    char *romName; //in the ROM.  Set by useCartridge()
+    i64 romNameLen;
+    SoundBuffer soundFramesBuffer;
+    SerialOutput serialOutput;
+    CartRAMPlatformState cartRAMPlatformState;
+};
+
+//The MMU's bulk memory, allocated apart from it so its registers are packed into a few cache lines
+struct GameBoyMemory {
+    u8 videoRAM[VIDEO_RAM_SIZE];
+    u8 workingRAM[WORKING_RAM_SIZE];
 };
 
 enum class Flag {
@@ -111,7 +153,8 @@ enum class PaletteColor : i32 {
 enum class InterruptRequestedBit {
     VBlankRequested = 0,
     LCDRequested = 1,
-    TimerRequested = 2
+    TimerRequested = 2,
+    SerialRequested = 3
 };
 
 enum class LCDCBit {
@@ -129,6 +172,22 @@ enum class TimerIncrementRate : i32 {
     TIR_3 = 256
 };
 
+//things that happen at a known cycle, so they don't need to be polled every instruction
+enum class ScheduledEvent {
+    TimerOverflow,
+    DMAEnd,
+    SerialTransferEnd,
+
+    NumEvents
+};
+#define EVENT_NOT_SCHEDULED INT64_MAX
+
+#define DMA_CYCLES_PER_BYTE 4
+#define DMA_DURATION (0xA0 * DMA_CYCLES_PER_BYTE)
+
+//the internal serial clock is 8192Hz, and shifts out a bit each time the divider counter passes a multiple of this
+#define SERIAL_CYCLES_PER_BIT 512
+
 enum class ColorID {
     Color0 = 0,
     Color1 = 1,
@@ -188,41 +247,40 @@ struct Sprite {
     bool isLowPriority;
 };
 struct LCD {
-    PaletteColor backgroundPalette[PALETTE_LEN];
-    PaletteColor spritePalette0[PALETTE_LEN];
-    PaletteColor spritePalette1[PALETTE_LEN];
-    u8 videoRAM[0x2000];
-    
-    //TODO: hashmap of addresses to sprites
-    
-    u8 oam[0xA0]; //sprite memory
+    //stepped every instruction, so first
     LCDMode mode;
     i32 modeClock;
-    SpriteHeight spriteHeight;
+    u8 ly; //curr scan line
+    u8 lyc; //used to compare to ly
+    u8 stat;
+    bool isEnabled;
     bool isBackgroundEnabled;
     bool isWindowEnabled;
-    bool isEnabled;
     bool isOAMEnabled;
+    SpriteHeight spriteHeight;
 
     u8 scx; //scroll x
     u8 scy; //scroll y
     u8 wx; //window x
     u8 wy; //window y
-    u8 ly; //curr scan line
-    u8 stat;
-    u8 lyc; //used to compare to ly
     u8 backgroundTileMap;  //which background tile map to use (0 or 1)
     u8 backgroundTileSet;  //which background tile set to use (0 or 1)
     u8 windowTileMap;
 
     i32 numScreensToSkip;
 
+    //owned by the platform layer.  They are swapped every frame
     PaletteColor *screen;
     PaletteColor *backBuffer;
+
+    PaletteColor backgroundPalette[PALETTE_LEN];
+    PaletteColor spritePalette0[PALETTE_LEN];
+    PaletteColor spritePalette1[PALETTE_LEN];
     
-    PaletteColor screenStorage[SCREEN_WIDTH*SCREEN_HEIGHT];
-    PaletteColor backBufferStorage[SCREEN_WIDTH*SCREEN_HEIGHT];
+    //TODO: hashmap of addresses to sprites
     
+    u8 oam[0xA0]; //sprite memory
+    u8 *videoRAM; //in the MMU's GameBoyMemory
 };
 
 struct RTC {
@@ -377,60 +435,59 @@ struct MMU {
     };
          
     
-    SoundBuffer soundFramesBuffer; 
-    
-    u8 workingRAM[0x2000];
-    u8 zeroPageRAM[0x7F];
-
-    LCD lcd;
-    JoyPad joyPad;
-
-    //Cart data
+    /*****************************************************************
+     * Hot.  Touched by nearly every instruction, so kept together at
+     * the start
+     *****************************************************************/
+    //cpu->totalCycles as of the start of the current instruction
+    i64 currentCycle;
+
+    //scheduled events
+    i64 nextEventCycle; //earliest of eventCycles
+    i64 eventCycles[(int)ScheduledEvent::NumEvents]; //EVENT_NOT_SCHEDULED if not scheduled
+
+    //banking
     u8 *romData;
-    i64 romSize;
-    u16 currentROMBank;
-    char *romName;
-    i64 romNameLen;
-    i32 maxROMBank;
-    
-    MBCType mbcType;
     u8 *cartRAM;
-    i64 cartRAMSize;
-    i32 maxCartRAMBank;
-    
-    //TODO: Contains platform specific data.  Move?
-    CartRAMPlatformState cartRAMPlatformState;
-    
+    u16 currentROMBank;
     u8 currentRAMBank;
     bool isCartRAMEnabled;
+    MBCType mbcType;
+    BankingMode bankingMode;
     bool hasRAM;
-    
-    bool hasBattery;
-    
+
     u8 requestedInterrupts;
     u8 enabledInterrupts;
-    BankingMode bankingMode;
-    
-    bool hasRTC;
-    RTC rtc;
+    bool didInterruptsChange; //IE or IF was written since the CPU last checked for pending interrupts
 
-    //DMA
+    //DMA.  OAM is copied all at once when DMA starts.  Until it ends, the buses
+    //it uses stay blocked for the CPU
     bool isDMAOccurring;
-    u16 currentDMAAddress;
-    int cyclesSinceLastDMACopy;
+    u16 dmaSourceAddress;
+    i64 dmaStartCycle;
 
-    //divider
-    int cyclesSinceDividerIncrement;
-    u8 divider;
+    //divider.  DIV is the upper byte of a 16-bit counter that increments every cycle
+    i64 dividerBaseCycle; //cycle the counter was last 0
 
-    //timer
-    int cyclesSinceTimerIncrement;
+    //timer.  TIMA increments on the falling edge of a divider counter bit, chosen by TAC
+    i64 timerBaseCycle;
+    u8 timerBaseValue; //TIMA as of timerBaseCycle
     TimerIncrementRate timerIncrementRate;
-    u8 timer;
     u8 timerModulo;
     bool isTimerEnabled;
 
-    //Sound
+    //serial.  With no link cable, a transfer on the external clock never finishes, and every bit shifted in is 1
+    u8 serialData; //SB
+    bool isSerialTransferring; //SC bit 7
+    bool isSerialClockInternal; //SC bit 0
+
+    //raw values of the FF00-FF7F registers that are read from a cache. See ioRegisterHandlers
+    u8 ioRegisters[0x80];
+    u8 zeroPageRAM[0x7F];
+
+    JoyPad joyPad;
+
+    //Sound.  Ticked every instruction
     u8 NR10;
     u8 NR11;
     u8 NR12;
@@ -460,6 +517,29 @@ struct MMU {
     i32 ticksSinceLastLengthCounter,  ticksSinceLastEnvelop, ticksSinceLastSweep;
     i32 cyclesSinceLastSoundSample, cyclesSinceLastFrameSequencer;
     i32 masterLeftVolume, masterRightVolume;
+
+    LCD lcd;
+    u8 *workingRAM; //in the MMU's GameBoyMemory
+
+    /*****************************************************************
+     * Cold.  Cart description
+     *****************************************************************/
+    i64 romSize;
+    u64 romHash;
+    i32 maxROMBank;
+    i64 cartRAMSize;
+    i32 maxCartRAMBank;
+    bool hasBattery;
+
+    bool hasRTC;
+    RTC rtc;
+
+    bool isSoundOutputSkipped; //no samples are made, for turbo frames that aren't heard
+    MMUHost *host;
+#ifdef GB_FLAT_TEST_MEMORY
+    //when set, the CPU reads and writes these 64KB instead of the memory map, for CPU test vectors
+    u8 *flatTestMemory;
+#endif
 };
 
 struct CPU {
@@ -471,15 +551,257 @@ struct CPU {
     i32 leftOverCyclesFromPreviousFrame; 
     i32 cylesExecutedThisFrame;
     bool enableInterrupts; 
+    bool shouldEnableInterrupts; //EI was just executed.  IME is set after the next instruction
+    bool isInterruptPending; //IME && (IE & IF).  Only recomputed when one of them changes
     bool isHalted;
+    bool isHaltBugTriggered; //HALT with IME off and an interrupt pending. The next byte is read twice
     bool isPaused;
     bool didHitIllegalOpcode;
 };
 
 
-struct GameBoyState {
-    CPU cpu;
-    MMU mmu;
+//In memory snapshots for tools that save and restore many times a frame, like run-ahead and
+//rollback.  Only the emulated state is stored, as the same chunks as a save state, without the
+//ROM name, header, compression or checksum.  Host pointers, the screens, queued sound and
+//derived caches are not stored.  Unlike loading a save state, restoring one turns the RTC back too,
+//in the battery file as well as the registers
+struct GameBoySnapshot {
+    u8 *data; //CO_MALLOCed by initSnapshot()
+    i64 size;
+    i64 capacity;
+};
+
+//hashGameBoyState() keeps a copy of the memories it last hashed and the hash of each of their pages,
+//so only the pages written since then are hashed again.  Zero it to start, and free with freeStateHasher()
+#define STATE_HASH_PAGE_SIZE 256
+struct GameBoyStateHasher {
+    //CO_MALLOCed by hashGameBoyState() on first use, and again for a cartridge with a different amount of cart RAM
+    u8 *core; //the rest of the state, serialized
+    i64 coreCapacity;
+    u8 *memories; //VRAM, OAM, WRAM then cart RAM, as of the last hash
+    i64 memoriesSize;
+    u64 *pageHashes;
+    i64 numPages;
+};
+
+//Input movies.  A movie is the state it starts from and the joypad for every frame after that.
+//While one is recording or playing, every frame runs exactly CYCLES_PER_FRAME cycles and the RTC
+//counts emulated time, so playback is exact.  Every MOVIE_FRAMES_PER_KEY_FRAME frames the whole
+//state is stored compressed so playback can seek.  Playback runs against a copy of the battery
+//file and puts back the state it interrupted when it stops.
+#define MOVIE_FILE_EXTENSION "gbm"
+#define MOVIE_FILE_MAGIC 0x564D4247 //"GBMV"
+#define MOVIE_FILE_VERSION 6 //key frames are raw snapshots and hashGameBoyState() is checked every frame, so this changes with either
+#define MOVIE_FRAMES_PER_KEY_FRAME 120
+enum class MovieMode {
+    None,
+    Recording,
+    Playing
+};
+struct MovieKeyFrame {
+    i64 frame; //taken before this frame's joypad was applied
+    i64 offset; //into Movie::keyFrameData
+    i64 size;
+    i64 imageSize; //uncompressed
+};
+struct Movie {
+    MovieMode mode;
+    char path[MAX_PATH_LEN + 1];
+    u64 romHash;
+    i64 startTime; //unix time the RTC is at when the movie starts
+    i64 currentFrame;
+    i64 desyncFrame; //first frame playback didn't match the recording's state hash, or -1
+    
+    //buf_malloc stretchy buffers
+    u8 *inputs; //joypad for each frame, in the bit order of FF00. Set bits are pressed
+    u64 *stateHashes; //hashGameBoyState() at the start of each frame
+    MovieKeyFrame *keyFrames; //the first one is the state the movie starts from
+    u8 *keyFrameData;
+    
+    GameBoySnapshot snapshot; //a key frame, uncompressed
+    GameBoyStateHasher stateHasher;
+    
+    //playback only
+    u8 *playbackCartRAMFile; //stands in for the battery file
+    CartRAMPlatformState platformStateBeforePlayback;
+    GameBoySnapshot stateBeforePlayback;
+};
+
+//Run-ahead.  Hides the frames of input lag a game has.  After each frame, numFrames more frames are
+//run with the same input and without sound, their last screen is shown, and the state goes back
+//to the end of the real frame.  SameInstance runs them on the real Game Boy between a snapshot
+//and a restore.  SecondInstance restores the snapshot into a copy of the Game Boy and runs them on
+//a worker thread, so they overlap with the platform layer's audio and presentation work
+#define MAX_RUN_AHEAD_FRAMES 4
+enum class RunAheadMode {
+    SameInstance,
+    SecondInstance
+};
+struct GameBoyDebug;
+struct RunAhead;
+typedef void RunAheadFn(RunAhead *runAhead);
+struct RunAhead {
+    i32 numFrames; //0 is off
+    RunAheadMode mode;
+    GameBoySnapshot snapshot; //CO_MALLOCed by the emulator on first use
+    RTCFileState rtcFileState; //stands in for the second instance's battery file
+
+    //SecondInstance only
+    CPU *cpu;
+    MMU *mmu;
+    GameBoyMemory *memory;
+    MMUHost *host;
+    GameBoyDebug *gbDebug;
+    u8 *cartRAM;
+    u8 *cartRAMFileMap;
+    PaletteColor *screens;
+    bool hasScreen; //the copy's screen is the one to show this frame
+    RunAheadFn *lookAhead; //set every frame by the emulator, since its code can be reloaded
+#ifdef CO_PROFILE
+    ProfileState *profileState; //the worker's, since profiling isn't thread safe
+#endif
+    Mutex *mutex;
+    WaitCondition *workAvailable;
+    Thread *worker;
+    bool isWorkQueued;
+    bool shouldWorkerExit;
+};
+
+//Turbo.  While Turbo is held or ToggleTurbo is on, speed times as many whole frames are run as the
+//host's frame time covers, each with that frame's input, and only the last one is drawn.  A speed of 0
+//is uncapped and runs as many frames as fit in TURBO_UNCAPPED_TIME_US.  The sound is either skipped,
+//or cut down to the host's frame time by only making the last frames' samples, which keeps its pitch.
+//Each of those cuts is crossfaded over TURBO_CROSSFADE_SAMPLES so it doesn't click
+#define DEFAULT_TURBO_SPEED 4
+#define MAX_TURBO_SPEED 64
+#define TURBO_UNCAPPED_TIME_US 10000
+#define TURBO_CROSSFADE_SAMPLES 64
+enum class TurboSound {
+    Off = 0,
+    Compressed
+};
+struct Turbo {
+    i32 speed; //0 is uncapped
+    TurboSound sound;
+    bool isToggledOn;
+    bool isActive; //this frame, read by the platform layer
+    i64 leftOverCycles; //of speed times the host's frame time
+    i64 leftOverSoundCycles; //of the host's frame time
+    TimeUS frameTime; //measured per emulated frame, to size uncapped runs
+    SoundFrame crossfade[TURBO_CROSSFADE_SAMPLES]; //the end of the last sound heard, held back
+    i32 numCrossfadeSamples;
+};
+
+//Rewind history.  Every frame, the CPU, MMU, screen and cart RAM are captured as one flat image.
+//Every REWIND_FRAMES_PER_KEY_FRAME frames a key frame is stored, and the frames in between are
+//stored as the XOR against their key frame, run length encoded.  Compression happens on a
+//worker thread if one is started, and the oldest frames are dropped to stay under the memory budget.
+struct RewindFrame {
+    i64 offset; //into RewindBuffer::data
+    i64 size;
+    i64 serial; //never reused
+    i64 keyFrameSerial;
+    bool isKeyFrame;
+};
+
+struct RewindBuffer {
+    i64 imageSize; //sizeof(CPU) + sizeof(MMU) + VRAM + WRAM + screen + cart RAM
+    
+    //compressed frames, oldest to newest. Guarded by mutex
+    u8 *data;
+    i64 dataSize; //memory budget
+    i64 dataHead; //where the next frame goes
+    RewindFrame *frames;
+    i64 oldestFrame;
+    i64 numFrames;
+    i64 nextSerial;
+    
+    //images captured by the emulator that have yet to be compressed.  Guarded by mutex
+    u8 *pendingImages[REWIND_MAX_PENDING_FRAMES];
+    i64 firstPendingImage;
+    i64 numPendingImages;
+    
+    //only touched by whoever is compressing
+    u8 *keyFrameImage; //deltas are taken against this
+    i64 keyFrameSerial;
+    i64 framesUntilKeyFrame; //0 to force a key frame
+    u8 *compressedImage;
+    
+    //only touched when rewinding
+    u8 *restoredImage;
+    u8 *cachedKeyFrameImage;
+    i64 cachedKeyFrameSerial;
+    
+    Mutex *mutex;
+    WaitCondition *workAvailable;
+    Thread *worker;
+    bool shouldWorkerExit;
+};
+
+//Save states are captured into memory by the emulator and written to disk on a worker thread.
+//Each one is written to a temporary file and synced, the previous save is hard linked as the
+//newest of SAVE_STATE_NUM_BACKUPS backups, then the temporary file is renamed over the slot.
+#define SAVE_STATE_NUM_BACKUPS 3
+#define SAVE_STATE_MAX_WRITE_RESULTS 16
+
+//Per ROM index of what is in each save slot, so the slots can be browsed without opening
+//every save state.  It is a memory mapped SaveSlotIndexFile, and a slot's entry is updated in
+//place once its save state has been written
+#define SAVE_SLOT_INDEX_FILE_EXTENSION "gbesindex"
+#define SAVE_SLOT_INDEX_MAGIC 0x49534247 //"GBSI"
+#define SAVE_SLOT_INDEX_VERSION 1
+#define SAVE_SLOT_THUMBNAIL_SCALE 4
+#define SAVE_SLOT_THUMBNAIL_WIDTH (SCREEN_WIDTH / SAVE_SLOT_THUMBNAIL_SCALE)
+#define SAVE_SLOT_THUMBNAIL_HEIGHT (SCREEN_HEIGHT / SAVE_SLOT_THUMBNAIL_SCALE)
+//2 bits per pixel
+#define SAVE_SLOT_THUMBNAIL_LEN (SAVE_SLOT_THUMBNAIL_WIDTH * SAVE_SLOT_THUMBNAIL_HEIGHT / 4)
+struct SaveSlotIndexEntry {
+    u32 isUsed;
+    u32 reserved;
+    i64 timestamp; //unix time of the save
+    i64 frameCount; //frames emulated since the game was loaded
+    u8 thumbnail[SAVE_SLOT_THUMBNAIL_LEN]; //PaletteColors, the first pixel in the low bits
+};
+struct SaveSlotIndexFile {
+    u32 magic;
+    u32 version;
+    SaveSlotIndexEntry entries[NUM_SAVE_SLOTS];
+};
+struct SaveSlotIndex {
+    MemoryMappedFileHandle *handle;
+    SaveSlotIndexFile *file;
+};
+
+struct SaveStateWriteJob {
+    u8 *data; //CO_MALLOCed. Freed once written
+    i64 size;
+    int slot;
+    char path[MAX_PATH_LEN + 1];
+    SaveSlotIndexEntry indexEntry; //written to the index if the save succeeds
+};
+struct SaveStateWriteResult {
+    int slot;
+    FileSystemResultCode resultCode;
+};
+struct SaveStateWriter {
+    //at most one write is queued per slot. Guarded by mutex, as is everything below
+    SaveStateWriteJob jobs[NUM_SAVE_SLOTS];
+    i64 firstJob;
+    i64 numJobs;
+    bool isWriting; //a job has been taken off the queue, but isn't written yet
+    
+    //finished writes for the emulator to report
+    SaveStateWriteResult results[SAVE_STATE_MAX_WRITE_RESULTS];
+    i64 firstResult;
+    i64 numResults;
+    
+    //updated by the worker, so read it through getSaveSlotIndexEntry()
+    SaveSlotIndex slotIndex;
+    
+    Mutex *mutex;
+    WaitCondition *workAvailable;
+    Thread *worker;
+    bool shouldWorkerExit;
 };
 
 
@@ -488,7 +810,6 @@ struct NotificationState {
     i64 writeIndex, readIndex;
     i64 numItemsQueued;
 };
-struct GameBoyDebug;
 
 
 #define NO_INPUT_MAPPING -1
@@ -499,7 +820,7 @@ struct Input {
 
         Rewind, DebuggerContinue, DebuggerStep, Mute,
         Pause, Reset, ShowDebugger, ShowHomePath,
-        FullScreen, ShowControls,
+        FullScreen, ShowControls, Turbo, ToggleTurbo,
 
         NumActions
     };
@@ -548,7 +869,7 @@ static const char *inputActionToStr[] = {
 
     "Rewind", "DebuggerContinue", "DebuggerStep", "Mute",
     "Pause", "Reset", "ShowDebugger", "ShowHomePath",
-    "FullScreen",
+    "FullScreen", "ShowControls", "Turbo", "ToggleTurbo",
 
     "NumActions"
 };
@@ -573,6 +894,15 @@ struct ProgramState {
     void *guiContext; 
     
     int screenScale;
+    int rewindBufferSizeMB;
+    int runAheadFrames;
+    bool isRunAheadOnSecondCore;
+    //every frame runs exactly CYCLES_PER_FRAME, whatever the host's frame time.  For runners without a clock
+    bool hasFixedFrameLength;
+    SaveStateWriter saveStateWriter;
+    Movie movie;
+    RunAhead runAhead;
+    Turbo turbo;
 };
 inline u8 lb(u16 word) {
     return (u8)(word & 0xFF);
@@ -596,8 +926,68 @@ inline bool isActionPressed(Input::Action action, const Input *input) {
 
 bool pushNotification(const char *notification, int len, NotificationState *buffer);
 bool popNotification(NotificationState *buffer, char *outNotification, int len = MAX_NOTIFICATION_LEN);
-void syncRTCTime(RTC *rtc, RTCFileState *rtcFS);
+void syncRTCTime(MMU *mmu);
+//from mmu->host->cartRAMPlatformState.rtcFileMap
+void loadRTCFromFile(MMU *mmu);
 i32 calculateMaxBank(i64 size);
+enum class ROMLoadResult {
+    Success,
+    TooSmall,
+    BadHeaderChecksum,
+    BadGlobalChecksum,
+    UnsupportedMBC
+};
+//what a ROM's header says about its cartridge
+struct CartridgeHeader {
+    MBCType mbcType;
+    bool hasRAM;
+    bool hasBattery;
+    bool hasRTC;
+    i64 cartRAMSize;
+    i32 maxCartRAMBank;
+    i64 romNameLen;
+    u64 romHash; //hashMemory() of the whole ROM, so snapshots can tell cartridges apart
+};
+//checks the ROM's checksums and reads its header, without touching a Game Boy
+ROMLoadResult readCartridgeHeader(const u8 *romData, i64 romSize, CartridgeHeader *header);
+//points mmu at the memory and host data its owner keeps for it.  Do this before anything else
+void attachMMU(GameBoyMemory *memory, MMUHost *host, MMU *mmu);
+//points mmu at a ROM whose header has already been read.  romData is only ever read from
+void useCartridge(u8 *romData, i64 romSize, const CartridgeHeader *header, MMU *mmu);
+//Reads the cartridge header into mmu.  Cart RAM is left for the caller to allocate, and no files are touched
+ROMLoadResult loadROM(u8 *romData, i64 romSize, MMU *mmu);
+//How many bytes to allocate for mmu->cartRAM.  0xA000-0xBFFF is indexed a whole bank at a time without
+//being masked, so carts with less than a bank (or none) still get one
+i64 cartRAMAllocationSize(const MMU *mmu);
+
+//Shared ROMs.  A ROM checked and read once, then shared read-only by every Game Boy in the process running
+//it, so each instance only holds its own mutable state.  Each instance holds a reference, and the last
+//releaseSharedROM() frees it.  See romcache.cpp
+struct ROMCache;
+struct SharedROM {
+    u8 *data;
+    i64 size;
+    CartridgeHeader header;
+    i32 refCount; //changed atomically, or under cache's mutex
+    ROMCache *cache; //nullptr if not loaded from a file
+    char path[MAX_PATH_LEN + 1];
+};
+//the ROMs loaded from files and still held, so loading the same file again shares it
+struct ROMCache {
+    Mutex *mutex;
+    SharedROM **roms; //buf_malloc
+};
+//Copies romData.  Returns nullptr if it can't be run, or if out of memory, when *outResult is Success
+SharedROM *createSharedROM(const u8 *romData, i64 romSize, ROMLoadResult *outResult);
+//Shares the ROM at path if cache already has it, otherwise reads it, using fileMemory only while reading.
+//A cache of nullptr always reads it.  Returns nullptr and why if it can't be read or run
+SharedROM *acquireSharedROM(const char *path, MemoryStack *fileMemory, ROMCache *cache, const char **outError);
+void retainSharedROM(SharedROM *rom);
+void releaseSharedROM(SharedROM *rom);
+const char *romLoadResultToStr(ROMLoadResult result);
+bool initROMCache(ROMCache *cache);
+//every ROM from it has to have been released
+void freeROMCache(ROMCache *cache);
 inline void setPausedState(bool isPaused, ProgramState *programState, CPU *cpu) {
     programState->shouldUpdateTitleBar = true;
     cpu->isPaused = isPaused;
@@ -607,6 +997,78 @@ u8 readByte(u16 address, MMU *mmu);
 u16 readWord(u16 address, MMU *mmu);
 void writeByte(u8 byte, u16 address, MMU *mmu, GameBoyDebug *gbDebug);
 void writeWord(u16 word, u16 address, MMU *mmu, GameBoyDebug *gbDebug);
+void clearScheduledEvents(MMU *mmu);
+//call after changing I/O register state without writeByte()
+void rebuildIORegisterCache(MMU *mmu);
+//after mmu->joyPad changes
+void updateJoyPadRegister(MMU *mmu);
+//numFrames of 0 leaves run-ahead off.  Expects the cartridge to be loaded
+bool initRunAhead(i32 numFrames, RunAheadMode mode, const MMU *mmu, RunAhead *runAhead);
+void freeRunAhead(RunAhead *runAhead);
+void startRunAheadWorker(RunAhead *runAhead);
+void stopRunAheadWorker(RunAhead *runAhead);
+//waits for the look-ahead queued by the last frame, and returns the screen to show
+const PaletteColor *finishRunAhead(const MMU *mmu, RunAhead *runAhead);
+bool initRewindBuffer(i64 budget, i64 cartRAMSize, RewindBuffer *rb);
+void freeRewindBuffer(RewindBuffer *rb);
+void startRewindWorker(RewindBuffer *rb);
+void stopRewindWorker(RewindBuffer *rb);
+void clearRewindBuffer(RewindBuffer *rb);
+void recordRewindFrame(const CPU *cpu, const MMU *mmu, RewindBuffer *rb);
+bool rewindOneFrame(CPU *cpu, MMU *mmu, RewindBuffer *rb);
+//the platform layer calls these, so they are loaded from the game code in hot reload builds
+#ifdef CO_DEBUG
+extern "C" {
+#endif
+//recording from power on resets first.  Otherwise the movie starts from the current state
+bool startMovieRecording(const char *path, bool fromPowerOn, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState);
+bool startMoviePlayback(const char *path, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState);
+//writes the movie if recording
+FileSystemResultCode stopMovie(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState);
+#ifdef CO_DEBUG
+}
+#endif
+//call at the start of each emulated frame, after the joypad is set from the host's input.  Records
+//the joypad, or replaces it with the movie's.  Returns false once playback has run out of frames
+bool updateMovieFrame(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, Movie *movie);
+bool seekMovie(i64 frame, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, Movie *movie);
+//the most a snapshot of the loaded cartridge can take
+i64 snapshotCapacity(const MMU *mmu);
+bool initSnapshot(MMU *mmu, GameBoySnapshot *snapshot);
+void freeSnapshot(GameBoySnapshot *snapshot);
+void snapshotGameBoy(CPU *cpu, MMU *mmu, GameBoySnapshot *snapshot);
+enum class RestoreSnapshotResult {
+    Success,
+    WrongCartridge, //taken on another ROM, or one with a different cart RAM, MBC or RTC
+    Corrupt //truncated, or doesn't decode
+};
+//whether restoreSnapshot() would take it, without touching the state
+RestoreSnapshotResult checkSnapshot(const GameBoySnapshot *snapshot, const CPU *cpu, const MMU *mmu);
+//The state is only changed on Success.  The snapshot is decoded into a copy of the state first
+RestoreSnapshotResult restoreSnapshot(const GameBoySnapshot *snapshot, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug);
+//Hash of the emulated state, for finding the frame two runs diverged on.  Covers what a snapshot
+//does, minus the pause flag and the cycles carried over between host frames.  The memories are
+//hashed a page at a time, and the rest is serialized into the hasher first
+u64 hashGameBoyState(CPU *cpu, MMU *mmu, GameBoyStateHasher *hasher);
+void freeStateHasher(GameBoyStateHasher *hasher);
+void startSaveStateWriter(SaveStateWriter *writer);
+void stopSaveStateWriter(SaveStateWriter *writer);
+//takes ownership of data, which must be CO_MALLOCed
+void queueSaveStateWrite(u8 *data, i64 size, int slot, const char *path, const SaveSlotIndexEntry *indexEntry, SaveStateWriter *writer);
+//waits for all queued writes to finish
+void flushSaveStateWriter(SaveStateWriter *writer);
+bool popSaveStateWriteResult(SaveStateWriter *writer, SaveStateWriteResult *outResult);
+//the index is created if missing or unreadable.  Returns false if it can't be used
+bool openSaveSlotIndex(const char *path, SaveStateWriter *writer);
+void closeSaveSlotIndex(SaveStateWriter *writer);
+//returns false if nothing is known about the slot
+bool getSaveSlotIndexEntry(int slot, SaveStateWriter *writer, SaveSlotIndexEntry *outEntry);
+u16 readDividerCounter(MMU *mmu);
+u8 readTimer(MMU *mmu);
+//these rebase the divider, timer, DMA and serial transfer on mmu->currentCycle and reschedule their events
+void restoreTimers(u16 dividerCounter, u8 timer, MMU *mmu);
+void restoreDMA(u16 currentDMAAddress, int cyclesSinceLastDMACopy, MMU *mmu);
+void restoreSerialTransfer(i64 cyclesUntilTransferEnds, MMU *mmu);
 void step(CPU *cpu, MMU* mmu, GameBoyDebug *gbDebug, int volume);
     
 #ifdef CO_DEBUG
@@ -704,8 +1166,13 @@ bool popNotification(NotificationState *buffer, char *outNotification, int len)
     return true;
 }
 
-void syncRTCTime(RTC *rtc, RTCFileState *rtcFS) {
-    i64 tmpWallClockTime = unixWallClockTime();
+void syncRTCTime(MMU *mmu) {
+    RTC *rtc = &mmu->rtc;
+    RTCFileState *rtcFS = mmu->host->cartRAMPlatformState.rtcFileMap;
+    const CartRAMPlatformState *crps = &mmu->host->cartRAMPlatformState;
+    i64 tmpWallClockTime = crps->isRTCOnEmulatedTime ?
+        crps->rtcEmulatedTimeBase + (mmu->currentCycle - crps->rtcEmulatedCycleBase) / CLOCK_SPEED_HZ :
+        unixWallClockTime();
     i64 timeToAdd = tmpWallClockTime - rtcFS->unixTimestamp;
     if (timeToAdd > 0) {
         rtc->wallClockTime = rtcFS->unixTimestamp = tmpWallClockTime;
@@ -731,9 +1198,147 @@ void syncRTCTime(RTC *rtc, RTCFileState *rtcFS) {
         }
     }
 }
+void loadRTCFromFile(MMU *mmu) {
+    const RTCFileState *rtcFS = mmu->host->cartRAMPlatformState.rtcFileMap;
+    zeroMemory(&mmu->rtc, sizeof(RTC));
+    mmu->rtc.seconds = (u8)rtcFS->seconds;
+    mmu->rtc.minutes = (u8)rtcFS->minutes;
+    mmu->rtc.hours = (u8)rtcFS->hours;
+    mmu->rtc.days = (u8)rtcFS->days;
+    mmu->rtc.daysHigh = (u8)rtcFS->daysHigh;
+    mmu->rtc.wallClockTime = rtcFS->unixTimestamp;
+
+    mmu->rtc.latchedSeconds = (u8)rtcFS->latchedSeconds;
+    mmu->rtc.latchedMinutes = (u8)rtcFS->latchedMinutes;
+    mmu->rtc.latchedHours = (u8)rtcFS->latchedHours;
+    mmu->rtc.latchedDays = (u8)rtcFS->latchedDays;
+    mmu->rtc.latchedMisc = (u8)rtcFS->latchedDaysHigh;
+}
 i32 calculateMaxBank(i64 size) {
     i32 maxCartRAMBank = (i32)((size / KB(8)) - 1);
     if (maxCartRAMBank < 0) maxCartRAMBank = 0;
     return maxCartRAMBank;
 }
+ROMLoadResult readCartridgeHeader(const u8 *romData, i64 romSize, CartridgeHeader *header) {
+    *header = {};
+    if (romSize < 0x150) {
+        return ROMLoadResult::TooSmall;
+    }
+    {
+        u8 computedChecksum = 0;
+        for (int i = 0x134; i <= 0x14C; i++) {
+            computedChecksum = (u8)(computedChecksum - romData[i] - 1);
+        }
+        if (computedChecksum != romData[0x14D]) {
+            return ROMLoadResult::BadHeaderChecksum;
+        }
+    }
+    {
+        u16 computedChecksum = 0;
+        u16 globalChecksum = (u16)((romData[0x14E] << 8) | romData[0x14F]);
+        for (i64 i = 0; i < romSize; i++) {
+            if (i == 0x14E || i == 0x14F) {
+                continue;
+            }
+            computedChecksum += romData[i];
+        }
+        if (computedChecksum != globalChecksum) {
+            return ROMLoadResult::BadGlobalChecksum;
+        }
+    }
+
+    u8 mbcType = romData[0x147];
+    switch (mbcType) {
+    case 0: {
+        header->mbcType = MBCType::MBC0;
+    } break;
+    case 1: {
+        header->mbcType = MBCType::MBC1;
+    } break;
+    case 2 ... 3: {
+        header->mbcType = MBCType::MBC1;
+        header->hasRAM = true;
+        if (mbcType == 3) {
+            header->hasBattery = true;
+        }
+    } break;
+    case 8 ... 9: {
+        header->mbcType = MBCType::MBC0;
+        header->hasRAM = true;
+    } break;
+    case 0xF ... 0x13: {
+        header->mbcType = MBCType::MBC3;
+        if (mbcType == 0xF || mbcType == 0x10) {
+            header->hasRTC = true;
+        }
+        if (mbcType == 0x10 || mbcType == 0x12 || mbcType == 0x13) {
+            header->hasRAM = true;
+        }
+        if (mbcType == 0xF || mbcType == 0x10 || mbcType == 0x13) {
+            header->hasBattery = true;
+        }
+    } break;
+    case 0x19 ... 0x1E: {
+        header->mbcType = MBCType::MBC5;
+        if (mbcType == 0x1A || mbcType == 0x1B || mbcType == 0x1D || mbcType == 0x1E) {
+            header->hasRAM = true;
+        }
+        if (mbcType == 0x1B || mbcType == 0x1E) {
+            header->hasBattery = true;
+        }
+        //TODO: rumble
+    } break;
+    default: {
+        return ROMLoadResult::UnsupportedMBC;
+    } break;
+    }
+
+    //RAM size
+    if (header->hasRAM) {
+        switch (romData[0x149]) {
+        case 0: header->cartRAMSize = 0; break;
+        case 1: header->cartRAMSize = KB(2); break;
+        case 2: header->cartRAMSize = KB(8); break;
+        case 3: header->cartRAMSize = KB(32); break;
+        case 4: header->cartRAMSize = KB(128); break;
+        case 5: header->cartRAMSize = KB(64); break;
+        }
+        header->maxCartRAMBank = calculateMaxBank(header->cartRAMSize);
+    }
+
+    header->romNameLen = (romData[0x143] == 0x80 || romData[0x143] == 0xC0) ? 15 : 16;
+    header->romHash = hashMemory(romData, romSize);
+    return ROMLoadResult::Success;
+}
+void attachMMU(GameBoyMemory *memory, MMUHost *host, MMU *mmu) {
+    mmu->lcd.videoRAM = memory->videoRAM;
+    mmu->workingRAM = memory->workingRAM;
+    mmu->host = host;
+}
+void useCartridge(u8 *romData, i64 romSize, const CartridgeHeader *header, MMU *mmu) {
+    mmu->romData = romData;
+    mmu->romSize = romSize;
+    mmu->mbcType = header->mbcType;
+    mmu->hasRAM = header->hasRAM;
+    mmu->hasBattery = header->hasBattery;
+    mmu->hasRTC = header->hasRTC;
+    mmu->cartRAMSize = header->cartRAMSize;
+    mmu->maxCartRAMBank = header->maxCartRAMBank;
+    mmu->host->romNameLen = header->romNameLen;
+    mmu->host->romName = (char*)romData + 0x134;
+    mmu->romHash = header->romHash;
+}
+ROMLoadResult loadROM(u8 *romData, i64 romSize, MMU *mmu) {
+    mmu->romData = romData;
+    mmu->romSize = romSize;
+    CartridgeHeader header;
+    ROMLoadResult result = readCartridgeHeader(romData, romSize, &header);
+    if (result == ROMLoadResult::Success) {
+        useCartridge(romData, romSize, &header, mmu);
+    }
+    return result;
+}
+i64 cartRAMAllocationSize(const MMU *mmu) {
+    return MAX(mmu->cartRAMSize, (i64)KB(8));
+}
 #endif
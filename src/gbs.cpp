@@ -0,0 +1,250 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//GBS (Game Boy Sound System) player.  Runs a GBS file's init and play routines on the
+//regular CPU, MMU and APU, but never steps the LCD, so songs can be rendered offline at
+//many times real time.  Unity built after gbemu.cpp so it can use stepCPU() and stepSound().
+
+#define GBS_HEADER_LEN 0x70
+#define GBS_STRING_LEN 32
+#define GBS_MIN_LOAD_ADDRESS 0x100
+//play and init "return" here.  Lives in the padding before the load address
+#define GBS_RETURN_ADDRESS 0xF0
+#define GBS_VOLUME 50
+#define GBS_SAMPLE_RATE 44100
+#define GBS_CYCLES_PER_SAMPLE (CLOCK_SPEED_HZ/GBS_SAMPLE_RATE)
+#define GBS_CYCLES_PER_VBLANK (TOTAL_SCANLINE_DURATION * (MAX_LY + 1))
+//routines that haven't returned after this many cycles are assumed to be stuck
+#define GBS_MAX_ROUTINE_CYCLES (CLOCK_SPEED_HZ/8)
+//enough to hold the longest possible play period (TMA = 0 at 4096Hz)
+#define GBS_SOUND_BUFFER_LEN 8192
+
+struct GBSFile {
+    u8 version;
+    u8 numSongs;
+    u8 firstSong; //1 based
+    u16 loadAddress, initAddress, playAddress;
+    u16 stackPointer;
+    u8 timerModulo, timerControl;
+
+    char title[GBS_STRING_LEN + 1];
+    char author[GBS_STRING_LEN + 1];
+    char copyright[GBS_STRING_LEN + 1];
+
+    //ROM image with the GBS data at the load address.  Read only, so it can be shared across players
+    u8 *romData;
+    i64 romSize;
+};
+
+enum class GBSLoadResult {
+    Success,
+    InvalidHeader,
+    UnsupportedVersion,
+    InvalidAddress
+};
+
+//Everything needed to play one song.  Large, so allocate on the heap; one per thread.
+struct GBSPlayer {
+    CPU cpu;
+    MMU mmu;
+    GameBoyMemory memory;
+    MMUHost host;
+    u8 cartRAM[KB(8)];
+    SoundFrame soundFrames[GBS_SOUND_BUFFER_LEN];
+};
+
+static inline u16 gbsReadU16(const u8 *data) {
+    return (u16)(data[0] | (data[1] << 8));
+}
+
+GBSLoadResult loadGBSFile(const u8 *fileData, i64 fileSize, GBSFile *outGBS) {
+    *outGBS = {};
+    if (fileSize <= GBS_HEADER_LEN || !areStringsEqual((const char*)fileData, "GBS", 3)) {
+        return GBSLoadResult::InvalidHeader;
+    }
+
+    outGBS->version = fileData[0x3];
+    if (outGBS->version != 1) {
+        return GBSLoadResult::UnsupportedVersion;
+    }
+    outGBS->numSongs = fileData[0x4];
+    outGBS->firstSong = fileData[0x5];
+    outGBS->loadAddress = gbsReadU16(fileData + 0x6);
+    outGBS->initAddress = gbsReadU16(fileData + 0x8);
+    outGBS->playAddress = gbsReadU16(fileData + 0xA);
+    outGBS->stackPointer = gbsReadU16(fileData + 0xC);
+    outGBS->timerModulo = fileData[0xE];
+    outGBS->timerControl = fileData[0xF];
+    copyMemory(fileData + 0x10, outGBS->title, GBS_STRING_LEN);
+    copyMemory(fileData + 0x30, outGBS->author, GBS_STRING_LEN);
+    copyMemory(fileData + 0x50, outGBS->copyright, GBS_STRING_LEN);
+
+    if (outGBS->numSongs == 0) {
+        return GBSLoadResult::InvalidHeader;
+    }
+    if (outGBS->loadAddress < GBS_MIN_LOAD_ADDRESS || outGBS->loadAddress >= 0x8000 ||
+        outGBS->initAddress < outGBS->loadAddress || outGBS->playAddress < outGBS->loadAddress) {
+        return GBSLoadResult::InvalidAddress;
+    }
+
+    //pad up to a power of 2 so the MBC bank mask works
+    i64 dataSize = fileSize - GBS_HEADER_LEN;
+    i64 romSize = 0x8000;
+    while (romSize < outGBS->loadAddress + dataSize) {
+        romSize *= 2;
+    }
+
+    u8 *romData = CO_CALLOC(romSize, u8);
+    copyMemory(fileData + GBS_HEADER_LEN, romData + outGBS->loadAddress, dataSize);
+
+    //RST vectors are relative to the load address
+    for (u16 vector = 0; vector <= 0x38; vector += 8) {
+        u16 target = (u16)(outGBS->loadAddress + vector);
+        romData[vector] = 0xC3; //JP a16
+        romData[vector + 1] = lb(target);
+        romData[vector + 2] = hb(target);
+    }
+    //interrupts are not used to drive playback, so just return from any that fire
+    foriarr (interruptRoutineAddresses) {
+        romData[interruptRoutineAddresses[i]] = 0xD9; //RETI
+    }
+    romData[GBS_RETURN_ADDRESS] = 0x18; //JR -2
+    romData[GBS_RETURN_ADDRESS + 1] = 0xFE;
+
+    outGBS->romData = romData;
+    outGBS->romSize = romSize;
+
+    return GBSLoadResult::Success;
+}
+
+void freeGBSFile(GBSFile *gbs) {
+    CO_FREE(gbs->romData);
+    *gbs = {};
+}
+
+static void resetGBSPlayer(const GBSFile *gbs, i32 song, GBSPlayer *player, GameBoyDebug *gbDebug) {
+    CPU *cpu = &player->cpu;
+    MMU *mmu = &player->mmu;
+
+    *cpu = {};
+    *mmu = {};
+    player->memory = {};
+    player->host = {};
+    attachMMU(&player->memory, &player->host, mmu);
+    clearScheduledEvents(mmu);
+    zeroMemory(player->cartRAM, ARRAY_LEN(player->cartRAM));
+
+    mmu->romData = gbs->romData;
+    mmu->romSize = gbs->romSize;
+    mmu->maxROMBank = calculateMaxBank(gbs->romSize);
+    mmu->currentROMBank = 1;
+    mmu->mbcType = (gbs->romSize > 0x8000) ? MBCType::MBC5 : MBCType::MBC0;
+
+    mmu->cartRAM = player->cartRAM;
+    mmu->cartRAMSize = ARRAY_LEN(player->cartRAM);
+    mmu->maxCartRAMBank = calculateMaxBank(mmu->cartRAMSize);
+    mmu->hasRAM = true;
+    mmu->isCartRAMEnabled = true;
+
+    mmu->host->soundFramesBuffer.data = player->soundFrames;
+    mmu->host->soundFramesBuffer.len = ARRAY_LEN(player->soundFrames);
+    mmu->noiseChannel.shiftValue = 1;
+    mmu->timerIncrementRate = TimerIncrementRate::TIR_0;
+    mmu->joyPad.selectedButtonGroup = JPButtonGroup::Nothing;
+
+    rebuildIORegisterCache(mmu);
+
+    //state the boot ROM leaves the APU in
+    writeByte(0x80, 0xFF26, mmu, gbDebug);
+    writeByte(0x77, 0xFF24, mmu, gbDebug);
+    writeByte(0xFF, 0xFF25, mmu, gbDebug);
+
+    writeByte(gbs->timerModulo, 0xFF06, mmu, gbDebug);
+    writeByte(gbs->timerControl, 0xFF07, mmu, gbDebug);
+
+    cpu->SP = gbs->stackPointer;
+    cpu->A = (u8)song;
+}
+
+static void fastForwardGBSSound(i64 cycles, GBSPlayer *player, GameBoyDebug *gbDebug) {
+    if (cycles <= 0) {
+        return;
+    }
+    //the timer catches up on its own, so only the APU needs to be stepped, a sample at a time
+    player->cpu.totalCycles += cycles;
+    while (cycles > 0) {
+        i32 cyclesToStep = (cycles > GBS_CYCLES_PER_SAMPLE) ? GBS_CYCLES_PER_SAMPLE : (i32)cycles;
+        stepSound(&player->mmu, gbDebug, cyclesToStep, GBS_VOLUME);
+        cycles -= cyclesToStep;
+    }
+    player->mmu.currentCycle = player->cpu.totalCycles;
+    processScheduledEvents(&player->mmu);
+}
+
+//returns the number of cycles the routine took, or -1 if it hit an illegal opcode
+static i64 runGBSRoutine(u16 address, GBSPlayer *player, GameBoyDebug *gbDebug) {
+    CPU *cpu = &player->cpu;
+    MMU *mmu = &player->mmu;
+    i64 cyclesTaken = 0;
+    u16 spBeforeCall = cpu->SP;
+
+    pushOnToStack(GBS_RETURN_ADDRESS, &cpu->SP, mmu, gbDebug);
+    cpu->PC = address;
+
+    while (cpu->PC != GBS_RETURN_ADDRESS) {
+        stepCPU(cpu, mmu, gbDebug);
+        if (cpu->didHitIllegalOpcode) {
+            return -1;
+        }
+        cyclesTaken += cpu->instructionCycles;
+        stepSound(mmu, gbDebug, cpu->instructionCycles, GBS_VOLUME);
+        processScheduledEvents(mmu);
+
+        if (cpu->isHalted || cyclesTaken >= GBS_MAX_ROUTINE_CYCLES) {
+            //waiting on something that will never come. Bail out as if it returned
+            cpu->isHalted = false;
+            cpu->SP = spBeforeCall;
+            cpu->PC = GBS_RETURN_ADDRESS;
+        }
+    }
+
+    return cyclesTaken;
+}
+
+static i64 gbsPlayPeriod(MMU *mmu) {
+    if (mmu->isTimerEnabled) {
+        return (256 - mmu->timerModulo) * (i64)mmu->timerIncrementRate;
+    }
+    else {
+        return GBS_CYCLES_PER_VBLANK;
+    }
+}
+
+//song is 0 based.  Returns the number of frames rendered or -1 on error
+i64 renderGBSSong(const GBSFile *gbs, i32 song, SoundFrame *outFrames, i64 numFramesToRender,
+                  GBSPlayer *player, GameBoyDebug *gbDebug) {
+    resetGBSPlayer(gbs, song, player, gbDebug);
+    MMU *mmu = &player->mmu;
+    i64 numFramesRendered = 0;
+
+    i64 cyclesTaken = runGBSRoutine(gbs->initAddress, player, gbDebug);
+    if (cyclesTaken < 0) {
+        return -1;
+    }
+    numFramesRendered += popn(numFramesToRender, &mmu->host->soundFramesBuffer, outFrames);
+
+    while (numFramesRendered < numFramesToRender) {
+        cyclesTaken = runGBSRoutine(gbs->playAddress, player, gbDebug);
+        if (cyclesTaken < 0) {
+            return -1;
+        }
+
+        i64 cyclesLeftInPeriod = gbsPlayPeriod(mmu) - cyclesTaken;
+        fastForwardGBSSound(cyclesLeftInPeriod, player, gbDebug);
+
+        numFramesRendered += popn(numFramesToRender - numFramesRendered, &mmu->host->soundFramesBuffer,
+                                  outFrames + numFramesRendered);
+        clear(&mmu->host->soundFramesBuffer);
+    }
+
+    return numFramesRendered;
+}
@@ -0,0 +1,222 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Command line GBS renderer.  Renders songs from a GBS file to WAV files as fast as possible,
+//one song per thread.
+
+#define CO_IMPL
+#include "common.h"
+#define GB_IMPL
+#include "gbemu.cpp"
+#include "gbs.cpp"
+
+#define DEFAULT_SONG_LENGTH_SECONDS 120
+
+struct GBSRenderJob {
+    i32 song; //0 based
+    char outputPath[MAX_PATH_LEN + 1]; //empty if it didn't fit, and the song isn't rendered
+    bool didSucceed;
+};
+
+struct GBSRenderQueue {
+    const GBSFile *gbs;
+    GameBoyDebug *gbDebug; //never enabled, so it is only ever read and can be shared
+    i64 numFramesPerSong;
+
+    GBSRenderJob *jobs;
+    i64 numJobs;
+    i64 nextJob;
+    Mutex *mutex;
+};
+
+static void renderWorker(void *arg) {
+    auto queue = (GBSRenderQueue*)arg;
+    //memory stacks are not thread safe, so workers use the heap
+    GBSPlayer *player = CO_CALLOC(1, GBSPlayer);
+    SoundFrame *frames = CO_MALLOC(queue->numFramesPerSong, SoundFrame);
+
+    for (;;) {
+        lockMutex(queue->mutex);
+        GBSRenderJob *job = (queue->nextJob < queue->numJobs) ? &queue->jobs[queue->nextJob++] : nullptr;
+        unlockMutex(queue->mutex);
+        if (!job) {
+            break;
+        }
+        if (!job->outputPath[0]) {
+            continue;
+        }
+
+        i64 numFrames = renderGBSSong(queue->gbs, job->song, frames, queue->numFramesPerSong,
+                                      player, queue->gbDebug);
+        if (numFrames < 0) {
+            PRINT_ERR("Song %d hit an illegal opcode.", job->song + 1);
+            continue;
+        }
+        auto result = writeWAVFile(frames, numFrames, GBS_SAMPLE_RATE, job->outputPath);
+        if (result != FileSystemResultCode::OK) {
+            PRINT_ERR("Could not write %s.", job->outputPath);
+            continue;
+        }
+        job->didSucceed = true;
+    }
+
+    CO_FREE(frames);
+    CO_FREE(player);
+}
+
+static void printUsage() {
+    PRINT("Usage: gbs [-t song] [-l seconds] [-j jobs] [-o output_dir] file.gbs");
+    PRINT("\t-t -- Song to render, starting at 1. Renders every song by default.");
+    PRINT("\t-l -- Length of each song in seconds. Default is %d.", DEFAULT_SONG_LENGTH_SECONDS);
+    PRINT("\t-j -- Number of songs to render at the same time. Default is the number of CPU cores.");
+    PRINT("\t-o -- Directory to write the WAV files to. Default is the current directory.");
+}
+
+//"path/to/music.gbs" -> "music"
+static void baseNameWithoutExtension(const char *path, char *out, i64 outLen) {
+    const char *start = path;
+    for (const char *c = path; *c; c++) {
+        if (*c == '/' || *c == '\\') {
+            start = c + 1;
+        }
+    }
+    i64 len = stringLength(start);
+    for (i64 i = len - 1; i > 0; i--) {
+        if (start[i] == '.') {
+            len = i;
+            break;
+        }
+    }
+    if (len > outLen - 1) {
+        len = outLen - 1;
+    }
+    copyMemory(start, out, len);
+    out[len] = '\0';
+}
+
+int main(int argc, char **argv) {
+    const char *gbsPath = nullptr;
+    const char *outputDirectory = ".";
+    i32 songToRender = 0;
+    i32 songLengthInSeconds = DEFAULT_SONG_LENGTH_SECONDS;
+    i32 numWorkers = numberOfCPUCores();
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (areStringsEqual(argv[i], "-t", 3) && hasValue) {
+            songToRender = atoi(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-l", 3) && hasValue) {
+            songLengthInSeconds = atoi(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-j", 3) && hasValue) {
+            numWorkers = atoi(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-o", 3) && hasValue) {
+            outputDirectory = argv[++i];
+        }
+        else if (argv[i][0] != '-' && !gbsPath) {
+            gbsPath = argv[i];
+        }
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (!gbsPath || songLengthInSeconds <= 0 || numWorkers <= 0) {
+        printUsage();
+        return 1;
+    }
+
+    if (!initMemory(FILE_MEMORY_SIZE, 0)) {
+        PRINT_ERR("Could not allocate memory.");
+        return 1;
+    }
+    MemoryStack fileMemory;
+    makeMemoryStack(FILE_MEMORY_SIZE, "fileMem", &fileMemory);
+
+    auto fileResult = readEntireFile(gbsPath, &fileMemory);
+    if (fileResult.resultCode != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not read %s.", gbsPath);
+        return 1;
+    }
+
+    GBSFile gbs;
+    switch (loadGBSFile(fileResult.data, fileResult.size, &gbs)) {
+        case GBSLoadResult::Success: break;
+        case GBSLoadResult::InvalidHeader: {
+            PRINT_ERR("%s is not a GBS file.", gbsPath);
+            return 1;
+        } break;
+        case GBSLoadResult::UnsupportedVersion: {
+            PRINT_ERR("GBS version %d is not supported.", gbs.version);
+            return 1;
+        } break;
+        case GBSLoadResult::InvalidAddress: {
+            PRINT_ERR("%s has an invalid load, init or play address.", gbsPath);
+            return 1;
+        } break;
+    }
+    freeFileBuffer(&fileResult, &fileMemory);
+
+    if (songToRender < 0 || songToRender > gbs.numSongs) {
+        PRINT_ERR("Song must be between 1 and %d.", gbs.numSongs);
+        return 1;
+    }
+
+    PRINT("%s -- %s (%s)", gbs.title, gbs.author, gbs.copyright);
+
+    char baseName[MAX_PATH_LEN + 1];
+    baseNameWithoutExtension(gbsPath, baseName, ARRAY_LEN(baseName));
+
+    GBSRenderQueue queue = {};
+    queue.gbs = &gbs;
+    queue.gbDebug = CO_CALLOC(1, GameBoyDebug);
+    queue.numFramesPerSong = (i64)songLengthInSeconds * GBS_SAMPLE_RATE;
+    queue.numJobs = (songToRender > 0) ? 1 : gbs.numSongs;
+    queue.jobs = CO_CALLOC(queue.numJobs, GBSRenderJob);
+    queue.mutex = createMutex();
+    fori (queue.numJobs) {
+        GBSRenderJob *job = &queue.jobs[i];
+        job->song = (songToRender > 0) ? songToRender - 1 : (i32)i;
+        int pathLen = snprintf(job->outputPath, ARRAY_LEN(job->outputPath), "%s" FILE_SEPARATOR "%s_%02d.wav",
+                               outputDirectory, baseName, job->song + 1);
+        if (pathLen < 0 || pathLen >= (int)ARRAY_LEN(job->outputPath)) {
+            PRINT_ERR("The path to write song %d to is too long.", job->song + 1);
+            job->outputPath[0] = '\0';
+        }
+    }
+    if (numWorkers > queue.numJobs) {
+        numWorkers = (i32)queue.numJobs;
+    }
+
+    TimeUS startTime = nowInMicroseconds();
+    Thread **workers = CO_MALLOC(numWorkers, Thread*);
+    fori (numWorkers) {
+        workers[i] = startThread(renderWorker, &queue);
+    }
+    fori (numWorkers) {
+        waitForAndFreeThread(workers[i]);
+    }
+    TimeUS elapsedTime = nowInMicroseconds() - startTime;
+
+    i64 numRendered = 0;
+    fori (queue.numJobs) {
+        if (queue.jobs[i].didSucceed) {
+            PRINT("Wrote %s", queue.jobs[i].outputPath);
+            numRendered++;
+        }
+    }
+    double secondsOfAudio = (double)(numRendered * songLengthInSeconds);
+    double elapsedSeconds = (double)elapsedTime / 1000000.;
+    PRINT("Rendered %" PRId64 " of %" PRId64 " songs (%.0f seconds of audio) in %.2f seconds on %d threads. %.0fx real time.",
+          numRendered, queue.numJobs, secondsOfAudio, elapsedSeconds, numWorkers,
+          (elapsedSeconds > 0) ? secondsOfAudio / elapsedSeconds : 0.);
+
+    CO_FREE(workers);
+    destroyMutex(queue.mutex);
+    CO_FREE(queue.jobs);
+    CO_FREE(queue.gbDebug);
+    freeGBSFile(&gbs);
+
+    return (numRendered == queue.numJobs) ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Shared by the command line runners that drive a Game Boy without a platform layer: setting one up
+//from a ROM and playing input scripts into it.  Included after gbemu.cpp.
+//
+//Input script: one line per change of the buttons held, "frame button button ...", where frame
+//counts from 0 and the buttons are held until the next line.  Lines starting with # are comments.
+//  0
+//  120 Start
+//  130 A Right
+
+#define HEADLESS_VOLUME 50
+#define HEADLESS_SAMPLE_RATE 44100
+#define HEADLESS_SERIAL_OUTPUT_SIZE KB(64)
+
+struct InputScriptLine {
+    i64 frame;
+    bool actionsHit[(int)Input::Action::NumActions];
+};
+
+struct HeadlessGameBoy {
+    CPU *cpu;
+    MMU *mmu;
+    GameBoyMemory *memory;
+    MMUHost *host;
+    GameBoyDebug *gbDebug;
+    ProgramState *programState;
+    PaletteColor *screens;
+    SharedROM *rom;
+    u8 *batteryData; //when cart RAM is only kept in memory
+    GameBoyStateHasher stateHasher;
+
+    const InputScriptLine *script;
+    i64 nextScriptLine;
+};
+
+static bool parseInputScriptButton(const char *name, i64 len, Input::Action *outAction) {
+    struct {
+        const char *name;
+        Input::Action action;
+    } buttons[] = {
+        {"A", Input::Action::A}, {"B", Input::Action::B},
+        {"Start", Input::Action::Start}, {"Select", Input::Action::Select},
+        {"Up", Input::Action::Up}, {"Down", Input::Action::Down},
+        {"Left", Input::Action::Left}, {"Right", Input::Action::Right},
+    };
+    foriarr (buttons) {
+        if (len == stringLength(buttons[i].name) && areStringsEqual(name, buttons[i].name, len)) {
+            *outAction = buttons[i].action;
+            return true;
+        }
+    }
+    return false;
+}
+
+//returns a buf_malloc buffer of lines in frame order, or nullptr and prints why
+static InputScriptLine *parseInputScript(const char *text, i64 len, const char *path) {
+    InputScriptLine *ret = nullptr;
+    i64 lineNumber = 1;
+    i64 lastFrame = -1;
+    const char *c = text, *end = text + len;
+    while (c < end) {
+        const char *lineEnd = c;
+        while (lineEnd < end && *lineEnd != '\n') {
+            lineEnd++;
+        }
+        while (c < lineEnd && isspace(*c)) {
+            c++;
+        }
+        if (c < lineEnd && *c != '#') {
+            InputScriptLine line = {};
+            char *numberEnd;
+            line.frame = strtoll(c, &numberEnd, 10);
+            if (numberEnd == c || line.frame <= lastFrame) {
+                PRINT_ERR("%s:%" PRId64 ": expected a frame number after the previous line's.", path, lineNumber);
+                buf_malloc_free(ret);
+                return nullptr;
+            }
+            c = numberEnd;
+            for (;;) {
+                while (c < lineEnd && isspace(*c)) {
+                    c++;
+                }
+                if (c == lineEnd) {
+                    break;
+                }
+                const char *name = c;
+                while (c < lineEnd && !isspace(*c)) {
+                    c++;
+                }
+                Input::Action action;
+                if (!parseInputScriptButton(name, c - name, &action)) {
+                    PRINT_ERR("%s:%" PRId64 ": unknown button '%.*s'.", path, lineNumber, (int)(c - name), name);
+                    buf_malloc_free(ret);
+                    return nullptr;
+                }
+                line.actionsHit[(int)action] = true;
+            }
+            lastFrame = line.frame;
+            buf_malloc_push(ret, line);
+        }
+        c = lineEnd + 1;
+        lineNumber++;
+    }
+    return ret;
+}
+
+static InputScriptLine *readInputScript(const char *path, MemoryStack *fileMemory) {
+    auto scriptResult = readEntireFile(path, fileMemory);
+    if (scriptResult.resultCode != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not read %s.", path);
+        return nullptr;
+    }
+    auto ret = parseInputScript((const char*)scriptResult.data, scriptResult.size, path);
+    freeFileBuffer(&scriptResult, fileMemory);
+    return ret;
+}
+
+static void freeHeadlessGameBoy(HeadlessGameBoy *gb) {
+    if (gb->programState && gb->programState->movie.mode != MovieMode::None) {
+        stopMovie(gb->cpu, gb->mmu, gb->gbDebug, gb->programState);
+    }
+    if (gb->host) {
+        if (gb->host->cartRAMPlatformState.cartRAMFileHandle) {
+            closeMemoryMappedFile(gb->host->cartRAMPlatformState.cartRAMFileHandle);
+        }
+        CO_FREE(gb->host->soundFramesBuffer.data);
+        CO_FREE(gb->host->serialOutput.data);
+    }
+    if (gb->mmu) {
+        CO_FREE(gb->mmu->cartRAM);
+    }
+    freeStateHasher(&gb->stateHasher);
+    CO_FREE(gb->screens);
+    releaseSharedROM(gb->rom);
+    CO_FREE(gb->batteryData);
+    CO_FREE(gb->programState);
+    CO_FREE(gb->gbDebug);
+    CO_FREE(gb->host);
+    CO_FREE(gb->memory);
+    CO_FREE(gb->mmu);
+    CO_FREE(gb->cpu);
+    *gb = {};
+}
+
+//Shares the ROM through romCache, which can be nullptr for a ROM of its own.  fileMemory is taken by value so a
+//thread can hand each of its instances the same empty stack.  Cart RAM lives in batteryPath if there is one,
+//otherwise in memory.  The real time clock runs on emulated time from startTime, so runs do not depend on when
+//they were run.  Returns why it failed, or nullptr
+static const char *initHeadlessGameBoy(const char *romPath, const char *batteryPath, i64 startTime,
+                                       MemoryStack fileMemory, ROMCache *romCache, HeadlessGameBoy *gb) {
+    *gb = {};
+    gb->cpu = CO_CALLOC(1, CPU);
+    gb->mmu = CO_CALLOC(1, MMU);
+    gb->memory = CO_CALLOC(1, GameBoyMemory);
+    gb->host = CO_CALLOC(1, MMUHost);
+    gb->gbDebug = CO_CALLOC(1, GameBoyDebug);
+    gb->programState = CO_CALLOC(1, ProgramState);
+    if (!gb->cpu || !gb->mmu || !gb->memory || !gb->host || !gb->gbDebug || !gb->programState) {
+        freeHeadlessGameBoy(gb);
+        return "Could not allocate memory.";
+    }
+    CPU *cpu = gb->cpu;
+    MMU *mmu = gb->mmu;
+    attachMMU(gb->memory, gb->host, mmu);
+    ProgramState *programState = gb->programState;
+    programState->fileMemory = fileMemory;
+    programState->hasFixedFrameLength = true;
+
+    const char *error = nullptr;
+    gb->rom = acquireSharedROM(romPath, &programState->fileMemory, romCache, &error);
+    if (!gb->rom) {
+        freeHeadlessGameBoy(gb);
+        return error;
+    }
+    useCartridge(gb->rom->data, gb->rom->size, &gb->rom->header, mmu);
+    copyMemory(mmu->host->romName, programState->loadedROMName, mmu->host->romNameLen);
+
+    mmu->cartRAM = CO_CALLOC(cartRAMAllocationSize(mmu), u8);
+
+    //the battery file is laid out like the platform layer's, so they can be swapped
+    CartRAMPlatformState *crps = &mmu->host->cartRAMPlatformState;
+    i64 batteryFileSize = mmu->cartRAMSize + (mmu->hasRTC ? (i64)sizeof(RTCFileState) : 0);
+    if (mmu->hasBattery) {
+        if (batteryPath) {
+            if (access(batteryPath, F_OK) != 0) {
+                u8 *zeros = CO_CALLOC(batteryFileSize, u8);
+                auto result = writeDataToFile(zeros, batteryFileSize, batteryPath);
+                CO_FREE(zeros);
+                if (result != FileSystemResultCode::OK) {
+                    freeHeadlessGameBoy(gb);
+                    return "Could not create the battery file.";
+                }
+            }
+            crps->cartRAMFileHandle = mapFileToMemory(batteryPath, &crps->cartRAMFileMap, &crps->ramLen);
+            if (!crps->cartRAMFileHandle || crps->ramLen != (usize)batteryFileSize) {
+                freeHeadlessGameBoy(gb);
+                return "Could not use the battery file.";
+            }
+        }
+        else {
+            gb->batteryData = CO_CALLOC(batteryFileSize, u8);
+            crps->cartRAMFileMap = gb->batteryData;
+            crps->ramLen = (usize)batteryFileSize;
+        }
+        copyMemory(crps->cartRAMFileMap, mmu->cartRAM, mmu->cartRAMSize);
+        if (mmu->hasRTC) {
+            crps->rtcFileMap = (RTCFileState*)(crps->cartRAMFileMap + mmu->cartRAMSize);
+            loadRTCFromFile(mmu);
+        }
+    }
+    crps->isRTCOnEmulatedTime = true;
+    crps->rtcEmulatedTimeBase = startTime;
+    crps->rtcEmulatedCycleBase = 0;
+
+    gb->screens = CO_CALLOC(2 * SCREEN_WIDTH * SCREEN_HEIGHT, PaletteColor);
+    mmu->lcd.screen = gb->screens;
+    mmu->lcd.backBuffer = gb->screens + SCREEN_WIDTH * SCREEN_HEIGHT;
+    mmu->host->soundFramesBuffer.len = HEADLESS_SAMPLE_RATE; //1 second
+    mmu->host->soundFramesBuffer.data = CO_MALLOC(mmu->host->soundFramesBuffer.len, SoundFrame);
+    programState->soundState.volume = HEADLESS_VOLUME;
+    mmu->host->serialOutput.data = CO_MALLOC(HEADLESS_SERIAL_OUTPUT_SIZE, u8);
+    mmu->host->serialOutput.capacity = HEADLESS_SERIAL_OUTPUT_SIZE;
+    if (!gb->screens || !mmu->host->soundFramesBuffer.data || !mmu->host->serialOutput.data) {
+        freeHeadlessGameBoy(gb);
+        return "Could not allocate memory.";
+    }
+
+    reset(cpu, mmu, gb->gbDebug, programState);
+    if (mmu->hasRTC) {
+        syncRTCTime(mmu);
+    }
+    return nullptr;
+}
+
+//Presses what the script says to for this frame, then runs it.  Returns false on an illegal opcode
+static bool runHeadlessFrame(i64 frame, HeadlessGameBoy *gb) {
+    Input *input = &gb->programState->input;
+    input->oldState = input->newState;
+    while (gb->nextScriptLine < (i64)buf_len(gb->script) && gb->script[gb->nextScriptLine].frame <= frame) {
+        copyMemory(gb->script[gb->nextScriptLine].actionsHit, input->newState.actionsHit, sizeof(input->newState.actionsHit));
+        gb->nextScriptLine++;
+    }
+
+    //there's no host clock; every frame is CYCLES_PER_FRAME
+    runFrame(gb->cpu, gb->mmu, gb->gbDebug, gb->programState, 0);
+    return !gb->cpu->didHitIllegalOpcode;
+}
@@ -0,0 +1,193 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Headless runner.  Runs a ROM as fast as possible through reset() and runFrame(), with input from
+//a script (see headless.cpp) instead of a keyboard, then writes out whatever was asked for.  Needs no window,
+//audio device or GBEmu home directory, so it runs on servers without displays.
+
+#define CO_IMPL
+#include "common.h"
+#define GB_IMPL
+#include "gbemu.cpp"
+#include "headless.cpp"
+#include "testrom.cpp"
+
+#define DEFAULT_NUM_FRAMES 600
+
+//binary PPM, in the same grays the platform layer draws
+static FileSystemResultCode writePPMFile(const PaletteColor *screen, const char *path) {
+    char header[32];
+    int headerLen = snprintf(header, ARRAY_LEN(header), "P6\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+    i64 size = headerLen + SCREEN_WIDTH * SCREEN_HEIGHT * 3;
+    u8 *data = CO_MALLOC(size, u8);
+    copyMemory(header, data, headerLen);
+    u8 *pixel = data + headerLen;
+    fori (SCREEN_WIDTH * SCREEN_HEIGHT) {
+        u8 gray = 0;
+        switch (screen[i]) {
+            case PaletteColor::White: gray = 0xFF; break;
+            case PaletteColor::LightGray: gray = 0xAA; break;
+            case PaletteColor::DarkGray: gray = 0x55; break;
+            case PaletteColor::Black: gray = 0; break;
+        }
+        *pixel++ = gray;
+        *pixel++ = gray;
+        *pixel++ = gray;
+    }
+    auto result = writeDataToFile(data, size, path);
+    CO_FREE(data);
+    return result;
+}
+
+static void printUsage() {
+    PRINT("Usage: headless [-f frames | -c cycles] [-i script] [-H hashes] [-s screenshot] [-a audio] [-b battery] [-t time] file.gb");
+    PRINT("\t-f -- Number of frames to run. Default is %d.", DEFAULT_NUM_FRAMES);
+    PRINT("\t-c -- Number of cycles to run instead, rounded up to a whole frame.");
+    PRINT("\t-i -- Input script to play.  No buttons are pressed by default.");
+    PRINT("\t-H -- File to write each frame's state hash to, one per line.");
+    PRINT("\t-s -- PPM file to write the final screen to.");
+    PRINT("\t-a -- WAV file to write all of the audio to.");
+    PRINT("\t-b -- Battery file to load cart RAM from and save it to.  Cart RAM is kept in memory by default.");
+    PRINT("\t-t -- Unix time the real time clock starts at, for cartridges with one. Default is 0.");
+}
+
+int main(int argc, char **argv) {
+    const char *romPath = nullptr;
+    const char *scriptPath = nullptr;
+    const char *hashesPath = nullptr;
+    const char *screenshotPath = nullptr;
+    const char *audioPath = nullptr;
+    const char *batteryPath = nullptr;
+    i64 numFrames = DEFAULT_NUM_FRAMES;
+    i64 startTime = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (areStringsEqual(argv[i], "-f", 3) && hasValue) {
+            numFrames = atoll(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-c", 3) && hasValue) {
+            numFrames = (atoll(argv[++i]) + CYCLES_PER_FRAME - 1) / CYCLES_PER_FRAME;
+        }
+        else if (areStringsEqual(argv[i], "-i", 3) && hasValue) {
+            scriptPath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-H", 3) && hasValue) {
+            hashesPath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-s", 3) && hasValue) {
+            screenshotPath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-a", 3) && hasValue) {
+            audioPath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-b", 3) && hasValue) {
+            batteryPath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-t", 3) && hasValue) {
+            startTime = atoll(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && !romPath) {
+            romPath = argv[i];
+        }
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (!romPath || numFrames <= 0) {
+        printUsage();
+        return 1;
+    }
+
+    if (!initMemory(FILE_MEMORY_SIZE, 0)) {
+        PRINT_ERR("Could not allocate memory.");
+        return 1;
+    }
+    MemoryStack fileMemory;
+    makeMemoryStack(FILE_MEMORY_SIZE, "fileMem", &fileMemory);
+
+    InputScriptLine *script = nullptr;
+    if (scriptPath) {
+        script = readInputScript(scriptPath, &fileMemory);
+        if (!script) {
+            return 1;
+        }
+    }
+
+    HeadlessGameBoy gb;
+    const char *error = initHeadlessGameBoy(romPath, batteryPath, startTime, fileMemory, nullptr, &gb);
+    if (error) {
+        PRINT_ERR("%s: %s", romPath, error);
+        return 1;
+    }
+    gb.script = script;
+    CPU *cpu = gb.cpu;
+    MMU *mmu = gb.mmu;
+
+    //every frame's samples, with room for the one a frame can run over by
+    i64 maxAudioFrames = audioPath ? numFrames * (CYCLES_PER_FRAME / (CLOCK_SPEED_HZ / HEADLESS_SAMPLE_RATE) + 1) : 0;
+    SoundFrame *audio = audioPath ? CO_MALLOC(maxAudioFrames, SoundFrame) : nullptr;
+    if (audioPath && !audio) {
+        PRINT_ERR("Could not allocate memory.");
+        return 1;
+    }
+
+    char *hashes = nullptr;
+    i64 numAudioFrames = 0;
+    char notification[MAX_NOTIFICATION_LEN + 1];
+    bool didHitIllegalOpcode = false;
+    i64 frame = 0;
+    TimeUS startTimeUS = nowInMicroseconds();
+    for (; frame < numFrames && !didHitIllegalOpcode; frame++) {
+        didHitIllegalOpcode = !runHeadlessFrame(frame, &gb);
+        while (popNotification(&gb.programState->notifications, notification)) {
+            PRINT("Frame %" PRId64 ": %s", frame, notification);
+        }
+
+        if (hashesPath) {
+            buf_malloc_printf(hashes, "%016" PRIx64 "\n", hashGameBoyState(cpu, mmu, &gb.stateHasher));
+        }
+        SoundBuffer *soundFramesBuffer = &mmu->host->soundFramesBuffer;
+        if (audio) {
+            numAudioFrames += popn(MIN(soundFramesBuffer->numItemsQueued, maxAudioFrames - numAudioFrames),
+                                   soundFramesBuffer, audio + numAudioFrames);
+        }
+        clear(soundFramesBuffer);
+    }
+    TimeUS elapsedTime = nowInMicroseconds() - startTimeUS;
+
+    bool didSucceed = !didHitIllegalOpcode;
+    if (hashesPath && writeDataToFile(hashes, (isize)buf_len(hashes), hashesPath) != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not write %s.", hashesPath);
+        didSucceed = false;
+    }
+    if (screenshotPath && writePPMFile(mmu->lcd.screen, screenshotPath) != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not write %s.", screenshotPath);
+        didSucceed = false;
+    }
+    if (audioPath && writeWAVFile(audio, numAudioFrames, HEADLESS_SAMPLE_RATE, audioPath) != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not write %s.", audioPath);
+        didSucceed = false;
+    }
+
+    double elapsedSeconds = (double)elapsedTime / 1000000.;
+    double emulatedSeconds = (double)cpu->totalCycles / CLOCK_SPEED_HZ;
+    PRINT("Ran %" PRId64 " frames (%" PRId64 " cycles) in %.2f seconds. %.0fx real time.",
+          frame, cpu->totalCycles, elapsedSeconds, (elapsedSeconds > 0) ? emulatedSeconds / elapsedSeconds : 0.);
+    PRINT("Final state hash: %016" PRIx64, hashGameBoyState(cpu, mmu, &gb.stateHasher));
+    if (mmu->host->serialOutput.len > 0) {
+        PRINT("Serial output: %.*s", (int)mmu->host->serialOutput.len, (const char*)mmu->host->serialOutput.data);
+    }
+    switch (testROMResult(&gb)) {
+        case TestROMResult::Running: break;
+        case TestROMResult::Passed: PRINT("Test ROM passed."); break;
+        case TestROMResult::Failed: PRINT("Test ROM failed."); break;
+    }
+
+    freeHeadlessGameBoy(&gb);
+    CO_FREE(audio);
+    buf_malloc_free(hashes);
+    buf_malloc_free(script);
+
+    return didSucceed ? 0 : 1;
+}
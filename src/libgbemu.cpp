@@ -0,0 +1,567 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//libgbemu.  The C API in libgbemu.h over the core, built with GB_NO_DEBUGGER_UI so it doesn't need ImGui.
+//Runs the core with step() directly instead of runFrame(), since runFrame() is the platform layer's: host
+//time, rewind, movies, save state slots and notifications all live there.
+//
+//Can also be included after gbemu.cpp in another unity build, as the benchmarks do.
+//
+//Allocates with calloc and malloc rather than CO_CALLOC and CO_MALLOC, which exit when out of memory, so
+//running out can be returned as GBEMU_OUT_OF_MEMORY.
+
+#ifndef GBEMU_H
+#define CO_IMPL
+#include "common.h"
+#define GB_IMPL
+#include "gbemu.cpp"
+#endif
+#include "libgbemu.h"
+
+#define LIBGBEMU_VOLUME 50 //same as the headless runner's
+#define LIBGBEMU_SOUND_BUFFER_LEN 4096 //about 90ms
+#define LIBGBEMU_SCREEN_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+static_assert(GBEMU_SCREEN_WIDTH == SCREEN_WIDTH && GBEMU_SCREEN_HEIGHT == SCREEN_HEIGHT, "Screen size is part of the API");
+static_assert(GBEMU_CYCLES_PER_FRAME == CYCLES_PER_FRAME, "Frame length is part of the API");
+
+struct GBEmu {
+    CPU cpu;
+    MMU mmu;
+    GameBoyMemory memory;
+    MMUHost host;
+    GameBoyDebug gbDebug; //never enabled, but step() checks it for breakpoints.  Small without the debugger's windows
+    PaletteColor screens[2][SCREEN_WIDTH * SCREEN_HEIGHT];
+    u8 framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+    SoundFrame soundFrames[LIBGBEMU_SOUND_BUFFER_LEN];
+    i64 overrunCycles; //run past the end of the last frame, taken off the next
+
+    SharedROM *rom; //a reference held by each instance
+    //calloced by initGBEmu()
+    u8 *cartRAM;
+    u8 *batteryData; //where the core writes battery RAM and the RTC through to, instead of a file
+};
+
+enum class VecEnvJob {
+    Step, Reset
+};
+
+//a contiguous run of instances, so each worker writes its own part of every observation array
+struct VecEnvWorker {
+    GBEmuVecEnv *vec;
+    i32 firstEnv;
+    i32 numEnvs;
+    Thread *thread;
+};
+
+struct GBEmuVecEnv {
+    GBEmu **envs; //each allocated on its own, so a large batch doesn't need one huge block
+    i32 numEnvs;
+    GBEmuMemoryRange *ramRanges;
+    i32 numRAMRanges;
+    GBEmuVecLayout layout;
+    GameBoySnapshot startState;
+
+    VecEnvWorker *workers; //workers[0] is whichever thread calls in, and has no thread of its own
+    i32 numWorkers;
+    Mutex *mutex;
+    WaitCondition *workChanged; //broadcast when a job is started, when it's finished, and on exit
+    i64 jobNumber;
+    i32 numWorkersBusy;
+    bool shouldWorkersExit;
+
+    //the job being run
+    VecEnvJob job;
+    const u32 *buttons;
+    const u8 *resetMask;
+    u8 *observations;
+    bool didAnyHitIllegalOpcode;
+};
+
+static void copyScreenShades(const PaletteColor *screen, u8 *out) {
+    fori (LIBGBEMU_SCREEN_SIZE) {
+        out[i] = (u8)screen[i];
+    }
+}
+
+extern "C" {
+
+int gbemu_api_version(void) {
+    return GBEMU_API_VERSION;
+}
+
+const char *gbemu_result_string(GBEmuResult result) {
+    switch (result) {
+        case GBEMU_OK: return "OK";
+        case GBEMU_OUT_OF_MEMORY: return "Out of memory";
+        case GBEMU_ROM_TOO_SMALL: return "Not a Game Boy ROM. File is too small";
+        case GBEMU_BAD_HEADER_CHECKSUM: return "Not a Game Boy ROM. Checksum does not match";
+        case GBEMU_BAD_GLOBAL_CHECKSUM: return "Not a Game Boy ROM. Global checksum does not match";
+        case GBEMU_UNSUPPORTED_MBC: return "The ROM uses an unsupported MBC";
+        case GBEMU_BUFFER_TOO_SMALL: return "Buffer too small";
+        case GBEMU_WRONG_CARTRIDGE: return "Snapshot is for a different cartridge";
+        case GBEMU_ILLEGAL_OPCODE: return "Illegal opcode hit";
+        case GBEMU_INVALID_ARGUMENT: return "Invalid argument";
+        case GBEMU_CORRUPT_SNAPSHOT: return "Snapshot is corrupt";
+    }
+    return "Unknown result";
+}
+
+static void freeGBEmuMemory(GBEmu *gb) {
+    CO_FREE(gb->batteryData);
+    CO_FREE(gb->cartRAM);
+    releaseSharedROM(gb->rom);
+}
+
+void gbemu_destroy(GBEmu *gb) {
+    if (!gb) {
+        return;
+    }
+    freeGBEmuMemory(gb);
+    CO_FREE(gb);
+}
+
+//takes a reference to rom.  On failure, what was allocated is left for freeGBEmuMemory()
+static GBEmuResult initGBEmu(SharedROM *rom, GBEmu *gb) {
+    retainSharedROM(rom);
+    gb->rom = rom;
+    MMU *mmu = &gb->mmu;
+    attachMMU(&gb->memory, &gb->host, mmu);
+    useCartridge(rom->data, rom->size, &rom->header, mmu);
+
+    gb->cartRAM = (u8*)calloc((usize)cartRAMAllocationSize(mmu), 1);
+    if (!gb->cartRAM) {
+        return GBEMU_OUT_OF_MEMORY;
+    }
+    mmu->cartRAM = gb->cartRAM;
+
+    //laid out like the platform layer's battery file
+    CartRAMPlatformState *crps = &gb->host.cartRAMPlatformState;
+    if (mmu->hasBattery) {
+        i64 batterySize = mmu->cartRAMSize + (mmu->hasRTC ? (i64)sizeof(RTCFileState) : 0);
+        gb->batteryData = (u8*)calloc((usize)batterySize, 1);
+        if (!gb->batteryData) {
+            return GBEMU_OUT_OF_MEMORY;
+        }
+        crps->cartRAMFileMap = gb->batteryData;
+        crps->ramLen = (usize)batterySize;
+        if (mmu->hasRTC) {
+            crps->rtcFileMap = (RTCFileState*)(gb->batteryData + mmu->cartRAMSize);
+        }
+    }
+    crps->isRTCOnEmulatedTime = true;
+
+    mmu->lcd.screen = gb->screens[0];
+    mmu->lcd.backBuffer = gb->screens[1];
+    gb->host.soundFramesBuffer.data = gb->soundFrames;
+    gb->host.soundFramesBuffer.len = LIBGBEMU_SOUND_BUFFER_LEN;
+
+    gbemu_reset(gb);
+    return GBEMU_OK;
+}
+
+//GBEmuROM is never defined.  Its pointers are SharedROMs
+GBEmuResult gbemu_rom_create(const void *rom, int64_t romSize, GBEmuROM **outROM) {
+    ROMLoadResult loadResult;
+    SharedROM *sharedROM = createSharedROM((const u8*)rom, romSize, &loadResult);
+    if (sharedROM) {
+        *outROM = (GBEmuROM*)sharedROM;
+        return GBEMU_OK;
+    }
+    switch (loadResult) {
+        case ROMLoadResult::Success: return GBEMU_OUT_OF_MEMORY;
+        case ROMLoadResult::TooSmall: return GBEMU_ROM_TOO_SMALL;
+        case ROMLoadResult::BadHeaderChecksum: return GBEMU_BAD_HEADER_CHECKSUM;
+        case ROMLoadResult::BadGlobalChecksum: return GBEMU_BAD_GLOBAL_CHECKSUM;
+        case ROMLoadResult::UnsupportedMBC: return GBEMU_UNSUPPORTED_MBC;
+    }
+    return GBEMU_OUT_OF_MEMORY;
+}
+
+void gbemu_rom_release(GBEmuROM *rom) {
+    releaseSharedROM((SharedROM*)rom);
+}
+
+GBEmuResult gbemu_create_from_rom(GBEmuROM *rom, GBEmu **outGB) {
+    GBEmu *gb = (GBEmu*)calloc(1, sizeof(GBEmu));
+    if (!gb) {
+        return GBEMU_OUT_OF_MEMORY;
+    }
+    GBEmuResult result = initGBEmu((SharedROM*)rom, gb);
+    if (result != GBEMU_OK) {
+        gbemu_destroy(gb);
+        return result;
+    }
+    *outGB = gb;
+    return GBEMU_OK;
+}
+
+GBEmuResult gbemu_create(const void *rom, int64_t romSize, GBEmu **outGB) {
+    GBEmuROM *sharedROM;
+    GBEmuResult result = gbemu_rom_create(rom, romSize, &sharedROM);
+    if (result != GBEMU_OK) {
+        return result;
+    }
+    result = gbemu_create_from_rom(sharedROM, outGB);
+    gbemu_rom_release(sharedROM);
+    return result;
+}
+
+void gbemu_reset(GBEmu *gb) {
+    MMU *mmu = &gb->mmu;
+    reset(&gb->cpu, mmu, &gb->gbDebug, nullptr);
+    CartRAMPlatformState *crps = &gb->host.cartRAMPlatformState;
+    crps->isRTCOnEmulatedTime = true;
+    crps->rtcEmulatedTimeBase = 0;
+    crps->rtcEmulatedCycleBase = mmu->currentCycle;
+    if (mmu->hasRTC) {
+        syncRTCTime(mmu);
+    }
+    gb->overrunCycles = 0;
+}
+
+GBEmuResult gbemu_run_cycles(GBEmu *gb, int64_t numCycles) {
+    CPU *cpu = &gb->cpu;
+    MMU *mmu = &gb->mmu;
+    i64 endCycle = cpu->totalCycles + numCycles;
+    while (cpu->totalCycles < endCycle) {
+        if (cpu->didHitIllegalOpcode) {
+            return GBEMU_ILLEGAL_OPCODE;
+        }
+        step(cpu, mmu, &gb->gbDebug, LIBGBEMU_VOLUME);
+    }
+    gb->overrunCycles = cpu->totalCycles - endCycle;
+    if (mmu->hasRTC) {
+        syncRTCTime(mmu);
+    }
+    return cpu->didHitIllegalOpcode ? GBEMU_ILLEGAL_OPCODE : GBEMU_OK;
+}
+
+GBEmuResult gbemu_run_frame(GBEmu *gb) {
+    return gbemu_run_cycles(gb, CYCLES_PER_FRAME - gb->overrunCycles);
+}
+
+void gbemu_set_input(GBEmu *gb, uint32_t buttons) {
+    JoyPad *joyPad = &gb->mmu.joyPad;
+#define BUTTON_STATE(button) (((buttons & (button)) != 0) ? JPButtonState::Down : JPButtonState::Up)
+    joyPad->a = BUTTON_STATE(GBEMU_BUTTON_A);
+    joyPad->b = BUTTON_STATE(GBEMU_BUTTON_B);
+    joyPad->select = BUTTON_STATE(GBEMU_BUTTON_SELECT);
+    joyPad->start = BUTTON_STATE(GBEMU_BUTTON_START);
+    joyPad->right = BUTTON_STATE(GBEMU_BUTTON_RIGHT);
+    joyPad->left = BUTTON_STATE(GBEMU_BUTTON_LEFT);
+    joyPad->up = BUTTON_STATE(GBEMU_BUTTON_UP);
+    joyPad->down = BUTTON_STATE(GBEMU_BUTTON_DOWN);
+#undef BUTTON_STATE
+    updateJoyPadRegister(&gb->mmu);
+}
+
+const uint8_t *gbemu_get_framebuffer(GBEmu *gb) {
+    copyScreenShades(gb->mmu.lcd.screen, gb->framebuffer);
+    return gb->framebuffer;
+}
+
+int64_t gbemu_drain_audio(GBEmu *gb, int16_t *outSamples, int64_t maxFrames) {
+    static_assert(sizeof(SoundFrame) == 2 * sizeof(i16), "SoundFrame is the interleaved left and right samples");
+    return popn(maxFrames, &gb->host.soundFramesBuffer, (SoundFrame*)outSamples);
+}
+
+int64_t gbemu_snapshot_size(const GBEmu *gb) {
+    return snapshotCapacity(&gb->mmu);
+}
+
+GBEmuResult gbemu_snapshot(GBEmu *gb, void *out, int64_t capacity, int64_t *outSize) {
+    if (capacity < snapshotCapacity(&gb->mmu)) {
+        return GBEMU_BUFFER_TOO_SMALL;
+    }
+    GameBoySnapshot snapshot = {};
+    snapshot.data = (u8*)out;
+    snapshot.capacity = capacity;
+    snapshotGameBoy(&gb->cpu, &gb->mmu, &snapshot);
+    *outSize = snapshot.size;
+    return GBEMU_OK;
+}
+
+GBEmuResult gbemu_restore(GBEmu *gb, const void *data, int64_t size) {
+    //restoreSnapshot() only reads it
+    GameBoySnapshot snapshot = {};
+    snapshot.data = (u8*)data;
+    snapshot.size = size;
+    snapshot.capacity = size;
+    switch (restoreSnapshot(&snapshot, &gb->cpu, &gb->mmu, &gb->gbDebug)) {
+    case RestoreSnapshotResult::Success: break;
+    case RestoreSnapshotResult::WrongCartridge: return GBEMU_WRONG_CARTRIDGE;
+    case RestoreSnapshotResult::Corrupt: return GBEMU_CORRUPT_SNAPSHOT;
+    }
+    gb->overrunCycles = 0;
+    return GBEMU_OK;
+}
+
+uint8_t gbemu_read_memory(GBEmu *gb, uint16_t address) {
+    return readByte(address, &gb->mmu);
+}
+
+void gbemu_write_memory(GBEmu *gb, uint16_t address, uint8_t value) {
+    writeByte(value, address, &gb->mmu, &gb->gbDebug);
+}
+
+/*****************************
+ * Vectorised environments
+ *****************************/
+static void writeVecObservation(GBEmuVecEnv *vec, i32 envIndex, GBEmuResult result) {
+    GBEmu *gb = vec->envs[envIndex];
+    const GBEmuVecLayout *layout = &vec->layout;
+    u8 *observations = vec->observations;
+    copyScreenShades(gb->mmu.lcd.screen, observations + layout->framebuffersOffset + (i64)envIndex * LIBGBEMU_SCREEN_SIZE);
+
+    u8 *ram = observations + layout->ramOffset + (i64)envIndex * layout->ramBytesPerEnv;
+    fori (vec->numRAMRanges) {
+        const GBEmuMemoryRange *range = &vec->ramRanges[i];
+        for (i32 j = 0; j < range->length; j++) {
+            *ram++ = readByte((u16)(range->address + j), &gb->mmu);
+        }
+    }
+    observations[layout->resultsOffset + envIndex] = (u8)result;
+}
+
+//the sound is never heard, so none is made
+static void restoreVecEnv(GBEmuVecEnv *vec, GBEmu *gb) {
+    gbemu_restore(gb, vec->startState.data, vec->startState.size);
+    gb->mmu.isSoundOutputSkipped = true;
+    ZEROM(gb->mmu.lcd.screen, LIBGBEMU_SCREEN_SIZE, PaletteColor);
+}
+
+static void runVecEnvWorker(VecEnvWorker *worker) {
+    GBEmuVecEnv *vec = worker->vec;
+    bool didHitIllegalOpcode = false;
+    for (i32 i = worker->firstEnv; i < worker->firstEnv + worker->numEnvs; i++) {
+        GBEmu *gb = vec->envs[i];
+        switch (vec->job) {
+            case VecEnvJob::Step: {
+                GBEmuResult result = GBEMU_ILLEGAL_OPCODE;
+                if (!gb->cpu.didHitIllegalOpcode) {
+                    gbemu_set_input(gb, vec->buttons[i]);
+                    result = gbemu_run_frame(gb);
+                }
+                didHitIllegalOpcode |= result != GBEMU_OK;
+                writeVecObservation(vec, i, result);
+            } break;
+            case VecEnvJob::Reset: {
+                if (!vec->resetMask || vec->resetMask[i]) {
+                    restoreVecEnv(vec, gb);
+                    writeVecObservation(vec, i, GBEMU_OK);
+                }
+            } break;
+        }
+    }
+    if (didHitIllegalOpcode) {
+        lockMutex(vec->mutex);
+        vec->didAnyHitIllegalOpcode = true;
+        unlockMutex(vec->mutex);
+    }
+}
+
+static void vecEnvWorkerThread(void *arg) {
+    auto worker = (VecEnvWorker*)arg;
+    GBEmuVecEnv *vec = worker->vec;
+    i64 lastJobNumber = 0;
+    lockMutex(vec->mutex);
+    for (;;) {
+        while (vec->jobNumber == lastJobNumber && !vec->shouldWorkersExit) {
+            waitForCondition(vec->workChanged, vec->mutex);
+        }
+        if (vec->shouldWorkersExit) {
+            break;
+        }
+        lastJobNumber = vec->jobNumber;
+        unlockMutex(vec->mutex);
+
+        runVecEnvWorker(worker);
+
+        lockMutex(vec->mutex);
+        vec->numWorkersBusy--;
+        if (vec->numWorkersBusy == 0) {
+            broadcastCondition(vec->workChanged);
+        }
+    }
+    unlockMutex(vec->mutex);
+}
+
+//returns once every instance has had the job run on it
+static void runVecEnvJob(VecEnvJob job, const u32 *buttons, const u8 *resetMask, u8 *observations, GBEmuVecEnv *vec) {
+    lockMutex(vec->mutex);
+    vec->job = job;
+    vec->buttons = buttons;
+    vec->resetMask = resetMask;
+    vec->observations = observations;
+    vec->didAnyHitIllegalOpcode = false;
+    vec->numWorkersBusy = vec->numWorkers - 1;
+    vec->jobNumber++;
+    broadcastCondition(vec->workChanged);
+    unlockMutex(vec->mutex);
+
+    runVecEnvWorker(&vec->workers[0]);
+
+    lockMutex(vec->mutex);
+    while (vec->numWorkersBusy > 0) {
+        waitForCondition(vec->workChanged, vec->mutex);
+    }
+    unlockMutex(vec->mutex);
+}
+
+void gbemu_vec_destroy(GBEmuVecEnv *vec) {
+    if (!vec) {
+        return;
+    }
+    if (vec->mutex) {
+        lockMutex(vec->mutex);
+        vec->shouldWorkersExit = true;
+        broadcastCondition(vec->workChanged);
+        unlockMutex(vec->mutex);
+    }
+    if (vec->workers) {
+        for (i32 i = 1; i < vec->numWorkers; i++) {
+            if (vec->workers[i].thread) {
+                waitForAndFreeThread(vec->workers[i].thread);
+            }
+        }
+    }
+    if (vec->workChanged) {
+        destroyWaitCondition(vec->workChanged);
+    }
+    if (vec->mutex) {
+        destroyMutex(vec->mutex);
+    }
+    if (vec->envs) {
+        fori (vec->numEnvs) {
+            gbemu_destroy(vec->envs[i]);
+        }
+    }
+    freeSnapshot(&vec->startState);
+    CO_FREE(vec->workers);
+    CO_FREE(vec->ramRanges);
+    CO_FREE(vec->envs);
+    CO_FREE(vec);
+}
+
+GBEmuResult gbemu_vec_create(const void *rom, int64_t romSize, int32_t numEnvs, int32_t numThreads,
+                             const GBEmuMemoryRange *ramRanges, int32_t numRAMRanges,
+                             GBEmuVecEnv **outVec) {
+    if (numEnvs <= 0 || numThreads < 0 || numRAMRanges < 0 || (numRAMRanges > 0 && !ramRanges)) {
+        return GBEMU_INVALID_ARGUMENT;
+    }
+    i64 ramBytesPerEnv = 0;
+    fori (numRAMRanges) {
+        if ((i64)ramRanges[i].address + ramRanges[i].length > 0x10000) {
+            return GBEMU_INVALID_ARGUMENT;
+        }
+        ramBytesPerEnv += ramRanges[i].length;
+    }
+    GBEmuROM *sharedROM;
+    GBEmuResult romResult = gbemu_rom_create(rom, romSize, &sharedROM);
+    if (romResult != GBEMU_OK) {
+        return romResult;
+    }
+
+    GBEmuVecEnv *vec = (GBEmuVecEnv*)calloc(1, sizeof(GBEmuVecEnv));
+    if (!vec) {
+        gbemu_rom_release(sharedROM);
+        return GBEMU_OUT_OF_MEMORY;
+    }
+    vec->envs = (GBEmu**)calloc((usize)numEnvs, sizeof(GBEmu*));
+    if (numRAMRanges > 0) {
+        vec->ramRanges = (GBEmuMemoryRange*)malloc((usize)numRAMRanges * sizeof(GBEmuMemoryRange));
+    }
+    if (!vec->envs || (numRAMRanges > 0 && !vec->ramRanges)) {
+        gbemu_rom_release(sharedROM);
+        gbemu_vec_destroy(vec);
+        return GBEMU_OUT_OF_MEMORY;
+    }
+    vec->numEnvs = numEnvs;
+    if (numRAMRanges > 0) {
+        copyMemory(ramRanges, vec->ramRanges, numRAMRanges * (i64)sizeof(GBEmuMemoryRange));
+    }
+    vec->numRAMRanges = numRAMRanges;
+
+    GBEmuVecLayout *layout = &vec->layout;
+    layout->framebuffersOffset = 0;
+    layout->ramOffset = (i64)numEnvs * LIBGBEMU_SCREEN_SIZE;
+    layout->ramBytesPerEnv = ramBytesPerEnv;
+    layout->resultsOffset = layout->ramOffset + numEnvs * ramBytesPerEnv;
+    layout->size = layout->resultsOffset + numEnvs;
+
+    fori (numEnvs) {
+        GBEmuResult result = gbemu_create_from_rom(sharedROM, &vec->envs[i]);
+        if (result != GBEMU_OK) {
+            gbemu_rom_release(sharedROM);
+            gbemu_vec_destroy(vec);
+            return result;
+        }
+        vec->envs[i]->mmu.isSoundOutputSkipped = true;
+    }
+    gbemu_rom_release(sharedROM);
+    if (!initSnapshot(&vec->envs[0]->mmu, &vec->startState)) {
+        gbemu_vec_destroy(vec);
+        return GBEMU_OUT_OF_MEMORY;
+    }
+    snapshotGameBoy(&vec->envs[0]->cpu, &vec->envs[0]->mmu, &vec->startState);
+
+    vec->numWorkers = (numThreads == 0) ? numberOfCPUCores() : numThreads;
+    if (vec->numWorkers > numEnvs) {
+        vec->numWorkers = numEnvs;
+    }
+    vec->workers = (VecEnvWorker*)calloc((usize)vec->numWorkers, sizeof(VecEnvWorker));
+    if (!vec->workers) {
+        gbemu_vec_destroy(vec);
+        return GBEMU_OUT_OF_MEMORY;
+    }
+    i32 firstEnv = 0;
+    fori (vec->numWorkers) {
+        VecEnvWorker *worker = &vec->workers[i];
+        worker->vec = vec;
+        worker->firstEnv = firstEnv;
+        worker->numEnvs = numEnvs / vec->numWorkers + ((i < numEnvs % vec->numWorkers) ? 1 : 0);
+        firstEnv += worker->numEnvs;
+    }
+    vec->mutex = createMutex();
+    vec->workChanged = createWaitCondition();
+    for (i32 i = 1; i < vec->numWorkers; i++) {
+        vec->workers[i].thread = startThread(vecEnvWorkerThread, &vec->workers[i]);
+    }
+
+    *outVec = vec;
+    return GBEMU_OK;
+}
+
+int32_t gbemu_vec_num_envs(const GBEmuVecEnv *vec) {
+    return vec->numEnvs;
+}
+
+GBEmuVecLayout gbemu_vec_layout(const GBEmuVecEnv *vec) {
+    return vec->layout;
+}
+
+GBEmuResult gbemu_vec_set_start_state(GBEmuVecEnv *vec, const void *snapshot, int64_t size) {
+    GameBoySnapshot candidate = {};
+    candidate.data = (u8*)snapshot;
+    candidate.size = size;
+    candidate.capacity = size;
+    switch (checkSnapshot(&candidate, &vec->envs[0]->cpu, &vec->envs[0]->mmu)) {
+    case RestoreSnapshotResult::Success: break;
+    case RestoreSnapshotResult::WrongCartridge: return GBEMU_WRONG_CARTRIDGE;
+    case RestoreSnapshotResult::Corrupt: return GBEMU_CORRUPT_SNAPSHOT;
+    }
+    copyMemory(snapshot, vec->startState.data, size);
+    vec->startState.size = size;
+    return GBEMU_OK;
+}
+
+void gbemu_vec_reset(GBEmuVecEnv *vec, const uint8_t *resetMask, uint8_t *observations) {
+    runVecEnvJob(VecEnvJob::Reset, nullptr, resetMask, observations, vec);
+}
+
+GBEmuResult gbemu_vec_step(GBEmuVecEnv *vec, const uint32_t *buttons, uint8_t *observations) {
+    runVecEnvJob(VecEnvJob::Step, buttons, nullptr, observations, vec);
+    return vec->didAnyHitIllegalOpcode ? GBEMU_ILLEGAL_OPCODE : GBEMU_OK;
+}
+
+}
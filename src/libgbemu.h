@@ -0,0 +1,155 @@
+/* Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license */
+
+/* libgbemu -- the emulator core as a library, for tools that drive Game Boys themselves.
+ *
+ * Each GBEmu is an opaque instance that owns everything it uses, other than a ROM it only reads, so any
+ * number of them can run side by side, one per thread at a time.  All memory is allocated by gbemu_create()
+ * and freed by gbemu_destroy(); nothing is allocated while running, and there are no globals.  Nothing here touches files, the
+ * battery RAM included, and the real time clock counts emulated time from 0.
+ *
+ * Built by "make libgbemu" in linux/ or mac/ as build/libgbemu.a, and build/libgbemu.so or build/libgbemu.dylib. */
+
+#ifndef LIBGBEMU_H
+#define LIBGBEMU_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+# define GBEMU_API __declspec(dllexport)
+#else
+# define GBEMU_API __attribute__((visibility("default")))
+#endif
+
+/* bumped when anything below changes in a way that breaks existing callers */
+#define GBEMU_API_VERSION 1
+
+#define GBEMU_SCREEN_WIDTH 160
+#define GBEMU_SCREEN_HEIGHT 144
+#define GBEMU_SAMPLE_RATE 44100
+#define GBEMU_CYCLES_PER_FRAME 70224
+
+typedef struct GBEmu GBEmu;
+
+typedef enum GBEmuResult {
+    GBEMU_OK = 0,
+    GBEMU_OUT_OF_MEMORY,
+    GBEMU_ROM_TOO_SMALL,
+    GBEMU_BAD_HEADER_CHECKSUM,
+    GBEMU_BAD_GLOBAL_CHECKSUM,
+    GBEMU_UNSUPPORTED_MBC,
+    GBEMU_BUFFER_TOO_SMALL,
+    GBEMU_WRONG_CARTRIDGE, /* the snapshot was taken on a different cartridge */
+    GBEMU_ILLEGAL_OPCODE, /* the game ran into one, and won't run any further until it's reset or restored */
+    GBEMU_INVALID_ARGUMENT,
+    GBEMU_CORRUPT_SNAPSHOT /* truncated, or doesn't decode. The state is left as it was */
+} GBEmuResult;
+
+/* OR them together for gbemu_set_input() */
+typedef enum GBEmuButton {
+    GBEMU_BUTTON_A = 1 << 0,
+    GBEMU_BUTTON_B = 1 << 1,
+    GBEMU_BUTTON_SELECT = 1 << 2,
+    GBEMU_BUTTON_START = 1 << 3,
+    GBEMU_BUTTON_RIGHT = 1 << 4,
+    GBEMU_BUTTON_LEFT = 1 << 5,
+    GBEMU_BUTTON_UP = 1 << 6,
+    GBEMU_BUTTON_DOWN = 1 << 7
+} GBEmuButton;
+
+GBEMU_API int gbemu_api_version(void);
+GBEMU_API const char *gbemu_result_string(GBEmuResult result);
+
+/* A ROM checked and copied once, then shared read-only by every instance made from it, so running many
+ * instances of one game costs one copy of it.  Each instance holds a reference, so it can be released as
+ * soon as the instances have been made, and is freed along with the last of them */
+typedef struct GBEmuROM GBEmuROM;
+GBEMU_API GBEmuResult gbemu_rom_create(const void *rom, int64_t romSize, GBEmuROM **outROM);
+GBEMU_API void gbemu_rom_release(GBEmuROM *rom);
+
+/* The ROM is copied, so it can be freed as soon as this returns.  *outGB is only set on GBEMU_OK */
+GBEMU_API GBEmuResult gbemu_create(const void *rom, int64_t romSize, GBEmu **outGB);
+GBEMU_API GBEmuResult gbemu_create_from_rom(GBEmuROM *rom, GBEmu **outGB);
+GBEMU_API void gbemu_destroy(GBEmu *gb);
+/* like the power switch.  Battery RAM is kept */
+GBEMU_API void gbemu_reset(GBEmu *gb);
+
+/* Runs GBEMU_CYCLES_PER_FRAME cycles.  Instructions can run past the end, and the next frame is that
+ * much shorter, so frames stay in step with the screen */
+GBEMU_API GBEmuResult gbemu_run_frame(GBEmu *gb);
+/* runs at least numCycles cycles, stopping at the end of the instruction that crosses it */
+GBEMU_API GBEmuResult gbemu_run_cycles(GBEmu *gb, int64_t numCycles);
+/* the buttons held from now until the next call */
+GBEMU_API void gbemu_set_input(GBEmu *gb, uint32_t buttons);
+
+/* The last finished screen, GBEMU_SCREEN_WIDTH * GBEMU_SCREEN_HEIGHT shades from 0 (white) to 3 (black),
+ * row by row.  Owned by gb, and valid until it next runs */
+GBEMU_API const uint8_t *gbemu_get_framebuffer(GBEmu *gb);
+/* Copies up to maxFrames stereo frames at GBEMU_SAMPLE_RATE, left then right, into outSamples and
+ * returns how many there were.  About 90ms is kept, and newer samples are dropped once it's full, so
+ * drain at least once a frame */
+GBEMU_API int64_t gbemu_drain_audio(GBEmu *gb, int16_t *outSamples, int64_t maxFrames);
+
+/* The most a snapshot of this cartridge can take.  Snapshots hold the emulated state only, not the
+ * screen or queued audio, and can only be restored into an instance of the same cartridge */
+GBEMU_API int64_t gbemu_snapshot_size(const GBEmu *gb);
+GBEMU_API GBEmuResult gbemu_snapshot(GBEmu *gb, void *out, int64_t capacity, int64_t *outSize);
+GBEMU_API GBEmuResult gbemu_restore(GBEmu *gb, const void *snapshot, int64_t size);
+
+/* as the CPU sees the address space, so reading or writing I/O registers has their side effects */
+GBEMU_API uint8_t gbemu_read_memory(GBEmu *gb, uint16_t address);
+GBEMU_API void gbemu_write_memory(GBEmu *gb, uint16_t address, uint8_t value);
+
+/* Vectorised environments, for training agents: many instances of one ROM run in lockstep.
+ *
+ * Each step runs every instance for a frame with its own buttons, split across a pool of worker threads,
+ * and writes what each sees into one caller-owned buffer laid out as an array per kind of observation:
+ *     framebuffers  numEnvs screens of shades, as gbemu_get_framebuffer() gives them
+ *     ram           numEnvs copies of the watched memory ranges, one after another in the order given
+ *     results       numEnvs GBEmuResults, a byte each
+ * The instances share one copy of the ROM and make no sound.  They're reset by restoring a start state
+ * shared by all of them, which is cheap next to running a frame. */
+typedef struct GBEmuVecEnv GBEmuVecEnv;
+
+typedef struct GBEmuMemoryRange {
+    uint16_t address;
+    uint16_t length;
+} GBEmuMemoryRange;
+
+/* in bytes, from the start of an observation buffer */
+typedef struct GBEmuVecLayout {
+    int64_t size;
+    int64_t framebuffersOffset;
+    int64_t ramOffset;
+    int64_t ramBytesPerEnv;
+    int64_t resultsOffset;
+} GBEmuVecLayout;
+
+/* numThreads counts the calling thread, and 0 means one per CPU core.  The ROM and the ranges are copied */
+GBEMU_API GBEmuResult gbemu_vec_create(const void *rom, int64_t romSize, int32_t numEnvs, int32_t numThreads,
+                                       const GBEmuMemoryRange *ramRanges, int32_t numRAMRanges,
+                                       GBEmuVecEnv **outVec);
+GBEMU_API void gbemu_vec_destroy(GBEmuVecEnv *vec);
+GBEMU_API int32_t gbemu_vec_num_envs(const GBEmuVecEnv *vec);
+GBEMU_API GBEmuVecLayout gbemu_vec_layout(const GBEmuVecEnv *vec);
+
+/* The state instances are reset to, from gbemu_snapshot() on the same ROM, e.g. past the title screen.
+ * Power on until it's set.  No instance is reset by setting it */
+GBEMU_API GBEmuResult gbemu_vec_set_start_state(GBEmuVecEnv *vec, const void *snapshot, int64_t size);
+/* Resets the instances whose byte in resetMask isn't 0, or all of them if it's NULL, and writes their
+ * observations.  Other instances' observations are left alone.  A reset instance's screen is blank
+ * until it next runs, since snapshots don't hold the screen */
+GBEMU_API void gbemu_vec_reset(GBEmuVecEnv *vec, const uint8_t *resetMask, uint8_t *observations);
+/* Runs every instance for a frame holding buttons[i], and writes every observation.  An instance that
+ * has hit an illegal opcode stays stopped until it's reset, and GBEMU_ILLEGAL_OPCODE is returned
+ * while any has; its results say which */
+GBEMU_API GBEmuResult gbemu_vec_step(GBEmuVecEnv *vec, const uint32_t *buttons, uint8_t *observations);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
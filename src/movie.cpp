@@ -0,0 +1,377 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Input movies.  See Movie in gbemu.h.
+//
+//File layout: MovieFileHeader, then a byte of joypad per frame, then a state hash per frame, then
+//the MovieKeyFrames, then the compressed key frame data.
+
+#include "gbemu.h"
+
+struct MovieFileHeader {
+    u32 magic;
+    u32 version;
+    u64 romHash;
+    i64 startTime;
+    i64 numFrames;
+    i64 numKeyFrames;
+    i64 keyFrameDataSize;
+};
+
+//low nibble is the buttons and high nibble is the d-pad, each in FF00 order
+static u8 packJoyPad(const JoyPad *joyPad) {
+    u8 ret = 0;
+    if (joyPad->a == JPButtonState::Down) ret |= 0x01;
+    if (joyPad->b == JPButtonState::Down) ret |= 0x02;
+    if (joyPad->select == JPButtonState::Down) ret |= 0x04;
+    if (joyPad->start == JPButtonState::Down) ret |= 0x08;
+    if (joyPad->right == JPButtonState::Down) ret |= 0x10;
+    if (joyPad->left == JPButtonState::Down) ret |= 0x20;
+    if (joyPad->up == JPButtonState::Down) ret |= 0x40;
+    if (joyPad->down == JPButtonState::Down) ret |= 0x80;
+    return ret;
+}
+
+static void unpackJoyPad(u8 buttons, JoyPad *joyPad) {
+#define BUTTON_STATE(bit) ((buttons & (bit)) ? JPButtonState::Down : JPButtonState::Up)
+    joyPad->a = BUTTON_STATE(0x01);
+    joyPad->b = BUTTON_STATE(0x02);
+    joyPad->select = BUTTON_STATE(0x04);
+    joyPad->start = BUTTON_STATE(0x08);
+    joyPad->right = BUTTON_STATE(0x10);
+    joyPad->left = BUTTON_STATE(0x20);
+    joyPad->up = BUTTON_STATE(0x40);
+    joyPad->down = BUTTON_STATE(0x80);
+#undef BUTTON_STATE
+}
+
+static u64 hashROM(MMU *mmu) {
+    return hashMemory(mmu->romData, mmu->romSize);
+}
+
+static void freeMovie(Movie *movie) {
+    buf_malloc_free(movie->inputs);
+    buf_malloc_free(movie->stateHashes);
+    buf_malloc_free(movie->keyFrames);
+    buf_malloc_free(movie->keyFrameData);
+    CO_FREE(movie->playbackCartRAMFile);
+    freeSnapshot(&movie->snapshot);
+    freeStateHasher(&movie->stateHasher);
+    freeSnapshot(&movie->stateBeforePlayback);
+    *movie = {};
+}
+
+static bool initMovie(const char *path, MMU *mmu, Movie *movie) {
+    freeMovie(movie);
+    copyString(path, movie->path, MAX_PATH_LEN);
+    movie->desyncFrame = -1;
+    movie->romHash = hashROM(mmu);
+    return initSnapshot(mmu, &movie->snapshot);
+}
+
+static void addMovieKeyFrame(CPU *cpu, MMU *mmu, Movie *movie) {
+    snapshotGameBoy(cpu, mmu, &movie->snapshot);
+
+    MovieKeyFrame keyFrame;
+    keyFrame.frame = movie->currentFrame;
+    keyFrame.offset = (i64)buf_len(movie->keyFrameData);
+    keyFrame.imageSize = movie->snapshot.size;
+    buf_fit(chkMalloc, chkRealloc, movie->keyFrameData,
+            (usize)(keyFrame.offset + maxCompressedSaveStateSize(keyFrame.imageSize)));
+    keyFrame.size = compressSaveState(movie->snapshot.data, keyFrame.imageSize, movie->keyFrameData + keyFrame.offset);
+    buf__hdr(movie->keyFrameData)->len += (usize)keyFrame.size;
+    buf_malloc_push(movie->keyFrames, keyFrame);
+}
+
+static bool restoreMovieKeyFrame(const MovieKeyFrame *keyFrame, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, Movie *movie) {
+    GameBoySnapshot *snapshot = &movie->snapshot;
+    if (decompressSaveState(movie->keyFrameData + keyFrame->offset, keyFrame->size, snapshot->data, keyFrame->imageSize) != keyFrame->imageSize) {
+        CO_ERR("Movie key frame at frame %" PRId64 " is corrupt", keyFrame->frame);
+        return false;
+    }
+    snapshot->size = keyFrame->imageSize;
+    if (restoreSnapshot(snapshot, cpu, mmu, gbDebug) != RestoreSnapshotResult::Success) {
+        return false;
+    }
+    movie->currentFrame = keyFrame->frame;
+    return true;
+}
+
+static void useEmulatedRTCTime(i64 startTime, i64 startCycle, MMU *mmu) {
+    CartRAMPlatformState *crps = &mmu->host->cartRAMPlatformState;
+    crps->isRTCOnEmulatedTime = true;
+    crps->rtcEmulatedTimeBase = startTime;
+    crps->rtcEmulatedCycleBase = startCycle;
+}
+
+bool startMovieRecording(const char *path, bool fromPowerOn, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState) {
+    Movie *movie = &programState->movie;
+    if (movie->mode != MovieMode::None) {
+        stopMovie(cpu, mmu, gbDebug, programState);
+    }
+    if (!initMovie(path, mmu, movie)) {
+        CO_ERR("Could not allocate movie");
+        freeMovie(movie);
+        return false;
+    }
+    if (fromPowerOn) {
+        reset(cpu, mmu, gbDebug, programState);
+    }
+
+    if (mmu->hasRTC) {
+        syncRTCTime(mmu);
+    }
+    movie->startTime = unixWallClockTime();
+    useEmulatedRTCTime(movie->startTime, cpu->totalCycles, mmu);
+    if (mmu->host->cartRAMPlatformState.rtcFileMap) {
+        mmu->host->cartRAMPlatformState.rtcFileMap->unixTimestamp = movie->startTime;
+        mmu->rtc.wallClockTime = movie->startTime;
+    }
+
+    addMovieKeyFrame(cpu, mmu, movie);
+    movie->mode = MovieMode::Recording;
+    return true;
+}
+
+static FileSystemResultCode writeMovieFile(const Movie *movie) {
+    MovieFileHeader header = {};
+    header.magic = MOVIE_FILE_MAGIC;
+    header.version = MOVIE_FILE_VERSION;
+    header.romHash = movie->romHash;
+    header.startTime = movie->startTime;
+    header.numFrames = (i64)buf_len(movie->inputs);
+    header.numKeyFrames = (i64)buf_len(movie->keyFrames);
+    header.keyFrameDataSize = (i64)buf_len(movie->keyFrameData);
+
+    i64 fileSize = (i64)sizeof(header) + header.numFrames * (1 + (i64)sizeof(u64)) +
+        header.numKeyFrames * (i64)sizeof(MovieKeyFrame) + header.keyFrameDataSize;
+    u8 *fileData = CO_MALLOC(fileSize, u8);
+    if (!fileData) {
+        return FileSystemResultCode::OutOfMemory;
+    }
+    u8 *cursor = fileData;
+    copyMemory(&header, cursor, sizeof(header));
+    cursor += sizeof(header);
+    copyMemory(movie->inputs, cursor, header.numFrames);
+    cursor += header.numFrames;
+    copyMemory(movie->stateHashes, cursor, header.numFrames * (i64)sizeof(u64));
+    cursor += header.numFrames * (i64)sizeof(u64);
+    copyMemory(movie->keyFrames, cursor, header.numKeyFrames * (i64)sizeof(MovieKeyFrame));
+    cursor += header.numKeyFrames * (i64)sizeof(MovieKeyFrame);
+    copyMemory(movie->keyFrameData, cursor, header.keyFrameDataSize);
+
+    auto ret = writeDataToFile(fileData, fileSize, movie->path, true);
+    CO_FREE(fileData);
+    return ret;
+}
+
+static bool readMovieFile(const char *path, MMU *mmu, MemoryStack *fileMemory, Movie *movie) {
+    auto fileResult = readEntireFile(path, fileMemory);
+    if (fileResult.resultCode != FileSystemResultCode::OK) {
+        CO_ERR("Could not read movie %s", path);
+        return false;
+    }
+    bool ret = false;
+    MovieFileHeader header;
+    const u8 *cursor = fileResult.data;
+    i64 keyFramesSize;
+    if (fileResult.size < (i64)sizeof(header)) {
+        CO_ERR("Movie is truncated");
+        goto exit;
+    }
+    copyMemory(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    if (header.magic != MOVIE_FILE_MAGIC || header.version != MOVIE_FILE_VERSION) {
+        CO_ERR("Not a movie, or a movie from another version of GBEmu");
+        goto exit;
+    }
+    keyFramesSize = header.numKeyFrames * (i64)sizeof(MovieKeyFrame);
+    if (header.numFrames < 0 || header.numKeyFrames < 1 || header.keyFrameDataSize < 0 ||
+        header.numFrames > fileResult.size || header.numKeyFrames > fileResult.size ||
+        (i64)sizeof(header) + header.numFrames * (1 + (i64)sizeof(u64)) + keyFramesSize + header.keyFrameDataSize != fileResult.size) {
+        CO_ERR("Movie is corrupt");
+        goto exit;
+    }
+    if (!initMovie(path, mmu, movie)) {
+        CO_ERR("Could not allocate movie");
+        goto exit;
+    }
+    if (header.romHash != movie->romHash) {
+        CO_ERR("Movie is not for this ROM");
+        goto exit;
+    }
+    movie->startTime = header.startTime;
+
+    buf_fit(chkMalloc, chkRealloc, movie->inputs, (usize)header.numFrames);
+    copyMemory(cursor, movie->inputs, header.numFrames);
+    if (movie->inputs) {
+        buf__hdr(movie->inputs)->len = (usize)header.numFrames;
+    }
+    cursor += header.numFrames;
+
+    buf_fit(chkMalloc, chkRealloc, movie->stateHashes, (usize)header.numFrames);
+    copyMemory(cursor, movie->stateHashes, header.numFrames * (i64)sizeof(u64));
+    if (movie->stateHashes) {
+        buf__hdr(movie->stateHashes)->len = (usize)header.numFrames;
+    }
+    cursor += header.numFrames * (i64)sizeof(u64);
+
+    fori (header.numKeyFrames) {
+        MovieKeyFrame keyFrame;
+        copyMemory(cursor, &keyFrame, sizeof(keyFrame));
+        cursor += sizeof(keyFrame);
+        //frames have to be in order and start at 0 for seeking
+        i64 minFrame = (i == 0) ? 0 : movie->keyFrames[i - 1].frame + 1;
+        if ((i == 0 && keyFrame.frame != 0) || keyFrame.frame < minFrame || keyFrame.frame > header.numFrames ||
+            keyFrame.offset < 0 || keyFrame.size < 0 || keyFrame.offset + keyFrame.size > header.keyFrameDataSize ||
+            keyFrame.imageSize <= 0 || keyFrame.imageSize > movie->snapshot.capacity) {
+            CO_ERR("Movie key frame %" PRId64 " is corrupt", i);
+            goto exit;
+        }
+        buf_malloc_push(movie->keyFrames, keyFrame);
+    }
+
+    buf_fit(chkMalloc, chkRealloc, movie->keyFrameData, (usize)header.keyFrameDataSize);
+    copyMemory(cursor, movie->keyFrameData, header.keyFrameDataSize);
+    if (movie->keyFrameData) {
+        buf__hdr(movie->keyFrameData)->len = (usize)header.keyFrameDataSize;
+    }
+    ret = true;
+
+exit:
+    if (!ret) {
+        freeMovie(movie);
+    }
+    freeFileBuffer(&fileResult, fileMemory);
+    return ret;
+}
+
+bool startMoviePlayback(const char *path, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState) {
+    Movie *movie = &programState->movie;
+    if (movie->mode != MovieMode::None) {
+        stopMovie(cpu, mmu, gbDebug, programState);
+    }
+    if (!readMovieFile(path, mmu, &programState->fileMemory, movie)) {
+        return false;
+    }
+
+    //put aside what is being played, and give the movie its own battery file
+    CartRAMPlatformState *crps = &mmu->host->cartRAMPlatformState;
+    movie->platformStateBeforePlayback = *crps;
+    if (!initSnapshot(mmu, &movie->stateBeforePlayback)) {
+        freeMovie(movie);
+        return false;
+    }
+    snapshotGameBoy(cpu, mmu, &movie->stateBeforePlayback);
+    if (crps->cartRAMFileMap) {
+        movie->playbackCartRAMFile = CO_CALLOC(crps->ramLen, u8);
+        crps->cartRAMFileMap = movie->playbackCartRAMFile;
+        if (crps->rtcFileMap) {
+            crps->rtcFileMap = (RTCFileState*)(movie->playbackCartRAMFile + mmu->cartRAMSize);
+        }
+    }
+    useEmulatedRTCTime(movie->startTime, 0, mmu);
+
+    if (!restoreMovieKeyFrame(&movie->keyFrames[0], cpu, mmu, gbDebug, movie)) {
+        movie->mode = MovieMode::Playing;
+        stopMovie(cpu, mmu, gbDebug, programState);
+        return false;
+    }
+    //the emulated clock counts from where the movie started
+    crps->rtcEmulatedCycleBase = cpu->totalCycles;
+    movie->mode = MovieMode::Playing;
+    return true;
+}
+
+FileSystemResultCode stopMovie(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, ProgramState *programState) {
+    Movie *movie = &programState->movie;
+    FileSystemResultCode ret = FileSystemResultCode::OK;
+    CartRAMPlatformState *crps = &mmu->host->cartRAMPlatformState;
+    switch (movie->mode) {
+    case MovieMode::None: {
+        return ret;
+    } break;
+    case MovieMode::Recording: {
+        ret = writeMovieFile(movie);
+    } break;
+    case MovieMode::Playing: {
+        *crps = movie->platformStateBeforePlayback;
+        restoreSnapshot(&movie->stateBeforePlayback, cpu, mmu, gbDebug);
+        //so rewinding can't bring the movie's cart RAM back into the real battery file
+        clearRewindBuffer(&gbDebug->rewindBuffer);
+    } break;
+    }
+
+    crps->isRTCOnEmulatedTime = false;
+    if (mmu->hasRTC) {
+        syncRTCTime(mmu);
+    }
+    freeMovie(movie);
+    return ret;
+}
+
+bool updateMovieFrame(CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, Movie *movie) {
+    UNUSED(gbDebug);
+    switch (movie->mode) {
+    case MovieMode::None: {
+    } break;
+    case MovieMode::Recording: {
+        if (movie->currentFrame % MOVIE_FRAMES_PER_KEY_FRAME == 0 && movie->currentFrame > 0) {
+            addMovieKeyFrame(cpu, mmu, movie);
+        }
+        buf_malloc_push(movie->inputs, packJoyPad(&mmu->joyPad));
+        buf_malloc_push(movie->stateHashes, hashGameBoyState(cpu, mmu, &movie->stateHasher));
+        movie->currentFrame++;
+    } break;
+    case MovieMode::Playing: {
+        if (movie->currentFrame >= (i64)buf_len(movie->inputs)) {
+            return false;
+        }
+        unpackJoyPad(movie->inputs[movie->currentFrame], &mmu->joyPad);
+        updateJoyPadRegister(mmu);
+        //hashed after the joypad is set, like when recording
+        if (movie->desyncFrame < 0 &&
+            hashGameBoyState(cpu, mmu, &movie->stateHasher) != movie->stateHashes[movie->currentFrame]) {
+            movie->desyncFrame = movie->currentFrame;
+            CO_ERR("Movie desynced at frame %" PRId64, movie->desyncFrame);
+        }
+        movie->currentFrame++;
+    } break;
+    }
+    return true;
+}
+
+//Restores the closest key frame, then plays the frames after it.  Costs at most
+//MOVIE_FRAMES_PER_KEY_FRAME frames of emulation
+bool seekMovie(i64 frame, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug, Movie *movie) {
+    if (movie->mode != MovieMode::Playing || frame < 0 || frame > (i64)buf_len(movie->inputs)) {
+        return false;
+    }
+    const MovieKeyFrame *keyFrame = &movie->keyFrames[0];
+    fori ((i64)buf_len(movie->keyFrames)) {
+        if (movie->keyFrames[i].frame > frame) {
+            break;
+        }
+        keyFrame = &movie->keyFrames[i];
+    }
+    //going forward a little is cheaper than going back to a key frame
+    if (frame < movie->currentFrame || keyFrame->frame > movie->currentFrame) {
+        if (!restoreMovieKeyFrame(keyFrame, cpu, mmu, gbDebug, movie)) {
+            return false;
+        }
+    }
+
+    while (movie->currentFrame < frame) {
+        updateMovieFrame(cpu, mmu, gbDebug, movie);
+        i32 cyclesToExecute = CYCLES_PER_FRAME;
+        while (cyclesToExecute > 0) {
+            step(cpu, mmu, gbDebug, 0);
+            cyclesToExecute -= cpu->instructionCycles;
+        }
+        if (mmu->hasRTC) {
+            syncRTCTime(mmu);
+        }
+    }
+    //nothing is listening to what was played on the way
+    clear(&mmu->host->soundFramesBuffer);
+    return true;
+}
@@ -0,0 +1,423 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Rewind history.  See RewindBuffer in gbemu.h.
+//
+//Image layout: [CPU][MMU][VRAM][WRAM][the screen being shown][cart RAM]
+//
+//Delta format: repeated [varint unchanged bytes][varint changed bytes][changed bytes XOR reference]
+//Key frames use the same format against an all zero reference.
+
+#include "gbemu.h"
+
+//shorter runs of unchanged bytes are cheaper to store as part of the changed bytes
+#define REWIND_MIN_UNCHANGED_RUN 4
+
+//VRAM and WRAM are allocated apart from the MMU, and the screens are owned by the platform
+#define REWIND_MEMORY_OFFSET ((i64)(sizeof(CPU) + sizeof(MMU)))
+#define REWIND_SCREEN_OFFSET (REWIND_MEMORY_OFFSET + VIDEO_RAM_SIZE + WORKING_RAM_SIZE)
+#define REWIND_CART_RAM_OFFSET (REWIND_SCREEN_OFFSET + (i64)sizeof(PaletteColor) * SCREEN_WIDTH * SCREEN_HEIGHT)
+
+static i64 maxCompressedRewindImageSize(i64 imageSize) {
+    return imageSize * 2 + 64;
+}
+
+//reference can be null for all zeros. Returns the size of the delta
+static i64 encodeRewindDelta(const u8 *image, const u8 *reference, i64 len, u8 *out) {
+    u8 *o = out;
+    i64 i = 0;
+#define REF(i) (reference ? reference[i] : 0)
+    while (i < len) {
+        i64 unchangedStart = i;
+        while (i < len && image[i] == REF(i)) {
+            i++;
+        }
+
+        i64 changedStart = i;
+        i64 changedEnd = i;
+        while (i < len && i - changedEnd < REWIND_MIN_UNCHANGED_RUN) {
+            if (image[i] != REF(i)) {
+                changedEnd = i + 1;
+            }
+            i++;
+        }
+        i = changedEnd;
+
+        o = writeVarInt((u64)(changedStart - unchangedStart), o);
+        o = writeVarInt((u64)(changedEnd - changedStart), o);
+        for (i64 j = changedStart; j < changedEnd; j++) {
+            *o++ = image[j] ^ REF(j);
+        }
+    }
+#undef REF
+    return o - out;
+}
+
+//Returns false if the delta is corrupt: it runs past its end or decodes to other than len bytes
+static bool decodeRewindDelta(const u8 *delta, i64 deltaSize, const u8 *reference, i64 len, u8 *outImage) {
+    const u8 *d = delta;
+    const u8 *end = delta + deltaSize;
+    i64 i = 0;
+    while (d < end) {
+        i64 numUnchanged, numChanged;
+        d = readVarInt(d, end, &numUnchanged);
+        if (!d) {
+            return false;
+        }
+        d = readVarInt(d, end, &numChanged);
+        if (!d || numUnchanged < 0 || numChanged < 0 ||
+            numUnchanged > len - i || numChanged > len - i - numUnchanged || numChanged > end - d) {
+            return false;
+        }
+
+        if (reference) {
+            copyMemory(reference + i, outImage + i, numUnchanged);
+        }
+        else {
+            zeroMemory(outImage + i, numUnchanged);
+        }
+        i += numUnchanged;
+
+        for (i64 changedEnd = i + numChanged; i < changedEnd; i++) {
+            outImage[i] = *d++ ^ (reference ? reference[i] : 0);
+        }
+    }
+    return i == len;
+}
+
+static inline RewindFrame *rewindFrameAt(i64 age, RewindBuffer *rb) {
+    return &rb->frames[(rb->oldestFrame + age) % REWIND_MAX_FRAMES];
+}
+
+//frames after a key frame are useless without it, so drop them along with it
+static void dropOldestRewindFrame(RewindBuffer *rb) {
+    do {
+        rb->oldestFrame = (rb->oldestFrame + 1) % REWIND_MAX_FRAMES;
+        rb->numFrames--;
+    } while (rb->numFrames > 0 && !rewindFrameAt(0, rb)->isKeyFrame);
+
+    if (rb->numFrames == 0) {
+        rb->dataHead = 0;
+    }
+}
+
+//returns the offset to store size bytes at, dropping old frames to make room.  -1 if it can never fit
+static i64 reserveRewindData(i64 size, RewindBuffer *rb) {
+    if (size >= rb->dataSize) {
+        return -1;
+    }
+
+    for (;;) {
+        if (rb->numFrames == 0) {
+            return 0;
+        }
+        if (rb->numFrames < REWIND_MAX_FRAMES) {
+            i64 tail = rewindFrameAt(0, rb)->offset;
+            if (rb->dataHead > tail) {
+                if (rb->dataSize - rb->dataHead >= size) {
+                    return rb->dataHead;
+                }
+                if (size < tail) {
+                    return 0;
+                }
+            }
+            else if (tail - rb->dataHead > size) {
+                return rb->dataHead;
+            }
+        }
+        dropOldestRewindFrame(rb);
+    }
+}
+
+//called with the mutex held, if there is a worker
+static void addCompressedRewindFrame(i64 size, bool isKeyFrame, RewindBuffer *rb) {
+    i64 offset = reserveRewindData(size, rb);
+    if (offset < 0) {
+        CO_ERR("Rewind frame of %" PRId64 " bytes is larger than the rewind buffer", size);
+        rb->framesUntilKeyFrame = 0;
+        return;
+    }
+    if (!isKeyFrame && (rb->numFrames == 0 || rb->keyFrameSerial < rewindFrameAt(0, rb)->keyFrameSerial)) {
+        //the key frame this delta is against was dropped to make room
+        rb->framesUntilKeyFrame = 0;
+        return;
+    }
+    copyMemory(rb->compressedImage, rb->data + offset, size);
+
+    RewindFrame *frame = rewindFrameAt(rb->numFrames, rb);
+    frame->offset = offset;
+    frame->size = size;
+    frame->serial = rb->nextSerial++;
+    frame->isKeyFrame = isKeyFrame;
+    if (isKeyFrame) {
+        rb->keyFrameSerial = frame->serial;
+    }
+    frame->keyFrameSerial = rb->keyFrameSerial;
+    rb->numFrames++;
+    rb->dataHead = offset + size;
+}
+
+//compresses into rb->compressedImage.  Returns the size
+static i64 compressRewindImage(const u8 *image, bool *outIsKeyFrame, RewindBuffer *rb) {
+    bool isKeyFrame = rb->framesUntilKeyFrame <= 0;
+    i64 size;
+    if (isKeyFrame) {
+        size = encodeRewindDelta(image, nullptr, rb->imageSize, rb->compressedImage);
+        copyMemory(image, rb->keyFrameImage, rb->imageSize);
+        rb->framesUntilKeyFrame = REWIND_FRAMES_PER_KEY_FRAME;
+    }
+    else {
+        size = encodeRewindDelta(image, rb->keyFrameImage, rb->imageSize, rb->compressedImage);
+    }
+    rb->framesUntilKeyFrame--;
+    *outIsKeyFrame = isKeyFrame;
+    return size;
+}
+
+static void rewindWorker(void *arg) {
+    auto rb = (RewindBuffer*)arg;
+    lockMutex(rb->mutex);
+    for (;;) {
+        while (rb->numPendingImages == 0 && !rb->shouldWorkerExit) {
+            waitForCondition(rb->workAvailable, rb->mutex);
+        }
+        if (rb->numPendingImages == 0) {
+            break;
+        }
+        //the slot stays counted as pending until it has been compressed, so it won't be overwritten
+        u8 *image = rb->pendingImages[rb->firstPendingImage];
+        unlockMutex(rb->mutex);
+
+        bool isKeyFrame;
+        i64 size = compressRewindImage(image, &isKeyFrame, rb);
+
+        lockMutex(rb->mutex);
+        addCompressedRewindFrame(size, isKeyFrame, rb);
+        rb->firstPendingImage = (rb->firstPendingImage + 1) % REWIND_MAX_PENDING_FRAMES;
+        rb->numPendingImages--;
+        broadcastCondition(rb->workAvailable);
+    }
+    unlockMutex(rb->mutex);
+}
+
+bool initRewindBuffer(i64 budget, i64 cartRAMSize, RewindBuffer *rb) {
+    *rb = {};
+    rb->imageSize = REWIND_CART_RAM_OFFSET + cartRAMSize;
+    rb->dataSize = budget;
+    rb->data = CO_MALLOC(budget, u8);
+    rb->frames = CO_MALLOC(REWIND_MAX_FRAMES, RewindFrame);
+    foriarr (rb->pendingImages) {
+        rb->pendingImages[i] = CO_MALLOC(rb->imageSize, u8);
+    }
+    rb->keyFrameImage = CO_MALLOC(rb->imageSize, u8);
+    rb->compressedImage = CO_MALLOC(maxCompressedRewindImageSize(rb->imageSize), u8);
+    rb->restoredImage = CO_MALLOC(rb->imageSize, u8);
+    rb->cachedKeyFrameImage = CO_MALLOC(rb->imageSize, u8);
+    rb->cachedKeyFrameSerial = -1;
+
+    if (!rb->data || !rb->frames || !rb->keyFrameImage || !rb->compressedImage ||
+        !rb->restoredImage || !rb->cachedKeyFrameImage) {
+        freeRewindBuffer(rb);
+        return false;
+    }
+    foriarr (rb->pendingImages) {
+        if (!rb->pendingImages[i]) {
+            freeRewindBuffer(rb);
+            return false;
+        }
+    }
+    return true;
+}
+
+void freeRewindBuffer(RewindBuffer *rb) {
+    stopRewindWorker(rb);
+    CO_FREE(rb->data);
+    CO_FREE(rb->frames);
+    foriarr (rb->pendingImages) {
+        CO_FREE(rb->pendingImages[i]);
+    }
+    CO_FREE(rb->keyFrameImage);
+    CO_FREE(rb->compressedImage);
+    CO_FREE(rb->restoredImage);
+    CO_FREE(rb->cachedKeyFrameImage);
+    *rb = {};
+}
+
+//Started by the platform layer, not the emulator, since the emulator code can be reloaded out from under it
+void startRewindWorker(RewindBuffer *rb) {
+    if (!rb->data || rb->worker) {
+        return;
+    }
+    rb->mutex = createMutex();
+    rb->workAvailable = createWaitCondition();
+    rb->shouldWorkerExit = false;
+    rb->worker = startThread(rewindWorker, rb);
+}
+
+void stopRewindWorker(RewindBuffer *rb) {
+    if (!rb->worker) {
+        return;
+    }
+    lockMutex(rb->mutex);
+    rb->shouldWorkerExit = true;
+    broadcastCondition(rb->workAvailable);
+    unlockMutex(rb->mutex);
+    waitForAndFreeThread(rb->worker);
+
+    destroyWaitCondition(rb->workAvailable);
+    destroyMutex(rb->mutex);
+    rb->worker = nullptr;
+    rb->workAvailable = nullptr;
+    rb->mutex = nullptr;
+}
+
+//waits for the worker to finish compressing and keeps it from starting again until unlocked
+static void lockRewindBuffer(RewindBuffer *rb) {
+    if (rb->worker) {
+        lockMutex(rb->mutex);
+        while (rb->numPendingImages > 0) {
+            waitForCondition(rb->workAvailable, rb->mutex);
+        }
+    }
+}
+
+static void unlockRewindBuffer(RewindBuffer *rb) {
+    if (rb->worker) {
+        unlockMutex(rb->mutex);
+    }
+}
+
+void clearRewindBuffer(RewindBuffer *rb) {
+    lockRewindBuffer(rb);
+    rb->oldestFrame = 0;
+    rb->numFrames = 0;
+    rb->dataHead = 0;
+    rb->framesUntilKeyFrame = 0;
+    rb->cachedKeyFrameSerial = -1;
+    unlockRewindBuffer(rb);
+}
+
+void recordRewindFrame(const CPU *cpu, const MMU *mmu, RewindBuffer *rb) {
+    if (!rb->data) {
+        return;
+    }
+    i64 cartRAMSize = rb->imageSize - REWIND_CART_RAM_OFFSET;
+
+    u8 *image;
+    if (rb->worker) {
+        lockMutex(rb->mutex);
+        while (rb->numPendingImages == REWIND_MAX_PENDING_FRAMES) {
+            waitForCondition(rb->workAvailable, rb->mutex);
+        }
+        image = rb->pendingImages[(rb->firstPendingImage + rb->numPendingImages) % REWIND_MAX_PENDING_FRAMES];
+        unlockMutex(rb->mutex);
+    }
+    else {
+        image = rb->pendingImages[0];
+    }
+
+    copyMemory(cpu, image, sizeof(CPU));
+    copyMemory(mmu, image + sizeof(CPU), sizeof(MMU));
+    copyMemory(mmu->lcd.videoRAM, image + REWIND_MEMORY_OFFSET, VIDEO_RAM_SIZE);
+    copyMemory(mmu->workingRAM, image + REWIND_MEMORY_OFFSET + VIDEO_RAM_SIZE, WORKING_RAM_SIZE);
+    copyMemory(mmu->lcd.screen, image + REWIND_SCREEN_OFFSET, REWIND_CART_RAM_OFFSET - REWIND_SCREEN_OFFSET);
+    if (cartRAMSize > 0) {
+        copyMemory(mmu->cartRAM, image + REWIND_CART_RAM_OFFSET, cartRAMSize);
+    }
+
+    if (rb->worker) {
+        lockMutex(rb->mutex);
+        rb->numPendingImages++;
+        broadcastCondition(rb->workAvailable);
+        unlockMutex(rb->mutex);
+    }
+    else {
+        bool isKeyFrame;
+        i64 size = compressRewindImage(image, &isKeyFrame, rb);
+        addCompressedRewindFrame(size, isKeyFrame, rb);
+    }
+}
+
+//Restores the most recently recorded frame and drops it.  Returns false if there is nothing left
+bool rewindOneFrame(CPU *cpu, MMU *mmu, RewindBuffer *rb) {
+    if (!rb->data) {
+        return false;
+    }
+    lockRewindBuffer(rb);
+    if (rb->numFrames == 0) {
+        unlockRewindBuffer(rb);
+        return false;
+    }
+
+    RewindFrame *frame = rewindFrameAt(rb->numFrames - 1, rb);
+    bool didDecode;
+    if (frame->isKeyFrame) {
+        didDecode = decodeRewindDelta(rb->data + frame->offset, frame->size, nullptr, rb->imageSize, rb->restoredImage);
+    }
+    else {
+        didDecode = true;
+        if (rb->cachedKeyFrameSerial != frame->keyFrameSerial) {
+            RewindFrame *keyFrame = nullptr;
+            for (i64 age = rb->numFrames - 1; age >= 0; age--) {
+                keyFrame = rewindFrameAt(age, rb);
+                if (keyFrame->serial == frame->keyFrameSerial) {
+                    break;
+                }
+            }
+            CO_ASSERT(keyFrame && keyFrame->serial == frame->keyFrameSerial);
+            didDecode = decodeRewindDelta(rb->data + keyFrame->offset, keyFrame->size, nullptr, rb->imageSize, rb->cachedKeyFrameImage);
+            rb->cachedKeyFrameSerial = didDecode ? keyFrame->serial : -1;
+        }
+        didDecode = didDecode &&
+            decodeRewindDelta(rb->data + frame->offset, frame->size, rb->cachedKeyFrameImage, rb->imageSize, rb->restoredImage);
+    }
+    if (!didDecode) {
+        //nothing has been restored yet, so leave the game as it is and drop the history, which can't be trusted
+        CO_ERR("Rewind frame is corrupt. Clearing the rewind history");
+        rb->oldestFrame = 0;
+        rb->numFrames = 0;
+        rb->dataHead = 0;
+        rb->framesUntilKeyFrame = 0;
+        unlockRewindBuffer(rb);
+        return false;
+    }
+
+    rb->numFrames--;
+    rb->dataHead = (rb->numFrames > 0) ? frame->offset : 0;
+    //the key frame deltas are taken against may have just been dropped
+    rb->framesUntilKeyFrame = 0;
+    unlockRewindBuffer(rb);
+
+    //the memories, host data, screens and cart RAM are allocated apart from the MMU, so keep the live pointers
+    u8 *videoRAM = mmu->lcd.videoRAM;
+    u8 *workingRAM = mmu->workingRAM;
+    MMUHost *host = mmu->host;
+    PaletteColor *screen = mmu->lcd.screen;
+    PaletteColor *backBuffer = mmu->lcd.backBuffer;
+    u8 *cartRAM = mmu->cartRAM;
+
+    copyMemory(rb->restoredImage, cpu, sizeof(CPU));
+    copyMemory(rb->restoredImage + sizeof(CPU), mmu, sizeof(MMU));
+    mmu->lcd.videoRAM = videoRAM;
+    mmu->workingRAM = workingRAM;
+    mmu->host = host;
+    mmu->lcd.screen = screen;
+    mmu->lcd.backBuffer = backBuffer;
+    mmu->cartRAM = cartRAM;
+    copyMemory(rb->restoredImage + REWIND_MEMORY_OFFSET, mmu->lcd.videoRAM, VIDEO_RAM_SIZE);
+    copyMemory(rb->restoredImage + REWIND_MEMORY_OFFSET + VIDEO_RAM_SIZE, mmu->workingRAM, WORKING_RAM_SIZE);
+    copyMemory(rb->restoredImage + REWIND_SCREEN_OFFSET, mmu->lcd.screen, REWIND_CART_RAM_OFFSET - REWIND_SCREEN_OFFSET);
+
+    i64 cartRAMSize = rb->imageSize - REWIND_CART_RAM_OFFSET;
+    if (cartRAMSize > 0) {
+        const u8 *restoredCartRAM = rb->restoredImage + REWIND_CART_RAM_OFFSET;
+        copyMemory(restoredCartRAM, mmu->cartRAM, cartRAMSize);
+        if (mmu->host->cartRAMPlatformState.cartRAMFileMap) {
+            copyMemory(restoredCartRAM, mmu->host->cartRAMPlatformState.cartRAMFileMap, cartRAMSize);
+        }
+    }
+    if (mmu->hasRTC) {
+        syncRTCTime(mmu);
+    }
+
+    return true;
+}
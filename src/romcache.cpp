@@ -0,0 +1,140 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Shared ROMs.  See SharedROM in gbemu.h.
+//
+//Nothing in the emulator writes to ROM, so one copy can be read by any number of Game Boys on any number of
+//threads.  Its checksums and header are checked once, when it's loaded, instead of by every instance.
+
+#include "gbemu.h"
+
+const char *romLoadResultToStr(ROMLoadResult result) {
+    switch (result) {
+        case ROMLoadResult::Success: return "Success.";
+        case ROMLoadResult::TooSmall: return "Not a Game Boy ROM. File is too small.";
+        case ROMLoadResult::BadHeaderChecksum: return "Not a Game Boy ROM. Checksum does not match.";
+        case ROMLoadResult::BadGlobalChecksum: return "Not a Game Boy ROM. Global checksum does not match.";
+        case ROMLoadResult::UnsupportedMBC: return "The ROM uses an unsupported MBC.";
+    }
+    return "Unknown error.";
+}
+
+SharedROM *createSharedROM(const u8 *romData, i64 romSize, ROMLoadResult *outResult) {
+    CartridgeHeader header;
+    *outResult = readCartridgeHeader(romData, romSize, &header);
+    if (*outResult != ROMLoadResult::Success) {
+        return nullptr;
+    }
+    //plain calloc and malloc, since libgbemu passes running out of memory back to its caller
+    SharedROM *rom = (SharedROM*)calloc(1, sizeof(SharedROM));
+    u8 *data = (u8*)malloc((usize)romSize);
+    if (!rom || !data) {
+        CO_FREE(data);
+        CO_FREE(rom);
+        return nullptr;
+    }
+    copyMemory(romData, data, romSize);
+    rom->data = data;
+    rom->size = romSize;
+    rom->header = header;
+    rom->refCount = 1;
+    return rom;
+}
+
+static void freeSharedROM(SharedROM *rom) {
+    CO_FREE(rom->data);
+    CO_FREE(rom);
+}
+
+SharedROM *acquireSharedROM(const char *path, MemoryStack *fileMemory, ROMCache *cache, const char **outError) {
+    //held while reading, so instances started together on the same ROM wait for one read instead of each doing it
+    if (cache) {
+        lockMutex(cache->mutex);
+        for (isize i = 0; i < (isize)buf_len(cache->roms); i++) {
+            SharedROM *rom = cache->roms[i];
+            if (areStringsEqual(rom->path, path, MAX_PATH_LEN)) {
+                rom->refCount++;
+                unlockMutex(cache->mutex);
+                return rom;
+            }
+        }
+    }
+
+    SharedROM *rom = nullptr;
+    auto romResult = readEntireFile(path, fileMemory);
+    if (romResult.resultCode != FileSystemResultCode::OK) {
+        *outError = "Could not read the ROM.";
+    }
+    else {
+        ROMLoadResult result;
+        rom = createSharedROM(romResult.data, romResult.size, &result);
+        freeFileBuffer(&romResult, fileMemory);
+        if (!rom) {
+            *outError = (result == ROMLoadResult::Success) ? "Could not allocate memory." : romLoadResultToStr(result);
+        }
+        else if (cache) {
+            copyString(path, rom->path, MAX_PATH_LEN);
+            rom->cache = cache;
+            buf_malloc_push(cache->roms, rom);
+        }
+    }
+
+    if (cache) {
+        unlockMutex(cache->mutex);
+    }
+    return rom;
+}
+
+void retainSharedROM(SharedROM *rom) {
+    if (rom->cache) {
+        lockMutex(rom->cache->mutex);
+        rom->refCount++;
+        unlockMutex(rom->cache->mutex);
+    }
+    else {
+        __atomic_add_fetch(&rom->refCount, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void releaseSharedROM(SharedROM *rom) {
+    if (!rom) {
+        return;
+    }
+    ROMCache *cache = rom->cache;
+    if (!cache) {
+        if (__atomic_sub_fetch(&rom->refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+            freeSharedROM(rom);
+        }
+        return;
+    }
+
+    //taken out under the lock, so it can't be handed out again as it's freed
+    lockMutex(cache->mutex);
+    rom->refCount--;
+    if (rom->refCount == 0) {
+        isize last = (isize)buf_len(cache->roms) - 1;
+        for (isize i = 0; i <= last; i++) {
+            if (cache->roms[i] == rom) {
+                cache->roms[i] = cache->roms[last];
+                buf__hdr(cache->roms)->len--;
+                break;
+            }
+        }
+        freeSharedROM(rom);
+    }
+    unlockMutex(cache->mutex);
+}
+
+bool initROMCache(ROMCache *cache) {
+    *cache = {};
+    cache->mutex = createMutex();
+    return cache->mutex != nullptr;
+}
+
+void freeROMCache(ROMCache *cache) {
+    CO_ASSERT_MSG(buf_len(cache->roms) == 0, "ROMs are still held");
+    buf_malloc_free(cache->roms);
+    if (cache->mutex) {
+        destroyMutex(cache->mutex);
+    }
+    *cache = {};
+}
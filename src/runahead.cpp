@@ -0,0 +1,141 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Run-ahead.  See RunAhead in gbemu.h.
+//
+//This half is owned by the platform layer: the SecondInstance copy of the Game Boy and the worker
+//that runs it.  The look-ahead itself is done by the emulator, next to runFrame() in gbemu.cpp.
+
+#include "gbemu.h"
+#include "debugger.h"
+
+static void runAheadWorker(void *arg) {
+    auto runAhead = (RunAhead*)arg;
+    lockMutex(runAhead->mutex);
+    for (;;) {
+        while (!runAhead->isWorkQueued && !runAhead->shouldWorkerExit) {
+            waitForCondition(runAhead->workAvailable, runAhead->mutex);
+        }
+        if (!runAhead->isWorkQueued) {
+            break;
+        }
+        unlockMutex(runAhead->mutex);
+
+        runAhead->lookAhead(runAhead);
+
+        lockMutex(runAhead->mutex);
+        runAhead->isWorkQueued = false;
+        broadcastCondition(runAhead->workAvailable);
+    }
+    unlockMutex(runAhead->mutex);
+}
+
+bool initRunAhead(i32 numFrames, RunAheadMode mode, const MMU *mmu, RunAhead *runAhead) {
+    *runAhead = {};
+    runAhead->numFrames = (numFrames > MAX_RUN_AHEAD_FRAMES) ? MAX_RUN_AHEAD_FRAMES : numFrames;
+    runAhead->mode = mode;
+    if (runAhead->numFrames <= 0 || mode != RunAheadMode::SecondInstance) {
+        return true;
+    }
+
+    runAhead->cpu = CO_CALLOC(1, CPU);
+    runAhead->mmu = CO_MALLOC(1, MMU);
+    runAhead->memory = CO_MALLOC(1, GameBoyMemory);
+    runAhead->host = CO_CALLOC(1, MMUHost);
+    runAhead->gbDebug = CO_CALLOC(1, GameBoyDebug);
+    runAhead->screens = CO_CALLOC(2 * SCREEN_WIDTH * SCREEN_HEIGHT, PaletteColor);
+    if (mmu->cartRAMSize > 0) {
+        runAhead->cartRAM = CO_CALLOC(cartRAMAllocationSize(mmu), u8);
+        runAhead->cartRAMFileMap = CO_CALLOC(mmu->cartRAMSize, u8);
+    }
+#ifdef CO_PROFILE
+    runAhead->profileState = CO_MALLOC(1, ProfileState);
+#endif
+    if (!runAhead->cpu || !runAhead->mmu || !runAhead->memory || !runAhead->host ||
+        !runAhead->gbDebug || !runAhead->screens ||
+        (mmu->cartRAMSize > 0 && (!runAhead->cartRAM || !runAhead->cartRAMFileMap))) {
+        freeRunAhead(runAhead);
+        return false;
+    }
+#ifdef CO_PROFILE
+    if (!runAhead->profileState) {
+        freeRunAhead(runAhead);
+        return false;
+    }
+    profileInit(runAhead->profileState);
+#endif
+
+    //everything else comes from the snapshot each frame
+    MMU *copy = runAhead->mmu;
+    *copy = *mmu;
+    attachMMU(runAhead->memory, runAhead->host, copy);
+    copy->cartRAM = runAhead->cartRAM;
+    copy->lcd.screen = runAhead->screens;
+    copy->lcd.backBuffer = runAhead->screens + SCREEN_WIDTH * SCREEN_HEIGHT;
+    //the sound buffer and serial output have a length of 0, which drops everything
+    MMUHost *host = runAhead->host;
+    host->romName = mmu->host->romName;
+    host->romNameLen = mmu->host->romNameLen;
+    host->cartRAMPlatformState.cartRAMFileMap = runAhead->cartRAMFileMap;
+    host->cartRAMPlatformState.ramLen = (usize)mmu->cartRAMSize;
+    host->cartRAMPlatformState.rtcFileMap = &runAhead->rtcFileState;
+
+    return true;
+}
+
+void freeRunAhead(RunAhead *runAhead) {
+    stopRunAheadWorker(runAhead);
+    CO_FREE(runAhead->snapshot.data);
+    CO_FREE(runAhead->cpu);
+    CO_FREE(runAhead->mmu);
+    CO_FREE(runAhead->memory);
+    CO_FREE(runAhead->host);
+    CO_FREE(runAhead->gbDebug);
+    CO_FREE(runAhead->screens);
+    CO_FREE(runAhead->cartRAM);
+    CO_FREE(runAhead->cartRAMFileMap);
+#ifdef CO_PROFILE
+    CO_FREE(runAhead->profileState);
+#endif
+    *runAhead = {};
+}
+
+//Started by the platform layer, not the emulator, since the emulator code can be reloaded out from under it
+void startRunAheadWorker(RunAhead *runAhead) {
+    if (!runAhead->cpu || runAhead->worker) {
+        return;
+    }
+    runAhead->mutex = createMutex();
+    runAhead->workAvailable = createWaitCondition();
+    runAhead->shouldWorkerExit = false;
+    runAhead->worker = startThread(runAheadWorker, runAhead);
+}
+
+void stopRunAheadWorker(RunAhead *runAhead) {
+    if (!runAhead->worker) {
+        return;
+    }
+    lockMutex(runAhead->mutex);
+    runAhead->shouldWorkerExit = true;
+    broadcastCondition(runAhead->workAvailable);
+    unlockMutex(runAhead->mutex);
+    waitForAndFreeThread(runAhead->worker);
+
+    destroyWaitCondition(runAhead->workAvailable);
+    destroyMutex(runAhead->mutex);
+    runAhead->worker = nullptr;
+    runAhead->workAvailable = nullptr;
+    runAhead->mutex = nullptr;
+}
+
+const PaletteColor *finishRunAhead(const MMU *mmu, RunAhead *runAhead) {
+    if (runAhead->worker) {
+        profileStart("Wait for run-ahead", profileState);
+        lockMutex(runAhead->mutex);
+        while (runAhead->isWorkQueued) {
+            waitForCondition(runAhead->workAvailable, runAhead->mutex);
+        }
+        unlockMutex(runAhead->mutex);
+        profileEnd(profileState);
+    }
+    return runAhead->hasScreen ? runAhead->mmu->lcd.screen : mmu->lcd.screen;
+}
@@ -0,0 +1,292 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Background save state writer.  See SaveStateWriter in gbemu.h.
+
+#include "gbemu.h"
+
+//false if it doesn't fit in MAX_PATH_LEN.  Cut short, it could name the live slot
+static bool saveStateBackupPath(const char *path, int backup, char *outPath) {
+    int len = snprintf(outPath, MAX_PATH_LEN + 1, "%s.backup%d", path, backup);
+    return len >= 0 && len <= MAX_PATH_LEN;
+}
+
+//The live slot is only ever replaced by a rename, so a crash at any point leaves either the old or the new state in it
+static FileSystemResultCode writeSaveStateFile(const SaveStateWriteJob *job) {
+    char tmpPath[MAX_PATH_LEN + 1];
+    int tmpPathLen = snprintf(tmpPath, ARRAY_LEN(tmpPath), "%s.tmp", job->path);
+    if (tmpPathLen < 0 || tmpPathLen > MAX_PATH_LEN) {
+        CO_ERR("Save state path is too long: %s", job->path);
+        return FileSystemResultCode::Unknown;
+    }
+    //the longest backup path, checked before anything is moved
+    char newerPath[MAX_PATH_LEN + 1], olderPath[MAX_PATH_LEN + 1];
+    if (!saveStateBackupPath(job->path, SAVE_STATE_NUM_BACKUPS, olderPath)) {
+        CO_ERR("Save state path is too long: %s", job->path);
+        return FileSystemResultCode::Unknown;
+    }
+    auto res = writeDataToFile(job->data, job->size, tmpPath, true);
+    if (res != FileSystemResultCode::OK) {
+        remove(tmpPath);
+        return res;
+    }
+
+    //oldest first, so nothing is overwritten until it has been moved along.  Missing backups are fine
+    for (int backup = SAVE_STATE_NUM_BACKUPS - 1; backup >= 1; backup--) {
+        if (saveStateBackupPath(job->path, backup, newerPath) && saveStateBackupPath(job->path, backup + 1, olderPath)) {
+            renameFile(newerPath, olderPath);
+        }
+    }
+    //the first backup is a second name for the live slot, which stays in place until the rename below.
+    //There is no slot file on the first save.  Losing a backup isn't worth failing the save over
+    if (saveStateBackupPath(job->path, 1, newerPath)) {
+        remove(newerPath);
+        linkFile(job->path, newerPath);
+    }
+
+    res = renameFile(tmpPath, job->path);
+    if (res != FileSystemResultCode::OK) {
+        remove(tmpPath);
+        return res;
+    }
+
+    //the renames aren't durable until the directory is synced
+    const char *lastSeparator = strrchr(job->path, FILE_SEPARATOR[0]);
+    if (!lastSeparator) {
+        return syncDirectory(".");
+    }
+    char directory[MAX_PATH_LEN + 1];
+    i64 directoryLen = (lastSeparator == job->path) ? 1 : lastSeparator - job->path;
+    copyMemory(job->path, directory, directoryLen);
+    directory[directoryLen] = '\0';
+    return syncDirectory(directory);
+}
+
+//expects the mutex to be held if there is a worker
+static void updateSaveSlotIndex(const SaveStateWriteJob *job, SaveStateWriter *writer) {
+    SaveSlotIndexFile *file = writer->slotIndex.file;
+    if (file) {
+        file->entries[job->slot] = job->indexEntry;
+    }
+}
+
+//expects the mutex to be held if there is a worker
+static void pushSaveStateWriteResult(int slot, FileSystemResultCode resultCode, SaveStateWriter *writer) {
+    if (writer->numResults == SAVE_STATE_MAX_WRITE_RESULTS) {
+        //nobody is reading them, so drop the oldest
+        writer->firstResult = (writer->firstResult + 1) % SAVE_STATE_MAX_WRITE_RESULTS;
+        writer->numResults--;
+    }
+    SaveStateWriteResult *result = &writer->results[(writer->firstResult + writer->numResults) % SAVE_STATE_MAX_WRITE_RESULTS];
+    result->slot = slot;
+    result->resultCode = resultCode;
+    writer->numResults++;
+}
+
+static void saveStateWriterWorker(void *arg) {
+    auto writer = (SaveStateWriter*)arg;
+    lockMutex(writer->mutex);
+    for (;;) {
+        while (writer->numJobs == 0 && !writer->shouldWorkerExit) {
+            waitForCondition(writer->workAvailable, writer->mutex);
+        }
+        //everything queued is written before exiting
+        if (writer->numJobs == 0) {
+            break;
+        }
+        SaveStateWriteJob job = writer->jobs[writer->firstJob];
+        writer->firstJob = (writer->firstJob + 1) % NUM_SAVE_SLOTS;
+        writer->numJobs--;
+        writer->isWriting = true;
+        unlockMutex(writer->mutex);
+
+        auto res = writeSaveStateFile(&job);
+        CO_FREE(job.data);
+
+        lockMutex(writer->mutex);
+        writer->isWriting = false;
+        if (res == FileSystemResultCode::OK) {
+            updateSaveSlotIndex(&job, writer);
+        }
+        pushSaveStateWriteResult(job.slot, res, writer);
+        broadcastCondition(writer->workAvailable);
+    }
+    unlockMutex(writer->mutex);
+}
+
+//Started by the platform layer, not the emulator, since the emulator code can be reloaded out from under it
+void startSaveStateWriter(SaveStateWriter *writer) {
+    if (writer->worker) {
+        return;
+    }
+    writer->mutex = createMutex();
+    writer->workAvailable = createWaitCondition();
+    writer->shouldWorkerExit = false;
+    writer->worker = startThread(saveStateWriterWorker, writer);
+}
+
+void stopSaveStateWriter(SaveStateWriter *writer) {
+    if (!writer->worker) {
+        return;
+    }
+    lockMutex(writer->mutex);
+    writer->shouldWorkerExit = true;
+    broadcastCondition(writer->workAvailable);
+    unlockMutex(writer->mutex);
+    waitForAndFreeThread(writer->worker);
+
+    destroyWaitCondition(writer->workAvailable);
+    destroyMutex(writer->mutex);
+    writer->worker = nullptr;
+    writer->workAvailable = nullptr;
+    writer->mutex = nullptr;
+}
+
+void queueSaveStateWrite(u8 *data, i64 size, int slot, const char *path, const SaveSlotIndexEntry *indexEntry, SaveStateWriter *writer) {
+    CO_ASSERT(slot >= 0 && slot < NUM_SAVE_SLOTS);
+    SaveStateWriteJob newJob = {};
+    newJob.data = data;
+    newJob.size = size;
+    newJob.slot = slot;
+    copyString(path, newJob.path, MAX_PATH_LEN);
+    newJob.indexEntry = *indexEntry;
+
+    if (!writer->worker) {
+        auto res = writeSaveStateFile(&newJob);
+        CO_FREE(data);
+        if (res == FileSystemResultCode::OK) {
+            updateSaveSlotIndex(&newJob, writer);
+        }
+        pushSaveStateWriteResult(slot, res, writer);
+        return;
+    }
+
+    lockMutex(writer->mutex);
+    SaveStateWriteJob *job = nullptr;
+    fori (writer->numJobs) {
+        SaveStateWriteJob *queuedJob = &writer->jobs[(writer->firstJob + i) % NUM_SAVE_SLOTS];
+        if (queuedJob->slot == slot) {
+            //hasn't been written yet, so just write the newer state in its place
+            CO_FREE(queuedJob->data);
+            job = queuedJob;
+            break;
+        }
+    }
+    if (!job) {
+        CO_ASSERT(writer->numJobs < NUM_SAVE_SLOTS);
+        job = &writer->jobs[(writer->firstJob + writer->numJobs) % NUM_SAVE_SLOTS];
+        writer->numJobs++;
+    }
+    *job = newJob;
+    broadcastCondition(writer->workAvailable);
+    unlockMutex(writer->mutex);
+}
+
+void flushSaveStateWriter(SaveStateWriter *writer) {
+    if (!writer->worker) {
+        return;
+    }
+    lockMutex(writer->mutex);
+    while (writer->numJobs > 0 || writer->isWriting) {
+        waitForCondition(writer->workAvailable, writer->mutex);
+    }
+    unlockMutex(writer->mutex);
+}
+
+bool popSaveStateWriteResult(SaveStateWriter *writer, SaveStateWriteResult *outResult) {
+    bool ret = false;
+    if (writer->worker) {
+        lockMutex(writer->mutex);
+    }
+    if (writer->numResults > 0) {
+        *outResult = writer->results[writer->firstResult];
+        writer->firstResult = (writer->firstResult + 1) % SAVE_STATE_MAX_WRITE_RESULTS;
+        writer->numResults--;
+        ret = true;
+    }
+    if (writer->worker) {
+        unlockMutex(writer->mutex);
+    }
+    return ret;
+}
+
+static bool isSaveSlotIndexValid(const u8 *data, usize len) {
+    if (len != sizeof(SaveSlotIndexFile)) {
+        return false;
+    }
+    auto file = (const SaveSlotIndexFile*)data;
+    return file->magic == SAVE_SLOT_INDEX_MAGIC && file->version == SAVE_SLOT_INDEX_VERSION;
+}
+
+bool openSaveSlotIndex(const char *path, SaveStateWriter *writer) {
+    //nothing may be written into the old index while it is swapped out
+    flushSaveStateWriter(writer);
+    closeSaveSlotIndex(writer);
+
+    u8 *data = nullptr;
+    usize len = 0;
+    MemoryMappedFileHandle *handle = mapFileToMemory(path, &data, &len);
+    if (!handle || !isSaveSlotIndexValid(data, len)) {
+        //the index only describes the save states, so start over rather than fail if it is unreadable
+        closeMemoryMappedFile(handle);
+        SaveSlotIndexFile *emptyFile = CO_MALLOC(1, SaveSlotIndexFile);
+        if (!emptyFile) {
+            return false;
+        }
+        zeroMemory(emptyFile, sizeof(SaveSlotIndexFile));
+        emptyFile->magic = SAVE_SLOT_INDEX_MAGIC;
+        emptyFile->version = SAVE_SLOT_INDEX_VERSION;
+        auto res = writeDataToFile(emptyFile, sizeof(SaveSlotIndexFile), path);
+        CO_FREE(emptyFile);
+        if (res != FileSystemResultCode::OK) {
+            CO_ERR("Could not create save slot index: %s", path);
+            return false;
+        }
+
+        handle = mapFileToMemory(path, &data, &len);
+        if (!handle || !isSaveSlotIndexValid(data, len)) {
+            CO_ERR("Could not open save slot index: %s", path);
+            closeMemoryMappedFile(handle);
+            return false;
+        }
+    }
+
+    if (writer->worker) {
+        lockMutex(writer->mutex);
+    }
+    writer->slotIndex.handle = handle;
+    writer->slotIndex.file = (SaveSlotIndexFile*)data;
+    if (writer->worker) {
+        unlockMutex(writer->mutex);
+    }
+    return true;
+}
+
+void closeSaveSlotIndex(SaveStateWriter *writer) {
+    if (writer->worker) {
+        lockMutex(writer->mutex);
+    }
+    MemoryMappedFileHandle *handle = writer->slotIndex.handle;
+    writer->slotIndex.handle = nullptr;
+    writer->slotIndex.file = nullptr;
+    if (writer->worker) {
+        unlockMutex(writer->mutex);
+    }
+    closeMemoryMappedFile(handle);
+}
+
+bool getSaveSlotIndexEntry(int slot, SaveStateWriter *writer, SaveSlotIndexEntry *outEntry) {
+    CO_ASSERT(slot >= 0 && slot < NUM_SAVE_SLOTS);
+    bool ret = false;
+    if (writer->worker) {
+        lockMutex(writer->mutex);
+    }
+    SaveSlotIndexFile *file = writer->slotIndex.file;
+    if (file && file->entries[slot].isUsed) {
+        *outEntry = file->entries[slot];
+        ret = true;
+    }
+    if (writer->worker) {
+        unlockMutex(writer->mutex);
+    }
+    return ret;
+}
@@ -15,6 +15,10 @@
 #define GB_IMPL
 #ifdef CO_DEBUG
 #   include "gbemu.h"
+//the rewind, save state and run-ahead worker threads are owned here, since gbemu.so can be reloaded
+#   include "rewind.cpp"
+#   include "savewriter.cpp"
+#   include "runahead.cpp"
 #else
 #   include "gbemu.cpp"
 #endif
@@ -35,6 +39,8 @@
 
 #define RUN_BOOT_SCREEN_FLAG "-b" //unused for now
 #define DEBUG_ON_BOOT_FLAG "-d"
+#define RECORD_MOVIE_FLAG "-r"
+#define PLAY_MOVIE_FLAG "-p"
 
 #define DEFAULT_GBEMU_HOME_PATH "gbemu_home"
 #define HOME_PATH_ENV_VARIABLE "GBEMU_HOME"
@@ -52,6 +58,7 @@
 
 #define AUDIO_SAMPLE_RATE 44100   
 #define MAX_AUDIO_SAMPLES_TO_QUEUE 4410 //100 ms
+#define UNCAPPED_TURBO_PRESENT_INTERVAL_US 16667 //60 Hz
 
 #define DEBUG_WINDOW_MIN_HEIGHT 800
 #define DEBUG_WINDOW_MIN_WIDTH 800
@@ -179,7 +186,9 @@ static const char *actionToString[(int)Input::Action::NumActions] = {
     [(int)Input::Action::Reset] = "Reset Emulator",  
     [(int)Input::Action::ShowDebugger] = "Show Debugger",  
     [(int)Input::Action::FullScreen] = "Make Full Screen",  
-    [(int)Input::Action::ShowControls] = "Show This Message"  
+    [(int)Input::Action::ShowControls] = "Show This Message",
+    [(int)Input::Action::Turbo] = "Turbo While Held",
+    [(int)Input::Action::ToggleTurbo] = "Toggle Turbo"
 };
 
 bool openFileDialogAtPath(const char *path, char *outPath);
@@ -192,11 +201,17 @@ void alertDialogSDL(const char *message) {
 typedef void RunFrameFn(CPU *, MMU *, GameBoyDebug *, ProgramState *, TimeUS);
 typedef void ResetFn(CPU *cpu, MMU *, GameBoyDebug *, ProgramState *);
 typedef void SetPlatformContextFn(MemoryContext *, AlertDialogFn *);
+typedef bool StartMovieRecordingFn(const char *, bool, CPU *, MMU *, GameBoyDebug *, ProgramState *);
+typedef bool StartMoviePlaybackFn(const char *, CPU *, MMU *, GameBoyDebug *, ProgramState *);
+typedef FileSystemResultCode StopMovieFn(CPU *, MMU *, GameBoyDebug *, ProgramState *);
 struct GBEmuCode {
     void *handle;
     RunFrameFn *runFrame;
     ResetFn *reset;
     SetPlatformContextFn *setPlatformContext;
+    StartMovieRecordingFn *startMovieRecording;
+    StartMoviePlaybackFn *startMoviePlayback;
+    StopMovieFn *stopMovie;
     time_t timeLastModified;
 };
 
@@ -215,6 +230,13 @@ GBEmuCode loadGBEmuCode(const char *gbemuCodePath) {
     ret.setPlatformContext = (SetPlatformContextFn*) SDL_LoadFunction(ret.handle, "setPlatformContext");
     CO_ASSERT(ret.setPlatformContext);
 
+    ret.startMovieRecording = (StartMovieRecordingFn*) SDL_LoadFunction(ret.handle, "startMovieRecording");
+    CO_ASSERT(ret.startMovieRecording);
+    ret.startMoviePlayback = (StartMoviePlaybackFn*) SDL_LoadFunction(ret.handle, "startMoviePlayback");
+    CO_ASSERT(ret.startMoviePlayback);
+    ret.stopMovie = (StopMovieFn*) SDL_LoadFunction(ret.handle, "stopMovie");
+    CO_ASSERT(ret.stopMovie);
+
     struct stat fileStats;
     stat(gbemuCodePath, &fileStats);
 
@@ -683,6 +705,10 @@ static void showInputMapDialog(SDL_Window *mainWindow,
 }
 static bool doConfigFileParsing(const char *configFilePath, ProgramState *programState) {
 
+    //older config files won't have these
+    programState->turbo.speed = DEFAULT_TURBO_SPEED;
+    programState->turbo.sound = TurboSound::Compressed;
+
     auto result = parseConfigFile(configFilePath); 
     bool isNewConfig = false;
     switch (result.fsResultCode) {
@@ -710,6 +736,7 @@ static bool doConfigFileParsing(const char *configFilePath, ProgramState *progra
             "B = Key %s, Gamepad B" ENDL
             ENDL
             "Rewind = Key Left, Gamepad LeftBumper" ENDL
+            "Turbo = Key Tab, Gamepad RightBumper" ENDL
             "DebuggerStep = Key %s" ENDL
             "DebuggerContinue = Key %s" ENDL
             ENDL
@@ -720,9 +747,20 @@ static bool doConfigFileParsing(const char *configFilePath, ProgramState *progra
             "FullScreen = Key " CTRL "%s" ENDL
             "ShowHomePath = Key %s" ENDL
             "ShowControls = Key " CTRL "%s" ENDL
+            "ToggleTurbo = Key " CTRL "%s" ENDL
             ENDL
             "//Misc" ENDL
-            "ScreenScale = 4";
+            "ScreenScale = 4" ENDL
+            "//Memory for rewinding, in MB" ENDL
+            "RewindBufferSize = 64" ENDL
+            "//Frames to run ahead of the game to hide its input lag, up to 4.  Each costs a frame of emulation" ENDL
+            "RunAhead = 0" ENDL
+            "//1 to run ahead on a second core" ENDL
+            "RunAheadOnSecondCore = 0" ENDL
+            "//Times normal speed for turbo, up to 64.  0 runs as fast as possible" ENDL
+            "TurboSpeed = 4" ENDL
+            "//1 to hear turbo's sound sped up at its normal pitch, 0 to skip it" ENDL
+            "TurboSound = 1";
         char *fileContents = nullptr;
         buf_gen_memory_printf(fileContents, defaultConfigFileContents, 
                               utf8CharFromScancode(SDL_SCANCODE_W, 'w').string,
@@ -740,7 +778,8 @@ static bool doConfigFileParsing(const char *configFilePath, ProgramState *progra
                               utf8CharFromScancode(SDL_SCANCODE_B, 'b').string,
                               utf8CharFromScancode(SDL_SCANCODE_F, 'f').string,
                               utf8CharFromScancode(SDL_SCANCODE_H, 'h').string,
-                              utf8CharFromScancode(SDL_SCANCODE_N, 'n').string);
+                              utf8CharFromScancode(SDL_SCANCODE_N, 'n').string,
+                              utf8CharFromScancode(SDL_SCANCODE_T, 't').string);
                                                      
         auto writeResult = writeDataToFile(fileContents, (isize)strlen(fileContents), configFilePath);
         switch (writeResult) {
@@ -837,6 +876,8 @@ static bool doConfigFileParsing(const char *configFilePath, ProgramState *progra
         CASE_MAPPING(Reset);
         CASE_MAPPING(FullScreen);
         CASE_MAPPING(ShowControls);
+        CASE_MAPPING(Turbo);
+        CASE_MAPPING(ToggleTurbo);
         case ConfigKeyType::ScreenScale: {
            if (cp->numValues != 1) {
                ALERT_EXIT("ScreenScale config option must only take one value.");
@@ -867,6 +908,70 @@ static bool doConfigFileParsing(const char *configFilePath, ProgramState *progra
            } break;
            }
         } break;
+        case ConfigKeyType::RewindBufferSize: {
+           ConfigValue *value = cp->values;
+           if (cp->numValues != 1 || value->type != ConfigValueType::Integer || value->intValue <= 0) {
+               char *configKeyString = PUSHMCLR(cp->key.textFromFile.len + 1, char);
+               AutoMemory am(configKeyString);
+               copyMemory(cp->key.textFromFile.data, configKeyString, cp->key.textFromFile.len);
+               ALERT_EXIT("'%s' at line: %d, column %d in %s must be bound to a number of MB greater than 0.", 
+                          configKeyString, cp->key.line, cp->key.posInLine, GBEMU_CONFIG_FILENAME);
+               return false;
+           }
+           programState->rewindBufferSizeMB = value->intValue;
+        } break;
+        case ConfigKeyType::RunAhead: {
+           ConfigValue *value = cp->values;
+           if (cp->numValues != 1 || value->type != ConfigValueType::Integer ||
+               value->intValue < 0 || value->intValue > MAX_RUN_AHEAD_FRAMES) {
+               char *configKeyString = PUSHMCLR(cp->key.textFromFile.len + 1, char);
+               AutoMemory am(configKeyString);
+               copyMemory(cp->key.textFromFile.data, configKeyString, cp->key.textFromFile.len);
+               ALERT_EXIT("'%s' at line: %d, column %d in %s must be bound to a number of frames from 0 to %d.", 
+                          configKeyString, cp->key.line, cp->key.posInLine, GBEMU_CONFIG_FILENAME, MAX_RUN_AHEAD_FRAMES);
+               return false;
+           }
+           programState->runAheadFrames = value->intValue;
+        } break;
+        case ConfigKeyType::RunAheadOnSecondCore: {
+           ConfigValue *value = cp->values;
+           if (cp->numValues != 1 || value->type != ConfigValueType::Integer ||
+               (value->intValue != 0 && value->intValue != 1)) {
+               char *configKeyString = PUSHMCLR(cp->key.textFromFile.len + 1, char);
+               AutoMemory am(configKeyString);
+               copyMemory(cp->key.textFromFile.data, configKeyString, cp->key.textFromFile.len);
+               ALERT_EXIT("'%s' at line: %d, column %d in %s must be bound to 0 or 1.", 
+                          configKeyString, cp->key.line, cp->key.posInLine, GBEMU_CONFIG_FILENAME);
+               return false;
+           }
+           programState->isRunAheadOnSecondCore = value->intValue == 1;
+        } break;
+        case ConfigKeyType::TurboSpeed: {
+           ConfigValue *value = cp->values;
+           if (cp->numValues != 1 || value->type != ConfigValueType::Integer ||
+               value->intValue < 0 || value->intValue > MAX_TURBO_SPEED) {
+               char *configKeyString = PUSHMCLR(cp->key.textFromFile.len + 1, char);
+               AutoMemory am(configKeyString);
+               copyMemory(cp->key.textFromFile.data, configKeyString, cp->key.textFromFile.len);
+               ALERT_EXIT("'%s' at line: %d, column %d in %s must be bound to a speed from 0 to %d.", 
+                          configKeyString, cp->key.line, cp->key.posInLine, GBEMU_CONFIG_FILENAME, MAX_TURBO_SPEED);
+               return false;
+           }
+           programState->turbo.speed = value->intValue;
+        } break;
+        case ConfigKeyType::TurboSound: {
+           ConfigValue *value = cp->values;
+           if (cp->numValues != 1 || value->type != ConfigValueType::Integer ||
+               (value->intValue != 0 && value->intValue != 1)) {
+               char *configKeyString = PUSHMCLR(cp->key.textFromFile.len + 1, char);
+               AutoMemory am(configKeyString);
+               copyMemory(cp->key.textFromFile.data, configKeyString, cp->key.textFromFile.len);
+               ALERT_EXIT("'%s' at line: %d, column %d in %s must be bound to 0 or 1.", 
+                          configKeyString, cp->key.line, cp->key.posInLine, GBEMU_CONFIG_FILENAME);
+               return false;
+           }
+           programState->turbo.sound = (value->intValue == 1) ? TurboSound::Compressed : TurboSound::Off;
+        } break;
         }
 #undef CASE_MAPPING
     }
@@ -876,6 +981,10 @@ static bool doConfigFileParsing(const char *configFilePath, ProgramState *progra
         ALERT("ScreenScale not found in %s.  Defaulting to a ScreenScale of %d.", GBEMU_CONFIG_FILENAME, DEFAULT_SCREEN_SCALE);
         programState->screenScale = DEFAULT_SCREEN_SCALE;
     }
+    if (programState->rewindBufferSizeMB <= 0) {
+        //older config files won't have it, so no need to alert
+        programState->rewindBufferSizeMB = DEFAULT_REWIND_BUFFER_SIZE_MB;
+    }
     
     freeParserResult(&result);
     
@@ -888,7 +997,8 @@ static bool doConfigFileParsing(const char *configFilePath, ProgramState *progra
 static void 
 mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformState,
          SDL_AudioDeviceID audioDeviceID, SDL_GameController **gamepad, const char *romFileName,
-         bool shouldEnableDebugMode, DebuggerPlatformContext *debuggerContext, SDL_Window **debuggerWindow, GameBoyDebug *gbDebug, ProgramState *programState) {
+         bool shouldEnableDebugMode, MovieMode movieMode, const char *movieFileName,
+         DebuggerPlatformContext *debuggerContext, SDL_Window **debuggerWindow, GameBoyDebug *gbDebug, ProgramState *programState) {
     char filePath[MAX_PATH_LEN];
     
 #define GAME_LIB_PATH "gbemu.so"
@@ -905,9 +1015,10 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
     CPU *cpu = PUSHMCLR(1, CPU);
 
     MMU *mmu = PUSHMCLR(1, MMU);
+    attachMMU(PUSHMCLR(1, GameBoyMemory), PUSHMCLR(1, MMUHost), mmu);
     
-    mmu->lcd.screen = mmu->lcd.screenStorage;
-    mmu->lcd.backBuffer = mmu->lcd.backBufferStorage;
+    mmu->lcd.screen = PUSHMCLR(SCREEN_WIDTH*SCREEN_HEIGHT, PaletteColor);
+    mmu->lcd.backBuffer = PUSHMCLR(SCREEN_WIDTH*SCREEN_HEIGHT, PaletteColor);
 
 
     gbDebug->isEnabled = shouldEnableDebugMode;
@@ -947,114 +1058,32 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
             return;
         } break;
         }
-        mmu->romData = fileResult.data;
-        mmu->romSize = fileResult.size;
-        if (mmu->romSize < 0x150) {
+        switch (loadROM(fileResult.data, fileResult.size, mmu)) {
+        case ROMLoadResult::Success: break;
+        case ROMLoadResult::TooSmall: {
             ALERT("This file is not a valid Game Boy ROM file. File is too small.");
             return;
-        }
-		{
-			u8 computedChecksum = 0;
-			for (int i = 0x134; i <= 0x14C; i++) {
-				computedChecksum -= mmu->romData[i] + 1;
-			}
-			if (computedChecksum != mmu->romData[0x14D]) {
-				ALERT("This file is not a valid Game Boy ROM file. Checksum does not match.");
-				return;
-			}
-		}
-		{
-			u16 computedChecksum = 0;
-            u16 globalChecksum = (u16)((mmu->romData[0x14E] << 8) | mmu->romData[0x14F]);
-			for (int i = 0; i < mmu->romSize ; i++) {
-                if (i == 0x14E || i == 0x14F) {
-                    continue;
-                }
-				computedChecksum += mmu->romData[i];
-			}
-			if (computedChecksum != globalChecksum) {
-				ALERT("This file is not a valid Game Boy ROM file. Global checksum does not match.");
-				return;
-			}
-		}
-        u8 mbcType = mmu->romData[0x147];
-
-        switch (mbcType) {
-
-        case 0: {
-            mmu->mbcType = MBCType::MBC0;
-        } break; 
-        case 1: {
-            mmu->mbcType = MBCType::MBC1;
-        } break; 
-        case 2 ... 3: {
-            mmu->mbcType = MBCType::MBC1;
-            mmu->hasRAM = true;
-            if (mbcType == 3) {
-                mmu->hasBattery = true;       
-            }
-        } break; 
-        case  8 ... 9: {
-            mmu->mbcType = MBCType::MBC0;
-            mmu->hasRAM = true;
         } break;
-        case 0xF ... 0x13: {
-            mmu->mbcType = MBCType::MBC3;
-            if (mbcType == 0xF || mbcType == 0x10) {
-                mmu->hasRTC = true;
-            }
-            if (mbcType == 0x10 || mbcType == 0x12 || mbcType == 0x13) {
-                mmu->hasRAM = true;
-            }
-            
-            if (mbcType == 0xF || mbcType == 0x10 || mbcType == 0x13) {
-                mmu->hasBattery = true;
-            }
+        case ROMLoadResult::BadHeaderChecksum: {
+            ALERT("This file is not a valid Game Boy ROM file. Checksum does not match.");
+            return;
         } break;
-        case 0x19 ... 0x1E: {
-            mmu->mbcType = MBCType::MBC5;
-            if (mbcType == 0x1A || mbcType == 0x1B || mbcType == 0x1D || mbcType == 0x1E) {
-                mmu->hasRAM = true;
-            }
-            
-            if (mbcType == 0x1B || mbcType == 0x1E) {
-                mmu->hasBattery = true;
-            }
-            
-            //TODO: rumble
-            
-            
+        case ROMLoadResult::BadGlobalChecksum: {
+            ALERT("This file is not a valid Game Boy ROM file. Global checksum does not match.");
+            return;
         } break;
-        default: {
+        case ROMLoadResult::UnsupportedMBC: {
             ALERT("This game is not yet supported.");   
-            //            ALERT("Cannot load game.\nReason: Unsupported MBC: 0x%X.\nHopefully it will be supported in the future.", mbcType);
             return;
         } break;
         }
-        
-        //RAM size
-        if (mmu->hasRAM) {
-            switch (mmu->romData[0x149]) {
-            case 0: mmu->cartRAMSize = 0; break;
-            case 1: mmu->cartRAMSize = KB(2); break;
-            case 2: mmu->cartRAMSize = KB(8); break;
-            case 3: mmu->cartRAMSize = KB(32); break;
-            case 4: mmu->cartRAMSize = KB(128); break;
-            case 5: mmu->cartRAMSize = KB(64); break;
-            }
-            mmu->maxCartRAMBank = calculateMaxBank(mmu->cartRAMSize);
-        }
 
         if (mmu->hasRAM) {
-            //TODO: be smarter than this for creating cart ram for carts smaller than a bank
-            mmu->cartRAM = PUSHM(mmu->cartRAMSize < KB(8) ? KB(8) : mmu->cartRAMSize, u8);
+            mmu->cartRAM = PUSHM(cartRAMAllocationSize(mmu), u8);
             mmu->hasRAM = true;
         }
         
-        mmu->romNameLen = (mmu->romData[0x143] == 0x80 || mmu->romData[0x143] == 0xC0) ? 15 : 16;
-        
-        copyMemory(mmu->romData + 0x134, romTitle, mmu->romNameLen);
-        mmu->romName = (char*)mmu->romData + 0x134;
+        copyMemory(mmu->host->romName, romTitle, mmu->host->romNameLen);
         foriarr (romTitle) {
             if ((u8)romTitle[i] > 0x7E) {
                 romTitle[i] = '\0';
@@ -1112,10 +1141,14 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
         /******************************************
          * Everything after here is relative to the rom directory!!
          *******************************************/
+        snprintf(filePath, ARRAY_LEN(filePath), "%s." SAVE_SLOT_INDEX_FILE_EXTENSION, programState->loadedROMName);
+        //save states still work without it, the slots just can't be previewed
+        openSaveSlotIndex(filePath, &programState->saveStateWriter);
+
         if (mmu->hasBattery) {
             snprintf(filePath, ARRAY_LEN(filePath), "%s." CART_RAM_FILE_EXTENSION, programState->loadedROMName);
             
-            auto crps = &mmu->cartRAMPlatformState;
+            auto crps = &mmu->host->cartRAMPlatformState;
 
             crps->cartRAMFileHandle = mapFileToMemory(filePath, &crps->cartRAMFileMap, &crps->ramLen);
             
@@ -1141,24 +1174,9 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
                        40      8       unix timestamp when saving (64 bits little endian)
                        */
                     
-                    RTCFileState *rtcFS = (RTCFileState*)(crps->cartRAMFileMap + mmu->cartRAMSize);
-                    
-                    zeroMemory(&mmu->rtc, sizeof(RTC));
-                    mmu->rtc.seconds = (u8)rtcFS->seconds;
-                    mmu->rtc.minutes = (u8)rtcFS->minutes;
-                    mmu->rtc.hours = (u8)rtcFS->hours;
-                    mmu->rtc.days = (u8)rtcFS->days;
-                    mmu->rtc.daysHigh = (u8)rtcFS->daysHigh;
-                    mmu->rtc.wallClockTime = rtcFS->unixTimestamp;
-                    
-                    mmu->rtc.latchedSeconds = (u8)rtcFS->latchedSeconds;
-                    mmu->rtc.latchedMinutes = (u8)rtcFS->latchedMinutes;
-                    mmu->rtc.latchedHours = (u8)rtcFS->latchedHours;
-                    mmu->rtc.latchedDays = (u8)rtcFS->latchedDays;
-                    mmu->rtc.latchedMisc = (u8)rtcFS->latchedDaysHigh;
-                    
-                    syncRTCTime(&mmu->rtc, rtcFS);
-                    crps->rtcFileMap = rtcFS;
+                    crps->rtcFileMap = (RTCFileState*)(crps->cartRAMFileMap + mmu->cartRAMSize);
+                    loadRTCFromFile(mmu);
+                    syncRTCTime(mmu);
                 }
                 
             }
@@ -1182,7 +1200,7 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
                     ALERT("Error while loading cart RAM file: %s!", filePath); 
                     return;
                 }
-                mmu->cartRAMPlatformState.rtcFileMap = (RTCFileState*)(crps->cartRAMFileMap + mmu->cartRAMSize);
+                mmu->host->cartRAMPlatformState.rtcFileMap = (RTCFileState*)(crps->cartRAMFileMap + mmu->cartRAMSize);
             }
             
         }
@@ -1230,7 +1248,7 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
 
     {
 #define GB_SAMPLES_PER_SEC 4194304/60
-        auto *soundFramesBuffer = &mmu->soundFramesBuffer;
+        auto *soundFramesBuffer = &mmu->host->soundFramesBuffer;
         soundFramesBuffer->len = GB_SAMPLES_PER_SEC; //1 second
         soundFramesBuffer->data = PUSHM(soundFramesBuffer->len, SoundFrame);
 #undef GB_SAMPLES_PER_SEC 
@@ -1238,29 +1256,55 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
     }
 
 
-    gbDebug->nextFreeGBStateIndex = 0;
-    
-    foriarr (gbDebug->recordedGBStates) {
-        auto state = &gbDebug->recordedGBStates[i]; 
-        
-        if (mmu->cartRAMSize > 0) {
-            state->mmu.cartRAMSize = mmu->cartRAMSize;
-            state->mmu.cartRAM = PUSHM(state->mmu.cartRAMSize,u8);
-        }
-        
-        auto *srcSoundBuffer = &mmu->soundFramesBuffer;
-        auto *destSoundBuffer = &state->mmu.soundFramesBuffer;
-        destSoundBuffer->len = srcSoundBuffer->len; 
-        destSoundBuffer->data = PUSHM(destSoundBuffer->len, SoundFrame);
+    if (initRewindBuffer(MB(programState->rewindBufferSizeMB), mmu->hasRAM ? mmu->cartRAMSize : 0,
+                         &gbDebug->rewindBuffer)) {
+        startRewindWorker(&gbDebug->rewindBuffer);
+    }
+    else {
+        ALERT("Could not allocate the rewind buffer. Rewind will be disabled.");
+    }
+    if (initRunAhead(programState->runAheadFrames,
+                     programState->isRunAheadOnSecondCore ? RunAheadMode::SecondInstance : RunAheadMode::SameInstance,
+                     mmu, &programState->runAhead)) {
+        startRunAheadWorker(&programState->runAhead);
+    }
+    else {
+        ALERT("Could not allocate the run-ahead instance. Run-ahead will be disabled.");
     }
 #ifdef CO_DEBUG
     gbEmuCode.reset(cpu, mmu, gbDebug, programState);
 #else
     reset(cpu, mmu, gbDebug, programState);
 #endif
+    
+    //already at power on, so recording doesn't need to reset again
+    switch (movieMode) {
+    case MovieMode::None: break;
+    case MovieMode::Recording: {
+#ifdef CO_DEBUG
+        bool didStart = gbEmuCode.startMovieRecording(movieFileName, false, cpu, mmu, gbDebug, programState);
+#else
+        bool didStart = startMovieRecording(movieFileName, false, cpu, mmu, gbDebug, programState);
+#endif
+        if (!didStart) {
+            ALERT("Could not record movie to %s", movieFileName);
+        }
+    } break;
+    case MovieMode::Playing: {
+#ifdef CO_DEBUG
+        bool didStart = gbEmuCode.startMoviePlayback(movieFileName, cpu, mmu, gbDebug, programState);
+#else
+        bool didStart = startMoviePlayback(movieFileName, cpu, mmu, gbDebug, programState);
+#endif
+        if (!didStart) {
+            ALERT("Could not play movie %s", movieFileName);
+        }
+    } break;
+    }
 
     TimeUS startTime = nowInMicroseconds(), dt;
     TimeUS startMeasureTime = startTime;
+    TimeUS lastPresentTime = 0;
 
     /*******************
      * Start main loop
@@ -1300,7 +1344,14 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
                     switch (e.window.event) {
                     case SDL_WINDOWEVENT_CLOSE: {
                         if (e.window.windowID == SDL_GetWindowID(window)) {
-                            cleanUp(&mmu->cartRAMPlatformState, debuggerContext);
+#ifdef CO_DEBUG
+                            if (gbEmuCode.stopMovie(cpu, mmu, gbDebug, programState) != FileSystemResultCode::OK) {
+#else
+                            if (stopMovie(cpu, mmu, gbDebug, programState) != FileSystemResultCode::OK) {
+#endif
+                                ALERT("Could not save movie to %s", movieFileName);
+                            }
+                            cleanUp(&mmu->host->cartRAMPlatformState, debuggerContext);
                             return;
                         }
                         else if (e.window.windowID == SDL_GetWindowID(*debuggerWindow)) {
@@ -1323,7 +1374,14 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
 
                 } break;
                 case SDL_QUIT:
-                    cleanUp(&mmu->cartRAMPlatformState, debuggerContext);
+#ifdef CO_DEBUG
+                    if (gbEmuCode.stopMovie(cpu, mmu, gbDebug, programState) != FileSystemResultCode::OK) {
+#else
+                    if (stopMovie(cpu, mmu, gbDebug, programState) != FileSystemResultCode::OK) {
+#endif
+                        ALERT("Could not save movie to %s", movieFileName);
+                    }
+                    cleanUp(&mmu->host->cartRAMPlatformState, debuggerContext);
                     return;
 
                 case SDL_KEYDOWN: {
@@ -1569,13 +1627,13 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
         /***************
          * Play Audio
          **************/
-        if (mmu->soundFramesBuffer.numItemsQueued > 0) {
+        if (mmu->host->soundFramesBuffer.numItemsQueued > 0) {
 #define MAX_FRAMES_TO_PLAY 1000
 #define VOLUME_AMPLIFIER 4
-            SoundFrame *framesToPlay = PUSHM(mmu->soundFramesBuffer.numItemsQueued, SoundFrame);
+            SoundFrame *framesToPlay = PUSHM(mmu->host->soundFramesBuffer.numItemsQueued, SoundFrame);
             AutoMemory _am(framesToPlay);
 
-            u32 numFramesToQueue = (u32)popn(mmu->soundFramesBuffer.numItemsQueued, &mmu->soundFramesBuffer, framesToPlay);
+            u32 numFramesToQueue = (u32)popn(mmu->host->soundFramesBuffer.numItemsQueued, &mmu->host->soundFramesBuffer, framesToPlay);
 
             if (!platformSoundState->isMuted) {
                 if (SDL_GetAudioDeviceStatus(audioDeviceID) != SDL_AUDIO_PLAYING)  {
@@ -1603,17 +1661,25 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
             SDL_RenderClear(renderer);
 
             LCD *lcd = &mmu->lcd;
+            //the run-ahead worker has had the audio work above to overlap with
+            const PaletteColor *screen = finishRunAhead(mmu, &programState->runAhead);
 
             profileStart("Draw Screen", profileState);
             if (lcd->isEnabled) {
                 int w,h;
                 SDL_GetWindowSize(window, &w, &h);
-                renderMainScreen(renderer, platformState, lcd->screen, w, h);
+                renderMainScreen(renderer, platformState, screen, w, h);
                 
             }
             profileEnd(profileState);
             profileStart("Flip to screen", profileState);
-            SDL_RenderPresent(renderer);
+            //vsync would hold uncapped turbo to the display's rate, so it only presents that often
+            TimeUS now = nowInMicroseconds();
+            const Turbo *turbo = &programState->turbo;
+            if (!turbo->isActive || turbo->speed > 0 || now - lastPresentTime >= UNCAPPED_TURBO_PRESENT_INTERVAL_US) {
+                SDL_RenderPresent(renderer);
+                lastPresentTime = now;
+            }
             profileEnd(profileState);
         }
 
@@ -1644,6 +1710,7 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
             }
             if (programState->shouldUpdateTitleBar) {
                 const char *pausedOrMutedStatus = (cpu->isPaused) ? " -- Paused" : 
+                                                                    (programState->turbo.isActive) ? " -- Turbo" :
                                                                     (platformSoundState->isMuted) ? " -- Muted"
                                                                                                   : "";
                 if (!isEmptyString(currentNotification)) {
@@ -1665,12 +1732,27 @@ mainLoop(SDL_Window *window, SDL_Renderer *renderer, PlatformState *platformStat
 int main(int argc, char **argv) {
     bool shouldEnableDebugMode = false;
     char romFileName[MAX_PATH_LEN] = {};
-    if (argc > 1 && argc <= 4) {
+    MovieMode movieMode = MovieMode::None;
+    char movieFileName[MAX_PATH_LEN + 1] = {};
+    if (argc > 1 && argc <= 5) {
         forirange (1, argc) {
             if (argv[i][0] == '-') {
                 if (strcmp(DEBUG_ON_BOOT_FLAG, argv[i]) == 0) {
                     shouldEnableDebugMode = true;
                 }
+                else if ((strcmp(RECORD_MOVIE_FLAG, argv[i]) == 0 || strcmp(PLAY_MOVIE_FLAG, argv[i]) == 0) && i + 1 < argc) {
+                    movieMode = (strcmp(RECORD_MOVIE_FLAG, argv[i]) == 0) ? MovieMode::Recording : MovieMode::Playing;
+                    i++;
+                    //the working directory changes to the ROM's save directory once the ROM is loaded
+                    if (argv[i][0] == FILE_SEPARATOR[0]) {
+                        strncpy(movieFileName, argv[i], MAX_PATH_LEN);
+                    }
+                    else {
+                        getCurrentWorkingDirectory(movieFileName);
+                        strncat(movieFileName, FILE_SEPARATOR, MAX_PATH_LEN - strlen(movieFileName));
+                        strncat(movieFileName, argv[i], MAX_PATH_LEN - strlen(movieFileName));
+                    }
+                }
                 else {
                     PRINT_ERR("Unknown option %s", argv[i]);
                 }
@@ -1682,8 +1764,10 @@ int main(int argc, char **argv) {
     }
     else if (argc != 1) {
        PRINT("GBEmu -- Version %s", GBEMU_VERSION);
-       PRINT("Usage :gbemu " DEBUG_ON_BOOT_FLAG " path_to_ROM");
+       PRINT("Usage :gbemu [" DEBUG_ON_BOOT_FLAG "] [" RECORD_MOVIE_FLAG "|" PLAY_MOVIE_FLAG " movie." MOVIE_FILE_EXTENSION "] path_to_ROM");
        PRINT("\t" DEBUG_ON_BOOT_FLAG " -- Start with the debugger screen up and emulator paused");
+       PRINT("\t" RECORD_MOVIE_FLAG " -- Record the joypad to a movie from power on. Written on exit");
+       PRINT("\t" PLAY_MOVIE_FLAG " -- Play back a movie");
        return 1; 
     }
     PRINT("GBEmu -- Version %s", GBEMU_VERSION);
@@ -1715,6 +1799,7 @@ int main(int argc, char **argv) {
 //            *im = {NO_INPUT_MAPPING, NO_INPUT_MAPPING, NO_INPUT_MAPPING};
 //        }
         makeMemoryStack(FILE_MEMORY_SIZE, "fileMem", &programState->fileMemory);
+        startSaveStateWriter(&programState->saveStateWriter);
 
     }
 
@@ -1983,7 +2068,13 @@ int main(int argc, char **argv) {
             }
         }
 
-        mainLoop(window, renderer, platformState, audioDeviceID, &gamepad, romFileName, shouldEnableDebugMode, debuggerContext, &debuggerWindow, gbDebug, programState);
+        mainLoop(window, renderer, platformState, audioDeviceID, &gamepad, romFileName, shouldEnableDebugMode, movieMode, movieFileName, debuggerContext, &debuggerWindow, gbDebug, programState);
+        freeRewindBuffer(&gbDebug->rewindBuffer);
+        CO_FREE(gbDebug->journal);
+        freeRunAhead(&programState->runAhead);
+        //finishes any queued saves
+        stopSaveStateWriter(&programState->saveStateWriter);
+        closeSaveSlotIndex(&programState->saveStateWriter);
         
     }
 
@@ -1,18 +1,64 @@
 //Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
 //Derived from code from https://yave.handmade.network/blogs/p/2723-how_media_molecule_does_serialization
 
-#include <errno.h>
 #include "gbemu.h"
 enum class SaveStateVersion : i32 {
     Initial = 1,
+    InterruptTiming, //EI delay and HALT bug
+    Chunked, //tagged chunks built in memory, optionally compressed, with a checksum
+    Serial, //SB and SC
+    BatteryRTC, //the battery file's RTC state in the RTC chunk
     
     //Don't delete this
     CurrentPlusOne
 };
+
+//Chunked file layout:
+//    i32 version, u32 flags, u32 payload size, u32 stored size, u64 checksum of the payload,
+//    then the payload, compressed if SAVE_STATE_FLAG_COMPRESSED is set.
+//The payload is the ROM name followed by chunks of [u32 tag][u32 len][data].  Unknown chunks are skipped.
+//Older versions are the version followed by the fields of the CPU and MMU in order, with no chunks.
+#define SAVE_STATE_FLAG_COMPRESSED 0x1
+#define SAVE_STATE_TAG(a, b, c, d) ((u32)(a) | ((u32)(b) << 8) | ((u32)(c) << 16) | ((u32)(d) << 24))
+enum class SaveStateChunkTag : u32 {
+    CPU = SAVE_STATE_TAG('C', 'P', 'U', ' '),
+    MMUCore = SAVE_STATE_TAG('M', 'M', 'U', ' '),
+    VideoRAM = SAVE_STATE_TAG('V', 'R', 'A', 'M'),
+    OAM = SAVE_STATE_TAG('O', 'A', 'M', ' '),
+    WorkingRAM = SAVE_STATE_TAG('W', 'R', 'A', 'M'),
+    CartRAM = SAVE_STATE_TAG('C', 'R', 'A', 'M'),
+    RTC = SAVE_STATE_TAG('R', 'T', 'C', ' '),
+    APU = SAVE_STATE_TAG('A', 'P', 'U', ' '),
+};
+//in the order they are written.  MMUCore must come after CPU and before the rest
+static const SaveStateChunkTag saveStateChunks[] = {
+    SaveStateChunkTag::CPU,
+    SaveStateChunkTag::MMUCore,
+    SaveStateChunkTag::VideoRAM,
+    SaveStateChunkTag::OAM,
+    SaveStateChunkTag::WorkingRAM,
+    SaveStateChunkTag::CartRAM,
+    SaveStateChunkTag::RTC,
+    SaveStateChunkTag::APU,
+};
+
+//where the memories a copy of an MMU shares with it are, in a snapshot decoded into that copy
+struct DeferredMemoryOffsets {
+    i64 videoRAM, workingRAM, cartRAM, rtcFileState;
+};
+
+//Save states are built in, or read from, a single buffer
 struct SerializingState {
     bool isWriting;
     SaveStateVersion version;
-    FILE *f;
+    u8 *data;
+    i64 len; //capacity when writing
+    i64 cursor;
+
+    //Reading only.  VRAM, WRAM, cart RAM and the battery file's RTC are shared with the MMU being decoded into,
+    //so when decoding into a copy, they're only checked.  Otherwise the RTC is synced to the battery file
+    bool shouldDeferMemories;
+    DeferredMemoryOffsets deferredOffsets; //in data
 };
 #define ADD(data, v) if (state->version >= (v)) { \
         auto res = serialize(&(data), state); \
@@ -21,13 +67,6 @@ struct SerializingState {
             return res;\
         }\
     }
-#define ADD_IGNORE_READ(data, v) if (state->version >= (v)) { \
-        auto res = serialize(&(data), state, true); \
-        if (res != FileSystemResultCode::OK) {\
-            CO_ERR("Failed to write " #data);\
-            return res;\
-        }\
-    }
 #define ADD_N(data, n, v) if (state->version >= (v)) { \
         auto res = serialize(data, n, state); \
         if (res != FileSystemResultCode::OK) {\
@@ -45,77 +84,42 @@ struct SerializingState {
         return FileSystemResultCode::Unknown; } } while (0)
 
 #define ADD_ARR(data, v) ADD_N(data, ARRAY_LEN(data), v)
-    FileSystemResultCode checkResult(usize numItems, SerializingState *state) {
-       if (numItems == 1) {
-           return FileSystemResultCode::OK;
-       }
-       else if (ferror(state->f)) {
-           switch (errno) {
-           case ENOSPC:
-               return FileSystemResultCode::OutOfSpace;
-           case EACCES:
-               return FileSystemResultCode::PermissionDenied; 
-           case EIO:
-               return FileSystemResultCode::IOError;
-           default:
-               return FileSystemResultCode::Unknown;
-           }
-       }
-       else {
-           return FileSystemResultCode::Unknown; 
-       }
-        
-    }
-    FileSystemResultCode checkWriteResult(usize numItems, SerializingState *state) {
-       if (numItems == 1) {
-           return FileSystemResultCode::OK;
-       }
-       else if (ferror(state->f)) {
-           switch (errno) {
-           case ENOSPC:
-               return FileSystemResultCode::OutOfSpace;
-           case EACCES:
-               return FileSystemResultCode::PermissionDenied; 
-           case EIO:
-               return FileSystemResultCode::IOError;
-           default:
-               return FileSystemResultCode::Unknown;
-           }
-       }
-       else {
-           return FileSystemResultCode::Unknown; 
-       }
-        
+
+//for fields that were removed, or moved into their own chunk, in version r
+#define ADD_REM(data, v, r) if (state->version < (r)) { ADD(data, v); }
+#define ADD_ARR_REM(data, v, r) if (state->version < (r)) { ADD_ARR(data, v); }
+#define ADD_N_REM(data, n, v, r) if (state->version < (r)) { ADD_N(data, n, v); }
+
+    //data can be null when reading to skip over the bytes
+    FileSystemResultCode serializeBytes(void *data, i64 size, SerializingState *state) {
+        if (state->cursor + size > state->len) {
+            //the buffer is sized for the whole state, so running out when writing is a bug
+            CO_ASSERT(!state->isWriting);
+            return FileSystemResultCode::Unknown;
+        }
+        if (state->isWriting) {
+            copyMemory(data, state->data + state->cursor, size);
+        }
+        else if (data) {
+            copyMemory(state->data + state->cursor, data, size);
+        }
+        state->cursor += size;
+        return FileSystemResultCode::OK;
     }
     template <typename T>
-    FileSystemResultCode serialize(T *data, SerializingState *state, bool ignore = false) {
-       usize numItems;
-       if (state->isWriting) {
-          numItems = fwrite(data, sizeof(*data), 1, state->f); 
-       }
-       else {
-           if (ignore) {
-               T throwAway;
-               numItems = fread(&throwAway, sizeof(throwAway), 1, state->f);
-           }
-           else {
-               numItems = fread(data, sizeof(*data), 1, state->f);
-           }
-       }
-       return checkResult(numItems, state);
+    FileSystemResultCode serialize(T *data, SerializingState *state) {
+        //most of a state is small fields, which are cheaper to copy at a size known here
+        if (state->isWriting && state->cursor + (i64)sizeof(*data) <= state->len) {
+            memcpy(state->data + state->cursor, data, sizeof(*data));
+            state->cursor += (i64)sizeof(*data);
+            return FileSystemResultCode::OK;
+        }
+        return serializeBytes(data, (i64)sizeof(*data), state);
     }
     
     template <typename T> 
     FileSystemResultCode serialize(T *data, i64 len, SerializingState *state) {
-       usize numItems;
-       if (state->isWriting) {
-          numItems = fwrite(data, (usize)len * sizeof(*data), 1, state->f); 
-       }
-       else {
-           numItems = fread(data, (usize)len * sizeof(*data), 1, state->f);
-       }
-       CO_ASSERT(numItems == 1);
-       return checkResult(numItems, state);
+        return serializeBytes(data, len * (i64)sizeof(*data), state);
     }
     
     FileSystemResultCode serialize(SoundBuffer *data, SerializingState *state) {
@@ -130,20 +134,20 @@ struct SerializingState {
    
     
     FileSystemResultCode serialize(RTC *data, SerializingState *state) {
-        ADD_IGNORE_READ(data->latchState, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->isStopped, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->didOverflow, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->seconds, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->minutes, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->hours, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->days, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->daysHigh, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->wallClockTime, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->latchedSeconds, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->latchedMinutes, SaveStateVersion::Initial); 
-        ADD_IGNORE_READ(data->latchedHours, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->latchedDays, SaveStateVersion::Initial);
-        ADD_IGNORE_READ(data->latchedMisc, SaveStateVersion::Initial);
+        ADD(data->latchState, SaveStateVersion::Initial);
+        ADD(data->isStopped, SaveStateVersion::Initial);
+        ADD(data->didOverflow, SaveStateVersion::Initial);
+        ADD(data->seconds, SaveStateVersion::Initial);
+        ADD(data->minutes, SaveStateVersion::Initial);
+        ADD(data->hours, SaveStateVersion::Initial);
+        ADD(data->days, SaveStateVersion::Initial);
+        ADD(data->daysHigh, SaveStateVersion::Initial);
+        ADD(data->wallClockTime, SaveStateVersion::Initial);
+        ADD(data->latchedSeconds, SaveStateVersion::Initial);
+        ADD(data->latchedMinutes, SaveStateVersion::Initial); 
+        ADD(data->latchedHours, SaveStateVersion::Initial);
+        ADD(data->latchedDays, SaveStateVersion::Initial);
+        ADD(data->latchedMisc, SaveStateVersion::Initial);
         
                 
         return FileSystemResultCode::OK;
@@ -167,8 +171,8 @@ struct SerializingState {
         ADD_ARR(data->backgroundPalette, SaveStateVersion::Initial);
         ADD_ARR(data->spritePalette0, SaveStateVersion::Initial);
         ADD_ARR(data->spritePalette1, SaveStateVersion::Initial);
-        ADD_ARR(data->videoRAM, SaveStateVersion::Initial);
-        ADD_ARR(data->oam, SaveStateVersion::Initial);
+        ADD_N_REM(data->videoRAM, VIDEO_RAM_SIZE, SaveStateVersion::Initial, SaveStateVersion::Chunked);
+        ADD_ARR_REM(data->oam, SaveStateVersion::Initial, SaveStateVersion::Chunked);
         ADD(data->mode, SaveStateVersion::Initial);
         ADD(data->modeClock, SaveStateVersion::Initial);
         ADD(data->spriteHeight, SaveStateVersion::Initial);
@@ -192,36 +196,19 @@ struct SerializingState {
         
         ADD(data->numScreensToSkip, SaveStateVersion::Initial);
         
-        if (state->version >= SaveStateVersion::Initial) {  
+        //screens are redrawn within a frame, so chunked saves leave them alone.  Older saves have
+        //both screens, in the order of the arrays they used to be stored in, and which one was showing.
+        //Only ever read, since saves are written at the current version
+        if (state->version >= SaveStateVersion::Initial && state->version < SaveStateVersion::Chunked) {  
+            CO_ASSERT(!state->isWriting);
             bool isSwapped;
-            if (state->isWriting) {
-                isSwapped = data->screen == data->screenStorage;
-                auto res = serialize(&isSwapped, state);
-                if (res != FileSystemResultCode::OK) {
-                    CO_ERR("Failed to write isSwapped");
-                    return res;
-                }
-            }
-            else {
-                auto res = serialize(&isSwapped, state);
-                if (res != FileSystemResultCode::OK) {
-                    CO_ERR("Failed to read isSwapped");
-                    return res;
-                }
-                if (isSwapped) {
-                    data->screen = data->screenStorage;
-                    data->backBuffer = data->backBufferStorage;
-                }
-                else {
-                    data->screen = data->backBufferStorage;
-                    data->backBuffer = data->screenStorage;
-                }
-            }
+            ADD(isSwapped, SaveStateVersion::Initial);
+            PaletteColor *firstScreen = isSwapped ? data->screen : data->backBuffer;
+            PaletteColor *secondScreen = isSwapped ? data->backBuffer : data->screen;
+            ADD_N(firstScreen, SCREEN_WIDTH*SCREEN_HEIGHT, SaveStateVersion::Initial);
+            ADD_N(secondScreen, SCREEN_WIDTH*SCREEN_HEIGHT, SaveStateVersion::Initial);
         }
         
-        ADD_ARR(data->screenStorage, SaveStateVersion::Initial);
-        ADD_ARR(data->backBufferStorage, SaveStateVersion::Initial);
-        
         return FileSystemResultCode::OK;
     }
     
@@ -328,20 +315,61 @@ struct SerializingState {
         ADD(data->channelEnabledState, SaveStateVersion::Initial);
         return FileSystemResultCode::OK;
     }
+    FileSystemResultCode serializeAPU(MMU *data, SerializingState *state) {
+        ADD(data->NR10, SaveStateVersion::Initial);
+        ADD(data->NR11, SaveStateVersion::Initial);
+        ADD(data->NR12, SaveStateVersion::Initial);
+        ADD(data->NR13, SaveStateVersion::Initial);
+        ADD(data->NR14, SaveStateVersion::Initial);
+        ADD(data->NR21, SaveStateVersion::Initial);
+        ADD(data->NR22, SaveStateVersion::Initial);
+        ADD(data->NR23, SaveStateVersion::Initial);
+        ADD(data->NR24, SaveStateVersion::Initial);
+        ADD(data->NR30, SaveStateVersion::Initial);
+        ADD(data->NR31, SaveStateVersion::Initial);
+        ADD(data->NR32, SaveStateVersion::Initial);
+        ADD(data->NR33, SaveStateVersion::Initial);
+        ADD(data->NR34, SaveStateVersion::Initial);
+        ADD(data->NR41, SaveStateVersion::Initial);
+        ADD(data->NR42, SaveStateVersion::Initial);
+        ADD(data->NR43, SaveStateVersion::Initial);
+        ADD(data->NR44, SaveStateVersion::Initial);
+        ADD(data->NR50, SaveStateVersion::Initial);
+        ADD(data->NR51, SaveStateVersion::Initial);
+        ADD(data->NR52, SaveStateVersion::Initial);
+        ADD(data->isSoundEnabled, SaveStateVersion::Initial);
+        
+        ADD(data->squareWave1Channel, SaveStateVersion::Initial);
+        ADD(data->squareWave2Channel, SaveStateVersion::Initial);
+        ADD(data->waveChannel, SaveStateVersion::Initial);
+        ADD(data->noiseChannel, SaveStateVersion::Initial);
+        
+        ADD(data->ticksSinceLastLengthCounter, SaveStateVersion::Initial);
+        ADD(data->ticksSinceLastEnvelop, SaveStateVersion::Initial);
+        ADD(data->ticksSinceLastSweep, SaveStateVersion::Initial);
+        ADD(data->cyclesSinceLastSoundSample, SaveStateVersion::Initial);
+        ADD(data->cyclesSinceLastFrameSequencer, SaveStateVersion::Initial);
+        ADD(data->masterLeftVolume, SaveStateVersion::Initial);
+        ADD(data->masterRightVolume, SaveStateVersion::Initial);
+        
+        return FileSystemResultCode::OK;
+    }
+    
     FileSystemResultCode serialize(MMU *data, SerializingState *state) {
-       ADD(data->soundFramesBuffer, SaveStateVersion::Initial); 
-       ADD_ARR(data->workingRAM, SaveStateVersion::Initial);
+       //queued sound has already been mixed, so chunked saves don't include it
+       ADD_REM(data->host->soundFramesBuffer, SaveStateVersion::Initial, SaveStateVersion::Chunked); 
+       ADD_N_REM(data->workingRAM, WORKING_RAM_SIZE, SaveStateVersion::Initial, SaveStateVersion::Chunked);
        ADD_ARR(data->zeroPageRAM, SaveStateVersion::Initial);
        ADD(data->lcd, SaveStateVersion::Initial); 
        ADD(data->joyPad, SaveStateVersion::Initial); 
        
        ADD_CHECK_SAME(data->romSize, SaveStateVersion::Initial);
-       ADD_CHECK_SAME(data->romNameLen, SaveStateVersion::Initial);
+       ADD_CHECK_SAME(data->host->romNameLen, SaveStateVersion::Initial);
        ADD_CHECK_SAME(data->mbcType, SaveStateVersion::Initial);
        
        ADD_CHECK_SAME(data->hasRAM, SaveStateVersion::Initial);
        ADD_CHECK_SAME(data->hasBattery, SaveStateVersion::Initial);
-       if (data->hasRAM) {
+       if (data->hasRAM && state->version < SaveStateVersion::Chunked) {
            ADD_N(data->cartRAM, data->cartRAMSize, SaveStateVersion::Initial);
            ADD_CHECK_SAME(data->cartRAMSize, SaveStateVersion::Initial);
        }
@@ -355,67 +383,99 @@ struct SerializingState {
 
        ADD(data->requestedInterrupts, SaveStateVersion::Initial);
        ADD(data->enabledInterrupts, SaveStateVersion::Initial);
+       data->didInterruptsChange = true;
        ADD(data->bankingMode, SaveStateVersion::Initial);
        ADD(data->hasRTC, SaveStateVersion::Initial);
-       if (data->hasRTC) {
-           ADD(data->rtc, SaveStateVersion::Initial);
+       if (data->hasRTC && state->version < SaveStateVersion::Chunked) {
+           //the clock comes from the battery file
+           RTC rtc = data->rtc;
+           ADD(rtc, SaveStateVersion::Initial);
            if (!state->isWriting) {
-               syncRTCTime(&data->rtc, data->cartRAMPlatformState.rtcFileMap);
+               syncRTCTime(data);
            }
        }
 
 
-       ADD(data->isDMAOccurring, SaveStateVersion::Initial);
-       ADD(data->currentDMAAddress, SaveStateVersion::Initial);
-       ADD(data->cyclesSinceLastDMACopy, SaveStateVersion::Initial);
-
-       //divider
-       ADD(data->cyclesSinceDividerIncrement, SaveStateVersion::Initial);
-       ADD(data->divider, SaveStateVersion::Initial);
-
-       //timer
-       ADD(data->cyclesSinceTimerIncrement, SaveStateVersion::Initial);
-       ADD(data->timerIncrementRate, SaveStateVersion::Initial);
-       ADD(data->timer, SaveStateVersion::Initial);
-       ADD(data->timerModulo, SaveStateVersion::Initial);
-       ADD(data->isTimerEnabled, SaveStateVersion::Initial);
-
-       //Sound
-       ADD(data->NR10, SaveStateVersion::Initial);
-       ADD(data->NR11, SaveStateVersion::Initial);
-       ADD(data->NR12, SaveStateVersion::Initial);
-       ADD(data->NR13, SaveStateVersion::Initial);
-       ADD(data->NR14, SaveStateVersion::Initial);
-       ADD(data->NR21, SaveStateVersion::Initial);
-       ADD(data->NR22, SaveStateVersion::Initial);
-       ADD(data->NR23, SaveStateVersion::Initial);
-       ADD(data->NR24, SaveStateVersion::Initial);
-       ADD(data->NR30, SaveStateVersion::Initial);
-       ADD(data->NR31, SaveStateVersion::Initial);
-       ADD(data->NR32, SaveStateVersion::Initial);
-       ADD(data->NR33, SaveStateVersion::Initial);
-       ADD(data->NR34, SaveStateVersion::Initial);
-       ADD(data->NR41, SaveStateVersion::Initial);
-       ADD(data->NR42, SaveStateVersion::Initial);
-       ADD(data->NR43, SaveStateVersion::Initial);
-       ADD(data->NR44, SaveStateVersion::Initial);
-       ADD(data->NR50, SaveStateVersion::Initial);
-       ADD(data->NR51, SaveStateVersion::Initial);
-       ADD(data->NR52, SaveStateVersion::Initial);
-       ADD(data->isSoundEnabled, SaveStateVersion::Initial);
-       
-       ADD(data->squareWave1Channel, SaveStateVersion::Initial);
-       ADD(data->squareWave2Channel, SaveStateVersion::Initial);
-       ADD(data->waveChannel, SaveStateVersion::Initial);
-       ADD(data->noiseChannel, SaveStateVersion::Initial);
-       
-       ADD(data->ticksSinceLastLengthCounter, SaveStateVersion::Initial);
-       ADD(data->ticksSinceLastEnvelop, SaveStateVersion::Initial);
-       ADD(data->ticksSinceLastSweep, SaveStateVersion::Initial);
-       ADD(data->cyclesSinceLastSoundSample, SaveStateVersion::Initial);
-       ADD(data->cyclesSinceLastFrameSequencer, SaveStateVersion::Initial);
-       ADD(data->masterLeftVolume, SaveStateVersion::Initial);
-       ADD(data->masterRightVolume, SaveStateVersion::Initial);
+       if (!state->isWriting) {
+           clearScheduledEvents(data);
+       }
+
+       //DMA is copied all at once, but is saved as how far the transfer has gotten
+       {
+           u16 currentDMAAddress = 0;
+           int cyclesSinceLastDMACopy = 0;
+           if (state->isWriting && data->isDMAOccurring) {
+               i64 cyclesSinceDMAStart = data->currentCycle - data->dmaStartCycle;
+               currentDMAAddress = (u16)(data->dmaSourceAddress + cyclesSinceDMAStart / DMA_CYCLES_PER_BYTE);
+               cyclesSinceLastDMACopy = (int)(cyclesSinceDMAStart % DMA_CYCLES_PER_BYTE);
+           }
+
+           ADD(data->isDMAOccurring, SaveStateVersion::Initial);
+           ADD(currentDMAAddress, SaveStateVersion::Initial);
+           ADD(cyclesSinceLastDMACopy, SaveStateVersion::Initial);
+
+           if (!state->isWriting) {
+               restoreDMA(currentDMAAddress, cyclesSinceLastDMACopy, data);
+           }
+       }
+
+       //divider and timer are computed from the cycle count, but are saved as plain values.
+       //Expects data->currentCycle to already be set when reading
+       {
+           int cyclesSinceDividerIncrement = 0, cyclesSinceTimerIncrement = 0;
+           u8 divider = 0, timer = 0;
+           if (state->isWriting) {
+               u16 dividerCounter = readDividerCounter(data);
+               cyclesSinceDividerIncrement = dividerCounter & 0xFF;
+               divider = (u8)(dividerCounter >> 8);
+               cyclesSinceTimerIncrement = dividerCounter % (int)data->timerIncrementRate;
+               timer = readTimer(data);
+           }
+
+           //divider
+           ADD(cyclesSinceDividerIncrement, SaveStateVersion::Initial);
+           ADD(divider, SaveStateVersion::Initial);
+
+           //timer
+           ADD(cyclesSinceTimerIncrement, SaveStateVersion::Initial);
+           ADD(data->timerIncrementRate, SaveStateVersion::Initial);
+           ADD(timer, SaveStateVersion::Initial);
+           ADD(data->timerModulo, SaveStateVersion::Initial);
+           ADD(data->isTimerEnabled, SaveStateVersion::Initial);
+
+           if (!state->isWriting) {
+               //the timer phase now always follows the divider, so cyclesSinceTimerIncrement isn't needed
+               restoreTimers((u16)((divider << 8) | (cyclesSinceDividerIncrement & 0xFF)), timer, data);
+           }
+       }
+
+       //serial.  An internal clock transfer is saved as how long it has left.  Expects the divider to already be restored
+       {
+           i64 cyclesUntilSerialTransferEnds = 0;
+           if (state->isWriting && data->eventCycles[(int)ScheduledEvent::SerialTransferEnd] != EVENT_NOT_SCHEDULED) {
+               cyclesUntilSerialTransferEnds = data->eventCycles[(int)ScheduledEvent::SerialTransferEnd] - data->currentCycle;
+           }
+           if (!state->isWriting) {
+               data->serialData = 0;
+               data->isSerialTransferring = false;
+               data->isSerialClockInternal = false;
+           }
+           ADD(data->serialData, SaveStateVersion::Serial);
+           ADD(data->isSerialTransferring, SaveStateVersion::Serial);
+           ADD(data->isSerialClockInternal, SaveStateVersion::Serial);
+           ADD(cyclesUntilSerialTransferEnds, SaveStateVersion::Serial);
+
+           if (!state->isWriting) {
+               restoreSerialTransfer(cyclesUntilSerialTransferEnds, data);
+           }
+       }
+
+       if (state->version < SaveStateVersion::Chunked) {
+           auto res = serializeAPU(data, state);
+           if (res != FileSystemResultCode::OK) {
+               return res;
+           }
+       }
        
        return FileSystemResultCode::OK;
     }
@@ -436,88 +496,645 @@ struct SerializingState {
         ADD(data->leftOverCyclesFromPreviousFrame, SaveStateVersion::Initial);
         ADD(data->enableInterrupts, SaveStateVersion::Initial);
         ADD(data->isHalted, SaveStateVersion::Initial);
+        if (!state->isWriting) {
+            data->shouldEnableInterrupts = false;
+            data->isHaltBugTriggered = false;
+        }
+        ADD(data->shouldEnableInterrupts, SaveStateVersion::InterruptTiming);
+        ADD(data->isHaltBugTriggered, SaveStateVersion::InterruptTiming);
         ADD(data->isPaused, SaveStateVersion::Initial);
         ADD(data->didHitIllegalOpcode, SaveStateVersion::Initial);
         
        return FileSystemResultCode::OK;
     }
 
-    static FileSystemResultCode saveSaveStateToFile(CPU *cpu, MMU *mmu, ProgramState *programState, int saveSlot) {
-        CO_ASSERT(saveSlot >= 0 && saveSlot <= 9);
-        char *romName = programState->loadedROMName;
-        FileSystemResultCode ret = FileSystemResultCode::Unknown;
-        char backupPath[MAX_PATH_LEN];
-        bool didBackup = false;
-        
-        timestampFileName(romName, "gbes.backup", backupPath);
-        
-        char *saveStateFileName = nullptr; 
-        buf_gen_memory_printf(saveStateFileName, "%s_%d.gbes", romName, saveSlot);
-        
-        auto copyFileRes = copyFile(saveStateFileName, backupPath, &programState->fileMemory);
-        switch (copyFileRes) {
-        case FileSystemResultCode::OK:
-            didBackup = true;
-            break;
-        case FileSystemResultCode::NotFound:
-            break;
-        default:
-            return copyFileRes;
-        }
-
-        FILE *f = fopen(saveStateFileName, "wb");
-        if (!f) {
-            CO_ERR("Could not save game state. Could not open file.");
-            return FileSystemResultCode::NotFound;
-        }
-        buf_gen_memory_free(saveStateFileName);
-        SerializingState ss;
-        ss.f = f;
+    FileSystemResultCode serializeChunk(SaveStateChunkTag tag, CPU *cpu, MMU *mmu, SerializingState *state) {
+        switch (tag) {
+        case SaveStateChunkTag::CPU: {
+            auto res = serialize(cpu, state);
+            if (res != FileSystemResultCode::OK) {
+                return res;
+            }
+            //the MMU expects this when reading
+            mmu->currentCycle = cpu->totalCycles;
+        } break;
+        case SaveStateChunkTag::MMUCore: return serialize(mmu, state);
+        case SaveStateChunkTag::VideoRAM: {
+            if (!state->isWriting && state->shouldDeferMemories) {
+                state->deferredOffsets.videoRAM = state->cursor;
+                ADD_N((u8*)nullptr, VIDEO_RAM_SIZE, SaveStateVersion::Chunked);
+            }
+            else {
+                ADD_N(mmu->lcd.videoRAM, VIDEO_RAM_SIZE, SaveStateVersion::Chunked);
+            }
+        } break;
+        case SaveStateChunkTag::OAM: ADD_ARR(mmu->lcd.oam, SaveStateVersion::Chunked); break;
+        case SaveStateChunkTag::WorkingRAM: {
+            if (!state->isWriting && state->shouldDeferMemories) {
+                state->deferredOffsets.workingRAM = state->cursor;
+                ADD_N((u8*)nullptr, WORKING_RAM_SIZE, SaveStateVersion::Chunked);
+            }
+            else {
+                ADD_N(mmu->workingRAM, WORKING_RAM_SIZE, SaveStateVersion::Chunked);
+            }
+        } break;
+        case SaveStateChunkTag::CartRAM: {
+            if (!mmu->hasRAM) {
+                CO_ERR("Save state has cart RAM, but the cartridge doesn't");
+                return FileSystemResultCode::Unknown;
+            }
+            ADD_CHECK_SAME(mmu->cartRAMSize, SaveStateVersion::Chunked);
+            if (!state->isWriting && state->shouldDeferMemories) {
+                state->deferredOffsets.cartRAM = state->cursor;
+                ADD_N((u8*)nullptr, mmu->cartRAMSize, SaveStateVersion::Chunked);
+            }
+            else {
+                ADD_N(mmu->cartRAM, mmu->cartRAMSize, SaveStateVersion::Chunked);
+            }
+        } break;
+        case SaveStateChunkTag::RTC: {
+            if (!mmu->hasRTC) {
+                CO_ERR("Save state has an RTC, but the cartridge doesn't");
+                return FileSystemResultCode::Unknown;
+            }
+            if (!state->isWriting && !state->shouldDeferMemories) {
+                //loading a save state file doesn't turn back the clock, which comes from the battery file
+                RTC rtc = mmu->rtc;
+                ADD(rtc, SaveStateVersion::Chunked);
+                ADD_N((u8*)nullptr, (i64)sizeof(RTCFileState), SaveStateVersion::BatteryRTC);
+                syncRTCTime(mmu);
+                break;
+            }
+            ADD(mmu->rtc, SaveStateVersion::Chunked);
+            if (state->isWriting) {
+                RTCFileState rtcFileState = {};
+                if (mmu->host->cartRAMPlatformState.rtcFileMap) {
+                    rtcFileState = *mmu->host->cartRAMPlatformState.rtcFileMap;
+                }
+                ADD(rtcFileState, SaveStateVersion::BatteryRTC);
+            }
+            else {
+                state->deferredOffsets.rtcFileState = state->cursor;
+                ADD_N((u8*)nullptr, (i64)sizeof(RTCFileState), SaveStateVersion::BatteryRTC);
+            }
+        } break;
+        case SaveStateChunkTag::APU: return serializeAPU(mmu, state);
+        }
+
+        return FileSystemResultCode::OK;
+    }
+
+    static bool isChunkNeeded(SaveStateChunkTag tag, MMU *mmu) {
+        switch (tag) {
+        case SaveStateChunkTag::CartRAM: return mmu->hasRAM;
+        case SaveStateChunkTag::RTC: return mmu->hasRTC;
+        default: return true;
+        }
+    }
+
+    FileSystemResultCode serializeChunks(CPU *cpu, MMU *mmu, SerializingState *state) {
+        if (state->isWriting) {
+            foriarr (saveStateChunks) {
+                if (!isChunkNeeded(saveStateChunks[i], mmu)) {
+                    continue;
+                }
+                u32 tag = (u32)saveStateChunks[i];
+                u32 len = 0;
+                ADD(tag, SaveStateVersion::Chunked);
+                i64 lenOffset = state->cursor;
+                ADD(len, SaveStateVersion::Chunked);
+
+                auto res = serializeChunk(saveStateChunks[i], cpu, mmu, state);
+                if (res != FileSystemResultCode::OK) {
+                    return res;
+                }
+                len = (u32)(state->cursor - lenOffset - (i64)sizeof(len));
+                copyMemory(&len, state->data + lenOffset, sizeof(len));
+            }
+
+            return FileSystemResultCode::OK;
+        }
+
+        bool wasChunkRead[ARRAY_LEN(saveStateChunks)] = {};
+        while (state->cursor < state->len) {
+            u32 tag = 0, len = 0;
+            ADD(tag, SaveStateVersion::Chunked);
+            ADD(len, SaveStateVersion::Chunked);
+            i64 chunkEnd = state->cursor + len;
+            if (chunkEnd > state->len) {
+                CO_ERR("Save state chunk %.4s is truncated", (char*)&tag);
+                return FileSystemResultCode::Unknown;
+            }
+
+            foriarr (saveStateChunks) {
+                if ((u32)saveStateChunks[i] != tag) {
+                    continue;
+                }
+                //the MMU needs the CPU, and the rest need the MMU
+                if ((i > 0 && !wasChunkRead[0]) || (i > 1 && !wasChunkRead[1])) {
+                    CO_ERR("Save state chunk %.4s is out of order", (char*)&tag);
+                    return FileSystemResultCode::Unknown;
+                }
+                auto res = serializeChunk(saveStateChunks[i], cpu, mmu, state);
+                if (res != FileSystemResultCode::OK) {
+                    return res;
+                }
+                if (state->cursor > chunkEnd) {
+                    CO_ERR("Save state chunk %.4s is larger than its length", (char*)&tag);
+                    return FileSystemResultCode::Unknown;
+                }
+                wasChunkRead[i] = true;
+                break;
+            }
+            //skip anything left, including chunks this version doesn't know about
+            state->cursor = chunkEnd;
+        }
+
+        foriarr (saveStateChunks) {
+            if (!wasChunkRead[i] && isChunkNeeded(saveStateChunks[i], mmu)) {
+                CO_ERR("Save state is missing chunk %.4s", (const char*)&saveStateChunks[i]);
+                return FileSystemResultCode::Unknown;
+            }
+        }
+
+        return FileSystemResultCode::OK;
+    }
+
+    //Save state compression.  Byte oriented LZ77 made of sequences of
+    //    [varint num literals][literals][varint match length - SAVE_STATE_MIN_MATCH][varint match distance]
+    //The last sequence is only literals.  Most of a state is zeros and repeated tiles, so this is plenty.
+#define SAVE_STATE_MIN_MATCH 4
+#define SAVE_STATE_HASH_BITS 12
+    static i64 maxCompressedSaveStateSize(i64 len) {
+        return len * 2 + 64;
+    }
+
+    static inline u32 readU32Unaligned(const u8 *data) {
+        u32 ret;
+        memcpy(&ret, data, sizeof(ret));
+        return ret;
+    }
+
+    //returns the compressed size
+    static i64 compressSaveState(const u8 *in, i64 len, u8 *out) {
+        i32 positions[1 << SAVE_STATE_HASH_BITS];
+        fillMemory(positions, (u8)0xFF, (i64)sizeof(positions)); //-1
+        u8 *o = out;
+        i64 literalStart = 0;
+        i64 i = 0;
+        while (i + SAVE_STATE_MIN_MATCH <= len) {
+            u32 sequence = readU32Unaligned(in + i);
+            u32 hash = (sequence * 2654435761u) >> (32 - SAVE_STATE_HASH_BITS);
+            i64 candidate = positions[hash];
+            positions[hash] = (i32)i;
+            if (candidate < 0 || readU32Unaligned(in + candidate) != sequence) {
+                //the longer it goes without a match, the less likely there is one, so search faster
+                i += 1 + ((i - literalStart) >> 5);
+                continue;
+            }
+
+            i64 matchLen = SAVE_STATE_MIN_MATCH;
+            while (i + matchLen + 8 <= len) {
+                u64 a, b;
+                memcpy(&a, in + candidate + matchLen, sizeof(a));
+                memcpy(&b, in + i + matchLen, sizeof(b));
+                if (a != b) {
+                    break;
+                }
+                matchLen += 8;
+            }
+            while (i + matchLen < len && in[candidate + matchLen] == in[i + matchLen]) {
+                matchLen++;
+            }
+            o = writeVarInt((u64)(i - literalStart), o);
+            copyMemory(in + literalStart, o, i - literalStart);
+            o += i - literalStart;
+            o = writeVarInt((u64)(matchLen - SAVE_STATE_MIN_MATCH), o);
+            o = writeVarInt((u64)(i - candidate), o);
+
+            i += matchLen;
+            literalStart = i;
+        }
+        o = writeVarInt((u64)(len - literalStart), o);
+        copyMemory(in + literalStart, o, len - literalStart);
+        o += len - literalStart;
+
+        return o - out;
+    }
+
+    //returns the decompressed size, or -1 if the data is corrupt
+    static i64 decompressSaveState(const u8 *in, i64 len, u8 *out, i64 outLen) {
+        const u8 *end = in + len;
+        i64 o = 0;
+        while (in < end) {
+            i64 numLiterals;
+            in = readVarInt(in, end, &numLiterals);
+            if (!in || numLiterals > end - in || numLiterals > outLen - o) {
+                return -1;
+            }
+            copyMemory(in, out + o, numLiterals);
+            in += numLiterals;
+            o += numLiterals;
+            if (in == end) {
+                break;
+            }
+
+            i64 matchLen, distance;
+            in = readVarInt(in, end, &matchLen);
+            if (!in) {
+                return -1;
+            }
+            in = readVarInt(in, end, &distance);
+            matchLen += SAVE_STATE_MIN_MATCH;
+            if (!in || distance <= 0 || distance > o || matchLen > outLen - o) {
+                return -1;
+            }
+            //may overlap, so copy forwards a byte at a time
+            for (i64 j = 0; j < matchLen; j++, o++) {
+                out[o] = out[o - distance];
+            }
+        }
+
+        return o;
+    }
+#undef SAVE_STATE_HASH_BITS
+#undef SAVE_STATE_MIN_MATCH
+
+    static i64 maxSaveStatePayloadSize(const MMU *mmu) {
+        //serialized fields are never larger than the structs they come from
+        return mmu->host->romNameLen + (i64)sizeof(CPU) + (i64)sizeof(MMU) + (i64)sizeof(GameBoyMemory) +
+               mmu->cartRAMSize + (i64)sizeof(RTCFileState) + KB(1);
+    }
+
+    //returns the size of the save state file built in fileData
+    static FileSystemResultCode buildSaveState(CPU *cpu, MMU *mmu, const char *romName, MemoryStack *memory,
+                                               u8 *fileData, i64 fileDataLen, i64 *outFileSize) {
+        i64 maxPayloadSize = maxSaveStatePayloadSize(mmu);
+        u8 *payload = PUSHMSTACK(memory, maxPayloadSize, u8);
+        if (!payload) {
+            return FileSystemResultCode::OutOfMemory;
+        }
+
+        SerializingState ss = {};
         ss.isWriting = true;
         ss.version = (SaveStateVersion)((i32)SaveStateVersion::CurrentPlusOne - 1);
-        ret = serialize(&ss.version, &ss);
-        if (ret != FileSystemResultCode::OK) {
-            CO_ERR("Could not save the version to save state!");
-            goto exit;
-        }
-        
-        ret = serialize(romName, mmu->romNameLen, &ss);
+        ss.data = payload;
+        ss.len = maxPayloadSize;
+        FileSystemResultCode ret = serialize((char*)romName, mmu->host->romNameLen, &ss);
         if (ret != FileSystemResultCode::OK) {
             CO_ERR("Could not save game state. Could not save rom name.");
             goto exit;
         }
-        ret = serialize(cpu, &ss);
+        ret = serializeChunks(cpu, mmu, &ss);
         if (ret != FileSystemResultCode::OK) {
-            CO_ERR("Could not save game state. Could not write CPU.");
-            goto exit; 
+            CO_ERR("Could not save game state.");
+            goto exit;
         }
 
-        ret = serialize(mmu, &ss);
-        if (ret != FileSystemResultCode::OK) {
-            CO_ERR("Could not save game state. Could not write MMU.");
-            goto exit; 
+        {
+            u32 payloadSize = (u32)ss.cursor;
+            u64 checksum = hashMemory(payload, payloadSize);
+            u32 flags = 0;
+            u32 storedSize = 0;
+            SerializingState *state = &ss;
+
+            ss.data = fileData;
+            ss.len = fileDataLen;
+            ss.cursor = 0;
+            ADD(ss.version, SaveStateVersion::Initial);
+            ADD(flags, SaveStateVersion::Chunked);
+            ADD(payloadSize, SaveStateVersion::Chunked);
+            i64 storedSizeOffset = ss.cursor;
+            ADD(storedSize, SaveStateVersion::Chunked);
+            ADD(checksum, SaveStateVersion::Chunked);
+
+            CO_ASSERT(ss.cursor + maxCompressedSaveStateSize(payloadSize) <= fileDataLen);
+            i64 compressedSize = compressSaveState(payload, payloadSize, fileData + ss.cursor);
+            if (compressedSize < payloadSize) {
+                flags |= SAVE_STATE_FLAG_COMPRESSED;
+                storedSize = (u32)compressedSize;
+            }
+            else {
+                copyMemory(payload, fileData + ss.cursor, payloadSize);
+                storedSize = payloadSize;
+            }
+            *outFileSize = ss.cursor + storedSize;
+
+            ss.cursor = storedSizeOffset;
+            ADD(storedSize, SaveStateVersion::Chunked);
+            ss.cursor = (i64)sizeof(ss.version);
+            ADD(flags, SaveStateVersion::Chunked);
         }
 
-        
-        ret = FileSystemResultCode::OK;
 exit:
-        fclose(f);
-        
-        if (ret == FileSystemResultCode::OK && didBackup) {
-            remove(backupPath);
+        POPMSTACK(payload, memory);
+        return ret;
+    }
+
+    //identifies the cartridge a snapshot was taken on, since restoring one from another cartridge
+    //would fail partway through, or worse, succeed
+    struct SnapshotHeader {
+        u64 romHash;
+        i64 romSize;
+        i64 cartRAMSize;
+        MBCType mbcType;
+        bool hasRAM;
+        bool hasBattery;
+        bool hasRTC;
+    };
+    static SnapshotHeader snapshotHeaderFor(const MMU *mmu) {
+        SnapshotHeader ret = {};
+        ret.romHash = mmu->romHash;
+        ret.romSize = mmu->romSize;
+        ret.cartRAMSize = mmu->cartRAMSize;
+        ret.mbcType = mmu->mbcType;
+        ret.hasRAM = mmu->hasRAM;
+        ret.hasBattery = mmu->hasBattery;
+        ret.hasRTC = mmu->hasRTC;
+        return ret;
+    }
+
+    i64 snapshotCapacity(const MMU *mmu) {
+        return (i64)sizeof(SnapshotHeader) + maxSaveStatePayloadSize(mmu);
+    }
+
+    bool initSnapshot(MMU *mmu, GameBoySnapshot *snapshot) {
+        snapshot->capacity = snapshotCapacity(mmu);
+        snapshot->data = (u8*)malloc((usize)snapshot->capacity);
+        snapshot->size = 0;
+        return snapshot->data != nullptr;
+    }
+
+    void freeSnapshot(GameBoySnapshot *snapshot) {
+        CO_FREE(snapshot->data);
+        *snapshot = {};
+    }
+
+    void snapshotGameBoy(CPU *cpu, MMU *mmu, GameBoySnapshot *snapshot) {
+        SnapshotHeader header = snapshotHeaderFor(mmu);
+        copyMemory(&header, snapshot->data, sizeof(header));
+
+        SerializingState ss = {};
+        ss.isWriting = true;
+        ss.version = (SaveStateVersion)((i32)SaveStateVersion::CurrentPlusOne - 1);
+        ss.data = snapshot->data;
+        ss.len = snapshot->capacity;
+        ss.cursor = (i64)sizeof(header);
+        auto res = serializeChunks(cpu, mmu, &ss);
+        CO_ASSERT(res == FileSystemResultCode::OK);
+        UNUSED(res);
+        snapshot->size = ss.cursor;
+    }
+
+    //Decodes the snapshot into outCPU and outMMU, which should start as copies of the state it's for.  VRAM,
+    //WRAM, cart RAM and the battery file's RTC are left where they are in the snapshot, at *outOffsets
+    static RestoreSnapshotResult decodeSnapshot(const GameBoySnapshot *snapshot, CPU *outCPU, MMU *outMMU,
+                                                DeferredMemoryOffsets *outOffsets) {
+        SnapshotHeader header;
+        if (snapshot->size < (i64)sizeof(header)) {
+            CO_ERR("Snapshot is truncated");
+            return RestoreSnapshotResult::Corrupt;
         }
-        else if (didBackup) {
-           auto copyRes = copyFile(backupPath, saveStateFileName, &programState->fileMemory); 
-           if (copyRes == FileSystemResultCode::OK) {
-               remove(backupPath);
-           }
-           else {
-               //TODO: need to communicate the backup location
-           }
+        copyMemory(snapshot->data, &header, sizeof(header));
+        SnapshotHeader expected = snapshotHeaderFor(outMMU);
+        if (header.romHash != expected.romHash || header.romSize != expected.romSize ||
+            header.cartRAMSize != expected.cartRAMSize || header.mbcType != expected.mbcType ||
+            header.hasRAM != expected.hasRAM || header.hasBattery != expected.hasBattery || header.hasRTC != expected.hasRTC) {
+            CO_ERR("Snapshot is for a different cartridge");
+            return RestoreSnapshotResult::WrongCartridge;
+        }
+        if (snapshot->size > snapshotCapacity(outMMU)) {
+            CO_ERR("Snapshot is corrupt. It is larger than any snapshot of this cartridge");
+            return RestoreSnapshotResult::Corrupt;
         }
 
-        return ret;
+        SerializingState ss = {};
+        ss.isWriting = false;
+        ss.version = (SaveStateVersion)((i32)SaveStateVersion::CurrentPlusOne - 1);
+        ss.data = snapshot->data;
+        ss.len = snapshot->size;
+        ss.cursor = (i64)sizeof(SnapshotHeader);
+        ss.shouldDeferMemories = true;
+        ss.deferredOffsets = {-1, -1, -1, -1};
+        if (serializeChunks(outCPU, outMMU, &ss) != FileSystemResultCode::OK) {
+            CO_ERR("Snapshot is corrupt");
+            return RestoreSnapshotResult::Corrupt;
+        }
+        //serializeChunks() already checked that the VRAM and WRAM chunks are there
+        if (outMMU->hasRAM && ss.deferredOffsets.cartRAM < 0) {
+            CO_ERR("Snapshot is corrupt. It is missing the cart RAM");
+            return RestoreSnapshotResult::Corrupt;
+        }
+        if (outMMU->hasRTC && ss.deferredOffsets.rtcFileState < 0) {
+            CO_ERR("Snapshot is corrupt. It is missing the RTC");
+            return RestoreSnapshotResult::Corrupt;
+        }
+        *outOffsets = ss.deferredOffsets;
+        return RestoreSnapshotResult::Success;
+    }
 
+    RestoreSnapshotResult checkSnapshot(const GameBoySnapshot *snapshot, const CPU *cpu, const MMU *mmu) {
+        CPU scratchCPU = *cpu;
+        MMU scratchMMU = *mmu;
+        DeferredMemoryOffsets offsets;
+        return decodeSnapshot(snapshot, &scratchCPU, &scratchMMU, &offsets);
+    }
+
+    RestoreSnapshotResult restoreSnapshot(const GameBoySnapshot *snapshot, CPU *cpu, MMU *mmu, GameBoyDebug *gbDebug) {
+        //a snapshot that doesn't decode all the way leaves the state as it was
+        CPU restoredCPU = *cpu;
+        MMU restoredMMU = *mmu;
+        DeferredMemoryOffsets offsets;
+        auto ret = decodeSnapshot(snapshot, &restoredCPU, &restoredMMU, &offsets);
+        if (ret != RestoreSnapshotResult::Success) {
+            return ret;
+        }
+
+        //pausing belongs to the debugger, not the snapshot
+        restoredCPU.isPaused = cpu->isPaused;
+        *cpu = restoredCPU;
+        *mmu = restoredMMU;
+        rebuildIORegisterCache(mmu);
+
+        copyMemory(snapshot->data + offsets.videoRAM, mmu->lcd.videoRAM, VIDEO_RAM_SIZE);
+        copyMemory(snapshot->data + offsets.workingRAM, mmu->workingRAM, WORKING_RAM_SIZE);
+        if (mmu->hasRAM) {
+            copyMemory(snapshot->data + offsets.cartRAM, mmu->cartRAM, mmu->cartRAMSize);
+            if (mmu->hasBattery && mmu->host->cartRAMPlatformState.cartRAMFileMap) {
+                copyMemory(mmu->cartRAM, mmu->host->cartRAMPlatformState.cartRAMFileMap, mmu->cartRAMSize);
+            }
+        }
+        //the clock is left as it was, and catches up the next time it is synced
+        if (mmu->hasRTC && mmu->host->cartRAMPlatformState.rtcFileMap) {
+            copyMemory(snapshot->data + offsets.rtcFileState, mmu->host->cartRAMPlatformState.rtcFileMap, sizeof(RTCFileState));
+        }
+
+        //the journal and any hit breakpoint belong to the timeline that was just left
+        gbDebug->hitBreakpoint = nullptr;
+        clearDebugJournal(gbDebug->journal);
+        gbDebug->shouldRefreshDisassembler = true;
+
+        return RestoreSnapshotResult::Success;
+    }
+
+    //the memories hashGameBoyState() hashes a page at a time, in the order they're copied into the hasher
+    static int stateHashMemories(MMU *mmu, u8 *outMemories[4], i64 outSizes[4]) {
+        int numMemories = 0;
+        outMemories[numMemories] = mmu->lcd.videoRAM;
+        outSizes[numMemories++] = VIDEO_RAM_SIZE;
+        outMemories[numMemories] = mmu->lcd.oam;
+        outSizes[numMemories++] = (i64)sizeof(mmu->lcd.oam);
+        outMemories[numMemories] = mmu->workingRAM;
+        outSizes[numMemories++] = WORKING_RAM_SIZE;
+        if (isChunkNeeded(SaveStateChunkTag::CartRAM, mmu)) {
+            outMemories[numMemories] = mmu->cartRAM;
+            outSizes[numMemories++] = mmu->cartRAMSize;
+        }
+        return numMemories;
+    }
+
+    void freeStateHasher(GameBoyStateHasher *hasher) {
+        CO_FREE(hasher->core);
+        CO_FREE(hasher->memories);
+        CO_FREE(hasher->pageHashes);
+        *hasher = {};
+    }
+
+    u64 hashGameBoyState(CPU *cpu, MMU *mmu, GameBoyStateHasher *hasher) {
+        u8 *memories[4];
+        i64 memorySizes[4];
+        int numMemories = stateHashMemories(mmu, memories, memorySizes);
+        i64 memoriesSize = 0, numPages = 0;
+        fori (numMemories) {
+            memoriesSize += memorySizes[i];
+            numPages += (memorySizes[i] + STATE_HASH_PAGE_SIZE - 1) / STATE_HASH_PAGE_SIZE;
+        }
+        bool isNewHasher = !hasher->memories || hasher->memoriesSize != memoriesSize;
+        if (isNewHasher) {
+            freeStateHasher(hasher);
+            hasher->coreCapacity = maxSaveStatePayloadSize(mmu);
+            hasher->core = CO_MALLOC(hasher->coreCapacity, u8);
+            hasher->memoriesSize = memoriesSize;
+            hasher->memories = CO_MALLOC(memoriesSize, u8);
+            hasher->numPages = numPages;
+            hasher->pageHashes = CO_MALLOC(numPages, u64);
+        }
+
+        //these depend on the host, not the game
+        bool wasPaused = cpu->isPaused;
+        i32 leftOverCycles = cpu->leftOverCyclesFromPreviousFrame;
+        cpu->isPaused = false;
+        cpu->leftOverCyclesFromPreviousFrame = 0;
+
+        SerializingState ss = {};
+        ss.isWriting = true;
+        ss.version = (SaveStateVersion)((i32)SaveStateVersion::CurrentPlusOne - 1);
+        ss.data = hasher->core;
+        ss.len = hasher->coreCapacity;
+        foriarr (saveStateChunks) {
+            SaveStateChunkTag tag = saveStateChunks[i];
+            if (!isChunkNeeded(tag, mmu) || tag == SaveStateChunkTag::VideoRAM || tag == SaveStateChunkTag::OAM ||
+                tag == SaveStateChunkTag::WorkingRAM || tag == SaveStateChunkTag::CartRAM) {
+                continue;
+            }
+            auto res = serializeChunk(tag, cpu, mmu, &ss);
+            CO_ASSERT(res == FileSystemResultCode::OK);
+            UNUSED(res);
+        }
+        cpu->isPaused = wasPaused;
+        cpu->leftOverCyclesFromPreviousFrame = leftOverCycles;
+
+        //A frame only writes to a few pages, and comparing a page is much cheaper than hashing it.
+        //The hash only depends on what's in the pages, not which ones were hashed again
+        u8 *copy = hasher->memories;
+        u64 *pageHash = hasher->pageHashes;
+        fori (numMemories) {
+            for (i64 offset = 0; offset < memorySizes[i]; offset += STATE_HASH_PAGE_SIZE) {
+                const u8 *page = memories[i] + offset;
+                i64 pageSize = MIN(STATE_HASH_PAGE_SIZE, memorySizes[i] - offset);
+                if (isNewHasher || memcmp(page, copy, (usize)pageSize) != 0) {
+                    copyMemory(page, copy, pageSize);
+                    *pageHash = hashMemory(page, pageSize);
+                }
+                copy += pageSize;
+                pageHash++;
+            }
+        }
+
+        u64 hash = hashMemory(hasher->core, ss.cursor);
+        return hashMemory(hasher->pageHashes, numPages * (i64)sizeof(u64), hash);
+    }
+
+    //the full path when there is one, since the working directory changes when another ROM is
+    //loaded while the write is queued
+    //false if the path doesn't fit in MAX_PATH_LEN
+    static bool saveStateFilePath(ProgramState *programState, int saveSlot, char *outPath) {
+        int len;
+        if (isEmptyString(programState->romSpecificPath)) {
+            len = snprintf(outPath, MAX_PATH_LEN + 1, "%s_%d.gbes", programState->loadedROMName, saveSlot);
+        }
+        else {
+            len = snprintf(outPath, MAX_PATH_LEN + 1, "%s" FILE_SEPARATOR "%s_%d.gbes",
+                           programState->romSpecificPath, programState->loadedROMName, saveSlot);
+        }
+        return len >= 0 && len <= MAX_PATH_LEN;
+    }
+
+    //what the save slot index shows for this state.  Each thumbnail pixel is the average shade
+    //of a SAVE_SLOT_THUMBNAIL_SCALE square of the screen
+    static void fillSaveSlotIndexEntry(CPU *cpu, MMU *mmu, SaveSlotIndexEntry *entry) {
+        zeroMemory(entry, sizeof(SaveSlotIndexEntry));
+        entry->isUsed = 1;
+        entry->timestamp = unixWallClockTime();
+        entry->frameCount = cpu->totalCycles / CYCLES_PER_FRAME;
+
+        const PaletteColor *screen = mmu->lcd.screen;
+        const int blockSize = SAVE_SLOT_THUMBNAIL_SCALE * SAVE_SLOT_THUMBNAIL_SCALE;
+        for (int y = 0; y < SAVE_SLOT_THUMBNAIL_HEIGHT; y++) {
+            for (int x = 0; x < SAVE_SLOT_THUMBNAIL_WIDTH; x++) {
+                int sum = 0;
+                const PaletteColor *block = screen + (y * SCREEN_WIDTH + x) * SAVE_SLOT_THUMBNAIL_SCALE;
+                for (int by = 0; by < SAVE_SLOT_THUMBNAIL_SCALE; by++) {
+                    for (int bx = 0; bx < SAVE_SLOT_THUMBNAIL_SCALE; bx++) {
+                        sum += (int)block[by * SCREEN_WIDTH + bx];
+                    }
+                }
+                int shade = (sum + blockSize / 2) / blockSize;
+                int pixel = y * SAVE_SLOT_THUMBNAIL_WIDTH + x;
+                entry->thumbnail[pixel / 4] |= (u8)(shade << ((pixel % 4) * 2));
+            }
+        }
+    }
+
+    //Captures the state into memory and queues it to be written.  The result of the write is
+    //reported by popSaveStateWriteResult()
+    static FileSystemResultCode saveSaveStateToFile(CPU *cpu, MMU *mmu, ProgramState *programState, int saveSlot) {
+        CO_ASSERT(saveSlot >= 0 && saveSlot <= 9);
+        char *romName = programState->loadedROMName;
+        char saveStatePath[MAX_PATH_LEN + 1];
+        if (!saveStateFilePath(programState, saveSlot, saveStatePath)) {
+            CO_ERR("Save state path is too long");
+            return FileSystemResultCode::Unknown;
+        }
+
+        //version and header, then the payload, which is stored uncompressed if compressing doesn't help
+        i64 maxFileSize = 64 + maxCompressedSaveStateSize(maxSaveStatePayloadSize(mmu));
+        u8 *fileData = CO_MALLOC(maxFileSize, u8);
+        if (!fileData) {
+            return FileSystemResultCode::OutOfMemory;
+        }
+        i64 fileSize = 0;
+        auto ret = buildSaveState(cpu, mmu, romName, &programState->fileMemory, fileData, maxFileSize, &fileSize);
+        if (ret != FileSystemResultCode::OK) {
+            CO_FREE(fileData);
+            return ret;
+        }
+
+        SaveSlotIndexEntry indexEntry;
+        fillSaveSlotIndexEntry(cpu, mmu, &indexEntry);
+        queueSaveStateWrite(fileData, fileSize, saveSlot, saveStatePath, &indexEntry, &programState->saveStateWriter);
+
+        return FileSystemResultCode::OK;
     }
 
     enum class RestoreSaveResult {
@@ -526,76 +1143,166 @@ exit:
         Error
     };
 
-    static RestoreSaveResult restoreSaveStateFromFile(CPU *cpu, MMU *mmu, const char *romName, int saveSlot) {
+    //reads the header of a chunked save state and points state at the checked payload, decompressing
+    //it into memory if needed.  *outDecompressed is set to what needs to be popped off memory afterwards
+    static FileSystemResultCode readSaveStatePayload(SerializingState *state, MMU *mmu, MemoryStack *memory, u8 **outDecompressed) {
+        *outDecompressed = nullptr;
+        u32 flags = 0, payloadSize = 0, storedSize = 0;
+        u64 checksum = 0;
+        ADD(flags, SaveStateVersion::Chunked);
+        ADD(payloadSize, SaveStateVersion::Chunked);
+        ADD(storedSize, SaveStateVersion::Chunked);
+        ADD(checksum, SaveStateVersion::Chunked);
+        if (flags & ~(u32)SAVE_STATE_FLAG_COMPRESSED) {
+            CO_ERR("Save state has unknown flags");
+            return FileSystemResultCode::Unknown;
+        }
+        if (storedSize != state->len - state->cursor) {
+            CO_ERR("Save state is truncated");
+            return FileSystemResultCode::Unknown;
+        }
+        if (payloadSize > maxSaveStatePayloadSize(mmu)) {
+            CO_ERR("Save state is corrupt. Payload is too large.");
+            return FileSystemResultCode::Unknown;
+        }
+
+        u8 *payload = state->data + state->cursor;
+        if (flags & SAVE_STATE_FLAG_COMPRESSED) {
+            u8 *decompressed = PUSHMSTACK(memory, payloadSize, u8);
+            if (!decompressed) {
+                return FileSystemResultCode::OutOfMemory;
+            }
+            *outDecompressed = decompressed;
+            if (decompressSaveState(payload, storedSize, decompressed, payloadSize) != payloadSize) {
+                CO_ERR("Save state is corrupt. Could not decompress it.");
+                return FileSystemResultCode::Unknown;
+            }
+            payload = decompressed;
+        }
+        else if (storedSize != payloadSize) {
+            CO_ERR("Save state is truncated");
+            return FileSystemResultCode::Unknown;
+        }
+        if (hashMemory(payload, payloadSize) != checksum) {
+            CO_ERR("Save state is corrupt. Checksum does not match.");
+            return FileSystemResultCode::Unknown;
+        }
+
+        state->data = payload;
+        state->len = payloadSize;
+        state->cursor = 0;
+        return FileSystemResultCode::OK;
+    }
+
+    static RestoreSaveResult restoreSaveStateFromFile(CPU *cpu, MMU *mmu, ProgramState *programState, int saveSlot) {
         CO_ASSERT(saveSlot >= 0 && saveSlot <= 9);
-        char *tmpROMNamePtr = mmu->romName;
-        CartRAMPlatformState tmpCartRAMPlatformState = mmu->cartRAMPlatformState;
+        const char *romName = programState->loadedROMName;
+        MemoryStack *fileMemory = &programState->fileMemory;
         u8 *tmpROM = mmu->romData;
         char tmpROMName[MAX_ROM_NAME_LEN + 1] = {};
-        
+        RestoreSaveResult ret = RestoreSaveResult::Error;
+        u8 *decompressed = nullptr;
+        FileSystemResultCode res;
+
         CPU backupCPU = *cpu;
         MMU backupMMU = *mmu;
-        
-        char *saveStateFileName = nullptr; 
-        buf_gen_memory_printf(saveStateFileName, "%s_%d.gbes", romName, saveSlot);
-        
-        FILE *f = fopen(saveStateFileName, "rb");
-        if (!f) {
+        GameBoyMemory backupMemory;
+        copyMemory(mmu->lcd.videoRAM, backupMemory.videoRAM, VIDEO_RAM_SIZE);
+        copyMemory(mmu->workingRAM, backupMemory.workingRAM, WORKING_RAM_SIZE);
+
+        //the slot may still be being written
+        flushSaveStateWriter(&programState->saveStateWriter);
+        char saveStatePath[MAX_PATH_LEN + 1];
+        if (!saveStateFilePath(programState, saveSlot, saveStatePath)) {
+            CO_ERR("Save state path is too long");
+            return RestoreSaveResult::Error;
+        }
+        //one read for the whole file
+        auto fileResult = readEntireFile(saveStatePath, fileMemory);
+        if (fileResult.resultCode == FileSystemResultCode::NotFound) {
             return RestoreSaveResult::NothingInSlot;
         }
-        buf_gen_memory_free(saveStateFileName);
+        else if (fileResult.resultCode != FileSystemResultCode::OK) {
+            CO_ERR("Could not read save state");
+            return RestoreSaveResult::Error;
+        }
 
-        SerializingState ss;
-        ss.f = f;
+        SerializingState ss = {};
         ss.isWriting = false;
-        auto res = serialize(&ss.version, &ss);
+        ss.data = fileResult.data;
+        ss.len = fileResult.size;
+        res = serialize(&ss.version, &ss);
         if (res != FileSystemResultCode::OK) {
             CO_ERR("Could not read version number of save state");
-            return RestoreSaveResult::Error;
+            goto exit;
+        }
+        if (ss.version >= SaveStateVersion::CurrentPlusOne) {
+            CO_ERR("Save state is from a newer version of GBEmu");
+            goto exit;
+        }
+        if (ss.version >= SaveStateVersion::Chunked) {
+            res = readSaveStatePayload(&ss, mmu, fileMemory, &decompressed);
+            if (res != FileSystemResultCode::OK) {
+                goto exit;
+            }
         }
-        res = serialize(tmpROMName, mmu->romNameLen, &ss);
+
+        res = serialize(tmpROMName, mmu->host->romNameLen, &ss);
         if (res != FileSystemResultCode::OK) {
             CO_ERR("Could not restore game state save. Could not read rom name.");
-            fclose(f);
-            return RestoreSaveResult::Error;
+            goto exit;
         }
 
-        if (!areStringsEqual(romName, tmpROMName, mmu->romNameLen)) {
+        if (!areStringsEqual(romName, tmpROMName, mmu->host->romNameLen)) {
             CO_ERR("Save state is not for this rom! Actual %s, Expected %s", tmpROMName, romName);
-            fclose(f);
-            return RestoreSaveResult::Error;
+            goto exit;
         }
 
-        res = serialize(cpu, &ss);
-        if (res != FileSystemResultCode::OK) {
-            CO_ERR("Could not load game state. Could not load CPU.");
-            goto error; 
+        if (ss.version >= SaveStateVersion::Chunked) {
+            res = serializeChunks(cpu, mmu, &ss);
+            if (res != FileSystemResultCode::OK) {
+                CO_ERR("Could not load game state.");
+                goto error;
+            }
         }
+        else {
+            res = serialize(cpu, &ss);
+            if (res != FileSystemResultCode::OK) {
+                CO_ERR("Could not load game state. Could not load CPU.");
+                goto error;
+            }
 
-        res = serialize(mmu, &ss);
-        if (res != FileSystemResultCode::OK) {
-            CO_ERR("Could not load game state. Could not load MMU.");
-            goto error; 
+            mmu->currentCycle = cpu->totalCycles;
+            res = serialize(mmu, &ss);
+            if (res != FileSystemResultCode::OK) {
+                CO_ERR("Could not load game state. Could not load MMU.");
+                goto error;
+            }
         }
+        rebuildIORegisterCache(mmu);
 
         if (mmu->hasRAM && mmu->hasBattery) {
-            mmu->cartRAMPlatformState = tmpCartRAMPlatformState;
             usize expectedRAMLen = (usize)mmu->cartRAMSize;
             if (mmu->hasRTC) expectedRAMLen += sizeof(RTCFileState);
-            if (expectedRAMLen != mmu->cartRAMPlatformState.ramLen) {
+            if (expectedRAMLen != mmu->host->cartRAMPlatformState.ramLen) {
                 goto error;
             }
-            copyMemory(mmu->cartRAM, mmu->cartRAMPlatformState.cartRAMFileMap, mmu->cartRAMSize);
+            copyMemory(mmu->cartRAM, mmu->host->cartRAMPlatformState.cartRAMFileMap, mmu->cartRAMSize);
         }
 
-        mmu->romName = tmpROMNamePtr;
         mmu->romData = tmpROM;
 
-        fclose(f);
-        return RestoreSaveResult::Success;
+        ret = RestoreSaveResult::Success;
+        goto exit;
 error:
         *cpu = backupCPU;
         *mmu = backupMMU;
-        fclose(f);
-        return RestoreSaveResult::Error;
+        copyMemory(backupMemory.videoRAM, mmu->lcd.videoRAM, VIDEO_RAM_SIZE);
+        copyMemory(backupMemory.workingRAM, mmu->workingRAM, WORKING_RAM_SIZE);
+exit:
+        if (decompressed) {
+            POPMSTACK(decompressed, fileMemory);
+        }
+        freeFileBuffer(&fileResult, fileMemory);
+        return ret;
     }
@@ -0,0 +1,48 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Telling when a test ROM has passed, for the runners that take them.  Included after headless.cpp.
+
+enum class TestROMResult {
+    Running, Passed, Failed
+};
+
+static bool doesSerialOutputEndWith(const SerialOutput *output, const u8 *bytes, i64 len) {
+    return output->len >= len && isMemoryEqual(output->data + output->len - len, bytes, len);
+}
+
+static bool doesSerialOutputContain(const SerialOutput *output, const char *str) {
+    i64 len = stringLength(str);
+    for (i64 i = 0; i + len <= output->len; i++) {
+        if (isMemoryEqual(output->data + i, str, len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//Blargg's test ROMs print "Passed" or "Failed" over serial.  Mooneye's send 3, 5, 8, 13, 21 and 34 when they pass
+//and six 0x42s when they fail, and leave the same in B, C, D, E, H and L before jumping to themselves forever
+static TestROMResult testROMResult(HeadlessGameBoy *gb) {
+    const SerialOutput *output = &gb->mmu->host->serialOutput;
+    const u8 mooneyePass[] = {3, 5, 8, 13, 21, 34};
+    const u8 mooneyeFail[] = {0x42, 0x42, 0x42, 0x42, 0x42, 0x42};
+    if (doesSerialOutputContain(output, "Passed") || doesSerialOutputEndWith(output, mooneyePass, ARRAY_LEN(mooneyePass))) {
+        return TestROMResult::Passed;
+    }
+    if (doesSerialOutputContain(output, "Failed") || doesSerialOutputEndWith(output, mooneyeFail, ARRAY_LEN(mooneyeFail))) {
+        return TestROMResult::Failed;
+    }
+
+    CPU *cpu = gb->cpu;
+    bool isLoopingForever = readByte(cpu->PC, gb->mmu) == 0x18 && readByte((u16)(cpu->PC + 1), gb->mmu) == 0xFE; //JR -2
+    if (isLoopingForever) {
+        const u8 registers[] = {cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L};
+        if (isMemoryEqual(registers, mooneyePass, ARRAY_LEN(registers))) {
+            return TestROMResult::Passed;
+        }
+        if (isMemoryEqual(registers, mooneyeFail, ARRAY_LEN(registers))) {
+            return TestROMResult::Failed;
+        }
+    }
+    return TestROMResult::Running;
+}
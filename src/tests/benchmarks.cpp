@@ -0,0 +1,1156 @@
+//Copyright (C) 2018 Daniel Bokser.  See LICENSE.txt for license
+
+//Benchmarks for the emulator core.  Runs small generated ROMs, so no files are needed, plus any ROMs
+//given on the command line.  Every result is written to a JSON file, which a later run can be compared
+//against to catch regressions.
+//
+//	bench [-o results] [-c baseline] [-t percent] [-f frames] [[-i script] file.gb ...]
+
+#define CO_IMPL
+#include "../common.h"
+#define GB_IMPL
+#include "../gbemu.cpp"
+#include "../headless.cpp"
+#include "../testrom.cpp"
+#include "../libgbemu.cpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define BENCH_ROM_SIZE 0x8000
+#define BENCH_CART_RAM_SIZE KB(8)
+#define BENCH_SNAPSHOT_ITERATIONS 100000
+#define BENCH_FRAMES 600
+#define BENCH_STEP_FRAMES 3000
+#define BENCH_CACHE_LINE_SIZE 64
+#define BENCH_MOVIE_FRAMES 1000
+#define BENCH_MOVIE_PATH "bench." MOVIE_FILE_EXTENSION
+#define BENCH_RUN_AHEAD_FRAMES 300
+#define BENCH_TURBO_SPEED 8
+#define BENCH_TURBO_HOST_FRAMES 75
+#define BENCH_HOST_FRAME_TIME_US 16667
+#define BENCH_VEC_ENVS 16
+#define BENCH_VEC_FRAMES 60
+#define BENCH_CPU_INSTRUCTIONS 5000000
+#define BENCH_MEMORY_OPS 2000000
+#define BENCH_SCAN_LINES (SCREEN_HEIGHT * 2000)
+#define BENCH_SOUND_STEPS 5000000
+#define BENCH_JOURNAL_FRAMES 600
+#define BENCH_SAVE_STATE_ITERATIONS 2000
+#define BENCH_SUBROUTINE_ADDRESS 0x150
+#define DEFAULT_BENCH_ROM_FRAMES 3600
+#define DEFAULT_RESULTS_PATH "bench_results.json"
+#define DEFAULT_REGRESSION_PERCENT 10.
+#define MAX_BENCH_NAME_LEN 64
+
+struct BenchMachine {
+    CPU cpu;
+    MMU mmu;
+    GameBoyMemory memory;
+    MMUHost host;
+    u8 rom[BENCH_ROM_SIZE];
+    u8 cartRAM[BENCH_CART_RAM_SIZE];
+    PaletteColor screen[SCREEN_WIDTH*SCREEN_HEIGHT];
+    PaletteColor backBuffer[SCREEN_WIDTH*SCREEN_HEIGHT];
+    SoundFrame soundFrames[4096];
+};
+
+//Enables cart RAM, then forever increments every byte of 1KB of WRAM and 512 bytes of cart RAM,
+//and decrements 256 bytes of VRAM
+static const u8 benchProgram[] = {
+    0x3E, 0x0A,             //LD A,0x0A
+    0xEA, 0x00, 0x00,       //LD (0x0000),A
+    0x21, 0x00, 0xC0,       //loop: LD HL,0xC000
+    0x34,                   //INC (HL)
+    0x23,                   //INC HL
+    0x7C,                   //LD A,H
+    0xFE, 0xC4,             //CP 0xC4
+    0x20, 0xF9,             //JR NZ,-7
+    0x21, 0x00, 0xA0,       //LD HL,0xA000
+    0x34,                   //INC (HL)
+    0x23,                   //INC HL
+    0x7C,                   //LD A,H
+    0xFE, 0xA2,             //CP 0xA2
+    0x20, 0xF9,             //JR NZ,-7
+    0x21, 0x00, 0x80,       //LD HL,0x8000
+    0x35,                   //DEC (HL)
+    0x2C,                   //INC L
+    0x20, 0xFC,             //JR NZ,-4
+    0xC3, 0x05, 0x01,       //JP loop
+};
+
+//framesPerSecond is 0 for results that aren't a whole frame
+struct BenchResult {
+    char name[MAX_BENCH_NAME_LEN];
+    double nsPerOp;
+    double framesPerSecond;
+};
+static BenchResult *benchResults; //buf_malloc
+
+static double nsPerOp(TimeUS elapsedTime, i64 numOps) {
+    return (double)elapsedTime * 1000. / (double)numOps;
+}
+
+static void addBenchResult(const char *name, double nsPerOp, bool isPerFrame) {
+    BenchResult result = {};
+    copyString(name, result.name, MAX_BENCH_NAME_LEN - 1);
+    result.nsPerOp = nsPerOp;
+    result.framesPerSecond = (isPerFrame && nsPerOp > 0) ? 1000000000. / nsPerOp : 0;
+    buf_malloc_push(benchResults, result);
+}
+
+static void resetBenchMachine(BenchMachine *machine, GameBoyDebug *gbDebug, ProgramState *programState) {
+    CPU *cpu = &machine->cpu;
+    MMU *mmu = &machine->mmu;
+    zeroMemory(machine->rom, BENCH_ROM_SIZE);
+    copyMemory(benchProgram, machine->rom + 0x100, sizeof(benchProgram));
+
+    mmu->romData = machine->rom;
+    mmu->romSize = BENCH_ROM_SIZE;
+    mmu->host->romName = programState->loadedROMName;
+    mmu->mbcType = MBCType::MBC1;
+    mmu->cartRAM = machine->cartRAM;
+    mmu->cartRAMSize = BENCH_CART_RAM_SIZE;
+    mmu->hasRAM = true;
+    mmu->lcd.screen = machine->screen;
+    mmu->lcd.backBuffer = machine->backBuffer;
+    mmu->host->soundFramesBuffer.data = machine->soundFrames;
+    mmu->host->soundFramesBuffer.len = ARRAY_LEN(machine->soundFrames);
+    reset(cpu, mmu, gbDebug, programState);
+
+    //sound on, so the APU is part of the state
+    writeByte(0x80, 0xFF26, mmu, gbDebug);
+    writeByte(0x80, 0xFF12, mmu, gbDebug);
+    writeByte(0x87, 0xFF14, mmu, gbDebug);
+}
+
+static void runBenchFrames(i64 numFrames, BenchMachine *machine, GameBoyDebug *gbDebug) {
+    i64 endCycle = machine->cpu.totalCycles + numFrames * CYCLES_PER_FRAME;
+    while (machine->cpu.totalCycles < endCycle) {
+        step(&machine->cpu, &machine->mmu, gbDebug, 0);
+        //queued sound is never played, so keep it from filling up
+        clear(&machine->mmu.host->soundFramesBuffer);
+    }
+}
+
+static bool areSnapshotsEqual(const GameBoySnapshot *a, const GameBoySnapshot *b) {
+    if (a->size != b->size) {
+        return false;
+    }
+    return memcmp(a->data, b->data, (usize)a->size) == 0;
+}
+
+static bool benchSnapshots(BenchMachine *machine, GameBoyDebug *gbDebug, const char *name, const char *id) {
+    CPU *cpu = &machine->cpu;
+    MMU *mmu = &machine->mmu;
+    GameBoySnapshot snapshot, replayed;
+    GameBoyStateHasher stateHasher = {}, freshStateHasher = {};
+    if (!initSnapshot(mmu, &snapshot) || !initSnapshot(mmu, &replayed)) {
+        PRINT_ERR("Could not allocate snapshots.");
+        return false;
+    }
+
+    runBenchFrames(10, machine, gbDebug);
+
+    TimeUS start = nowInMicroseconds();
+    fori (BENCH_SNAPSHOT_ITERATIONS) {
+        snapshotGameBoy(cpu, mmu, &snapshot);
+    }
+    TimeUS snapshotTime = nowInMicroseconds() - start;
+
+    start = nowInMicroseconds();
+    fori (BENCH_SNAPSHOT_ITERATIONS) {
+        restoreSnapshot(&snapshot, cpu, mmu, gbDebug);
+    }
+    TimeUS restoreTime = nowInMicroseconds() - start;
+
+    //hashed after every frame, like movies and the batch runner do, so it's timed with the pages a frame
+    //writes to changed since the last hash
+    u64 stateHash = hashGameBoyState(cpu, mmu, &stateHasher);
+    TimeUS hashTime = 0;
+    start = nowInMicroseconds();
+    fori (BENCH_FRAMES) {
+        runBenchFrames(1, machine, gbDebug);
+        TimeUS hashStart = nowInMicroseconds();
+        stateHash ^= hashGameBoyState(cpu, mmu, &stateHasher);
+        hashTime += nowInMicroseconds() - hashStart;
+    }
+    TimeUS frameTime = nowInMicroseconds() - start - hashTime;
+
+    //running the same frames from a restored snapshot has to end in the same state
+    snapshotGameBoy(cpu, mmu, &snapshot);
+    runBenchFrames(5, machine, gbDebug);
+    snapshotGameBoy(cpu, mmu, &replayed);
+    restoreSnapshot(&snapshot, cpu, mmu, gbDebug);
+    runBenchFrames(5, machine, gbDebug);
+    snapshotGameBoy(cpu, mmu, &snapshot);
+    bool isDeterministic = areSnapshotsEqual(&snapshot, &replayed);
+
+    //the same state has to hash the same after a round trip, and a different one differently
+    restoreSnapshot(&snapshot, cpu, mmu, gbDebug);
+    u64 hashBeforeFrame = hashGameBoyState(cpu, mmu, &stateHasher);
+    isDeterministic &= hashBeforeFrame == hashGameBoyState(cpu, mmu, &stateHasher);
+    runBenchFrames(1, machine, gbDebug);
+    u64 hashAfterFrame = hashGameBoyState(cpu, mmu, &stateHasher);
+    isDeterministic &= hashBeforeFrame != hashAfterFrame;
+    //only hashing the pages that changed has to give the same hash as hashing all of them
+    isDeterministic &= hashAfterFrame == hashGameBoyState(cpu, mmu, &freshStateHasher);
+
+    double hashUS = (double)hashTime / BENCH_FRAMES;
+    double frameUS = (double)frameTime / BENCH_FRAMES;
+    PRINT("%s: snapshot %.2fus, restore %.2fus, state hash %.2fus (%.2f%% of a %.0fus frame), %" PRId64 " bytes",
+          name, (double)snapshotTime / BENCH_SNAPSHOT_ITERATIONS, (double)restoreTime / BENCH_SNAPSHOT_ITERATIONS,
+          hashUS, 100. * hashUS / frameUS, frameUS, snapshot.size);
+    UNUSED(stateHash);
+    char resultName[MAX_BENCH_NAME_LEN];
+    snprintf(resultName, MAX_BENCH_NAME_LEN, "%s/snapshot", id);
+    addBenchResult(resultName, nsPerOp(snapshotTime, BENCH_SNAPSHOT_ITERATIONS), false);
+    snprintf(resultName, MAX_BENCH_NAME_LEN, "%s/restore", id);
+    addBenchResult(resultName, nsPerOp(restoreTime, BENCH_SNAPSHOT_ITERATIONS), false);
+    snprintf(resultName, MAX_BENCH_NAME_LEN, "%s/hash", id);
+    addBenchResult(resultName, nsPerOp(hashTime, BENCH_FRAMES), false);
+    if (!isDeterministic) {
+        PRINT_ERR("%s: replaying from a restored snapshot diverged.", name);
+    }
+
+    freeStateHasher(&freshStateHasher);
+    freeStateHasher(&stateHasher);
+    freeSnapshot(&replayed);
+    freeSnapshot(&snapshot);
+    return isDeterministic;
+}
+
+//the same steps runFrame takes while a movie is active
+static void runMovieFrame(BenchMachine *machine, GameBoyDebug *gbDebug, Movie *movie) {
+    updateMovieFrame(&machine->cpu, &machine->mmu, gbDebug, movie);
+    i32 cyclesToExecute = CYCLES_PER_FRAME;
+    while (cyclesToExecute > 0) {
+        step(&machine->cpu, &machine->mmu, gbDebug, 0);
+        cyclesToExecute -= machine->cpu.instructionCycles;
+    }
+    clear(&machine->mmu.host->soundFramesBuffer);
+}
+
+static bool benchMovies(BenchMachine *machine, GameBoyDebug *gbDebug, ProgramState *programState) {
+    CPU *cpu = &machine->cpu;
+    MMU *mmu = &machine->mmu;
+    Movie *movie = &programState->movie;
+    GameBoySnapshot recorded, played;
+    if (!initSnapshot(mmu, &recorded) || !initSnapshot(mmu, &played)) {
+        PRINT_ERR("Could not allocate snapshots.");
+        return false;
+    }
+
+    bool didPass = false;
+    TimeUS seekTime;
+    if (!startMovieRecording(BENCH_MOVIE_PATH, true, cpu, mmu, gbDebug, programState)) {
+        PRINT_ERR("Could not start recording a movie.");
+        goto exit;
+    }
+    fori (BENCH_MOVIE_FRAMES) {
+        JoyPad *joyPad = &mmu->joyPad;
+        joyPad->a = (i % 3 == 0) ? JPButtonState::Down : JPButtonState::Up;
+        joyPad->right = (i % 7 < 3) ? JPButtonState::Down : JPButtonState::Up;
+        runMovieFrame(machine, gbDebug, movie);
+    }
+    snapshotGameBoy(cpu, mmu, &recorded);
+    if (stopMovie(cpu, mmu, gbDebug, programState) != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not write the movie.");
+        goto exit;
+    }
+
+    //played somewhere else, so playback has to bring back the movie's start
+    runBenchFrames(3, machine, gbDebug);
+    if (!startMoviePlayback(BENCH_MOVIE_PATH, cpu, mmu, gbDebug, programState)) {
+        PRINT_ERR("Could not play the movie.");
+        goto exit;
+    }
+    while (movie->currentFrame < (i64)buf_len(movie->inputs)) {
+        runMovieFrame(machine, gbDebug, movie);
+    }
+    snapshotGameBoy(cpu, mmu, &played);
+    if (!areSnapshotsEqual(&recorded, &played) || movie->desyncFrame >= 0) {
+        PRINT_ERR("Movie playback diverged from the recording.");
+        goto exit;
+    }
+
+    seekMovie(BENCH_MOVIE_FRAMES / 2, cpu, mmu, gbDebug, movie);
+    seekTime = nowInMicroseconds();
+    seekMovie(BENCH_MOVIE_FRAMES - 1, cpu, mmu, gbDebug, movie);
+    seekTime = nowInMicroseconds() - seekTime;
+    runMovieFrame(machine, gbDebug, movie);
+    snapshotGameBoy(cpu, mmu, &played);
+    if (!areSnapshotsEqual(&recorded, &played)) {
+        PRINT_ERR("Seeking in the movie diverged from the recording.");
+        goto exit;
+    }
+    PRINT("Movies: %d frames, seek %.2fms", BENCH_MOVIE_FRAMES, (double)seekTime / 1000.);
+    addBenchResult("movie/seek", nsPerOp(seekTime, 1), false);
+    didPass = true;
+
+exit:
+    stopMovie(cpu, mmu, gbDebug, programState);
+    remove(BENCH_MOVIE_PATH);
+    freeSnapshot(&played);
+    freeSnapshot(&recorded);
+    return didPass;
+}
+
+//Run-ahead has to leave the real state as it found it, and both modes have to show the same screen
+static bool benchRunAhead(BenchMachine *machine, GameBoyDebug *gbDebug) {
+    CPU *cpu = &machine->cpu;
+    MMU *mmu = &machine->mmu;
+    GameBoySnapshot before, after;
+    RunAhead sameInstance, secondInstance;
+    PaletteColor *sameInstanceScreen = CO_MALLOC(SCREEN_WIDTH * SCREEN_HEIGHT, PaletteColor);
+    if (!initSnapshot(mmu, &before) || !initSnapshot(mmu, &after) || !sameInstanceScreen ||
+        !initRunAhead(MAX_RUN_AHEAD_FRAMES, RunAheadMode::SameInstance, mmu, &sameInstance) ||
+        !initRunAhead(MAX_RUN_AHEAD_FRAMES, RunAheadMode::SecondInstance, mmu, &secondInstance)) {
+        PRINT_ERR("Could not allocate run-ahead.");
+        return false;
+    }
+    startRunAheadWorker(&secondInstance);
+
+    bool didPass = true;
+    TimeUS frameTime = 0, sameInstanceTime = 0, secondInstanceTime = 0;
+    fori (BENCH_RUN_AHEAD_FRAMES) {
+        TimeUS start = nowInMicroseconds();
+        runBenchFrames(1, machine, gbDebug);
+        frameTime += nowInMicroseconds() - start;
+        snapshotGameBoy(cpu, mmu, &before);
+
+        start = nowInMicroseconds();
+        runAheadOfFrame(cpu, mmu, gbDebug, &sameInstance);
+        copyMemory(finishRunAhead(mmu, &sameInstance), sameInstanceScreen, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(PaletteColor));
+        sameInstanceTime += nowInMicroseconds() - start;
+        snapshotGameBoy(cpu, mmu, &after);
+        didPass &= areSnapshotsEqual(&before, &after);
+
+        start = nowInMicroseconds();
+        runAheadOfFrame(cpu, mmu, gbDebug, &secondInstance);
+        const PaletteColor *secondInstanceScreen = finishRunAhead(mmu, &secondInstance);
+        secondInstanceTime += nowInMicroseconds() - start;
+        snapshotGameBoy(cpu, mmu, &after);
+        didPass &= areSnapshotsEqual(&before, &after);
+        didPass &= memcmp(sameInstanceScreen, secondInstanceScreen, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(PaletteColor)) == 0;
+    }
+
+    //the second instance only overlaps with the platform layer's work, which there is none of here
+    double frameUS = (double)frameTime / BENCH_RUN_AHEAD_FRAMES;
+    PRINT("Run-ahead of %d frames: same instance %.2fus, second instance %.2fus, against a %.0fus frame",
+          MAX_RUN_AHEAD_FRAMES, (double)sameInstanceTime / BENCH_RUN_AHEAD_FRAMES,
+          (double)secondInstanceTime / BENCH_RUN_AHEAD_FRAMES, frameUS);
+    addBenchResult("run_ahead/same_instance", nsPerOp(sameInstanceTime, BENCH_RUN_AHEAD_FRAMES), false);
+    addBenchResult("run_ahead/second_instance", nsPerOp(secondInstanceTime, BENCH_RUN_AHEAD_FRAMES), false);
+    if (!didPass) {
+        PRINT_ERR("Run-ahead changed the real state, or the two modes diverged.");
+    }
+
+    freeRunAhead(&secondInstance);
+    freeRunAhead(&sameInstance);
+    CO_FREE(sameInstanceScreen);
+    freeSnapshot(&after);
+    freeSnapshot(&before);
+    return didPass;
+}
+
+//Turbo only cuts the sound, so whether it's heard can't change the state
+static bool benchTurbo(BenchMachine *machine, GameBoyDebug *gbDebug, ProgramState *programState) {
+    CPU *cpu = &machine->cpu;
+    MMU *mmu = &machine->mmu;
+    GameBoySnapshot start, soundOff, after;
+    if (!initSnapshot(mmu, &start) || !initSnapshot(mmu, &soundOff) || !initSnapshot(mmu, &after)) {
+        PRINT_ERR("Could not allocate snapshots.");
+        return false;
+    }
+    snapshotGameBoy(cpu, mmu, &start);
+
+    const TurboSound sounds[] = {TurboSound::Off, TurboSound::Compressed};
+    const char *ids[] = {"turbo/sound_off", "turbo/sound_compressed"};
+    double frameUS[ARRAY_LEN(sounds)];
+    bool didPass = true;
+    Turbo *turbo = &programState->turbo;
+    foriarr (sounds) {
+        restoreSnapshot(&start, cpu, mmu, gbDebug);
+        *turbo = {};
+        turbo->speed = BENCH_TURBO_SPEED;
+        turbo->sound = sounds[i];
+        i64 startCycle = cpu->totalCycles;
+        TimeUS startTime = nowInMicroseconds();
+        for (i64 j = 0; j < BENCH_TURBO_HOST_FRAMES; j++) {
+            runTurboFrames(cpu, mmu, gbDebug, programState, BENCH_HOST_FRAME_TIME_US);
+            clear(&mmu->host->soundFramesBuffer);
+        }
+        TimeUS elapsed = nowInMicroseconds() - startTime;
+        i64 numFrames = (cpu->totalCycles - startCycle) / CYCLES_PER_FRAME;
+        frameUS[i] = (double)elapsed / (double)numFrames;
+        addBenchResult(ids[i], nsPerOp(elapsed, numFrames), true);
+
+        if (sounds[i] == TurboSound::Off) {
+            snapshotGameBoy(cpu, mmu, &soundOff);
+        }
+        else {
+            snapshotGameBoy(cpu, mmu, &after);
+            didPass &= areSnapshotsEqual(&soundOff, &after);
+        }
+    }
+    *turbo = {};
+
+    PRINT("Turbo at %dx: %.2fus a frame with sound off, %.2fus with it compressed",
+          BENCH_TURBO_SPEED, frameUS[0], frameUS[1]);
+    if (!didPass) {
+        PRINT_ERR("Turbo's sound changed the state.");
+    }
+
+    freeSnapshot(&after);
+    freeSnapshot(&soundOff);
+    freeSnapshot(&start);
+    return didPass;
+}
+
+//Instances in lockstep with the same buttons have to see the same thing, however they're split between
+//threads, and again after being reset.  Times are what a core spends on each frame
+static bool benchVecEnv() {
+    u8 *rom = CO_CALLOC(BENCH_ROM_SIZE, u8);
+    copyMemory(benchProgram, rom + 0x100, sizeof(benchProgram));
+    rom[0x147] = 0x02; //MBC1+RAM
+    rom[0x149] = 0x02; //8KB
+    u8 headerChecksum = 0;
+    for (i64 i = 0x134; i <= 0x14C; i++) {
+        headerChecksum = (u8)(headerChecksum - rom[i] - 1);
+    }
+    rom[0x14D] = headerChecksum;
+    u16 globalChecksum = 0;
+    fori (BENCH_ROM_SIZE) {
+        globalChecksum = (u16)(globalChecksum + rom[i]);
+    }
+    rom[0x14E] = (u8)(globalChecksum >> 8);
+    rom[0x14F] = (u8)globalChecksum;
+
+    const GBEmuMemoryRange ranges[] = {{0xC000, 64}, {0xA000, 64}, {0x8000, 64}};
+    i32 numCores = numberOfCPUCores();
+    const i32 threadCounts[] = {1, (numCores < BENCH_VEC_ENVS) ? numCores : BENCH_VEC_ENVS};
+    const char *ids[] = {"vec_env/one_thread", "vec_env/all_threads"};
+    double framesPerSecond[ARRAY_LEN(threadCounts)] = {};
+    u32 buttons[BENCH_VEC_ENVS] = {};
+    u8 *oneThreadObservations = nullptr;
+    bool didPass = true;
+    foriarr (threadCounts) {
+        GBEmuVecEnv *vec;
+        GBEmuResult result = gbemu_vec_create(rom, BENCH_ROM_SIZE, BENCH_VEC_ENVS, threadCounts[i],
+                                              ranges, ARRAY_LEN(ranges), &vec);
+        if (result != GBEMU_OK) {
+            PRINT_ERR("Could not create the vectorised environment: %s.", gbemu_result_string(result));
+            didPass = false;
+            break;
+        }
+        GBEmuVecLayout layout = gbemu_vec_layout(vec);
+        u8 *observations = CO_MALLOC(layout.size, u8);
+        u8 *afterReset = CO_CALLOC(layout.size, u8); //touched, so page faults aren't timed
+
+        TimeUS startTime = nowInMicroseconds();
+        for (i64 j = 0; j < BENCH_VEC_FRAMES; j++) {
+            didPass &= gbemu_vec_step(vec, buttons, observations) == GBEMU_OK;
+        }
+        TimeUS elapsed = nowInMicroseconds() - startTime;
+        double nsPerFrame = nsPerOp(elapsed * threadCounts[i], BENCH_VEC_ENVS * BENCH_VEC_FRAMES);
+        framesPerSecond[i] = 1000000000. / nsPerFrame;
+        addBenchResult(ids[i], nsPerFrame, true);
+
+        startTime = nowInMicroseconds();
+        gbemu_vec_reset(vec, nullptr, afterReset);
+        elapsed = nowInMicroseconds() - startTime;
+        if (i == 0) {
+            addBenchResult("vec_env/reset", nsPerOp(elapsed, BENCH_VEC_ENVS), false);
+        }
+        for (i64 j = 0; j < BENCH_VEC_FRAMES; j++) {
+            gbemu_vec_step(vec, buttons, afterReset);
+        }
+        didPass &= memcmp(observations, afterReset, (usize)layout.size) == 0;
+
+        i64 screenSize = SCREEN_WIDTH * SCREEN_HEIGHT;
+        u8 *ram = observations + layout.ramOffset;
+        for (i64 j = 1; j < BENCH_VEC_ENVS; j++) {
+            didPass &= memcmp(observations, observations + j * screenSize, (usize)screenSize) == 0;
+            didPass &= memcmp(ram, ram + j * layout.ramBytesPerEnv, (usize)layout.ramBytesPerEnv) == 0;
+        }
+        if (oneThreadObservations) {
+            didPass &= memcmp(oneThreadObservations, observations, (usize)layout.size) == 0;
+            CO_FREE(observations);
+        }
+        else {
+            oneThreadObservations = observations;
+        }
+        CO_FREE(afterReset);
+        gbemu_vec_destroy(vec);
+    }
+
+    PRINT("%d vectorised environments: %.0f frames a second a core on 1 thread, %.0f on %d",
+          BENCH_VEC_ENVS, framesPerSecond[0], framesPerSecond[1], threadCounts[1]);
+    if (!didPass) {
+        PRINT_ERR("Vectorised environment instances diverged.");
+    }
+
+    CO_FREE(oneThreadObservations);
+    CO_FREE(rom);
+    return didPass;
+}
+
+/*****************************
+ * Cache misses in step()
+ *****************************/
+enum class CacheCounter {
+    L1DataReadMisses,
+    LastLevelReadMisses,
+    NumCounters
+};
+struct CacheCounters {
+    int fds[(int)CacheCounter::NumCounters];
+};
+
+//Hardware counters for this thread, where the kernel allows them.  Returns false if not
+static bool openCacheCounters(CacheCounters *counters) {
+#ifdef __linux__
+    const u64 caches[] = {PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL};
+    static_assert(ARRAY_LEN(caches) == (int)CacheCounter::NumCounters, "A cache for each counter");
+    bool ret = true;
+    foriarr (caches) {
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = caches[i] | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counters->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        ret &= counters->fds[i] >= 0;
+    }
+    return ret;
+#else
+    foriarr (counters->fds) {
+        counters->fds[i] = -1;
+    }
+    return false;
+#endif
+}
+
+static void closeCacheCounters(CacheCounters *counters) {
+#ifdef __linux__
+    foriarr (counters->fds) {
+        if (counters->fds[i] >= 0) {
+            close(counters->fds[i]);
+        }
+    }
+#else
+    UNUSED(counters);
+#endif
+}
+
+static void startCacheCounters(CacheCounters *counters) {
+#ifdef __linux__
+    foriarr (counters->fds) {
+        ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    UNUSED(counters);
+#endif
+}
+
+static void stopCacheCounters(CacheCounters *counters, u64 *outCounts) {
+#ifdef __linux__
+    foriarr (counters->fds) {
+        ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        outCounts[i] = 0;
+        if (read(counters->fds[i], &outCounts[i], sizeof(outCounts[i])) != sizeof(outCounts[i])) {
+            outCounts[i] = 0;
+        }
+    }
+#else
+    UNUSED(counters);
+    UNUSED(outCounts);
+#endif
+}
+
+static i64 cacheLinesSpanned(usize start, usize end) {
+    return (i64)((end - 1) / BENCH_CACHE_LINE_SIZE - start / BENCH_CACHE_LINE_SIZE + 1);
+}
+
+//The hot part of the MMU is everything before the LCD, plus the LCD's registers.  Compare the
+//counters against a build of the previous layout to see the difference
+static void benchStep(BenchMachine *machine, GameBoyDebug *gbDebug) {
+    PRINT("MMU layout: %" PRId64 " bytes, hot state spans %" PRId64 " + %" PRId64 " cache lines",
+          (i64)sizeof(MMU), cacheLinesSpanned(0, offsetof(MMU, lcd)),
+          cacheLinesSpanned(offsetof(MMU, lcd), offsetof(MMU, lcd) + offsetof(LCD, backgroundPalette)));
+
+    CacheCounters counters;
+    bool hasCounters = openCacheCounters(&counters);
+    u64 counts[(int)CacheCounter::NumCounters] = {};
+    runBenchFrames(10, machine, gbDebug);
+
+    TimeUS start = nowInMicroseconds();
+    if (hasCounters) {
+        startCacheCounters(&counters);
+    }
+    runBenchFrames(BENCH_STEP_FRAMES, machine, gbDebug);
+    if (hasCounters) {
+        stopCacheCounters(&counters, counts);
+    }
+    TimeUS stepTime = nowInMicroseconds() - start;
+
+    if (hasCounters) {
+        PRINT("Step: %.2fus per frame, %.1f L1D read misses and %.1f last level read misses per frame",
+              (double)stepTime / BENCH_STEP_FRAMES,
+              (double)counts[(int)CacheCounter::L1DataReadMisses] / BENCH_STEP_FRAMES,
+              (double)counts[(int)CacheCounter::LastLevelReadMisses] / BENCH_STEP_FRAMES);
+    }
+    else {
+        PRINT("Step: %.2fus per frame, cache counters unavailable", (double)stepTime / BENCH_STEP_FRAMES);
+    }
+    addBenchResult("step/frame", nsPerOp(stepTime, BENCH_STEP_FRAMES), true);
+    closeCacheCounters(&counters);
+}
+
+/*****************************
+ * Microbenchmarks
+ *****************************/
+//Loop bodies for each class of opcode.  loadBenchLoop() adds the jump back to the start
+static const u8 aluLoop[] = {
+    0x80,                   //ADD A,B
+    0x91,                   //SUB C
+    0xA2,                   //AND D
+    0xB3,                   //OR E
+    0xAC,                   //XOR H
+    0xBD,                   //CP L
+    0x3C,                   //INC A
+    0x05,                   //DEC B
+    0x89,                   //ADC A,C
+    0x9A,                   //SBC A,D
+    0xC6, 0x12,             //ADD A,0x12
+    0x27,                   //DAA
+    0x09,                   //ADD HL,BC
+    0x13,                   //INC DE
+};
+static const u8 loadLoop[] = {
+    0x47,                   //LD B,A
+    0x48,                   //LD C,B
+    0x51,                   //LD D,C
+    0x5A,                   //LD E,D
+    0x63,                   //LD H,E
+    0x6C,                   //LD L,H
+    0x7D,                   //LD A,L
+    0x3E, 0x12,             //LD A,0x12
+    0x06, 0x34,             //LD B,0x34
+    0x01, 0x34, 0x12,       //LD BC,0x1234
+    0x11, 0x78, 0x56,       //LD DE,0x5678
+};
+static const u8 memoryLoop[] = {
+    0x21, 0x00, 0xC0,       //LD HL,0xC000
+    0x2A,                   //LD A,(HL+)
+    0x32,                   //LD (HL-),A
+    0x77,                   //LD (HL),A
+    0x7E,                   //LD A,(HL)
+    0x34,                   //INC (HL)
+    0xEA, 0x00, 0xC1,       //LD (0xC100),A
+    0xFA, 0x00, 0xC1,       //LD A,(0xC100)
+    0xE0, 0x80,             //LDH (0x80),A
+    0xF0, 0x80,             //LDH A,(0x80)
+    0xC5,                   //PUSH BC
+    0xD1,                   //POP DE
+};
+//calls the RET at BENCH_SUBROUTINE_ADDRESS
+static const u8 branchLoop[] = {
+    0xCD, 0x50, 0x01,       //CALL 0x150
+    0xAF,                   //XOR A
+    0x20, 0x00,             //JR NZ,+0 (not taken)
+    0x28, 0x00,             //JR Z,+0
+    0xC3, 0x0B, 0x01,       //JP 0x10B
+    0xC4, 0x50, 0x01,       //CALL NZ,0x150 (not taken)
+    0xCC, 0x50, 0x01,       //CALL Z,0x150
+};
+static const u8 cbLoop[] = {
+    0xCB, 0x00,             //RLC B
+    0xCB, 0x39,             //SRL C
+    0xCB, 0x32,             //SWAP D
+    0xCB, 0x5B,             //BIT 3,E
+    0xCB, 0xCC,             //SET 1,H
+    0xCB, 0x95,             //RES 2,L
+    0xCB, 0x17,             //RL A
+    0xCB, 0x20,             //SLA B
+    0xCB, 0x2F,             //SRA A
+    0xCB, 0x46,             //BIT 0,(HL)
+};
+
+static void loadBenchLoop(const u8 *body, i64 len, BenchMachine *machine) {
+    CO_ASSERT(0x100 + len + 2 <= BENCH_SUBROUTINE_ADDRESS);
+    copyMemory(body, machine->rom + 0x100, len);
+    machine->rom[0x100 + len] = 0x18; //JR back to the start
+    machine->rom[0x100 + len + 1] = (u8)(-(len + 2));
+    machine->rom[BENCH_SUBROUTINE_ADDRESS] = 0xC9; //RET
+}
+
+//stepCPU() on its own, without the LCD, sound and timers step() also runs
+static void benchCPU(BenchMachine *machine, GameBoyDebug *gbDebug, ProgramState *programState) {
+    struct {
+        const char *name;
+        const char *id;
+        const u8 *loop;
+        i64 len;
+    } opcodeClasses[] = {
+        {"ALU", "cpu/alu", aluLoop, ARRAY_LEN(aluLoop)},
+        {"Loads", "cpu/load", loadLoop, ARRAY_LEN(loadLoop)},
+        {"Memory", "cpu/memory", memoryLoop, ARRAY_LEN(memoryLoop)},
+        {"Branches", "cpu/branch", branchLoop, ARRAY_LEN(branchLoop)},
+        {"CB prefixed", "cpu/cb", cbLoop, ARRAY_LEN(cbLoop)},
+    };
+    foriarr (opcodeClasses) {
+        resetBenchMachine(machine, gbDebug, programState);
+        loadBenchLoop(opcodeClasses[i].loop, opcodeClasses[i].len, machine);
+        TimeUS start = nowInMicroseconds();
+        forj (BENCH_CPU_INSTRUCTIONS) {
+            stepCPU(&machine->cpu, &machine->mmu, gbDebug);
+        }
+        TimeUS elapsedTime = nowInMicroseconds() - start;
+        PRINT("CPU %s: %.2fns per instruction", opcodeClasses[i].name, nsPerOp(elapsedTime, BENCH_CPU_INSTRUCTIONS));
+        addBenchResult(opcodeClasses[i].id, nsPerOp(elapsedTime, BENCH_CPU_INSTRUCTIONS), false);
+    }
+}
+
+static void benchMemory(BenchMachine *machine, GameBoyDebug *gbDebug, ProgramState *programState) {
+    struct {
+        const char *name;
+        const char *id;
+        u32 start, end;
+    } regions[] = {
+        {"ROM bank 0", "rom0", 0x0000, 0x4000},
+        {"ROM bank 1", "rom1", 0x4000, 0x8000},
+        {"VRAM", "vram", 0x8000, 0xA000},
+        {"Cart RAM", "cart_ram", 0xA000, 0xC000},
+        {"WRAM", "wram", 0xC000, 0xE000},
+        {"OAM", "oam", 0xFE00, 0xFEA0},
+        {"IO", "io", 0xFF00, 0xFF80},
+        {"HRAM", "hram", 0xFF80, 0xFFFF},
+    };
+    MMU *mmu = &machine->mmu;
+    resetBenchMachine(machine, gbDebug, programState);
+    u8 sink = 0;
+    foriarr (regions) {
+        //cart RAM on, and the LCD off so VRAM and OAM can always be reached
+        writeByte(0x0A, 0x0000, mmu, gbDebug);
+        writeByte(0, 0xFF40, mmu, gbDebug);
+
+        u32 address = regions[i].start;
+        TimeUS start = nowInMicroseconds();
+        forj (BENCH_MEMORY_OPS) {
+            sink ^= readByte((u16)address, mmu);
+            if (++address == regions[i].end) {
+                address = regions[i].start;
+            }
+        }
+        TimeUS readTime = nowInMicroseconds() - start;
+
+        //0 is safe to write anywhere.  In ROM it goes to the MBC, which turns cart RAM off and picks bank 1
+        address = regions[i].start;
+        start = nowInMicroseconds();
+        forj (BENCH_MEMORY_OPS) {
+            writeByte(0, (u16)address, mmu, gbDebug);
+            if (++address == regions[i].end) {
+                address = regions[i].start;
+            }
+        }
+        TimeUS writeTime = nowInMicroseconds() - start;
+
+        PRINT("%s: read %.2fns, write %.2fns", regions[i].name,
+              nsPerOp(readTime, BENCH_MEMORY_OPS), nsPerOp(writeTime, BENCH_MEMORY_OPS));
+        char resultName[MAX_BENCH_NAME_LEN];
+        snprintf(resultName, MAX_BENCH_NAME_LEN, "read/%s", regions[i].id);
+        addBenchResult(resultName, nsPerOp(readTime, BENCH_MEMORY_OPS), false);
+        snprintf(resultName, MAX_BENCH_NAME_LEN, "write/%s", regions[i].id);
+        addBenchResult(resultName, nsPerOp(writeTime, BENCH_MEMORY_OPS), false);
+    }
+    UNUSED(sink);
+}
+
+static void benchScanLines(BenchMachine *machine, GameBoyDebug *gbDebug, ProgramState *programState) {
+    struct {
+        const char *name;
+        const char *id;
+        u8 lcdControl;
+        bool hasSprites;
+    } layers[] = {
+        {"background", "ppu/background", 0x91, false},
+        {"background and window", "ppu/window", 0xB1, false},
+        {"background and 10 sprites", "ppu/sprites", 0x93, true},
+    };
+    MMU *mmu = &machine->mmu;
+    LCD *lcd = &mmu->lcd;
+    foriarr (layers) {
+        resetBenchMachine(machine, gbDebug, programState);
+        forj (VIDEO_RAM_SIZE) {
+            lcd->videoRAM[j] = (u8)(j * 31 + 7);
+        }
+        writeByte(layers[i].lcdControl, 0xFF40, mmu, gbDebug);
+        writeByte(0, 0xFF4A, mmu, gbDebug); //WY
+        writeByte(7, 0xFF4B, mmu, gbDebug); //WX
+        zeroMemory(lcd->oam, sizeof(lcd->oam));
+        if (layers[i].hasSprites) {
+            forj (MAX_SPRITES_PER_SCANLINE) {
+                lcd->oam[j*4 + 1] = (u8)(8 + j * 16);
+                lcd->oam[j*4 + 2] = (u8)j;
+                lcd->oam[j*4 + 3] = (j & 1) ? 0x20 : 0; //every other one flipped
+            }
+        }
+
+        TimeUS start = nowInMicroseconds();
+        forj (BENCH_SCAN_LINES) {
+            lcd->ly = (u8)(j % SCREEN_HEIGHT);
+            if (layers[i].hasSprites) {
+                //moved down with the line, so every line has all of them
+                for (i64 k = 0; k < MAX_SPRITES_PER_SCANLINE; k++) {
+                    lcd->oam[k*4] = (u8)(lcd->ly + MAX_SPRITE_HEIGHT);
+                }
+            }
+            drawScanLine(lcd);
+        }
+        TimeUS elapsedTime = nowInMicroseconds() - start;
+        PRINT("Scan line with %s: %.2fns", layers[i].name, nsPerOp(elapsedTime, BENCH_SCAN_LINES));
+        addBenchResult(layers[i].id, nsPerOp(elapsedTime, BENCH_SCAN_LINES), false);
+    }
+}
+
+//all four channels playing, stepped 4 cycles at a time like the shortest instructions
+static void benchSound(BenchMachine *machine, GameBoyDebug *gbDebug, ProgramState *programState) {
+    MMU *mmu = &machine->mmu;
+    resetBenchMachine(machine, gbDebug, programState);
+    writeByte(0x77, 0xFF24, mmu, gbDebug);
+    writeByte(0xFF, 0xFF25, mmu, gbDebug);
+    writeByte(0x80, 0xFF17, mmu, gbDebug);
+    writeByte(0x87, 0xFF19, mmu, gbDebug);
+    writeByte(0x80, 0xFF1A, mmu, gbDebug);
+    writeByte(0x20, 0xFF1C, mmu, gbDebug);
+    writeByte(0x87, 0xFF1E, mmu, gbDebug);
+    writeByte(0x80, 0xFF21, mmu, gbDebug);
+    writeByte(0x80, 0xFF23, mmu, gbDebug);
+
+    TimeUS start = nowInMicroseconds();
+    fori (BENCH_SOUND_STEPS) {
+        stepSound(mmu, gbDebug, 4, HEADLESS_VOLUME);
+        if ((i & 1023) == 0) {
+            clear(&mmu->host->soundFramesBuffer);
+        }
+    }
+    TimeUS elapsedTime = nowInMicroseconds() - start;
+    PRINT("Sound: %.2fns per step", nsPerOp(elapsedTime, BENCH_SOUND_STEPS));
+    addBenchResult("apu/step", nsPerOp(elapsedTime, BENCH_SOUND_STEPS), false);
+}
+
+//step() while the debugger records every step, to compare against Step
+static void benchJournal(BenchMachine *machine, GameBoyDebug *gbDebug, ProgramState *programState) {
+    resetBenchMachine(machine, gbDebug, programState);
+    gbDebug->isEnabled = true;
+    setDebugJournalEnabled(true, gbDebug);
+    runBenchFrames(10, machine, gbDebug);
+    TimeUS start = nowInMicroseconds();
+    runBenchFrames(BENCH_JOURNAL_FRAMES, machine, gbDebug);
+    TimeUS elapsedTime = nowInMicroseconds() - start;
+    gbDebug->isEnabled = false;
+    setDebugJournalEnabled(false, gbDebug);
+    PRINT("Step with the debugger's journal: %.2fus per frame", (double)elapsedTime / BENCH_JOURNAL_FRAMES);
+    addBenchResult("journal/frame", nsPerOp(elapsedTime, BENCH_JOURNAL_FRAMES), true);
+}
+
+//what saving to a slot does before the file is handed to the writer thread
+static bool benchSaveStateFile(BenchMachine *machine, GameBoyDebug *gbDebug, ProgramState *programState) {
+    CPU *cpu = &machine->cpu;
+    MMU *mmu = &machine->mmu;
+    runBenchFrames(10, machine, gbDebug);
+    i64 maxFileSize = 64 + maxCompressedSaveStateSize(maxSaveStatePayloadSize(mmu));
+    u8 *fileData = CO_MALLOC(maxFileSize, u8);
+    if (!fileData) {
+        PRINT_ERR("Could not allocate the save state.");
+        return false;
+    }
+
+    bool didPass = true;
+    i64 fileSize = 0;
+    TimeUS start = nowInMicroseconds();
+    fori (BENCH_SAVE_STATE_ITERATIONS) {
+        didPass &= buildSaveState(cpu, mmu, programState->loadedROMName, &programState->fileMemory,
+                                  fileData, maxFileSize, &fileSize) == FileSystemResultCode::OK;
+    }
+    TimeUS elapsedTime = nowInMicroseconds() - start;
+    PRINT("Save state file: %.2fus, %" PRId64 " bytes", (double)elapsedTime / BENCH_SAVE_STATE_ITERATIONS, fileSize);
+    addBenchResult("state/save_file", nsPerOp(elapsedTime, BENCH_SAVE_STATE_ITERATIONS), false);
+    if (!didPass) {
+        PRINT_ERR("Could not build a save state.");
+    }
+    CO_FREE(fileData);
+    return didPass;
+}
+
+/*****************************
+ * ROMs from the command line
+ *****************************/
+struct BenchROM {
+    const char *path;
+    const char *scriptPath;
+};
+
+static const char *fileNameInPath(const char *path) {
+    const char *ret = path;
+    for (const char *c = path; *c; c++) {
+        if (*c == '/') {
+            ret = c + 1;
+        }
+    }
+    return ret;
+}
+
+static bool benchROM(const BenchROM *rom, i64 numFrames, MemoryStack fileMemory) {
+    HeadlessGameBoy gb;
+    const char *error = initHeadlessGameBoy(rom->path, nullptr, 0, fileMemory, nullptr, &gb);
+    if (error) {
+        PRINT_ERR("%s: %s", rom->path, error);
+        return false;
+    }
+    InputScriptLine *script = nullptr;
+    if (rom->scriptPath) {
+        script = readInputScript(rom->scriptPath, &gb.programState->fileMemory);
+        if (!script) {
+            freeHeadlessGameBoy(&gb);
+            return false;
+        }
+        gb.script = script;
+    }
+
+    char notification[MAX_NOTIFICATION_LEN + 1];
+    bool didHitIllegalOpcode = false;
+    TimeUS start = nowInMicroseconds();
+    for (i64 frame = 0; frame < numFrames && !didHitIllegalOpcode; frame++) {
+        didHitIllegalOpcode = !runHeadlessFrame(frame, &gb);
+        while (popNotification(&gb.programState->notifications, notification))
+            ;
+        clear(&gb.mmu->host->soundFramesBuffer);
+    }
+    TimeUS elapsedTime = nowInMicroseconds() - start;
+
+    const char *result = "";
+    switch (testROMResult(&gb)) {
+        case TestROMResult::Running: break;
+        case TestROMResult::Passed: result = ", test ROM passed"; break;
+        case TestROMResult::Failed: result = ", test ROM failed"; break;
+    }
+    //the same ROM can be run with different scripts
+    char resultName[MAX_BENCH_NAME_LEN];
+    if (rom->scriptPath) {
+        snprintf(resultName, MAX_BENCH_NAME_LEN, "rom/%s/%s", fileNameInPath(rom->path), fileNameInPath(rom->scriptPath));
+    }
+    else {
+        snprintf(resultName, MAX_BENCH_NAME_LEN, "rom/%s", fileNameInPath(rom->path));
+    }
+    PRINT("%s: %.2fus per frame, %.0f frames per second%s", rom->path, (double)elapsedTime / (double)numFrames,
+          1000000. * (double)numFrames / (double)elapsedTime, result);
+    addBenchResult(resultName, nsPerOp(elapsedTime, numFrames), true);
+    if (didHitIllegalOpcode) {
+        PRINT_ERR("%s: hit an illegal opcode.", rom->path);
+    }
+
+    freeHeadlessGameBoy(&gb);
+    buf_malloc_free(script);
+    return !didHitIllegalOpcode;
+}
+
+/*****************************
+ * Results
+ *****************************/
+static bool writeBenchResults(const char *path) {
+    char *json = nullptr;
+    buf_malloc_printf(json, "{\n  \"results\": [");
+    for (isize i = 0; i < (isize)buf_len(benchResults); i++) {
+        const BenchResult *result = &benchResults[i];
+        buf_malloc_printf(json, "%s\n    {\"name\": \"%s\", \"nsPerOp\": %.3f", (i > 0) ? "," : "", result->name, result->nsPerOp);
+        if (result->framesPerSecond > 0) {
+            buf_malloc_printf(json, ", \"framesPerSecond\": %.1f", result->framesPerSecond);
+        }
+        buf_malloc_printf(json, "}");
+    }
+    buf_malloc_printf(json, "\n  ]\n}\n");
+    bool ret = writeDataToFile(json, (isize)buf_len(json), path) == FileSystemResultCode::OK;
+    buf_malloc_free(json);
+    return ret;
+}
+
+//Only reads what writeBenchResults() writes, one result per line.  Returns false if anything got
+//slower by more than regressionPercent
+static bool compareWithBaseline(const char *path, double regressionPercent, MemoryStack *fileMemory) {
+    auto fileResult = readEntireFile(path, fileMemory);
+    if (fileResult.resultCode != FileSystemResultCode::OK) {
+        PRINT_ERR("Could not read %s.", path);
+        return false;
+    }
+    const char namePrefix[] = "{\"name\": \"";
+    const char nsPerOpPrefix[] = "\"nsPerOp\": ";
+    i64 numCompared = 0, numRegressions = 0;
+    const char *c = (const char*)fileResult.data;
+    const char *end = c + fileResult.size;
+    while (c < end) {
+        const char *lineEnd = c;
+        while (lineEnd < end && *lineEnd != '\n') {
+            lineEnd++;
+        }
+        char line[256];
+        i64 lineLen = MIN(lineEnd - c, (i64)ARRAY_LEN(line) - 1);
+        copyMemory(c, line, lineLen);
+        line[lineLen] = '\0';
+        c = lineEnd + 1;
+
+        const char *name = strstr(line, namePrefix);
+        const char *nsPerOpField = strstr(line, nsPerOpPrefix);
+        if (!name || !nsPerOpField) {
+            continue;
+        }
+        name += ARRAY_LEN(namePrefix) - 1;
+        const char *nameEnd = strchr(name, '"');
+        double baselineNS = atof(nsPerOpField + ARRAY_LEN(nsPerOpPrefix) - 1);
+        if (!nameEnd || baselineNS <= 0) {
+            continue;
+        }
+        for (isize i = 0; i < (isize)buf_len(benchResults); i++) {
+            const BenchResult *result = &benchResults[i];
+            if (stringLength(result->name) != nameEnd - name || !areStringsEqual(result->name, name, nameEnd - name)) {
+                continue;
+            }
+            double change = 100. * (result->nsPerOp - baselineNS) / baselineNS;
+            if (change > regressionPercent) {
+                PRINT("Regression: %s went from %.2fns to %.2fns (+%.1f%%)", result->name, baselineNS, result->nsPerOp, change);
+                numRegressions++;
+            }
+            else if (change < -regressionPercent) {
+                PRINT("Improvement: %s went from %.2fns to %.2fns (%.1f%%)", result->name, baselineNS, result->nsPerOp, change);
+            }
+            numCompared++;
+            break;
+        }
+    }
+    freeFileBuffer(&fileResult, fileMemory);
+    PRINT("Compared %" PRId64 " results against %s. %" PRId64 " got more than %.0f%% slower.",
+          numCompared, path, numRegressions, regressionPercent);
+    return numRegressions == 0;
+}
+
+static void printUsage() {
+    PRINT("Usage: bench [-o results] [-c baseline] [-t percent] [-f frames] [[-i script] file.gb ...]");
+    PRINT("\t-o -- File to write the JSON results to. Default is " DEFAULT_RESULTS_PATH ".");
+    PRINT("\t-c -- Results from an earlier run to compare against. Fails if anything got slower.");
+    PRINT("\t-t -- How many percent slower counts as a regression. Default is %.0f.", DEFAULT_REGRESSION_PERCENT);
+    PRINT("\t-f -- Number of frames to run each ROM for. Default is %d.", DEFAULT_BENCH_ROM_FRAMES);
+    PRINT("\t-i -- Input script to play into the next ROM.");
+}
+
+int main(int argc, char **argv) {
+    const char *resultsPath = DEFAULT_RESULTS_PATH;
+    const char *baselinePath = nullptr;
+    double regressionPercent = DEFAULT_REGRESSION_PERCENT;
+    i64 numROMFrames = DEFAULT_BENCH_ROM_FRAMES;
+    const char *scriptPath = nullptr;
+    BenchROM *roms = nullptr; //buf_malloc
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (areStringsEqual(argv[i], "-o", 3) && hasValue) {
+            resultsPath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-c", 3) && hasValue) {
+            baselinePath = argv[++i];
+        }
+        else if (areStringsEqual(argv[i], "-t", 3) && hasValue) {
+            regressionPercent = atof(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-f", 3) && hasValue) {
+            numROMFrames = atoll(argv[++i]);
+        }
+        else if (areStringsEqual(argv[i], "-i", 3) && hasValue) {
+            scriptPath = argv[++i];
+        }
+        else if (argv[i][0] == '-') {
+            printUsage();
+            return 1;
+        }
+        else {
+            buf_malloc_push(roms, (BenchROM{argv[i], scriptPath}));
+            scriptPath = nullptr;
+        }
+    }
+    if (numROMFrames <= 0 || regressionPercent < 0) {
+        printUsage();
+        return 1;
+    }
+
+    if (!initMemory(MB(1) + FILE_MEMORY_SIZE, 0)) {
+        PRINT_ERR("Could not allocate memory.");
+        return 1;
+    }
+    MemoryStack romFileMemory;
+    makeMemoryStack(FILE_MEMORY_SIZE, "romFileMem", &romFileMemory);
+    BenchMachine *machine = CO_CALLOC(1, BenchMachine);
+    GameBoyDebug *gbDebug = CO_CALLOC(1, GameBoyDebug);
+    ProgramState *programState = CO_CALLOC(1, ProgramState);
+    makeMemoryStack(MB(1), "fileMem", &programState->fileMemory);
+    copyString("BENCH", programState->loadedROMName, MAX_ROM_NAME_LEN);
+    attachMMU(&machine->memory, &machine->host, &machine->mmu);
+    machine->host.romNameLen = stringLength(programState->loadedROMName);
+
+    bool didPass = true;
+    resetBenchMachine(machine, gbDebug, programState);
+    benchStep(machine, gbDebug);
+    benchCPU(machine, gbDebug, programState);
+    benchMemory(machine, gbDebug, programState);
+    benchScanLines(machine, gbDebug, programState);
+    benchSound(machine, gbDebug, programState);
+    benchJournal(machine, gbDebug, programState);
+
+    resetBenchMachine(machine, gbDebug, programState);
+    didPass &= benchSnapshots(machine, gbDebug, "Snapshots", "state");
+    resetBenchMachine(machine, gbDebug, programState);
+    didPass &= benchSaveStateFile(machine, gbDebug, programState);
+
+    //the debugger's journal has to be cleared by restores, not replayed into the restored state
+    resetBenchMachine(machine, gbDebug, programState);
+    gbDebug->isEnabled = true;
+    setDebugJournalEnabled(true, gbDebug);
+    didPass &= benchSnapshots(machine, gbDebug, "Snapshots with debugger", "state_debugger");
+
+    resetBenchMachine(machine, gbDebug, programState);
+    gbDebug->isEnabled = false;
+    setDebugJournalEnabled(false, gbDebug);
+    didPass &= benchMovies(machine, gbDebug, programState);
+
+    resetBenchMachine(machine, gbDebug, programState);
+    didPass &= benchRunAhead(machine, gbDebug);
+
+    resetBenchMachine(machine, gbDebug, programState);
+    didPass &= benchTurbo(machine, gbDebug, programState);
+    didPass &= benchVecEnv();
+
+    for (isize i = 0; i < (isize)buf_len(roms); i++) {
+        didPass &= benchROM(&roms[i], numROMFrames, romFileMemory);
+    }
+
+    if (!writeBenchResults(resultsPath)) {
+        PRINT_ERR("Could not write %s.", resultsPath);
+        didPass = false;
+    }
+    if (baselinePath) {
+        didPass &= compareWithBaseline(baselinePath, regressionPercent, &romFileMemory);
+    }
+
+    buf_malloc_free(benchResults);
+    buf_malloc_free(roms);
+    CO_FREE(programState);
+    CO_FREE(gbDebug);
+    CO_FREE(machine);
+    return didPass ? 0 : 1;
+}
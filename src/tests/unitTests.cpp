@@ -1,6 +1,7 @@
-#define CO_IMPL
 #define CO_DEBUG
-#include "../common.h"
+#define GB_NO_DEBUGGER_UI
+#define GB_FLAT_TEST_MEMORY
+#include "../gbemu.cpp" //with CO_DEBUG, brings in common.h's implementation too
 #include "../config.cpp"
 
 #define TEST_ASSERT_EQ(actual, expected, msg) do {\
@@ -30,6 +31,30 @@ int main() {
     TEST_ASSERT_EQ(utf8FromUTF32(L'🎮').data, 0xAE8E9FF0 , "Bad translation from utf8 to utf32");
     TEST_ASSERT_EQ(utf32FromUTF8({0xAE8E9FF0}),  L'🎮', "Bad translation from utf32 to utf8");
 
+    //EI then HALT with an interrupt pending.  The interrupt is taken with the HALT as its return address, and
+    //the halt bug doesn't carry into the handler
+    {
+        static CPU cpu;
+        static MMU mmu;
+        static GameBoyDebug gbDebug;
+        static u8 memory[0x10000];
+        mmu.flatTestMemory = memory;
+        memory[0x100] = 0xFB; //EI
+        memory[0x101] = 0x76; //HALT
+        memory[0x40] = 0x3C; //INC A
+        cpu.PC = 0x100;
+        cpu.SP = 0xFFFE;
+        mmu.enabledInterrupts = 1;
+        mmu.requestedInterrupts = 1;
+        mmu.didInterruptsChange = true;
+        fori (4) {
+            stepCPU(&cpu, &mmu, &gbDebug);
+        }
+        TEST_ASSERT_EQ(word(memory[0xFFFD], memory[0xFFFC]), 0x101, "Interrupt should return to the HALT");
+        TEST_ASSERT_EQ(cpu.A, 1, "Handler's first instruction should run once");
+        TEST_ASSERT_EQ(cpu.PC, 0x41, "Handler's first instruction should run once");
+    }
+
     //config tests
     auto res = parseConfigFile("../src/tests/test.txt");
     TEST_ASSERT_EQ(res.fsResultCode, FileSystemResultCode::OK, "File should exist");